@@ -0,0 +1,70 @@
+#include "AsyncLoader.hpp"
+
+namespace gps {
+
+    AsyncLoader& AsyncLoader::instance() {
+
+        static AsyncLoader loader;
+        return loader;
+    }
+
+    AsyncLoader::AsyncLoader() : stopping(false) {
+
+        // leave one hardware thread to the render loop
+        unsigned hardwareThreads = std::thread::hardware_concurrency();
+        unsigned workerCount = hardwareThreads > 2 ? hardwareThreads - 1 : 1;
+        for (unsigned i = 0; i < workerCount; i++) {
+            workers.push_back(std::thread(&AsyncLoader::workerLoop, this));
+        }
+    }
+
+    AsyncLoader::~AsyncLoader() {
+
+        shutdown();
+    }
+
+    void AsyncLoader::enqueue(std::function<void()> job) {
+
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            if (stopping) {
+                return;
+            }
+            jobs.push_back(job);
+        }
+        jobAvailable.notify_one();
+    }
+
+    void AsyncLoader::shutdown() {
+
+        {
+            std::lock_guard<std::mutex> lock(jobsMutex);
+            stopping = true;
+            jobs.clear();
+        }
+        jobAvailable.notify_all();
+
+        for (std::thread& worker : workers) {
+            if (worker.joinable()) {
+                worker.join();
+            }
+        }
+    }
+
+    void AsyncLoader::workerLoop() {
+
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(jobsMutex);
+                jobAvailable.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (stopping) {
+                    return;
+                }
+                job = jobs.front();
+                jobs.pop_front();
+            }
+            job();
+        }
+    }
+}
@@ -0,0 +1,38 @@
+#ifndef AsyncLoader_hpp
+#define AsyncLoader_hpp
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace gps {
+
+    // Background threads that run CPU-side asset work for the whole lifetime of the application
+    class AsyncLoader {
+
+    public:
+        static AsyncLoader& instance();
+
+        void enqueue(std::function<void()> job);
+
+        // Drops the jobs that have not started yet and waits for the running ones
+        void shutdown();
+
+    private:
+        AsyncLoader();
+        ~AsyncLoader();
+
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()> > jobs;
+        std::mutex jobsMutex;
+        std::condition_variable jobAvailable;
+        bool stopping;
+
+        void workerLoop();
+    };
+}
+
+#endif /* AsyncLoader_hpp */
@@ -0,0 +1,863 @@
+#include "BlockCompressor.hpp"
+#include "GLCaps.hpp"
+#include "TaskGraph.hpp"
+#include "TextureProcessor.hpp"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+// macOS headers stop at the 4.1 core enums
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+    #define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+#ifndef GL_COMPRESSED_RGBA_S3TC_DXT5_EXT
+    #define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_SRGB_S3TC_DXT1_EXT
+    #define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT
+    #define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+    #define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+#ifndef GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM
+    #define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+
+namespace gps {
+
+    TextureFormat BlockCompressor::cookFormat = FORMAT_RGBA8;
+
+    namespace {
+
+        typedef std::chrono::steady_clock Clock;
+
+        double elapsedMs(Clock::time_point since) {
+
+            return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+        }
+
+        // Block rows per encoder task, small enough to balance the threads on the lower levels
+        const int ROWS_PER_TASK = 16;
+
+        // BC7 interpolation weights for 4-bit indices, out of 64
+        const int BC7_WEIGHTS[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+        size_t blockBytes(TextureFormat format) {
+
+            return format == FORMAT_BC1 ? 8 : 16;
+        }
+
+        inline int clampByte(float value) {
+
+            return std::min(255, std::max(0, (int)(value + 0.5f)));
+        }
+
+        // Dominant direction of the texels around their mean, by power iteration on the covariance matrix
+        void principalAxis(const float texels[16][4], int channels, float mean[4], float axis[4]) {
+
+            for (int c = 0; c < 4; c++) {
+                mean[c] = 0.0f;
+                for (int i = 0; i < 16; i++) {
+                    mean[c] += texels[i][c];
+                }
+                mean[c] /= 16.0f;
+            }
+
+            float covariance[4][4] = {};
+            for (int i = 0; i < 16; i++) {
+                for (int a = 0; a < channels; a++) {
+                    for (int b = 0; b < channels; b++) {
+                        covariance[a][b] += (texels[i][a] - mean[a]) * (texels[i][b] - mean[b]);
+                    }
+                }
+            }
+
+            for (int c = 0; c < 4; c++) {
+                axis[c] = c < channels ? 1.0f : 0.0f;
+            }
+            for (int iteration = 0; iteration < 8; iteration++) {
+
+                float next[4] = {};
+                for (int a = 0; a < channels; a++) {
+                    for (int b = 0; b < channels; b++) {
+                        next[a] += covariance[a][b] * axis[b];
+                    }
+                }
+                float length = 0.0f;
+                for (int c = 0; c < channels; c++) {
+                    length = std::max(length, std::fabs(next[c]));
+                }
+                if (length < 1e-6f) {
+                    break;
+                }
+                for (int c = 0; c < channels; c++) {
+                    axis[c] = next[c] / length;
+                }
+            }
+        }
+
+        // Endpoints at the extreme projections of the texels onto the axis
+        void axisEndpoints(const float texels[16][4], int channels, float low[4], float high[4]) {
+
+            float mean[4], axis[4];
+            principalAxis(texels, channels, mean, axis);
+
+            float minProjection = 0.0f, maxProjection = 0.0f;
+            for (int i = 0; i < 16; i++) {
+                float projection = 0.0f;
+                for (int c = 0; c < channels; c++) {
+                    projection += (texels[i][c] - mean[c]) * axis[c];
+                }
+                minProjection = std::min(minProjection, projection);
+                maxProjection = std::max(maxProjection, projection);
+            }
+
+            float lengthSquared = 0.0f;
+            for (int c = 0; c < channels; c++) {
+                lengthSquared += axis[c] * axis[c];
+            }
+            lengthSquared = std::max(lengthSquared, 1e-6f);
+            for (int c = 0; c < 4; c++) {
+                low[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * minProjection / lengthSquared));
+                high[c] = std::min(255.0f, std::max(0.0f, mean[c] + axis[c] * maxProjection / lengthSquared));
+            }
+        }
+
+        // Least squares endpoints for fixed interpolation weights (the share of high per texel), false if degenerate
+        bool fitEndpoints(const float texels[16][4], int channels, const float weights[16], float low[4], float high[4]) {
+
+            float aa = 0.0f, ab = 0.0f, bb = 0.0f;
+            float ax[4] = {}, bx[4] = {};
+            for (int i = 0; i < 16; i++) {
+                float a = 1.0f - weights[i], b = weights[i];
+                aa += a * a;
+                ab += a * b;
+                bb += b * b;
+                for (int c = 0; c < channels; c++) {
+                    ax[c] += a * texels[i][c];
+                    bx[c] += b * texels[i][c];
+                }
+            }
+            float determinant = aa * bb - ab * ab;
+            if (std::fabs(determinant) < 1e-6f) {
+                return false;
+            }
+            for (int c = 0; c < channels; c++) {
+                low[c] = std::min(255.0f, std::max(0.0f, (bb * ax[c] - ab * bx[c]) / determinant));
+                high[c] = std::min(255.0f, std::max(0.0f, (aa * bx[c] - ab * ax[c]) / determinant));
+            }
+            return true;
+        }
+
+        // --- BC1 colour block ---
+
+        inline uint16_t packRGB565(const float color[4]) {
+
+            int r = std::min(31, std::max(0, (int)(color[0] * 31.0f / 255.0f + 0.5f)));
+            int g = std::min(63, std::max(0, (int)(color[1] * 63.0f / 255.0f + 0.5f)));
+            int b = std::min(31, std::max(0, (int)(color[2] * 31.0f / 255.0f + 0.5f)));
+            return (uint16_t)((r << 11) | (g << 5) | b);
+        }
+
+        inline void unpackRGB565(uint16_t packed, int color[3]) {
+
+            int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+            color[0] = (r << 3) | (r >> 2);
+            color[1] = (g << 2) | (g >> 4);
+            color[2] = (b << 3) | (b >> 2);
+        }
+
+        // The four colours of a block in index order, as the hardware decodes them
+        void colorPalette(uint16_t color0, uint16_t color1, bool fourColors, int palette[4][4]) {
+
+            unpackRGB565(color0, palette[0]);
+            unpackRGB565(color1, palette[1]);
+            palette[0][3] = palette[1][3] = 255;
+            for (int c = 0; c < 3; c++) {
+                if (fourColors) {
+                    palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+                    palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+                }
+                else {
+                    palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+                    palette[3][c] = 0;
+                }
+            }
+            palette[2][3] = 255;
+            palette[3][3] = fourColors ? 255 : 0;
+        }
+
+        // Picks the closest palette entry per texel, returns the summed squared error
+        int colorIndices(const float texels[16][4], uint16_t color0, uint16_t color1, int indices[16]) {
+
+            int palette[4][4];
+            colorPalette(color0, color1, true, palette);
+            int total = 0;
+            for (int i = 0; i < 16; i++) {
+                int best = 0, bestError = INT32_MAX;
+                for (int p = 0; p < 4; p++) {
+                    int error = 0;
+                    for (int c = 0; c < 3; c++) {
+                        int delta = clampByte(texels[i][c]) - palette[p][c];
+                        error += delta * delta;
+                    }
+                    if (error < bestError) {
+                        best = p;
+                        bestError = error;
+                    }
+                }
+                indices[i] = best;
+                total += bestError;
+            }
+            return total;
+        }
+
+        // Always the four colour mode, which is the only one BC3 knows
+        void encodeColorBlock(const float texels[16][4], unsigned char* block) {
+
+            static const float INDEX_WEIGHTS[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+
+            float low[4], high[4];
+            axisEndpoints(texels, 3, low, high);
+            uint16_t color0 = packRGB565(high), color1 = packRGB565(low);
+            int indices[16];
+            int error = colorIndices(texels, color0, color1, indices);
+
+            // refit the endpoints to the chosen indices while that lowers the error
+            for (int iteration = 0; iteration < 2 && error > 0; iteration++) {
+
+                float weights[16];
+                for (int i = 0; i < 16; i++) {
+                    weights[i] = 1.0f - INDEX_WEIGHTS[indices[i]];
+                }
+                if (!fitEndpoints(texels, 3, weights, low, high)) {
+                    break;
+                }
+                uint16_t fitted0 = packRGB565(high), fitted1 = packRGB565(low);
+                int fittedIndices[16];
+                int fittedError = colorIndices(texels, fitted0, fitted1, fittedIndices);
+                if (fittedError >= error) {
+                    break;
+                }
+                color0 = fitted0;
+                color1 = fitted1;
+                error = fittedError;
+                std::memcpy(indices, fittedIndices, sizeof(indices));
+            }
+
+            // color0 > color1 selects four colours, swapping the endpoints mirrors the indices
+            if (color0 < color1) {
+                std::swap(color0, color1);
+                for (int i = 0; i < 16; i++) {
+                    indices[i] ^= 1;
+                }
+            }
+            else if (color0 == color1) {
+                for (int i = 0; i < 16; i++) {
+                    indices[i] = 0;
+                }
+            }
+
+            uint32_t bits = 0;
+            for (int i = 0; i < 16; i++) {
+                bits |= (uint32_t)indices[i] << (2 * i);
+            }
+            block[0] = (unsigned char)(color0 & 0xFF);
+            block[1] = (unsigned char)(color0 >> 8);
+            block[2] = (unsigned char)(color1 & 0xFF);
+            block[3] = (unsigned char)(color1 >> 8);
+            for (int b = 0; b < 4; b++) {
+                block[4 + b] = (unsigned char)(bits >> (8 * b));
+            }
+        }
+
+        void decodeColorBlock(const unsigned char* block, bool forceFourColors, unsigned char* rgba) {
+
+            uint16_t color0 = (uint16_t)(block[0] | (block[1] << 8));
+            uint16_t color1 = (uint16_t)(block[2] | (block[3] << 8));
+            int palette[4][4];
+            colorPalette(color0, color1, forceFourColors || color0 > color1, palette);
+            uint32_t bits = block[4] | (block[5] << 8) | (block[6] << 16) | ((uint32_t)block[7] << 24);
+            for (int i = 0; i < 16; i++) {
+                const int* color = palette[(bits >> (2 * i)) & 3];
+                for (int c = 0; c < 4; c++) {
+                    rgba[i * 4 + c] = (unsigned char)color[c];
+                }
+            }
+        }
+
+        // --- BC3 alpha block ---
+
+        void alphaPalette(int alpha0, int alpha1, int palette[8]) {
+
+            palette[0] = alpha0;
+            palette[1] = alpha1;
+            if (alpha0 > alpha1) {
+                for (int i = 1; i < 7; i++) {
+                    palette[i + 1] = ((7 - i) * alpha0 + i * alpha1) / 7;
+                }
+            }
+            else {
+                for (int i = 1; i < 5; i++) {
+                    palette[i + 1] = ((5 - i) * alpha0 + i * alpha1) / 5;
+                }
+                palette[6] = 0;
+                palette[7] = 255;
+            }
+        }
+
+        void encodeAlphaBlock(const float texels[16][4], unsigned char* block) {
+
+            int minAlpha = 255, maxAlpha = 0;
+            for (int i = 0; i < 16; i++) {
+                int alpha = clampByte(texels[i][3]);
+                minAlpha = std::min(minAlpha, alpha);
+                maxAlpha = std::max(maxAlpha, alpha);
+            }
+
+            // eight interpolated values between the extremes, a flat block decodes everything from alpha0
+            int palette[8];
+            alphaPalette(maxAlpha, minAlpha, palette);
+            uint64_t bits = 0;
+            for (int i = 0; i < 16 && maxAlpha > minAlpha; i++) {
+                int alpha = clampByte(texels[i][3]);
+                int best = 0;
+                for (int p = 1; p < 8; p++) {
+                    if (std::abs(palette[p] - alpha) < std::abs(palette[best] - alpha)) {
+                        best = p;
+                    }
+                }
+                bits |= (uint64_t)best << (3 * i);
+            }
+
+            block[0] = (unsigned char)maxAlpha;
+            block[1] = (unsigned char)minAlpha;
+            for (int b = 0; b < 6; b++) {
+                block[2 + b] = (unsigned char)(bits >> (8 * b));
+            }
+        }
+
+        void decodeAlphaBlock(const unsigned char* block, unsigned char* rgba) {
+
+            int palette[8];
+            alphaPalette(block[0], block[1], palette);
+            uint64_t bits = 0;
+            for (int b = 0; b < 6; b++) {
+                bits |= (uint64_t)block[2 + b] << (8 * b);
+            }
+            for (int i = 0; i < 16; i++) {
+                rgba[i * 4 + 3] = (unsigned char)palette[(bits >> (3 * i)) & 7];
+            }
+        }
+
+        // --- BC7 mode 6: one subset, RGBA endpoints of 7 bits plus a shared low bit each, 4-bit indices ---
+
+        struct Mode6Endpoint {
+
+            int color[4];
+            int pBit;
+        };
+
+        // The 8-bit value a 7-bit channel and its p-bit decode to
+        inline int mode6Value(const Mode6Endpoint& endpoint, int c) {
+
+            return (endpoint.color[c] << 1) | endpoint.pBit;
+        }
+
+        // Rounds to the nearest representable endpoint, trying both p-bits
+        Mode6Endpoint quantizeMode6(const float color[4]) {
+
+            Mode6Endpoint best = Mode6Endpoint();
+            float bestError = -1.0f;
+            for (int pBit = 0; pBit < 2; pBit++) {
+
+                Mode6Endpoint candidate;
+                candidate.pBit = pBit;
+                float error = 0.0f;
+                for (int c = 0; c < 4; c++) {
+                    candidate.color[c] = std::min(127, std::max(0, (int)((color[c] - pBit) / 2.0f + 0.5f)));
+                    float delta = (float)mode6Value(candidate, c) - color[c];
+                    error += delta * delta;
+                }
+                if (bestError < 0.0f || error < bestError) {
+                    best = candidate;
+                    bestError = error;
+                }
+            }
+            return best;
+        }
+
+        void mode6Palette(const Mode6Endpoint& endpoint0, const Mode6Endpoint& endpoint1, int palette[16][4]) {
+
+            for (int i = 0; i < 16; i++) {
+                for (int c = 0; c < 4; c++) {
+                    palette[i][c] = ((64 - BC7_WEIGHTS[i]) * mode6Value(endpoint0, c) + BC7_WEIGHTS[i] * mode6Value(endpoint1, c) + 32) >> 6;
+                }
+            }
+        }
+
+        int mode6Indices(const float texels[16][4], const Mode6Endpoint& endpoint0, const Mode6Endpoint& endpoint1, int indices[16]) {
+
+            int palette[16][4];
+            mode6Palette(endpoint0, endpoint1, palette);
+            int total = 0;
+            for (int i = 0; i < 16; i++) {
+                int best = 0, bestError = INT32_MAX;
+                for (int p = 0; p < 16; p++) {
+                    int error = 0;
+                    for (int c = 0; c < 4; c++) {
+                        int delta = clampByte(texels[i][c]) - palette[p][c];
+                        error += delta * delta;
+                    }
+                    if (error < bestError) {
+                        best = p;
+                        bestError = error;
+                    }
+                }
+                indices[i] = best;
+                total += bestError;
+            }
+            return total;
+        }
+
+        // Appends count bits, least significant first
+        struct BitWriter {
+
+            unsigned char* block;
+            int position;
+
+            void write(uint32_t value, int count) {
+
+                for (int i = 0; i < count; i++, position++) {
+                    if ((value >> i) & 1) {
+                        block[position >> 3] |= (unsigned char)(1 << (position & 7));
+                    }
+                }
+            }
+        };
+
+        struct BitReader {
+
+            const unsigned char* block;
+            int position;
+
+            uint32_t read(int count) {
+
+                uint32_t value = 0;
+                for (int i = 0; i < count; i++, position++) {
+                    value |= (uint32_t)((block[position >> 3] >> (position & 7)) & 1) << i;
+                }
+                return value;
+            }
+        };
+
+        void encodeMode6Block(const float texels[16][4], unsigned char* block) {
+
+            float low[4], high[4];
+            axisEndpoints(texels, 4, low, high);
+            Mode6Endpoint endpoint0 = quantizeMode6(low), endpoint1 = quantizeMode6(high);
+            int indices[16];
+            int error = mode6Indices(texels, endpoint0, endpoint1, indices);
+
+            for (int iteration = 0; iteration < 2 && error > 0; iteration++) {
+
+                float weights[16];
+                for (int i = 0; i < 16; i++) {
+                    weights[i] = BC7_WEIGHTS[indices[i]] / 64.0f;
+                }
+                if (!fitEndpoints(texels, 4, weights, low, high)) {
+                    break;
+                }
+                Mode6Endpoint fitted0 = quantizeMode6(low), fitted1 = quantizeMode6(high);
+                int fittedIndices[16];
+                int fittedError = mode6Indices(texels, fitted0, fitted1, fittedIndices);
+                if (fittedError >= error) {
+                    break;
+                }
+                endpoint0 = fitted0;
+                endpoint1 = fitted1;
+                error = fittedError;
+                std::memcpy(indices, fittedIndices, sizeof(indices));
+            }
+
+            // the first index has an implicit zero top bit, the weights are symmetric so swapping mirrors them
+            if (indices[0] >= 8) {
+                std::swap(endpoint0, endpoint1);
+                for (int i = 0; i < 16; i++) {
+                    indices[i] = 15 - indices[i];
+                }
+            }
+
+            std::memset(block, 0, 16);
+            BitWriter writer = { block, 0 };
+            writer.write(1 << 6, 7);
+            for (int c = 0; c < 4; c++) {
+                writer.write(endpoint0.color[c], 7);
+                writer.write(endpoint1.color[c], 7);
+            }
+            writer.write(endpoint0.pBit, 1);
+            writer.write(endpoint1.pBit, 1);
+            writer.write(indices[0], 3);
+            for (int i = 1; i < 16; i++) {
+                writer.write(indices[i], 4);
+            }
+        }
+
+        // Reference for the encoder's own output, blocks in the other seven modes decode as magenta
+        void decodeMode6Block(const unsigned char* block, unsigned char* rgba) {
+
+            if ((block[0] & 0x7F) != 0x40) {
+                for (int i = 0; i < 16; i++) {
+                    rgba[i * 4 + 0] = 255; rgba[i * 4 + 1] = 0; rgba[i * 4 + 2] = 255; rgba[i * 4 + 3] = 255;
+                }
+                return;
+            }
+
+            BitReader reader = { block, 7 };
+            Mode6Endpoint endpoint0, endpoint1;
+            for (int c = 0; c < 4; c++) {
+                endpoint0.color[c] = (int)reader.read(7);
+                endpoint1.color[c] = (int)reader.read(7);
+            }
+            endpoint0.pBit = (int)reader.read(1);
+            endpoint1.pBit = (int)reader.read(1);
+
+            int palette[16][4];
+            mode6Palette(endpoint0, endpoint1, palette);
+            for (int i = 0; i < 16; i++) {
+                int index = (int)reader.read(i == 0 ? 3 : 4);
+                for (int c = 0; c < 4; c++) {
+                    rgba[i * 4 + c] = (unsigned char)palette[index][c];
+                }
+            }
+        }
+
+        void encodeBlock(TextureFormat format, const unsigned char* rgba, unsigned char* block) {
+
+            float texels[16][4];
+            for (int i = 0; i < 16; i++) {
+                for (int c = 0; c < 4; c++) {
+                    texels[i][c] = rgba[i * 4 + c];
+                }
+            }
+
+            switch (format) {
+            case FORMAT_BC1:
+                encodeColorBlock(texels, block);
+                break;
+            case FORMAT_BC3:
+                encodeAlphaBlock(texels, block);
+                encodeColorBlock(texels, block + 8);
+                break;
+            case FORMAT_BC7:
+                encodeMode6Block(texels, block);
+                break;
+            default:
+                break;
+            }
+        }
+
+        void decodeBlock(TextureFormat format, const unsigned char* block, unsigned char* rgba) {
+
+            switch (format) {
+            case FORMAT_BC1:
+                decodeColorBlock(block, false, rgba);
+                break;
+            case FORMAT_BC3:
+                decodeColorBlock(block + 8, true, rgba);
+                decodeAlphaBlock(block, rgba);
+                break;
+            case FORMAT_BC7:
+                decodeMode6Block(block, rgba);
+                break;
+            default:
+                break;
+            }
+        }
+
+        // Copies a 4x4 block out of a level, repeating the last row and column past the edges
+        void gatherBlock(const unsigned char* pixels, int width, int height, int blockX, int blockY, unsigned char* rgba) {
+
+            for (int y = 0; y < 4; y++) {
+                int sourceY = std::min(blockY * 4 + y, height - 1);
+                for (int x = 0; x < 4; x++) {
+                    int sourceX = std::min(blockX * 4 + x, width - 1);
+                    std::memcpy(rgba + (y * 4 + x) * 4, pixels + ((size_t)sourceY * width + sourceX) * 4, 4);
+                }
+            }
+        }
+
+        void encodeRows(const unsigned char* pixels, int width, int height, TextureFormat format, int firstRow, int lastRow, unsigned char* blocks) {
+
+            int blocksX = (width + 3) / 4;
+            size_t bytes = blockBytes(format);
+            unsigned char rgba[64];
+            for (int blockY = firstRow; blockY < lastRow; blockY++) {
+                for (int blockX = 0; blockX < blocksX; blockX++) {
+                    gatherBlock(pixels, width, height, blockX, blockY, rgba);
+                    encodeBlock(format, rgba, blocks + ((size_t)blockY * blocksX + blockX) * bytes);
+                }
+            }
+        }
+
+        // Smooth gradients with a sharp edge and an alpha ramp, the cases block compression handles worst
+        std::vector<unsigned char> syntheticImage(int size) {
+
+            std::vector<unsigned char> pixels((size_t)size * size * 4);
+            for (int y = 0; y < size; y++) {
+                for (int x = 0; x < size; x++) {
+                    unsigned char* texel = &pixels[((size_t)y * size + x) * 4];
+                    texel[0] = (unsigned char)(x * 255 / (size - 1));
+                    texel[1] = (unsigned char)(y * 255 / (size - 1));
+                    texel[2] = (unsigned char)(x + y < size ? 40 : 200);
+                    texel[3] = (unsigned char)((x * 7 + y * 3) & 0xFF);
+                }
+            }
+            return pixels;
+        }
+    }
+
+    const char* BlockCompressor::FormatName(TextureFormat format) {
+
+        switch (format) {
+        case FORMAT_BC1:
+            return "BC1";
+        case FORMAT_BC3:
+            return "BC3";
+        case FORMAT_BC7:
+            return "BC7";
+        default:
+            return "RGBA8";
+        }
+    }
+
+    bool BlockCompressor::ParseFormat(const std::string& name, TextureFormat& format) {
+
+        static const TextureFormat FORMATS[] = { FORMAT_RGBA8, FORMAT_BC1, FORMAT_BC3, FORMAT_BC7 };
+        for (TextureFormat candidate : FORMATS) {
+            std::string candidateName = FormatName(candidate);
+            std::transform(candidateName.begin(), candidateName.end(), candidateName.begin(), ::tolower);
+            if (name == candidateName) {
+                format = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t BlockCompressor::LevelSize(TextureFormat format, int width, int height) {
+
+        if (format == FORMAT_RGBA8) {
+            return (size_t)width * height * 4;
+        }
+        return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes(format);
+    }
+
+    size_t BlockCompressor::ChainSize(TextureFormat format, int width, int height, int levels) {
+
+        size_t size = 0;
+        for (int level = 0; level < levels; level++) {
+            size += LevelSize(format, width, height);
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        return size;
+    }
+
+    unsigned int BlockCompressor::GLInternalFormat(TextureFormat format, bool srgb) {
+
+        switch (format) {
+        case FORMAT_BC1:
+            return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case FORMAT_BC3:
+            return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+        case FORMAT_BC7:
+            return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+        default:
+            return srgb ? GL_SRGB8 : GL_RGBA8;
+        }
+    }
+
+    bool BlockCompressor::IsSupported(TextureFormat format) {
+
+        switch (format) {
+        case FORMAT_BC1:
+        case FORMAT_BC3:
+            return GLCaps::get().s3tcCompression;
+        case FORMAT_BC7:
+            return GLCaps::get().bptcCompression;
+        default:
+            return true;
+        }
+    }
+
+    void BlockCompressor::SetFormat(TextureFormat format) {
+
+        cookFormat = format;
+    }
+
+    TextureFormat BlockCompressor::GetFormat() {
+
+        return cookFormat;
+    }
+
+    unsigned char* BlockCompressor::CompressChain(const unsigned char* pixels, int width, int height, int levels, TextureFormat format,
+                                                  unsigned threadCount) {
+
+        unsigned char* blocks = TextureProcessor::AllocatePixels(ChainSize(format, width, height, levels));
+        if (!blocks) {
+            return nullptr;
+        }
+        if (format == FORMAT_RGBA8) {
+            std::memcpy(blocks, pixels, ChainSize(format, width, height, levels));
+            return blocks;
+        }
+
+        // every stripe of block rows is independent, the graph spreads them over the threads
+        TaskGraph graph;
+        const unsigned char* source = pixels;
+        unsigned char* target = blocks;
+        for (int level = 0; level < levels; level++) {
+
+            int blocksY = (height + 3) / 4;
+            for (int firstRow = 0; firstRow < blocksY; firstRow += ROWS_PER_TASK) {
+                int lastRow = std::min(blocksY, firstRow + ROWS_PER_TASK);
+                graph.addTask("encode", TaskGraph::WORKER_THREAD, [source, width, height, format, firstRow, lastRow, target]() {
+                    encodeRows(source, width, height, format, firstRow, lastRow, target);
+                });
+            }
+
+            source += (size_t)width * height * 4;
+            target += LevelSize(format, width, height);
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+
+        graph.run(threadCount > 0 ? threadCount : std::max(1u, std::thread::hardware_concurrency()));
+        return blocks;
+    }
+
+    void BlockCompressor::DecompressLevel(const unsigned char* blocks, int width, int height, TextureFormat format, unsigned char* pixels) {
+
+        if (format == FORMAT_RGBA8) {
+            std::memcpy(pixels, blocks, LevelSize(format, width, height));
+            return;
+        }
+
+        int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+        size_t bytes = blockBytes(format);
+        unsigned char rgba[64];
+        for (int blockY = 0; blockY < blocksY; blockY++) {
+            for (int blockX = 0; blockX < blocksX; blockX++) {
+
+                decodeBlock(format, blocks + ((size_t)blockY * blocksX + blockX) * bytes, rgba);
+                for (int y = 0; y < 4 && blockY * 4 + y < height; y++) {
+                    for (int x = 0; x < 4 && blockX * 4 + x < width; x++) {
+                        std::memcpy(pixels + ((size_t)(blockY * 4 + y) * width + blockX * 4 + x) * 4, rgba + (y * 4 + x) * 4, 4);
+                    }
+                }
+            }
+        }
+    }
+
+    double BlockCompressor::PSNR(const unsigned char* a, const unsigned char* b, size_t texels, bool alpha) {
+
+        int channels = alpha ? 4 : 3;
+        double squaredError = 0.0;
+        for (size_t i = 0; i < texels; i++) {
+            for (int c = 0; c < channels; c++) {
+                double delta = (double)a[i * 4 + c] - (double)b[i * 4 + c];
+                squaredError += delta * delta;
+            }
+        }
+        double meanSquaredError = squaredError / ((double)texels * channels);
+        return meanSquaredError > 0.0 ? 10.0 * std::log10(255.0 * 255.0 / meanSquaredError) : 99.0;
+    }
+
+    bool BlockCompressor::Verify(const std::vector<std::string>& fileNames) {
+
+        struct Image {
+
+            std::string name;
+            int width;
+            int height;
+            std::vector<unsigned char> pixels;
+        };
+        std::vector<Image> images;
+
+        for (const std::string& fileName : fileNames) {
+
+            int width, height, channels;
+            unsigned char* decoded = stbi_load(fileName.c_str(), &width, &height, &channels, 4);
+            if (!decoded) {
+                std::cerr << "ERROR: could not decode " << fileName << std::endl;
+                return false;
+            }
+            Image image = { fileName, width, height, std::vector<unsigned char>(decoded, decoded + (size_t)width * height * 4) };
+            stbi_image_free(decoded);
+            images.push_back(image);
+        }
+        Image synthetic = { "synthetic gradients", 256, 256, syntheticImage(256) };
+        images.push_back(synthetic);
+
+        // floors sit a few dB under what the encoder reaches on the shipped textures, the gradients are harder
+        static const TextureFormat FORMATS[] = { FORMAT_BC1, FORMAT_BC3, FORMAT_BC7 };
+        static const double MIN_PSNR[] = { 30.0, 30.0, 36.0 };
+
+        bool passed = true;
+        unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+        for (const Image& image : images) {
+
+            size_t texels = (size_t)image.width * image.height;
+            std::vector<unsigned char> decoded(texels * 4);
+            std::cout << "Compression : " << image.name << " (" << image.width << "x" << image.height << ")" << std::endl;
+
+            for (size_t f = 0; f < sizeof(FORMATS) / sizeof(FORMATS[0]); f++) {
+
+                TextureFormat format = FORMATS[f];
+                Clock::time_point start = Clock::now();
+                TextureProcessor::FreePixels(CompressChain(image.pixels.data(), image.width, image.height, 1, format, 1));
+                double serialMs = elapsedMs(start);
+
+                start = Clock::now();
+                unsigned char* blocks = CompressChain(image.pixels.data(), image.width, image.height, 1, format, threads);
+                double parallelMs = elapsedMs(start);
+                if (!blocks) {
+                    std::cout << "  " << FormatName(format) << " : out of memory" << std::endl;
+                    passed = false;
+                    continue;
+                }
+
+                DecompressLevel(blocks, image.width, image.height, format, decoded.data());
+                TextureProcessor::FreePixels(blocks);
+
+                double colorPSNR = PSNR(image.pixels.data(), decoded.data(), texels, false);
+                double alphaPSNR = PSNR(image.pixels.data(), decoded.data(), texels, true);
+                bool ok = colorPSNR >= MIN_PSNR[f] && (format == FORMAT_BC1 || alphaPSNR >= MIN_PSNR[f]);
+                passed = passed && ok;
+
+                double megapixels = texels / 1e6;
+                std::cout << "  " << FormatName(format) << " : RGB " << colorPSNR << " dB";
+                if (format != FORMAT_BC1) {
+                    std::cout << ", RGBA " << alphaPSNR << " dB";
+                }
+                std::cout << ", " << megapixels / (serialMs / 1000.0) << " MPix/s on 1 thread, "
+                    << megapixels / (parallelMs / 1000.0) << " MPix/s on " << threads
+                    << (ok ? "" : "  <-- below the floor") << std::endl;
+            }
+        }
+
+        std::cout << (passed ? "Block compression verified" : "ERROR: block compression lost too much quality") << std::endl;
+        return passed;
+    }
+}
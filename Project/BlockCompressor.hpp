@@ -0,0 +1,67 @@
+#ifndef BlockCompressor_hpp
+#define BlockCompressor_hpp
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Pixel layouts a texture can be cooked and uploaded in
+    enum TextureFormat {
+        FORMAT_RGBA8,
+        // 4 bpp, RGB with 5:6:5 endpoints, alpha dropped
+        FORMAT_BC1,
+        // 8 bpp, BC1 colour plus an interpolated 8-bit alpha block
+        FORMAT_BC3,
+        // 8 bpp, RGBA with 7-bit endpoints and 16 levels per block (mode 6 only)
+        FORMAT_BC7
+    };
+
+    // CPU encoder and reference decoder for 4x4 block-compressed textures, with the GL formats they upload as.
+    // Blocks are independent, so a level is encoded by several threads at once.
+    class BlockCompressor {
+
+    public:
+        static const char* FormatName(TextureFormat format);
+
+        // Parses "rgba8", "bc1", "bc3" or "bc7", returns false for anything else
+        static bool ParseFormat(const std::string& name, TextureFormat& format);
+
+        // Bytes of one level, partial blocks at the edges count in full
+        static size_t LevelSize(TextureFormat format, int width, int height);
+
+        // Bytes of the first levels levels stored back to back, the top one first
+        static size_t ChainSize(TextureFormat format, int width, int height, int levels);
+
+        // Internal format to upload with, the sRGB or the linear variant
+        static unsigned int GLInternalFormat(TextureFormat format, bool srgb);
+
+        // Whether the current context samples the format, needs a current context
+        static bool IsSupported(TextureFormat format);
+
+        // Format textures are cooked and uploaded in from now on, FORMAT_RGBA8 by default
+        static void SetFormat(TextureFormat format);
+        static TextureFormat GetFormat();
+
+        // Encodes every level of an RGBA8 chain (TextureProcessor layout) on threadCount threads, 0 for one per core.
+        // Release the result with TextureProcessor::FreePixels. Null if the blocks could not be allocated.
+        static unsigned char* CompressChain(const unsigned char* pixels, int width, int height, int levels, TextureFormat format,
+                                            unsigned threadCount = 0);
+
+        // Decodes one level back to RGBA8, for measuring the error
+        static void DecompressLevel(const unsigned char* blocks, int width, int height, TextureFormat format, unsigned char* pixels);
+
+        // Peak signal to noise ratio of the RGB (and, if alpha is set, the A) channels of two RGBA8 images
+        static double PSNR(const unsigned char* a, const unsigned char* b, size_t texels, bool alpha);
+
+        // Encodes the given images and a synthetic one in every format, on one thread and on all of them, and checks
+        // the PSNR of the round trip against a floor per format. Needs no GL context.
+        static bool Verify(const std::vector<std::string>& fileNames);
+
+    private:
+        static TextureFormat cookFormat;
+    };
+}
+
+#endif /* BlockCompressor_hpp */
@@ -0,0 +1,192 @@
+#include "CubemapCache.hpp"
+#include "ResourceRegistry.hpp"
+#include "TextureCache.hpp"
+#include "TextureProcessor.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+    namespace {
+
+        const char CACHE_MAGIC[4] = { 'G', 'P', 'S', 'C' };
+
+        struct FaceStamp {
+
+            uint64_t sourceSize;
+            int64_t sourceMtime;
+            uint64_t contentHash;
+            uint64_t reserved;
+        };
+
+        // 224 bytes, so the pixels start 16-byte aligned in the mapping
+        struct CacheHeader {
+
+            char magic[4];
+            uint32_t version;
+            uint32_t size;
+            uint32_t levels;
+            uint32_t format;
+            uint32_t reserved[3];
+            FaceStamp faces[CubemapCache::FACES];
+        };
+    }
+
+    CubemapCache::CubemapCache() : size(0), levels(0), format(FORMAT_RGBA8) {
+    }
+
+    std::string CubemapCache::cachePath(const std::string& firstFaceFileName) {
+
+        return firstFaceFileName + ".gpscube";
+    }
+
+    bool CubemapCache::write(const std::vector<std::string>& faceFileNames, const uint64_t contentHashes[FACES], TextureFormat format,
+                             int size, int levels, const unsigned char* const faces[FACES]) {
+
+        if (faceFileNames.size() != FACES) {
+            return false;
+        }
+
+        CacheHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        header.version = VERSION;
+        header.size = static_cast<uint32_t>(size);
+        header.levels = static_cast<uint32_t>(levels);
+        header.format = static_cast<uint32_t>(format);
+        for (int i = 0; i < FACES; i++) {
+            if (!TextureCache::readSourceStamp(faceFileNames[i], header.faces[i].sourceSize, header.faces[i].sourceMtime)) {
+                return false;
+            }
+            header.faces[i].contentHash = contentHashes[i];
+        }
+
+        // write to a temporary file first so a crash never leaves a half-written cache behind
+        std::string fileName = cachePath(faceFileNames[0]);
+        std::string tempFileName = fileName + ".tmp";
+        std::ofstream out(tempFileName, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "WARNING: could not write cube map cache " << fileName << std::endl;
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        std::streamsize chainSize = static_cast<std::streamsize>(BlockCompressor::ChainSize(format, size, size, levels));
+        for (int i = 0; i < FACES; i++) {
+            out.write(reinterpret_cast<const char*>(faces[i]), chainSize);
+        }
+        out.close();
+        if (!out) {
+            std::remove(tempFileName.c_str());
+            return false;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tempFileName, fileName, error);
+        if (error) {
+            std::remove(tempFileName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool CubemapCache::load(const std::vector<std::string>& faceFileNames, TextureFormat format) {
+
+        close();
+
+        if (faceFileNames.size() != FACES || !file.open(cachePath(faceFileNames[0]))) {
+            return false;
+        }
+
+        CacheHeader header;
+        if (file.size() < sizeof(header)) {
+            close();
+            return false;
+        }
+        std::memcpy(&header, file.data(), sizeof(header));
+
+        if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != VERSION ||
+            header.format != static_cast<uint32_t>(format)) {
+            close();
+            return false;
+        }
+
+        int cachedSize = static_cast<int>(header.size);
+        int cachedLevels = static_cast<int>(header.levels);
+        if (cachedSize <= 0 || cachedLevels <= 0 || cachedLevels > TextureProcessor::MipLevelCount(cachedSize, cachedSize) ||
+            (file.size() - sizeof(header)) / FACES < BlockCompressor::ChainSize(format, cachedSize, cachedSize, cachedLevels)) {
+            std::cerr << "WARNING: discarding corrupt cube map cache " << cachePath(faceFileNames[0]) << std::endl;
+            close();
+            return false;
+        }
+
+        for (int i = 0; i < FACES; i++) {
+
+            uint64_t sourceSize;
+            int64_t sourceMtime;
+            const FaceStamp& stamp = header.faces[i];
+            if (!TextureCache::readSourceStamp(faceFileNames[i], sourceSize, sourceMtime) || stamp.sourceSize != sourceSize) {
+                close();
+                return false;
+            }
+
+            // a touched but unchanged face (e.g. after a checkout) still matches by content
+            if (stamp.sourceMtime != sourceMtime) {
+                MappedFile source;
+                if (!source.open(faceFileNames[i]) || ResourceRegistry::hashBytes(source.data(), source.size()) != stamp.contentHash) {
+                    close();
+                    return false;
+                }
+            }
+        }
+
+        size = cachedSize;
+        levels = cachedLevels;
+        this->format = format;
+        return true;
+    }
+
+    void CubemapCache::close() {
+
+        file.close();
+        size = 0;
+        levels = 0;
+        format = FORMAT_RGBA8;
+    }
+
+    bool CubemapCache::isOpen() const {
+
+        return file.isOpen();
+    }
+
+    int CubemapCache::getSize() const {
+
+        return size;
+    }
+
+    int CubemapCache::getLevels() const {
+
+        return levels;
+    }
+
+    TextureFormat CubemapCache::getFormat() const {
+
+        return format;
+    }
+
+    const unsigned char* CubemapCache::getFace(int face) const {
+
+        if (!file.isOpen()) {
+            return nullptr;
+        }
+        return file.data() + sizeof(CacheHeader) + BlockCompressor::ChainSize(format, size, size, levels) * face;
+    }
+
+    size_t CubemapCache::getFileSize() const {
+
+        return file.size();
+    }
+}
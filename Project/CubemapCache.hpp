@@ -0,0 +1,54 @@
+#ifndef CubemapCache_hpp
+#define CubemapCache_hpp
+
+#include "BlockCompressor.hpp"
+#include "MappedFile.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Versioned cooked cube map: the six faces in GL_TEXTURE_CUBE_MAP_POSITIVE_X + i order in one file, each its full
+    // mip chain in RGBA8 or block compressed, stamped with every face's source like TextureCache
+    class CubemapCache {
+
+    public:
+        static const uint32_t VERSION = 1;
+        static const int FACES = 6;
+
+        CubemapCache();
+
+        // Cooked file name, named after the +X face
+        static std::string cachePath(const std::string& firstFaceFileName);
+
+        // Writes the chains of the six square faces, contentHashes are the hashes of the face files
+        static bool write(const std::vector<std::string>& faceFileNames, const uint64_t contentHashes[FACES], TextureFormat format,
+                          int size, int levels, const unsigned char* const faces[FACES]);
+
+        // Maps the cooked file, fails if it is missing, corrupt, in another format or older than any face
+        bool load(const std::vector<std::string>& faceFileNames, TextureFormat format);
+
+        void close();
+
+        bool isOpen() const;
+        int getSize() const;
+        int getLevels() const;
+        TextureFormat getFormat() const;
+
+        // The mip chain of a face, points into the mapping
+        const unsigned char* getFace(int face) const;
+
+        // Size of the mapped cooked file
+        size_t getFileSize() const;
+
+    private:
+        MappedFile file;
+        int size;
+        int levels;
+        TextureFormat format;
+    };
+}
+
+#endif /* CubemapCache_hpp */
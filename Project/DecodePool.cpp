@@ -0,0 +1,194 @@
+#include "DecodePool.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+namespace gps {
+
+    namespace {
+
+        // In front of every block, 16 bytes so the block keeps malloc's alignment
+        struct BlockHeader {
+
+            uint64_t size;
+            // -1 for blocks too large for a class, freed straight away
+            int32_t sizeClass;
+            uint32_t reserved;
+        };
+
+        BlockHeader* headerOf(void* block) {
+
+            return reinterpret_cast<BlockHeader*>(static_cast<unsigned char*>(block) - sizeof(BlockHeader));
+        }
+    }
+
+    DecodePool& DecodePool::instance() {
+
+        // never destroyed, pixels released during static destruction still find their pool
+        static DecodePool* pool = new DecodePool();
+        return *pool;
+    }
+
+    DecodePool::DecodePool() : cacheLimit(256 * 1024 * 1024), stats() {
+    }
+
+    int DecodePool::sizeClass(size_t bytes) {
+
+        if (bytes <= (size_t(1) << MIN_SHIFT)) {
+            return 0;
+        }
+        if (bytes > (size_t(1) << MAX_SHIFT)) {
+            return -1;
+        }
+
+        // the power of two below bytes, then the quarter steps above it
+        int shift = 0;
+        while ((size_t(1) << (shift + 1)) <= bytes - 1) {
+            shift++;
+        }
+        size_t base = size_t(1) << shift;
+        size_t quarter = base >> 2;
+        size_t sub = (bytes - base + quarter - 1) / quarter;
+        if (sub == 4) {
+            shift++;
+            sub = 0;
+        }
+        return (shift - MIN_SHIFT) * 4 + (int)sub;
+    }
+
+    size_t DecodePool::classSize(int sizeClass) {
+
+        int shift = MIN_SHIFT + sizeClass / 4;
+        return (size_t(1) << shift) + (sizeClass % 4) * (size_t(1) << (shift - 2));
+    }
+
+    void* DecodePool::allocate(size_t bytes) {
+
+        int index = sizeClass(bytes);
+        size_t size = index >= 0 ? classSize(index) : bytes;
+
+        void* memory = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.allocations++;
+            if (index >= 0 && !freeBlocks[index].empty()) {
+                memory = freeBlocks[index].back();
+                freeBlocks[index].pop_back();
+                stats.cachedBytes -= size;
+                stats.reused++;
+            }
+            else {
+                stats.systemAllocations++;
+            }
+            stats.liveBytes += size;
+            stats.peakLiveBytes = std::max(stats.peakLiveBytes, stats.liveBytes);
+            stats.footprintBytes = stats.liveBytes + stats.cachedBytes;
+            stats.peakFootprintBytes = std::max(stats.peakFootprintBytes, stats.footprintBytes);
+        }
+
+        if (!memory) {
+            memory = std::malloc(sizeof(BlockHeader) + size);
+            if (!memory) {
+                std::lock_guard<std::mutex> lock(mutex);
+                stats.liveBytes -= size;
+                stats.footprintBytes = stats.liveBytes + stats.cachedBytes;
+                return nullptr;
+            }
+        }
+
+        BlockHeader* header = static_cast<BlockHeader*>(memory);
+        header->size = size;
+        header->sizeClass = index;
+        header->reserved = 0;
+        return header + 1;
+    }
+
+    void* DecodePool::reallocate(void* block, size_t bytes) {
+
+        if (!block) {
+            return allocate(bytes);
+        }
+
+        // stb grows its buffers a little at a time, most of that fits the class already
+        BlockHeader* header = headerOf(block);
+        if (header->size >= bytes) {
+            return block;
+        }
+
+        void* grown = allocate(bytes);
+        if (grown) {
+            std::memcpy(grown, block, (size_t)header->size);
+            release(block);
+        }
+        return grown;
+    }
+
+    void DecodePool::release(void* block) {
+
+        if (!block) {
+            return;
+        }
+
+        BlockHeader* header = headerOf(block);
+        size_t size = (size_t)header->size;
+        bool cached = false;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stats.releases++;
+            stats.liveBytes -= size;
+            if (header->sizeClass >= 0 && stats.cachedBytes + size <= cacheLimit) {
+                freeBlocks[header->sizeClass].push_back(header);
+                stats.cachedBytes += size;
+                cached = true;
+            }
+            stats.footprintBytes = stats.liveBytes + stats.cachedBytes;
+        }
+
+        if (!cached) {
+            std::free(header);
+        }
+    }
+
+    void DecodePool::setCacheLimit(size_t bytes) {
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            cacheLimit = bytes;
+        }
+        trim();
+    }
+
+    void DecodePool::trim() {
+
+        std::vector<void*> blocks;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (std::vector<void*>& list : freeBlocks) {
+                blocks.insert(blocks.end(), list.begin(), list.end());
+                list.clear();
+            }
+            stats.cachedBytes = 0;
+            stats.footprintBytes = stats.liveBytes;
+        }
+        for (void* block : blocks) {
+            std::free(block);
+        }
+    }
+
+    DecodePoolStats DecodePool::getStats() const {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        return stats;
+    }
+
+    void DecodePool::printStats(std::ostream& out) const {
+
+        DecodePoolStats current = getStats();
+        out << "Decode memory    : " << current.liveBytes / 1024 << " KB live (peak " << current.peakLiveBytes / 1024 << " KB), "
+            << current.cachedBytes / 1024 << " KB cached, footprint " << current.footprintBytes / 1024 << " KB (peak "
+            << current.peakFootprintBytes / 1024 << " KB), " << current.allocations << " allocations, " << current.reused << " reused, "
+            << current.systemAllocations << " from the system" << std::endl;
+    }
+}
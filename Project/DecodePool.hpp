@@ -0,0 +1,74 @@
+#ifndef DecodePool_hpp
+#define DecodePool_hpp
+
+#include <cstddef>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+namespace gps {
+
+    // Counters of the decode memory, bytes as handed out (rounded up to their size class)
+    struct DecodePoolStats {
+
+        // held by decoded images and mip chains right now, and the most ever held at once
+        size_t liveBytes;
+        size_t peakLiveBytes;
+        // released blocks kept for reuse
+        size_t cachedBytes;
+        // live and cached together, what the pool takes from the system, now and at most
+        size_t footprintBytes;
+        size_t peakFootprintBytes;
+        size_t allocations;
+        // allocations served from a cached block, the rest went to malloc
+        size_t reused;
+        size_t systemAllocations;
+        size_t releases;
+    };
+
+    // Size-class pool behind stb_image (STBI_MALLOC/REALLOC/FREE) and TextureProcessor::AllocatePixels, so decoded
+    // images, mip chains and encoded blocks reuse the large buffers of the images before them instead of a fresh
+    // malloc each. Sizes are rounded up to a quarter of their power of two; a released block goes back to its class
+    // until the cache limit is reached. Thread safe, shared by the decode workers and the GL thread that frees the
+    // pixels once they are uploaded.
+    class DecodePool {
+
+    public:
+        static DecodePool& instance();
+
+        // Blocks are 16-byte aligned
+        void* allocate(size_t bytes);
+        void* reallocate(void* block, size_t bytes);
+        // Null is ignored
+        void release(void* block);
+
+        // Bytes released blocks may keep cached, 0 turns the pool into plain malloc and free
+        void setCacheLimit(size_t bytes);
+
+        // Frees every cached block
+        void trim();
+
+        DecodePoolStats getStats() const;
+
+        // One line of totals
+        void printStats(std::ostream& out) const;
+
+    private:
+        // 256 B to 1 GB, four classes per power of two
+        static const int MIN_SHIFT = 8;
+        static const int MAX_SHIFT = 30;
+        static const int CLASS_COUNT = (MAX_SHIFT - MIN_SHIFT) * 4 + 1;
+
+        mutable std::mutex mutex;
+        std::vector<void*> freeBlocks[CLASS_COUNT];
+        size_t cacheLimit;
+        DecodePoolStats stats;
+
+        DecodePool();
+
+        static int sizeClass(size_t bytes);
+        static size_t classSize(int sizeClass);
+    };
+}
+
+#endif /* DecodePool_hpp */
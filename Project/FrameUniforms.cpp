@@ -0,0 +1,97 @@
+#include "FrameUniforms.hpp"
+
+#include <cstddef>
+#include <iostream>
+
+namespace gps {
+
+    namespace {
+
+        struct FrameMember {
+
+            const GLchar* name;
+            size_t offset;
+        };
+
+        const FrameMember FRAME_MEMBERS[] = {
+            { "view", offsetof(FrameData, view) },
+            { "projection", offsetof(FrameData, projection) },
+            { "viewProjection", offsetof(FrameData, viewProjection) },
+            { "lightSpaceTrMatrix", offsetof(FrameData, lightSpaceTrMatrix) },
+            { "lightDir", offsetof(FrameData, lightDir) },
+            { "fogDensity", offsetof(FrameData, fogDensity) },
+            { "lightColor", offsetof(FrameData, lightColor) },
+            { "lightType", offsetof(FrameData, lightType) },
+            { "lightPosition", offsetof(FrameData, lightPosition) },
+        };
+        const GLsizei FRAME_MEMBER_COUNT = sizeof(FRAME_MEMBERS) / sizeof(FRAME_MEMBERS[0]);
+
+        static_assert(sizeof(FrameData) == 304, "FrameData must match the std140 layout of the FrameData block");
+    }
+
+    FrameUniforms& FrameUniforms::instance() {
+
+        // never destroyed, like the material table
+        static FrameUniforms* uniforms = new FrameUniforms();
+        return *uniforms;
+    }
+
+    FrameUniforms::FrameUniforms() {
+    }
+
+    bool FrameUniforms::attach(const Shader& shader, const std::string& name) {
+
+        GLuint program = shader.shaderProgram;
+        GLuint blockIndex = glGetUniformBlockIndex(program, "FrameData");
+        if (blockIndex == GL_INVALID_INDEX) {
+            std::cerr << "ERROR: " << name << " does not declare the FrameData block" << std::endl;
+            return false;
+        }
+        glUniformBlockBinding(program, blockIndex, UNIFORM_BINDING);
+
+        bool matches = true;
+        GLint blockSize = 0;
+        glGetActiveUniformBlockiv(program, blockIndex, GL_UNIFORM_BLOCK_DATA_SIZE, &blockSize);
+        if (blockSize != (GLint)sizeof(FrameData)) {
+            std::cerr << "ERROR: FrameData block of " << name << " is " << blockSize << " bytes, FrameData " << sizeof(FrameData) << std::endl;
+            matches = false;
+        }
+
+        // std140 keeps every member active, so each one has to be found at its CPU offset
+        const GLchar* names[FRAME_MEMBER_COUNT];
+        for (GLsizei i = 0; i < FRAME_MEMBER_COUNT; i++) {
+            names[i] = FRAME_MEMBERS[i].name;
+        }
+        GLuint indices[FRAME_MEMBER_COUNT];
+        glGetUniformIndices(program, FRAME_MEMBER_COUNT, names, indices);
+        for (GLsizei i = 0; i < FRAME_MEMBER_COUNT; i++) {
+
+            if (indices[i] == GL_INVALID_INDEX) {
+                std::cerr << "ERROR: FrameData block of " << name << " has no " << names[i] << std::endl;
+                matches = false;
+                continue;
+            }
+            GLint offset = -1;
+            glGetActiveUniformsiv(program, 1, &indices[i], GL_UNIFORM_OFFSET, &offset);
+            if (offset != (GLint)FRAME_MEMBERS[i].offset) {
+                std::cerr << "ERROR: FrameData." << names[i] << " of " << name << " is at offset " << offset << ", FrameData has it at "
+                          << FRAME_MEMBERS[i].offset << std::endl;
+                matches = false;
+            }
+        }
+        return matches;
+    }
+
+    void FrameUniforms::update(const FrameData& data) {
+
+        if (!buffer) {
+            buffer = GLBuffer::create();
+        }
+
+        // respecified every frame, so the driver can hand out new storage while the last frame still reads the old one
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer.get());
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameData), &data, GL_STREAM_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING, buffer.get());
+    }
+}
@@ -0,0 +1,51 @@
+#ifndef FrameUniforms_hpp
+#define FrameUniforms_hpp
+
+#include "GLHandle.hpp"
+#include "Shader.hpp"
+
+#include <glm/glm.hpp>
+
+namespace gps {
+
+    // CPU copy of the std140 FrameData block the shaders declare: a vec3 takes 12 bytes and the scalar after it
+    // fills the rest of its 16
+    struct FrameData {
+
+        glm::mat4 view;
+        glm::mat4 projection;
+        glm::mat4 viewProjection;
+        glm::mat4 lightSpaceTrMatrix;
+        // eye space
+        glm::vec3 lightDir;
+        GLfloat fogDensity;
+        glm::vec3 lightColor;
+        GLint lightType;
+        glm::vec3 lightPosition;
+        GLfloat padding;
+    };
+
+    // Camera and light data of a frame in one uniform buffer at a fixed binding point, uploaded once per frame and
+    // read by every program, instead of the same matrices set program by program. GL thread only.
+    class FrameUniforms {
+
+    public:
+        static const GLuint UNIFORM_BINDING = 1;
+
+        static FrameUniforms& instance();
+
+        // Binds the program's FrameData block to UNIFORM_BINDING and checks its size and member offsets against
+        // FrameData through GL reflection; false, with the differences printed, if they disagree
+        bool attach(const Shader& shader, const std::string& name);
+
+        // Uploads the frame's data and binds the buffer
+        void update(const FrameData& data);
+
+    private:
+        GLBuffer buffer;
+
+        FrameUniforms();
+    };
+}
+
+#endif /* FrameUniforms_hpp */
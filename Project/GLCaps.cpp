@@ -0,0 +1,46 @@
+#include "GLCaps.hpp"
+
+#include <cstring>
+
+namespace gps {
+
+    namespace {
+
+#if defined (__APPLE__)
+        bool hasExtension(const char* name) {
+
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for (GLint i = 0; i < count; i++) {
+                const GLubyte* extension = glGetStringi(GL_EXTENSIONS, i);
+                if (extension && std::strcmp(reinterpret_cast<const char*>(extension), name) == 0) {
+                    return true;
+                }
+            }
+            return false;
+        }
+#endif
+
+        GLCaps query() {
+
+            GLCaps caps = GLCaps();
+#if !defined (__APPLE__)
+            // macOS stops at 4.1, elsewhere GLEW knows what the driver offers
+            caps.bufferStorage = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+            caps.textureStorage = GLEW_VERSION_4_2 || GLEW_ARB_texture_storage;
+            caps.s3tcCompression = GLEW_EXT_texture_compression_s3tc && GLEW_EXT_texture_sRGB;
+            caps.bptcCompression = GLEW_VERSION_4_2 || GLEW_ARB_texture_compression_bptc;
+#else
+            // Apple drivers expose S3TC as an extension of the core profile, BPTC not at all
+            caps.s3tcCompression = hasExtension("GL_EXT_texture_compression_s3tc") && hasExtension("GL_EXT_texture_sRGB");
+#endif
+            return caps;
+        }
+    }
+
+    const GLCaps& GLCaps::get() {
+
+        static GLCaps caps = query();
+        return caps;
+    }
+}
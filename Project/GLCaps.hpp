@@ -0,0 +1,31 @@
+#ifndef GLCaps_hpp
+#define GLCaps_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+namespace gps {
+
+    // Optional features of the current context above the 4.1 core profile the application asks for
+    struct GLCaps {
+
+        // glBufferStorage, lets a buffer stay mapped while GL reads from it (4.4 / ARB_buffer_storage)
+        bool bufferStorage;
+        // glTexStorage2D, immutable storage for a whole mip chain (4.2 / ARB_texture_storage)
+        bool textureStorage;
+        // BC1 and BC3 uploads in sRGB (EXT_texture_compression_s3tc with EXT_texture_sRGB)
+        bool s3tcCompression;
+        // BC7 uploads (4.2 / ARB_texture_compression_bptc)
+        bool bptcCompression;
+
+        // Queried once, the first call needs a current context
+        static const GLCaps& get();
+    };
+}
+
+#endif /* GLCaps_hpp */
@@ -0,0 +1,115 @@
+#ifndef GLHandle_hpp
+#define GLHandle_hpp
+
+#if defined (__APPLE__)
+    #define GL_SILENCE_DEPRECATION
+    #include <OpenGL/gl3.h>
+#else
+    #define GLEW_STATIC
+    #include <GL/glew.h>
+#endif
+
+namespace gps {
+
+    // Move-only owner of one GL object name, deleted with the owner
+    template <typename Traits>
+    class GLHandle {
+
+    public:
+        GLHandle() : name(0) {
+        }
+
+        // Takes ownership of an existing name
+        explicit GLHandle(GLuint name) : name(name) {
+        }
+
+        ~GLHandle() {
+
+            reset();
+        }
+
+        GLHandle(const GLHandle&) = delete;
+        GLHandle& operator=(const GLHandle&) = delete;
+
+        GLHandle(GLHandle&& other) noexcept : name(other.release()) {
+        }
+
+        GLHandle& operator=(GLHandle&& other) noexcept {
+
+            if (this != &other) {
+                reset(other.release());
+            }
+            return *this;
+        }
+
+        static GLHandle create() {
+
+            GLuint created = 0;
+            Traits::generate(1, &created);
+            return GLHandle(created);
+        }
+
+        GLuint get() const {
+
+            return name;
+        }
+
+        // Gives up ownership without deleting the object
+        GLuint release() {
+
+            GLuint released = name;
+            name = 0;
+            return released;
+        }
+
+        void reset(GLuint newName = 0) {
+
+            if (name != 0) {
+                Traits::destroy(1, &name);
+            }
+            name = newName;
+        }
+
+        explicit operator bool() const {
+
+            return name != 0;
+        }
+
+    private:
+        GLuint name;
+    };
+
+    struct GLBufferTraits {
+
+        static void generate(GLsizei count, GLuint* names) { glGenBuffers(count, names); }
+        static void destroy(GLsizei count, const GLuint* names) { glDeleteBuffers(count, names); }
+    };
+
+    struct GLVertexArrayTraits {
+
+        static void generate(GLsizei count, GLuint* names) { glGenVertexArrays(count, names); }
+        static void destroy(GLsizei count, const GLuint* names) { glDeleteVertexArrays(count, names); }
+    };
+
+    // Takes deleted textures off the TextureAllocator's books, defined in TextureAllocator.cpp
+    void untrackTextures(GLsizei count, const GLuint* names);
+
+    struct GLTextureTraits {
+
+        static void generate(GLsizei count, GLuint* names) { glGenTextures(count, names); }
+        static void destroy(GLsizei count, const GLuint* names) { untrackTextures(count, names); glDeleteTextures(count, names); }
+    };
+
+    struct GLFramebufferTraits {
+
+        static void generate(GLsizei count, GLuint* names) { glGenFramebuffers(count, names); }
+        static void destroy(GLsizei count, const GLuint* names) { glDeleteFramebuffers(count, names); }
+    };
+
+    typedef GLHandle<GLBufferTraits> GLBuffer;
+    typedef GLHandle<GLVertexArrayTraits> GLVertexArray;
+    typedef GLHandle<GLTextureTraits> GLTexture;
+    typedef GLHandle<GLFramebufferTraits> GLFramebuffer;
+}
+
+#endif /* GLHandle_hpp */
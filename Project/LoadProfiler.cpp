@@ -0,0 +1,326 @@
+#include "LoadProfiler.hpp"
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#if defined (_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+    #include <psapi.h>
+#else
+    #include <sys/resource.h>
+#endif
+
+namespace gps {
+
+    namespace {
+
+        const char* STAGE_NAMES[STAGE_COUNT] = {
+            "fileIO", "parse", "triangulate", "vertexExpansion", "meshProcessing",
+            "imageDecode", "rowFlip", "glUpload", "mipGeneration", "blockCompression", "shaderCompile"
+        };
+
+        std::string jsonString(const std::string& text) {
+
+            std::string quoted = "\"";
+            for (char c : text) {
+                if (c == '"' || c == '\\') {
+                    quoted += '\\';
+                    quoted += c;
+                } else if ((unsigned char)c < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned)c);
+                    quoted += escaped;
+                } else {
+                    quoted += c;
+                }
+            }
+            return quoted + "\"";
+        }
+
+        // model, texture, shader or other, from the file extension
+        std::string assetType(const std::string& asset) {
+
+            std::string extension = asset.substr(asset.find_last_of('.') + 1);
+            for (char& c : extension) {
+                c = (char)std::tolower((unsigned char)c);
+            }
+            if (extension == "obj")
+                return "model";
+            if (extension == "vert" || extension == "frag")
+                return "shader";
+            if (extension == "png" || extension == "jpg" || extension == "jpeg" || extension == "tga" || extension == "bmp")
+                return "texture";
+            return "other";
+        }
+
+        void skipWhitespace(const std::string& text, size_t& at) {
+
+            while (at < text.size() && std::isspace((unsigned char)text[at]))
+                at++;
+        }
+
+        bool parseString(const std::string& text, size_t& at, std::string& value) {
+
+            if (at >= text.size() || text[at] != '"')
+                return false;
+            value.clear();
+            for (at++; at < text.size() && text[at] != '"'; at++) {
+                if (text[at] == '\\' && at + 1 < text.size())
+                    at++;
+                value += text[at];
+            }
+            if (at >= text.size())
+                return false;
+            at++;
+            return true;
+        }
+    }
+
+    LoadProfiler& LoadProfiler::instance() {
+
+        static LoadProfiler profiler;
+        return profiler;
+    }
+
+    LoadProfiler::LoadProfiler() : enabled(false) {
+    }
+
+    void LoadProfiler::setEnabled(bool enable) {
+
+        enabled = enable;
+    }
+
+    bool LoadProfiler::isEnabled() const {
+
+        return enabled.load(std::memory_order_relaxed);
+    }
+
+    LoadProfiler::AssetRecord& LoadProfiler::record(const std::string& asset) {
+
+        std::map<std::string, AssetRecord>::iterator found = assets.find(asset);
+        if (found != assets.end()) {
+            return found->second;
+        }
+
+        AssetRecord& created = assets[asset];
+        for (double& ms : created.stageMs) {
+            ms = 0.0;
+        }
+        created.bytesRead = 0;
+        created.peakAtStart = PeakResidentBytes();
+        created.peakAtEnd = created.peakAtStart;
+        return created;
+    }
+
+    void LoadProfiler::addTime(const std::string& asset, LoadStage stage, double ms) {
+
+        size_t peak = PeakResidentBytes();
+        std::lock_guard<std::mutex> lock(mutex);
+        AssetRecord& entry = record(asset);
+        entry.stageMs[stage] += ms;
+        entry.peakAtEnd = peak;
+    }
+
+    void LoadProfiler::addBytesRead(const std::string& asset, size_t bytes) {
+
+        if (!isEnabled()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        record(asset).bytesRead += bytes;
+    }
+
+    double LoadProfiler::AssetRecord::totalMs() const {
+
+        double total = 0.0;
+        for (double ms : stageMs) {
+            total += ms;
+        }
+        return total;
+    }
+
+    bool LoadProfiler::loadBudgets(const std::string& fileName) {
+
+        std::ifstream file(fileName);
+        if (!file) {
+            std::cerr << "ERROR: could not open budgets " << fileName << std::endl;
+            return false;
+        }
+        std::stringstream contents;
+        contents << file.rdbuf();
+        std::string text = contents.str();
+
+        std::map<std::string, double> parsed;
+        size_t at = 0;
+        skipWhitespace(text, at);
+        bool valid = at < text.size() && text[at] == '{';
+        for (at++; valid; ) {
+            skipWhitespace(text, at);
+            if (at < text.size() && text[at] == '}')
+                break;
+
+            std::string name;
+            valid = parseString(text, at, name);
+            skipWhitespace(text, at);
+            valid = valid && at < text.size() && text[at] == ':';
+            if (!valid)
+                break;
+
+            at++;
+            skipWhitespace(text, at);
+            const char* begin = text.c_str() + at;
+            char* end = nullptr;
+            double ms = strtod(begin, &end);
+            valid = end != begin;
+            at += (size_t)(end - begin);
+            parsed[name] = ms;
+
+            skipWhitespace(text, at);
+            if (at < text.size() && text[at] == ',')
+                at++;
+        }
+
+        if (!valid) {
+            std::cerr << "ERROR: " << fileName << " is not a flat JSON object of budgets in milliseconds" << std::endl;
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        budgets.swap(parsed);
+        return true;
+    }
+
+    double LoadProfiler::budgetOf(const std::string& asset) const {
+
+        std::map<std::string, double>::const_iterator found = budgets.find(asset);
+        if (found == budgets.end()) {
+            found = budgets.find("*");
+        }
+        return found != budgets.end() ? found->second : -1.0;
+    }
+
+    void LoadProfiler::writeReport(std::ostream& out) const {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        double stageTotals[STAGE_COUNT] = {};
+        size_t bytesTotal = 0;
+
+        out << std::fixed << std::setprecision(3);
+        out << "{\n  \"assets\": [";
+        bool first = true;
+        for (const auto& entry : assets) {
+
+            const AssetRecord& asset = entry.second;
+            double budget = budgetOf(entry.first);
+            out << (first ? "\n" : ",\n") << "    {\n";
+            out << "      \"name\": " << jsonString(entry.first) << ",\n";
+            out << "      \"type\": \"" << assetType(entry.first) << "\",\n";
+            out << "      \"totalMs\": " << asset.totalMs() << ",\n";
+            out << "      \"bytesRead\": " << asset.bytesRead << ",\n";
+            out << "      \"peakResidentBytes\": " << asset.peakAtEnd << ",\n";
+            out << "      \"peakGrowthBytes\": " << asset.peakAtEnd - asset.peakAtStart << ",\n";
+            if (budget >= 0.0) {
+                out << "      \"budgetMs\": " << budget << ",\n";
+                out << "      \"overBudget\": " << (asset.totalMs() > budget ? "true" : "false") << ",\n";
+            } else {
+                out << "      \"budgetMs\": null,\n";
+                out << "      \"overBudget\": false,\n";
+            }
+            out << "      \"stagesMs\": {";
+            for (int s = 0; s < STAGE_COUNT; s++) {
+                out << (s ? ", " : " ") << "\"" << STAGE_NAMES[s] << "\": " << asset.stageMs[s];
+                stageTotals[s] += asset.stageMs[s];
+            }
+            out << " }\n    }";
+            bytesTotal += asset.bytesRead;
+            first = false;
+        }
+
+        out << "\n  ],\n  \"totals\": {\n";
+        out << "    \"bytesRead\": " << bytesTotal << ",\n";
+        out << "    \"peakResidentBytes\": " << PeakResidentBytes() << ",\n";
+        out << "    \"stagesMs\": {";
+        for (int s = 0; s < STAGE_COUNT; s++) {
+            out << (s ? ", " : " ") << "\"" << STAGE_NAMES[s] << "\": " << stageTotals[s];
+        }
+        out << " }\n  }\n}\n";
+        out << std::defaultfloat;
+    }
+
+    bool LoadProfiler::writeReport(const std::string& fileName) const {
+
+        std::ofstream file(fileName);
+        if (!file) {
+            std::cerr << "ERROR: could not write " << fileName << std::endl;
+            return false;
+        }
+        writeReport(file);
+        return (bool)file;
+    }
+
+    bool LoadProfiler::checkBudgets(std::ostream& out) const {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        bool withinBudgets = true;
+        for (const auto& entry : assets) {
+
+            double budget = budgetOf(entry.first);
+            double total = entry.second.totalMs();
+            if (budget >= 0.0 && total > budget) {
+                out << "ERROR: " << entry.first << " took " << total << " ms to load, budget " << budget << " ms" << std::endl;
+                withinBudgets = false;
+            }
+        }
+        return withinBudgets;
+    }
+
+    size_t LoadProfiler::PeakResidentBytes() {
+
+#if defined (_WIN32)
+        PROCESS_MEMORY_COUNTERS counters;
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+            return counters.PeakWorkingSetSize;
+        }
+        return 0;
+#else
+        struct rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0) {
+            return 0;
+        }
+    #if defined (__APPLE__)
+        return (size_t)usage.ru_maxrss;
+    #else
+        // kilobytes on Linux
+        return (size_t)usage.ru_maxrss * 1024;
+    #endif
+#endif
+    }
+
+    const char* LoadProfiler::stageName(LoadStage stage) {
+
+        return STAGE_NAMES[stage];
+    }
+
+    LoadScope::LoadScope(const std::string& assetName, LoadStage loadStage) : active(LoadProfiler::instance().isEnabled()), stage(loadStage) {
+
+        if (active) {
+            asset = assetName;
+            start = std::chrono::steady_clock::now();
+        }
+    }
+
+    LoadScope::~LoadScope() {
+
+        if (active) {
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            LoadProfiler::instance().addTime(asset, stage, ms);
+        }
+    }
+}
@@ -0,0 +1,101 @@
+#ifndef LoadProfiler_hpp
+#define LoadProfiler_hpp
+
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+namespace gps {
+
+    // Parts of loading an asset that the profiler keeps apart
+    enum LoadStage {
+        STAGE_FILE_IO,
+        STAGE_PARSE,
+        STAGE_TRIANGULATE,
+        STAGE_VERTEX_EXPANSION,
+        // optimizer, LOD chain, material merging, meshlets
+        STAGE_MESH_PROCESSING,
+        STAGE_IMAGE_DECODE,
+        STAGE_ROW_FLIP,
+        STAGE_GL_UPLOAD,
+        STAGE_MIP_GENERATION,
+        // BC1/BC3/BC7 encoding of a mip chain before it is cooked
+        STAGE_BLOCK_COMPRESSION,
+        STAGE_SHADER_COMPILE,
+        STAGE_COUNT
+    };
+
+    // Per-asset, per-stage load timings with bytes read and peak memory, written out as JSON and checked against
+    // optional per-asset budgets. Thread safe; off until enabled, when a LoadScope costs one branch.
+    class LoadProfiler {
+
+    public:
+        static LoadProfiler& instance();
+
+        void setEnabled(bool enabled);
+        bool isEnabled() const;
+
+        void addTime(const std::string& asset, LoadStage stage, double ms);
+        void addBytesRead(const std::string& asset, size_t bytes);
+
+        // Reads a flat JSON object of asset name to milliseconds, "*" applies to every asset without its own entry
+        bool loadBudgets(const std::string& fileName);
+
+        bool writeReport(const std::string& fileName) const;
+        void writeReport(std::ostream& out) const;
+
+        // Prints every asset over its budget, returns false if there is one
+        bool checkBudgets(std::ostream& out) const;
+
+        // Peak resident set size of the process so far, 0 where it cannot be queried
+        static size_t PeakResidentBytes();
+
+        static const char* stageName(LoadStage stage);
+
+    private:
+        struct AssetRecord {
+
+            double stageMs[STAGE_COUNT];
+            size_t bytesRead;
+            // process peak when the asset was first and last worked on; loads that overlap share the growth
+            size_t peakAtStart;
+            size_t peakAtEnd;
+
+            double totalMs() const;
+        };
+
+        mutable std::mutex mutex;
+        std::atomic<bool> enabled;
+        std::map<std::string, AssetRecord> assets;
+        std::map<std::string, double> budgets;
+
+        LoadProfiler();
+
+        AssetRecord& record(const std::string& asset);
+        // budget of an asset, negative when it has none
+        double budgetOf(const std::string& asset) const;
+    };
+
+    // Adds the time until the end of the scope to one stage of an asset
+    class LoadScope {
+
+    public:
+        LoadScope(const std::string& asset, LoadStage stage);
+        ~LoadScope();
+
+        LoadScope(const LoadScope&) = delete;
+        LoadScope& operator=(const LoadScope&) = delete;
+
+    private:
+        // only copied while profiling is enabled
+        std::string asset;
+        bool active;
+        LoadStage stage;
+        std::chrono::steady_clock::time_point start;
+    };
+}
+
+#endif /* LoadProfiler_hpp */
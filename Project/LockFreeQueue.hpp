@@ -0,0 +1,84 @@
+#ifndef LockFreeQueue_hpp
+#define LockFreeQueue_hpp
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace gps {
+
+    // Bounded multi-producer/multi-consumer queue without locks (Vyukov ring buffer) - capacity must be a power of two
+    template <typename T>
+    class LockFreeQueue {
+
+    public:
+        explicit LockFreeQueue(size_t capacity) : cells(capacity), mask(capacity - 1), enqueuePosition(0), dequeuePosition(0) {
+
+            for (size_t i = 0; i < capacity; i++) {
+                cells[i].sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        LockFreeQueue(const LockFreeQueue&) = delete;
+        LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+
+        // Returns false when the queue is full
+        bool push(const T& value) {
+
+            size_t position = enqueuePosition.load(std::memory_order_relaxed);
+            for (;;) {
+                Cell& cell = cells[position & mask];
+                size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                ptrdiff_t difference = static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(position);
+                if (difference == 0) {
+                    if (enqueuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        cell.value = value;
+                        cell.sequence.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (difference < 0) {
+                    return false;
+                } else {
+                    position = enqueuePosition.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Returns false when the queue is empty
+        bool pop(T& value) {
+
+            size_t position = dequeuePosition.load(std::memory_order_relaxed);
+            for (;;) {
+                Cell& cell = cells[position & mask];
+                size_t sequence = cell.sequence.load(std::memory_order_acquire);
+                ptrdiff_t difference = static_cast<ptrdiff_t>(sequence) - static_cast<ptrdiff_t>(position + 1);
+                if (difference == 0) {
+                    if (dequeuePosition.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                        value = cell.value;
+                        cell.sequence.store(position + mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (difference < 0) {
+                    return false;
+                } else {
+                    position = dequeuePosition.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+    private:
+        struct Cell {
+
+            std::atomic<size_t> sequence;
+            T value;
+        };
+
+        std::vector<Cell> cells;
+        const size_t mask;
+        // producers and the consumer work on separate cache lines
+        alignas(64) std::atomic<size_t> enqueuePosition;
+        alignas(64) std::atomic<size_t> dequeuePosition;
+    };
+}
+
+#endif /* LockFreeQueue_hpp */
@@ -0,0 +1,141 @@
+#include "MappedFile.hpp"
+
+#if defined (_WIN32)
+    #define WIN32_LEAN_AND_MEAN
+    #define NOMINMAX
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#include <utility>
+
+namespace gps {
+
+    MappedFile::MappedFile() : mappedData(nullptr), mappedSize(0) {
+
+#if defined (_WIN32)
+        fileHandle = INVALID_HANDLE_VALUE;
+        mappingHandle = nullptr;
+#endif
+    }
+
+    MappedFile::~MappedFile() {
+
+        close();
+    }
+
+    MappedFile::MappedFile(MappedFile&& other) noexcept : MappedFile() {
+
+        *this = std::move(other);
+    }
+
+    MappedFile& MappedFile::operator=(MappedFile&& other) noexcept {
+
+        if (this != &other) {
+            close();
+            std::swap(mappedData, other.mappedData);
+            std::swap(mappedSize, other.mappedSize);
+#if defined (_WIN32)
+            std::swap(fileHandle, other.fileHandle);
+            std::swap(mappingHandle, other.mappingHandle);
+#endif
+        }
+        return *this;
+    }
+
+    bool MappedFile::open(const std::string& fileName) {
+
+        close();
+
+#if defined (_WIN32)
+        fileHandle = CreateFileA(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (fileHandle == INVALID_HANDLE_VALUE) {
+            return false;
+        }
+
+        LARGE_INTEGER fileSize;
+        if (!GetFileSizeEx(fileHandle, &fileSize) || fileSize.QuadPart == 0) {
+            close();
+            return false;
+        }
+
+        mappingHandle = CreateFileMappingA(fileHandle, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!mappingHandle) {
+            close();
+            return false;
+        }
+
+        mappedData = static_cast<const unsigned char*>(MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0));
+        if (!mappedData) {
+            close();
+            return false;
+        }
+        mappedSize = static_cast<size_t>(fileSize.QuadPart);
+#else
+        int fd = ::open(fileName.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0 || fileStat.st_size == 0) {
+            ::close(fd);
+            return false;
+        }
+
+        void* address = mmap(NULL, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        // the mapping keeps its own reference to the file
+        ::close(fd);
+        if (address == MAP_FAILED) {
+            return false;
+        }
+
+        madvise(address, static_cast<size_t>(fileStat.st_size), MADV_SEQUENTIAL);
+        mappedData = static_cast<const unsigned char*>(address);
+        mappedSize = static_cast<size_t>(fileStat.st_size);
+#endif
+        return true;
+    }
+
+    void MappedFile::close() {
+
+#if defined (_WIN32)
+        if (mappedData) {
+            UnmapViewOfFile(mappedData);
+        }
+        if (mappingHandle) {
+            CloseHandle(mappingHandle);
+            mappingHandle = nullptr;
+        }
+        if (fileHandle != INVALID_HANDLE_VALUE) {
+            CloseHandle(fileHandle);
+            fileHandle = INVALID_HANDLE_VALUE;
+        }
+#else
+        if (mappedData) {
+            munmap(const_cast<unsigned char*>(mappedData), mappedSize);
+        }
+#endif
+        mappedData = nullptr;
+        mappedSize = 0;
+    }
+
+    bool MappedFile::isOpen() const {
+
+        return mappedData != nullptr;
+    }
+
+    const unsigned char* MappedFile::data() const {
+
+        return mappedData;
+    }
+
+    size_t MappedFile::size() const {
+
+        return mappedSize;
+    }
+}
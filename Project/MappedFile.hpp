@@ -0,0 +1,41 @@
+#ifndef MappedFile_hpp
+#define MappedFile_hpp
+
+#include <cstddef>
+#include <string>
+
+namespace gps {
+
+    // Read-only memory mapping of a whole file
+    class MappedFile {
+
+    public:
+        MappedFile();
+        ~MappedFile();
+
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        // The mapping stays where it is, so pointers into data() survive a move
+        MappedFile(MappedFile&& other) noexcept;
+        MappedFile& operator=(MappedFile&& other) noexcept;
+
+        // Maps the file into memory, returns false if it is missing or empty
+        bool open(const std::string& fileName);
+        void close();
+
+        bool isOpen() const;
+        const unsigned char* data() const;
+        size_t size() const;
+
+    private:
+        const unsigned char* mappedData;
+        size_t mappedSize;
+#if defined (_WIN32)
+        void* fileHandle;
+        void* mappingHandle;
+#endif
+    };
+}
+
+#endif /* MappedFile_hpp */
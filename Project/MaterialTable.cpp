@@ -0,0 +1,312 @@
+#include "MaterialTable.hpp"
+#include "GLCaps.hpp"
+#include "ResourceRegistry.hpp"
+#include "TextureAllocator.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <string>
+
+namespace gps {
+
+    bool MaterialTable::enabled = true;
+    size_t MaterialTable::textureBinds = 0;
+
+    namespace {
+
+        // Layers an array starts with, it doubles from there
+        const int INITIAL_LAYERS = 4;
+
+        // Storage for every level and layer of the bound GL_TEXTURE_2D_ARRAY
+        void allocateArray(int width, int height, int levels, int layers, TextureFormat format) {
+
+            GLenum internalFormat = BlockCompressor::GLInternalFormat(format, true);
+#if !defined (__APPLE__)
+            if (GLCaps::get().textureStorage) {
+                glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, internalFormat, width, height, layers);
+                return;
+            }
+#endif
+            for (int level = 0; level < levels; level++) {
+                if (format == FORMAT_RGBA8) {
+                    glTexImage3D(GL_TEXTURE_2D_ARRAY, level, internalFormat, width, height, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+                }
+                else {
+                    std::vector<unsigned char> blocks(BlockCompressor::LevelSize(format, width, height) * layers, 0);
+                    glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, internalFormat, width, height, layers, 0, (GLsizei)blocks.size(), blocks.data());
+                }
+                width = std::max(1, width / 2);
+                height = std::max(1, height / 2);
+            }
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        }
+    }
+
+    // Deleter of the layer handles, puts the slot back on its array's free list
+    struct MaterialTable::Release {
+
+        MaterialTable* table;
+        uint64_t contentHash;
+
+        void operator()(TextureLayer* layer) const {
+
+            std::lock_guard<std::mutex> lock(table->mutex);
+            auto found = table->layers.find(contentHash);
+            if (found != table->layers.end() && found->second.expired()) {
+                table->layers.erase(found);
+            }
+            table->release(layer);
+        }
+    };
+
+    MaterialTable& MaterialTable::instance() {
+
+        // never destroyed, layers released during static destruction still find their array
+        static MaterialTable* table = new MaterialTable();
+        return *table;
+    }
+
+    MaterialTable::MaterialTable() : uploadedMaterials(0) {
+    }
+
+    void MaterialTable::setEnabled(bool enable) {
+
+        enabled = enable;
+    }
+
+    bool MaterialTable::isEnabled() {
+
+        return enabled;
+    }
+
+    bool MaterialTable::hasLayer(uint64_t contentHash) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = layers.find(contentHash);
+        return found != layers.end() && !found->second.expired();
+    }
+
+    LayerRef MaterialTable::findLayer(uint64_t contentHash) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = layers.find(contentHash);
+        return found != layers.end() ? found->second.lock() : LayerRef();
+    }
+
+    LayerRef MaterialTable::addLayer(uint64_t contentHash, int width, int height, int levels, TextureFormat format) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        size_t index = 0;
+        while (index < arrays.size() && !(arrays[index].width == width && arrays[index].height == height &&
+                                          arrays[index].levels == levels && arrays[index].format == format)) {
+            index++;
+        }
+        if (index == arrays.size()) {
+
+            if (arrays.size() == MAX_ARRAYS) {
+                return LayerRef();
+            }
+            arrays.push_back(TextureArray());
+            TextureArray& created = arrays.back();
+            created.width = width;
+            created.height = height;
+            created.levels = levels;
+            created.format = format;
+            created.capacity = 0;
+            created.used = 0;
+        }
+
+        TextureArray& array = arrays[index];
+        int layer;
+        if (!array.freeLayers.empty()) {
+            layer = array.freeLayers.back();
+            array.freeLayers.pop_back();
+        }
+        else {
+            if (array.used == array.capacity && !grow(array, std::max(INITIAL_LAYERS, array.capacity * 2))) {
+                return LayerRef();
+            }
+            layer = array.used++;
+        }
+
+        TextureLayer* slot = new TextureLayer();
+        slot->array = (int)index;
+        slot->layer = layer;
+        LayerRef added(slot, Release{ this, contentHash });
+        layers[contentHash] = added;
+        return added;
+    }
+
+    GLuint MaterialTable::getArrayTexture(int array) const {
+
+        return array >= 0 && array < (int)arrays.size() ? arrays[array].texture.get() : 0;
+    }
+
+    size_t MaterialTable::getLayerSize(int array) const {
+
+        const TextureArray& shape = arrays[array];
+        return BlockCompressor::ChainSize(shape.format, shape.width, shape.height, shape.levels);
+    }
+
+    int MaterialTable::addMaterial(const Material& material, const TextureLayer* diffuse, const TextureLayer* specular) {
+
+        MaterialData data;
+        data.ambient = glm::vec4(material.ambient, 0.0f);
+        data.diffuse = glm::vec4(material.diffuse, 0.0f);
+        data.specular = glm::vec4(material.specular, 0.0f);
+        data.textures = glm::ivec4(diffuse ? diffuse->array : -1, diffuse ? diffuse->layer : -1,
+                                   specular ? specular->array : -1, specular ? specular->layer : -1);
+
+        uint64_t key = ResourceRegistry::hashBytes(&data, sizeof(data));
+        auto found = materialIndices.find(key);
+        if (found != materialIndices.end()) {
+            return found->second;
+        }
+        if (materials.size() == MAX_MATERIALS) {
+            std::cerr << "WARNING: material table full, further meshes bind their textures themselves" << std::endl;
+            return -1;
+        }
+
+        materials.push_back(data);
+        int index = (int)materials.size() - 1;
+        materialIndices[key] = index;
+        return index;
+    }
+
+    void MaterialTable::bind(GLuint program) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        // the block is active in the shader even when every mesh binds its own textures, so a buffer is always bound
+        if (!uniformBuffer) {
+            uniformBuffer = GLBuffer::create();
+            glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer.get());
+            glBufferData(GL_UNIFORM_BUFFER, MAX_MATERIALS * sizeof(MaterialData), NULL, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        }
+        if (uploadedMaterials < materials.size()) {
+            glBindBuffer(GL_UNIFORM_BUFFER, uniformBuffer.get());
+            glBufferSubData(GL_UNIFORM_BUFFER, uploadedMaterials * sizeof(MaterialData), (materials.size() - uploadedMaterials) * sizeof(MaterialData),
+                            &materials[uploadedMaterials]);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+            uploadedMaterials = materials.size();
+        }
+        glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BINDING, uniformBuffer.get());
+
+        // block binding and sampler units are program state, set once
+        if (std::find(preparedPrograms.begin(), preparedPrograms.end(), program) == preparedPrograms.end()) {
+
+            GLuint blockIndex = glGetUniformBlockIndex(program, "Materials");
+            if (blockIndex != GL_INVALID_INDEX) {
+                glUniformBlockBinding(program, blockIndex, UNIFORM_BINDING);
+            }
+            for (int i = 0; i < MAX_ARRAYS; i++) {
+                std::string name = "materialTextures[" + std::to_string(i) + "]";
+                glUniform1i(glGetUniformLocation(program, name.c_str()), (GLint)(FIRST_TEXTURE_UNIT + i));
+            }
+            preparedPrograms.push_back(program);
+        }
+
+        for (size_t i = 0; i < arrays.size(); i++) {
+            glActiveTexture(GL_TEXTURE0 + FIRST_TEXTURE_UNIT + (GLuint)i);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, arrays[i].texture.get());
+        }
+        glActiveTexture(GL_TEXTURE0);
+        textureBinds += arrays.size();
+    }
+
+    void MaterialTable::countTextureBinds(size_t binds) {
+
+        textureBinds += binds;
+    }
+
+    size_t MaterialTable::takeTextureBinds() {
+
+        size_t binds = textureBinds;
+        textureBinds = 0;
+        return binds;
+    }
+
+    void MaterialTable::printStats(std::ostream& out) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        out << "Material table   : " << materials.size() << " materials, " << arrays.size() << " texture arrays" << std::endl;
+        for (const TextureArray& array : arrays) {
+            size_t bytes = BlockCompressor::ChainSize(array.format, array.width, array.height, array.levels) * array.capacity;
+            out << "  " << array.width << "x" << array.height << " " << BlockCompressor::FormatName(array.format) << " : "
+                << array.used - array.freeLayers.size() << "/" << array.capacity << " layers, " << bytes / 1024 << " KB" << std::endl;
+        }
+    }
+
+    void MaterialTable::release(TextureLayer* layer) {
+
+        arrays[layer->array].freeLayers.push_back(layer->layer);
+        delete layer;
+    }
+
+    bool MaterialTable::grow(TextureArray& array, int capacity) {
+
+        GLTexture grown = GLTexture::create();
+        glBindTexture(GL_TEXTURE_2D_ARRAY, grown.get());
+        TextureAllocator::beginAllocation();
+        allocateArray(array.width, array.height, array.levels, capacity, array.format);
+        {
+            // layers cannot drop levels one by one, the arrays stay pinned
+            TextureOwnerScope owner("materialTable");
+            if (!TextureAllocator::instance().track(grown.get(), GL_TEXTURE_2D_ARRAY, BlockCompressor::GLInternalFormat(array.format, true),
+                                                    array.width, array.height, array.levels, capacity, "array " + std::to_string(array.width) +
+                                                    "x" + std::to_string(array.height) + " " + BlockCompressor::FormatName(array.format), false)) {
+                glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+                return false;
+            }
+        }
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, array.levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+        if (array.used > 0) {
+
+            // a level of all old layers at a time, read into a pixel buffer and written back from it on the GPU
+            GLBuffer staging = GLBuffer::create();
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, staging.get());
+            glBufferData(GL_PIXEL_PACK_BUFFER, BlockCompressor::LevelSize(array.format, array.width, array.height) * array.capacity, NULL, GL_STREAM_COPY);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+            GLenum internalFormat = BlockCompressor::GLInternalFormat(array.format, true);
+            int width = array.width, height = array.height;
+            for (int level = 0; level < array.levels; level++) {
+
+                glBindTexture(GL_TEXTURE_2D_ARRAY, array.texture.get());
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, staging.get());
+                if (array.format == FORMAT_RGBA8) {
+                    glGetTexImage(GL_TEXTURE_2D_ARRAY, level, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+                }
+                else {
+                    glGetCompressedTexImage(GL_TEXTURE_2D_ARRAY, level, NULL);
+                }
+                glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+                glBindTexture(GL_TEXTURE_2D_ARRAY, grown.get());
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.get());
+                if (array.format == FORMAT_RGBA8) {
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, width, height, array.capacity, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+                }
+                else {
+                    GLsizei bytes = (GLsizei)(BlockCompressor::LevelSize(array.format, width, height) * array.capacity);
+                    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, 0, width, height, array.capacity, internalFormat, bytes, NULL);
+                }
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+                width = std::max(1, width / 2);
+                height = std::max(1, height / 2);
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+        array.texture = std::move(grown);
+        array.capacity = capacity;
+        return true;
+    }
+}
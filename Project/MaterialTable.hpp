@@ -0,0 +1,123 @@
+#ifndef MaterialTable_hpp
+#define MaterialTable_hpp
+
+#include "BlockCompressor.hpp"
+#include "GLHandle.hpp"
+#include "Mesh.hpp"
+
+#include <glm/glm.hpp>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // Slot of one texture in the material table's arrays, freed for reuse when the last handle goes away
+    struct TextureLayer {
+
+        int array;
+        int layer;
+    };
+
+    typedef std::shared_ptr<TextureLayer> LayerRef;
+
+    // One entry of the Materials uniform block (std140), colors in xyz
+    struct MaterialData {
+
+        glm::vec4 ambient;
+        glm::vec4 diffuse;
+        glm::vec4 specular;
+        // diffuse array, diffuse layer, specular array, specular layer; -1 where the material has no texture
+        glm::ivec4 textures;
+    };
+
+    // Textures of the same size, level count and format packed as layers of one GL_TEXTURE_2D_ARRAY, and the
+    // material parameters in one uniform buffer, so a mesh draw only sets its material index. Every array is
+    // bound once per pass instead of each texture once per mesh. Arrays grow by doubling, the old layers are
+    // copied on the GPU through a pixel buffer. GL thread only, except hasLayer.
+    class MaterialTable {
+
+    public:
+        // Sampler array size and uniform block length in basic.frag
+        static const int MAX_ARRAYS = 8;
+        static const int MAX_MATERIALS = 256;
+        // materialTextures[i] samples unit FIRST_TEXTURE_UNIT + i, below that are the mesh and shadow textures
+        static const GLuint FIRST_TEXTURE_UNIT = 4;
+        static const GLuint UNIFORM_BINDING = 0;
+
+        static MaterialTable& instance();
+
+        // Models loaded from now on put their textures into the table, on by default
+        static void setEnabled(bool enabled);
+        static bool isEnabled();
+
+        // Whether a live layer with this content exists - safe from any thread
+        bool hasLayer(uint64_t contentHash);
+
+        // Live layer with this content or null
+        LayerRef findLayer(uint64_t contentHash);
+
+        // Reserves a layer for an image of this shape, the caller fills it (see TextureUploader::uploadLayer).
+        // Null if every array is taken by another shape, or GL could not grow the array.
+        LayerRef addLayer(uint64_t contentHash, int width, int height, int levels, TextureFormat format);
+
+        // Current name of an array, it changes whenever the array grows
+        GLuint getArrayTexture(int array) const;
+
+        // Bytes of every level of one layer of an array
+        size_t getLayerSize(int array) const;
+
+        // Index of the entry with these parameters, added if new; -1 once the table is full
+        int addMaterial(const Material& material, const TextureLayer* diffuse, const TextureLayer* specular);
+
+        // Uploads new entries, binds the uniform buffer and every array for the next draws of program
+        void bind(GLuint program);
+
+        // glBindTexture calls for mesh textures since the last call, this table's and the per-mesh ones
+        static void countTextureBinds(size_t binds);
+        static size_t takeTextureBinds();
+
+        // Arrays with their used and allocated layers, and the material count
+        void printStats(std::ostream& out);
+
+    private:
+        struct TextureArray {
+
+            GLTexture texture;
+            int width;
+            int height;
+            int levels;
+            TextureFormat format;
+            int capacity;
+            int used;
+            std::vector<int> freeLayers;
+        };
+
+        struct Release;
+
+        std::mutex mutex;
+        std::vector<TextureArray> arrays;
+        std::unordered_map<uint64_t, std::weak_ptr<TextureLayer> > layers;
+        std::vector<MaterialData> materials;
+        std::unordered_map<uint64_t, int> materialIndices;
+        size_t uploadedMaterials;
+        GLBuffer uniformBuffer;
+        std::vector<GLuint> preparedPrograms;
+
+        static bool enabled;
+        static size_t textureBinds;
+
+        MaterialTable();
+
+        void release(TextureLayer* layer);
+        // Reallocates an array with room for capacity layers and copies the existing ones over; false if GL could not
+        // allocate it, the array keeps its old storage then
+        bool grow(TextureArray& array, int capacity);
+    };
+}
+
+#endif /* MaterialTable_hpp */
@@ -1,71 +1,327 @@
 #include "Mesh.hpp"
+#include "MaterialTable.hpp"
+#include "ObjectBuffer.hpp"
+#include "TextureAllocator.hpp"
+#include "VertexQuantizer.hpp"
+
+#include <algorithm>
+#include <utility>
+
 namespace gps {
 
+	bool Mesh::quantizationEnabled = false;
+	size_t Mesh::uploadChunkSize = 0;
+
+	void Mesh::setQuantization(bool enabled) {
+
+		quantizationEnabled = enabled;
+	}
+
+	void Mesh::setUploadChunkSize(size_t bytes) {
+
+		uploadChunkSize = bytes;
+	}
+
 	/* Mesh Constructor */
-	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures) {
+	Mesh::Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures,
+	           std::vector<MeshLod> lods, std::vector<Meshlet> meshlets, CpuDataPolicy cpuData) {
+
+		this->vertices = std::move(vertices);
+		this->indices = std::move(indices);
+		this->textures = std::move(textures);
+		this->materialIndex = -1;
+		this->lods = std::move(lods);
+		this->meshlets = std::move(meshlets);
+
+		this->setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), this->indices.size());
+
+		if (cpuData == RELEASE_CPU_DATA) {
 
-		this->vertices = vertices;
-		this->indices = indices;
-		this->textures = textures;
+			// swap with empty vectors, clear() alone keeps the capacity
+			std::vector<Vertex>().swap(this->vertices);
+			std::vector<GLuint>().swap(this->indices);
+		}
+	}
+
+	Mesh::Mesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount, std::vector<Texture> textures,
+	           std::vector<MeshLod> lods, std::vector<Meshlet> meshlets, CpuDataPolicy cpuData) {
+
+		this->textures = std::move(textures);
+		this->materialIndex = -1;
+		this->lods = std::move(lods);
+		this->meshlets = std::move(meshlets);
+
+		if (cpuData == KEEP_CPU_DATA) {
+
+			this->vertices.assign(vertexData, vertexData + vertexCount);
+			this->indices.assign(indexData, indexData + indexCount);
+		}
 
-		this->setupMesh();
+		this->setupMesh(vertexData, vertexCount, indexData, indexCount);
 	}
 
-	Buffers Mesh::getBuffers() {
-	    return this->buffers;
+	Buffers Mesh::getBuffers() const {
+
+		Buffers buffers;
+		buffers.VAO = this->vertexArray.get();
+		buffers.VBO = this->vertexBuffer.get();
+		buffers.EBO = this->indexBuffer.get();
+		return buffers;
 	}
 
 	/* Mesh drawing function - also applies associated textures */
 	void Mesh::Draw(gps::Shader shader)	{
 
+		Draw(shader, 0);
+	}
+
+	void Mesh::Draw(gps::Shader shader, int lod) {
+
+		if (!this->quantized) {
+
+			drawRange(shader, lod);
+			return;
+		}
+
+		// the caller did not pass the model matrix, take the current object's and point the shader back at it afterwards
+		ObjectBuffer& objects = ObjectBuffer::instance();
+		Draw(shader, lod, objects.getModel());
+		objects.restoreObject(shader);
+	}
+
+	void Mesh::Draw(gps::Shader shader, int lod, const glm::mat4& modelMatrix) {
+
+		setModelMatrix(shader, modelMatrix);
+		drawRange(shader, lod);
+	}
+
+	void Mesh::DrawMeshlets(gps::Shader shader, const glm::mat4& modelMatrix, const std::vector<GLuint>& visibleMeshlets) {
+
+		if (visibleMeshlets.empty())
+			return;
+
+		std::vector<GLsizei> counts;
+		std::vector<const GLvoid*> offsets;
+		size_t indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		GLuint runEnd = 0;
+
+		for (GLuint m : visibleMeshlets) {
+
+			const Meshlet& meshlet = this->meshlets[m];
+			if (!counts.empty() && meshlet.indexOffset == runEnd) {
+
+				counts.back() += (GLsizei)(meshlet.triangleCount * 3);
+			}
+			else {
+
+				counts.push_back((GLsizei)(meshlet.triangleCount * 3));
+				offsets.push_back((const GLvoid*)(meshlet.indexOffset * indexSize));
+			}
+			runEnd = meshlet.indexOffset + meshlet.triangleCount * 3;
+		}
+
+		setModelMatrix(shader, modelMatrix);
+		submit(shader, counts.data(), offsets.data(), (GLsizei)counts.size());
+	}
+
+	const std::vector<Meshlet>& Mesh::getMeshlets() const {
+
+		return this->meshlets;
+	}
+
+	bool Mesh::isQuantized() const {
+
+		return this->quantized;
+	}
+
+	void Mesh::setMaterial(int materialIndex) {
+
+		this->materialIndex = materialIndex;
+	}
+
+	int Mesh::getMaterial() const {
+
+		return this->materialIndex;
+	}
+
+	size_t Mesh::getVertexBufferSize() const {
+
+		return this->vertexBufferSize;
+	}
+
+	size_t Mesh::getIndexBufferSize() const {
+
+		return this->indexBufferSize;
+	}
+
+	size_t Mesh::getCpuSize() const {
+
+		return this->vertices.capacity() * sizeof(Vertex) + this->indices.capacity() * sizeof(GLuint) +
+			this->lods.capacity() * sizeof(MeshLod) + this->meshlets.capacity() * sizeof(Meshlet);
+	}
+
+	void Mesh::setModelMatrix(gps::Shader shader, const glm::mat4& modelMatrix) {
+
+		if (this->quantized) {
+
+			ObjectBuffer::instance().setObjectModel(shader, modelMatrix * this->dequantization);
+		}
+	}
+
+	void Mesh::drawRange(gps::Shader shader, int lod) {
+
+		// without a LOD chain the whole index buffer is the only level
+		GLuint firstIndex = 0;
+		GLsizei count = this->indexCount;
+		if (!this->lods.empty()) {
+
+			const MeshLod& level = this->lods[std::min(std::max(lod, 0), (int)this->lods.size() - 1)];
+			firstIndex = level.indexOffset;
+			count = (GLsizei)level.indexCount;
+		}
+
+		size_t indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		const GLvoid* offset = (const GLvoid*)(firstIndex * indexSize);
+		submit(shader, &count, &offset, 1);
+	}
+
+	void Mesh::submit(gps::Shader shader, const GLsizei* counts, const GLvoid* const* offsets, GLsizei drawCount) {
+
 		shader.useShaderProgram();
 
+		//a material table entry replaces the texture binds, -1 tells the shader to use the bound textures
+		shader.setUniform("materialIndex", this->materialIndex);
+		bool bindTextures = this->materialIndex < 0;
+
 		//set textures
-		for (GLuint i = 0; i < textures.size(); i++) {
+		for (GLuint i = 0; bindTextures && i < textures.size(); i++) {
 
 			glActiveTexture(GL_TEXTURE0 + i);
-			glUniform1i(glGetUniformLocation(shader.shaderProgram, this->textures[i].type.c_str()), i);
+			shader.setUniform(this->textures[i].type, (GLint)i);
 			glBindTexture(GL_TEXTURE_2D, this->textures[i].id);
+			TextureAllocator::instance().touch(this->textures[i].id);
 		}
 
-		glBindVertexArray(this->buffers.VAO);
-		glDrawElements(GL_TRIANGLES, (GLsizei)this->indices.size(), GL_UNSIGNED_INT, 0);
+		glBindVertexArray(this->vertexArray.get());
+		if (drawCount == 1)
+			glDrawElements(GL_TRIANGLES, counts[0], this->indexType, offsets[0]);
+		else
+			glMultiDrawElements(GL_TRIANGLES, counts, this->indexType, offsets, drawCount);
 		glBindVertexArray(0);
 
-        for(GLuint i = 0; i < this->textures.size(); i++) {
+        for(GLuint i = 0; bindTextures && i < this->textures.size(); i++) {
 
             glActiveTexture(GL_TEXTURE0 + i);
             glBindTexture(GL_TEXTURE_2D, 0);
         }
+        if (bindTextures)
+            MaterialTable::countTextureBinds(2 * this->textures.size());
 
     }
 
 	// Initializes all the buffer objects/arrays
-	void Mesh::setupMesh() {
+	void Mesh::setupMesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount) {
+
+		this->indexCount = (GLsizei)indexCount;
+		this->quantized = quantizationEnabled;
+		this->dequantization = glm::mat4(1.0f);
+		this->indexType = GL_UNSIGNED_INT;
 
 		// Create buffers/arrays
-		glGenVertexArrays(1, &this->buffers.VAO);
-		glGenBuffers(1, &this->buffers.VBO);
-		glGenBuffers(1, &this->buffers.EBO);
+		this->vertexArray = GLVertexArray::create();
+		this->vertexBuffer = GLBuffer::create();
+		this->indexBuffer = GLBuffer::create();
 
-		glBindVertexArray(this->buffers.VAO);
+		glBindVertexArray(this->vertexArray.get());
 		// Load data into vertex buffers
-		glBindBuffer(GL_ARRAY_BUFFER, this->buffers.VBO);
-		glBufferData(GL_ARRAY_BUFFER, this->vertices.size() * sizeof(Vertex), &this->vertices[0], GL_STATIC_DRAW);
+		glBindBuffer(GL_ARRAY_BUFFER, this->vertexBuffer.get());
+		glm::vec3 boundsMin(0.0f);
+		glm::vec3 boundsMax(0.0f);
+		if (this->quantized) {
+
+			VertexQuantizer::ComputeBounds(vertexData, vertexCount, boundsMin, boundsMax);
+			this->dequantization = VertexQuantizer::DequantizationMatrix(boundsMin, boundsMax);
+		}
+
+		size_t vertexSize = this->quantized ? sizeof(PackedVertex) : sizeof(Vertex);
+		this->vertexBufferSize = vertexCount * vertexSize;
+		if (!this->quantized && uploadChunkSize == 0) {
+
+			glBufferData(GL_ARRAY_BUFFER, this->vertexBufferSize, vertexData, GL_STATIC_DRAW);
+		}
+		else {
+
+			// packed a chunk at a time, so there is never a second full-size copy of the vertices
+			glBufferData(GL_ARRAY_BUFFER, this->vertexBufferSize, NULL, GL_STATIC_DRAW);
+			size_t chunkVertices = uploadChunkSize > 0 ? std::max(uploadChunkSize / vertexSize, (size_t)1) : vertexCount;
+			std::vector<PackedVertex> packed;
+			for (size_t first = 0; first < vertexCount; first += chunkVertices) {
+
+				size_t count = std::min(chunkVertices, vertexCount - first);
+				const GLvoid* chunk = vertexData + first;
+				if (this->quantized) {
+
+					packed.resize(count);
+					for (size_t i = 0; i < count; i++)
+						packed[i] = VertexQuantizer::Pack(vertexData[first + i], boundsMin, boundsMax);
+					chunk = packed.data();
+				}
+				glBufferSubData(GL_ARRAY_BUFFER, first * vertexSize, count * vertexSize, chunk);
+			}
+		}
+
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->indexBuffer.get());
+		// every index fits in 16 bits
+		if (this->quantized && vertexCount <= 65536)
+			this->indexType = GL_UNSIGNED_SHORT;
+
+		size_t indexSize = this->indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+		this->indexBufferSize = indexCount * indexSize;
+		if (this->indexType == GL_UNSIGNED_INT && uploadChunkSize == 0) {
+
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indexBufferSize, indexData, GL_STATIC_DRAW);
+		}
+		else {
+
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indexBufferSize, NULL, GL_STATIC_DRAW);
+			size_t chunkIndices = uploadChunkSize > 0 ? std::max(uploadChunkSize / indexSize, (size_t)1) : indexCount;
+			std::vector<GLushort> shortIndices;
+			for (size_t first = 0; first < indexCount; first += chunkIndices) {
 
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->buffers.EBO);
-		glBufferData(GL_ELEMENT_ARRAY_BUFFER, this->indices.size() * sizeof(GLuint), &this->indices[0], GL_STATIC_DRAW);
+				size_t count = std::min(chunkIndices, indexCount - first);
+				const GLvoid* chunk = indexData + first;
+				if (this->indexType == GL_UNSIGNED_SHORT) {
+
+					shortIndices.assign(indexData + first, indexData + first + count);
+					chunk = shortIndices.data();
+				}
+				glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, first * indexSize, count * indexSize, chunk);
+			}
+		}
 
 		// Set the vertex attribute pointers
-		// Vertex Positions
-		glEnableVertexAttribArray(0);
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
-		// Vertex Normals
-		glEnableVertexAttribArray(1);
-		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
-		// Vertex Texture Coords
-		glEnableVertexAttribArray(2);
-		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+		if (this->quantized) {
+
+			// the shaders read the same vec3/vec3/vec2 attributes, the fetch unit does the decoding
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, position));
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, normal));
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex), (GLvoid*)offsetof(PackedVertex, texCoords));
+		}
+		else {
+
+			// Vertex Positions
+			glEnableVertexAttribArray(0);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)0);
+			// Vertex Normals
+			glEnableVertexAttribArray(1);
+			glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, Normal));
+			// Vertex Texture Coords
+			glEnableVertexAttribArray(2);
+			glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (GLvoid*)offsetof(Vertex, TexCoords));
+		}
 
 		glBindVertexArray(0);
 	}
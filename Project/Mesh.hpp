@@ -12,6 +12,7 @@
 #include <glm/glm.hpp>
 
 #include "Shader.hpp"
+#include "GLHandle.hpp"
 
 #include <string>
 #include <vector>
@@ -26,12 +27,23 @@ namespace gps {
         glm::vec2 TexCoords;
     };
 
+    // Compact 16 byte vertex: positions normalized to the mesh bounds, GL_INT_2_10_10_10_REV normal, half-float UVs
+    struct PackedVertex {
+
+        GLushort position[4];
+        GLuint normal;
+        GLushort texCoords[2];
+    };
+
     struct Texture {
 
         GLuint id;
         //ambientTexture, diffuseTexture, specularTexture
         std::string type;
         std::string path;
+        //MaterialTable array and layer holding the image instead of id, -1 if none
+        int array;
+        int layer;
     };
 
     struct Material {
@@ -41,12 +53,38 @@ namespace gps {
         glm::vec3 specular;
     };
 
+    // One level of detail: a range of the mesh's index buffer and its geometric error in model units
+    struct MeshLod {
+        GLuint indexOffset;
+        GLuint indexCount;
+        float error;
+    };
+
+    // Contiguous run of triangles in the index buffer with its bounding sphere and normal cone, in model space
+    struct Meshlet {
+        GLuint indexOffset;
+        GLuint triangleCount;
+        GLuint vertexCount;
+        glm::vec3 center;
+        float radius;
+        glm::vec3 coneAxis;
+        // sine of the cone's half angle, 1 when the cone is too wide to cull anything
+        float coneCutoff;
+    };
+
     struct Buffers {
         GLuint VAO;
         GLuint VBO;
         GLuint EBO;
     };
 
+    // Whether a mesh keeps its CPU-side vertices and indices once they are in GL buffers (e.g. for picking)
+    enum CpuDataPolicy {
+        RELEASE_CPU_DATA,
+        KEEP_CPU_DATA
+    };
+
+    // Owns its GL objects, so it can be moved but not copied
     class Mesh {
 
     public:
@@ -54,18 +92,86 @@ namespace gps {
         std::vector<GLuint> indices;
         std::vector<Texture> textures;
 
-	    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures);
+	    // Takes the streams over, so callers can move freshly parsed data in without a copy
+	    Mesh(std::vector<Vertex> vertices, std::vector<GLuint> indices, std::vector<Texture> textures,
+	         std::vector<MeshLod> lods = std::vector<MeshLod>(), std::vector<Meshlet> meshlets = std::vector<Meshlet>(),
+	         CpuDataPolicy cpuData = RELEASE_CPU_DATA);
+
+	    // Uploads the streams straight from memory the mesh does not own, e.g. a mapped cache file,
+	    // and only copies them into vertices/indices with KEEP_CPU_DATA
+	    Mesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount, std::vector<Texture> textures,
+	         std::vector<MeshLod> lods = std::vector<MeshLod>(), std::vector<Meshlet> meshlets = std::vector<Meshlet>(),
+	         CpuDataPolicy cpuData = RELEASE_CPU_DATA);
 
-	    Buffers getBuffers();
+	    Mesh(Mesh&& other) = default;
+	    Mesh& operator=(Mesh&& other) = default;
+	    Mesh(const Mesh&) = delete;
+	    Mesh& operator=(const Mesh&) = delete;
+
+	    Buffers getBuffers() const;
 
 	    void Draw(gps::Shader shader);
 
+	    // Draws one level of detail, levels past the last one draw the coarsest
+	    void Draw(gps::Shader shader, int lod);
+
+	    // Same, with the model matrix known up front so a quantized mesh does not have to read it back
+	    void Draw(gps::Shader shader, int lod, const glm::mat4& modelMatrix);
+
+	    // Draws the full-detail meshlets listed in visibleMeshlets (ascending), adjacent ones merged into one range
+	    void DrawMeshlets(gps::Shader shader, const glm::mat4& modelMatrix, const std::vector<GLuint>& visibleMeshlets);
+
+	    // Meshlets of the full-detail level, empty if the mesh was not split
+	    const std::vector<Meshlet>& getMeshlets() const;
+
+	    bool isQuantized() const;
+
+	    // Entry of the MaterialTable the shader takes colors and texture layers from; with -1 (the default)
+	    // the mesh binds its textures around every draw
+	    void setMaterial(int materialIndex);
+	    int getMaterial() const;
+
+	    // Bytes of the vertex and index buffers on the GPU
+	    size_t getVertexBufferSize() const;
+	    size_t getIndexBufferSize() const;
+
+	    // Bytes still held in system memory: kept vertices/indices plus the LOD and meshlet tables
+	    size_t getCpuSize() const;
+
+	    // Meshes created from now on use PackedVertex and, below 65536 vertices, 16-bit indices
+	    static void setQuantization(bool enabled);
+
+	    // Meshes created from now on fill their buffers through glBufferSubData in pieces of at most this many bytes,
+	    // 0 (the default) uploads each buffer in one call
+	    static void setUploadChunkSize(size_t bytes);
+
     private:
         /*  Render data  */
-        Buffers buffers;
+        GLVertexArray vertexArray;
+        GLBuffer vertexBuffer;
+        GLBuffer indexBuffer;
+        GLsizei indexCount;
+        std::vector<MeshLod> lods;
+        std::vector<Meshlet> meshlets;
+
+        int materialIndex;
+
+        bool quantized;
+        // PackedVertex positions are in [0, 1], this maps them back into model space
+        glm::mat4 dequantization;
+        GLenum indexType;
+        size_t vertexBufferSize;
+        size_t indexBufferSize;
+
+        static bool quantizationEnabled;
+        static size_t uploadChunkSize;
+
+        void drawRange(gps::Shader shader, int lod);
+        void setModelMatrix(gps::Shader shader, const glm::mat4& modelMatrix);
+        void submit(gps::Shader shader, const GLsizei* counts, const GLvoid* const* offsets, GLsizei drawCount);
 
 	    // Initializes all the buffer objects/arrays
-	    void setupMesh();
+	    void setupMesh(const Vertex* vertexData, size_t vertexCount, const GLuint* indexData, size_t indexCount);
 
     };
 
@@ -0,0 +1,569 @@
+#include "MeshCache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+    namespace {
+
+        const char CACHE_MAGIC[4] = { 'G', 'P', 'S', 'M' };
+
+        enum StreamCodec : uint32_t {
+            CODEC_RAW = 0,
+            // every 32-bit word is xor-ed with the same word of the previous element and stored as a varint
+            CODEC_DELTA_VARINT = 1
+        };
+
+        struct CacheHeader {
+
+            char magic[4];
+            uint32_t version;
+            uint32_t vertexSize;
+            uint32_t meshCount;
+            uint32_t contentFlags;
+            // LibraryStamps, each followed by its name, come right after the header
+            uint32_t libraryCount;
+            uint64_t sourceSize;
+            int64_t sourceMtime;
+            uint64_t sourceHash;
+        };
+
+        // A material library the .obj names, stamped like the source itself since the cache holds its materials
+        struct LibraryStamp {
+
+            uint64_t size;
+            int64_t mtime;
+            uint64_t hash;
+            uint32_t nameLength;
+            // 0 if the library was missing, creating it later makes the cache stale as well
+            uint32_t exists;
+        };
+
+        struct CacheMeshHeader {
+
+            uint32_t vertexCount;
+            uint32_t indexCount;
+            uint32_t vertexCodec;
+            uint32_t indexCodec;
+            uint64_t vertexBytes;
+            uint64_t indexBytes;
+            float ambient[3];
+            float diffuse[3];
+            float specular[3];
+            float boundsMin[3];
+            float boundsMax[3];
+            uint32_t hasMaterial;
+            uint32_t textureNameLengths[3];
+            uint32_t lodCount;
+        };
+
+        // streams are aligned so the mapped pages can be handed to glBufferData as they are
+        const size_t STREAM_ALIGNMENT = 16;
+
+        size_t alignUp(size_t value, size_t alignment) {
+
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        uint64_t hashBytes(const unsigned char* data, size_t size) {
+
+            // FNV-1a
+            uint64_t hash = 14695981039346656037ULL;
+            for (size_t i = 0; i < size; i++) {
+                hash ^= data[i];
+                hash *= 1099511628211ULL;
+            }
+            return hash;
+        }
+
+        bool readSourceStamp(const std::string& fileName, uint64_t& size, int64_t& mtime) {
+
+            std::error_code error;
+            uintmax_t fileSize = std::filesystem::file_size(fileName, error);
+            if (error) {
+                return false;
+            }
+            std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(fileName, error);
+            if (error) {
+                return false;
+            }
+            size = static_cast<uint64_t>(fileSize);
+            mtime = static_cast<int64_t>(writeTime.time_since_epoch().count());
+            return true;
+        }
+
+        bool hashSourceFile(const std::string& fileName, uint64_t& hash) {
+
+            MappedFile source;
+            if (!source.open(fileName)) {
+                return false;
+            }
+            hash = hashBytes(source.data(), source.size());
+            return true;
+        }
+
+        bool isBlank(unsigned char c) {
+
+            return c == ' ' || c == '\t' || c == '\r';
+        }
+
+        // Names of every mtllib statement of an .obj file, in file order without repeats
+        bool findMaterialLibraries(const std::string& objFileName, std::vector<std::string>& libraries) {
+
+            MappedFile source;
+            if (!source.open(objFileName)) {
+                return false;
+            }
+            const unsigned char* p = source.data();
+            const unsigned char* end = p + source.size();
+            while (p < end) {
+
+                const unsigned char* lineEnd = static_cast<const unsigned char*>(std::memchr(p, '\n', end - p));
+                if (!lineEnd) {
+                    lineEnd = end;
+                }
+                while (p < lineEnd && isBlank(*p)) {
+                    p++;
+                }
+                if (lineEnd - p > 6 && std::memcmp(p, "mtllib", 6) == 0 && isBlank(p[6])) {
+                    p += 6;
+                    while (p < lineEnd) {
+                        while (p < lineEnd && isBlank(*p)) {
+                            p++;
+                        }
+                        const unsigned char* nameStart = p;
+                        while (p < lineEnd && !isBlank(*p)) {
+                            p++;
+                        }
+                        std::string name(reinterpret_cast<const char*>(nameStart), p - nameStart);
+                        if (!name.empty() && std::find(libraries.begin(), libraries.end(), name) == libraries.end()) {
+                            libraries.push_back(name);
+                        }
+                    }
+                }
+                p = lineEnd + 1;
+            }
+            return true;
+        }
+
+        void stampLibrary(const std::string& fileName, LibraryStamp& stamp) {
+
+            stamp.exists = readSourceStamp(fileName, stamp.size, stamp.mtime) && hashSourceFile(fileName, stamp.hash) ? 1 : 0;
+            if (!stamp.exists) {
+                stamp.size = 0;
+                stamp.mtime = 0;
+                stamp.hash = 0;
+            }
+        }
+
+        // Whether the library is still the one the cache was built with
+        bool libraryMatches(const std::string& fileName, const LibraryStamp& stamp) {
+
+            uint64_t size;
+            int64_t mtime;
+            bool exists = readSourceStamp(fileName, size, mtime);
+            if (exists != (stamp.exists != 0)) {
+                return false;
+            }
+            if (!exists) {
+                return true;
+            }
+            if (size != stamp.size) {
+                return false;
+            }
+            uint64_t hash;
+            return mtime == stamp.mtime || (hashSourceFile(fileName, hash) && hash == stamp.hash);
+        }
+
+        void writeVarint(std::vector<unsigned char>& out, uint32_t value) {
+
+            while (value >= 0x80) {
+                out.push_back(static_cast<unsigned char>(value | 0x80));
+                value >>= 7;
+            }
+            out.push_back(static_cast<unsigned char>(value));
+        }
+
+        bool readVarint(const unsigned char*& in, const unsigned char* end, uint32_t& value) {
+
+            value = 0;
+            for (int shift = 0; shift < 35; shift += 7) {
+                if (in == end) {
+                    return false;
+                }
+                unsigned char byte = *in++;
+                value |= static_cast<uint32_t>(byte & 0x7f) << shift;
+                if (!(byte & 0x80)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        // Xor-delta + varint over a stream of 32-bit words with a fixed stride
+        std::vector<unsigned char> encodeWords(const uint32_t* words, size_t count, size_t stride) {
+
+            std::vector<unsigned char> out;
+            out.reserve(count * 2);
+            for (size_t i = 0; i < count; i++) {
+                uint32_t previous = (i >= stride) ? words[i - stride] : 0;
+                writeVarint(out, words[i] ^ previous);
+            }
+            return out;
+        }
+
+        bool decodeWords(const unsigned char* in, size_t size, uint32_t* words, size_t count, size_t stride) {
+
+            const unsigned char* end = in + size;
+            for (size_t i = 0; i < count; i++) {
+                uint32_t delta;
+                if (!readVarint(in, end, delta)) {
+                    return false;
+                }
+                uint32_t previous = (i >= stride) ? words[i - stride] : 0;
+                words[i] = delta ^ previous;
+            }
+            return in == end;
+        }
+
+        void writePadding(std::ofstream& out, size_t& offset, size_t alignment) {
+
+            static const char zeros[STREAM_ALIGNMENT] = {};
+            size_t aligned = alignUp(offset, alignment);
+            out.write(zeros, static_cast<std::streamsize>(aligned - offset));
+            offset = aligned;
+        }
+
+        void copyVec3(float* destination, const glm::vec3& source) {
+
+            destination[0] = source.x;
+            destination[1] = source.y;
+            destination[2] = source.z;
+        }
+
+        glm::vec3 toVec3(const float* source) {
+
+            return glm::vec3(source[0], source[1], source[2]);
+        }
+    }
+
+    bool MeshCache::compressionEnabled = false;
+
+    std::string MeshCache::cachePath(const std::string& objFileName) {
+
+        return objFileName + ".gpsmesh";
+    }
+
+    void MeshCache::setCompression(bool enabled) {
+
+        compressionEnabled = enabled;
+    }
+
+    bool MeshCache::write(const std::string& objFileName, const std::string& basePath, const std::vector<MeshData>& meshes, uint32_t contentFlags,
+                          const std::string& cacheFileName) {
+
+        CacheHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        header.version = VERSION;
+        header.vertexSize = sizeof(Vertex);
+        header.meshCount = static_cast<uint32_t>(meshes.size());
+        header.contentFlags = contentFlags;
+
+        std::vector<std::string> libraries;
+        if (!readSourceStamp(objFileName, header.sourceSize, header.sourceMtime) || !hashSourceFile(objFileName, header.sourceHash) ||
+            !findMaterialLibraries(objFileName, libraries)) {
+            return false;
+        }
+        header.libraryCount = static_cast<uint32_t>(libraries.size());
+
+        // write to a temporary file first so a crash never leaves a half-written cache behind
+        std::string fileName = cacheFileName.empty() ? cachePath(objFileName) : cacheFileName;
+        std::string tempFileName = fileName + ".tmp";
+        std::ofstream out(tempFileName, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "WARNING: could not write mesh cache " << fileName << std::endl;
+            return false;
+        }
+
+        size_t offset = 0;
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        offset += sizeof(header);
+
+        for (const std::string& library : libraries) {
+
+            LibraryStamp stamp;
+            std::memset(&stamp, 0, sizeof(stamp));
+            stampLibrary(basePath + library, stamp);
+            stamp.nameLength = static_cast<uint32_t>(library.size());
+            out.write(reinterpret_cast<const char*>(&stamp), sizeof(stamp));
+            out.write(library.data(), static_cast<std::streamsize>(library.size()));
+            offset += sizeof(stamp) + library.size();
+        }
+
+        for (const MeshData& mesh : meshes) {
+
+            const std::string* textureNames[3] = { &mesh.info.ambientTexture, &mesh.info.diffuseTexture, &mesh.info.specularTexture };
+
+            std::vector<unsigned char> vertexStream;
+            std::vector<unsigned char> indexStream;
+
+            CacheMeshHeader meshHeader;
+            std::memset(&meshHeader, 0, sizeof(meshHeader));
+            meshHeader.vertexCount = static_cast<uint32_t>(mesh.vertices.size());
+            meshHeader.indexCount = static_cast<uint32_t>(mesh.indices.size());
+            meshHeader.vertexCodec = compressionEnabled ? CODEC_DELTA_VARINT : CODEC_RAW;
+            meshHeader.indexCodec = compressionEnabled ? CODEC_DELTA_VARINT : CODEC_RAW;
+
+            if (compressionEnabled) {
+                vertexStream = encodeWords(reinterpret_cast<const uint32_t*>(mesh.vertices.data()), mesh.vertices.size() * sizeof(Vertex) / 4, sizeof(Vertex) / 4);
+                indexStream = encodeWords(mesh.indices.data(), mesh.indices.size(), 1);
+                meshHeader.vertexBytes = vertexStream.size();
+                meshHeader.indexBytes = indexStream.size();
+            } else {
+                meshHeader.vertexBytes = mesh.vertices.size() * sizeof(Vertex);
+                meshHeader.indexBytes = mesh.indices.size() * sizeof(GLuint);
+            }
+
+            copyVec3(meshHeader.ambient, mesh.info.material.ambient);
+            copyVec3(meshHeader.diffuse, mesh.info.material.diffuse);
+            copyVec3(meshHeader.specular, mesh.info.material.specular);
+            copyVec3(meshHeader.boundsMin, mesh.info.boundsMin);
+            copyVec3(meshHeader.boundsMax, mesh.info.boundsMax);
+            meshHeader.hasMaterial = mesh.info.hasMaterial ? 1 : 0;
+            for (int t = 0; t < 3; t++) {
+                meshHeader.textureNameLengths[t] = static_cast<uint32_t>(textureNames[t]->size());
+            }
+            meshHeader.lodCount = static_cast<uint32_t>(mesh.info.lods.size());
+
+            out.write(reinterpret_cast<const char*>(&meshHeader), sizeof(meshHeader));
+            offset += sizeof(meshHeader);
+            for (int t = 0; t < 3; t++) {
+                out.write(textureNames[t]->data(), static_cast<std::streamsize>(textureNames[t]->size()));
+                offset += textureNames[t]->size();
+            }
+            out.write(reinterpret_cast<const char*>(mesh.info.lods.data()), static_cast<std::streamsize>(mesh.info.lods.size() * sizeof(MeshLod)));
+            offset += mesh.info.lods.size() * sizeof(MeshLod);
+
+            writePadding(out, offset, STREAM_ALIGNMENT);
+            if (compressionEnabled) {
+                out.write(reinterpret_cast<const char*>(vertexStream.data()), static_cast<std::streamsize>(vertexStream.size()));
+            } else {
+                out.write(reinterpret_cast<const char*>(mesh.vertices.data()), static_cast<std::streamsize>(meshHeader.vertexBytes));
+            }
+            offset += static_cast<size_t>(meshHeader.vertexBytes);
+
+            writePadding(out, offset, STREAM_ALIGNMENT);
+            if (compressionEnabled) {
+                out.write(reinterpret_cast<const char*>(indexStream.data()), static_cast<std::streamsize>(indexStream.size()));
+            } else {
+                out.write(reinterpret_cast<const char*>(mesh.indices.data()), static_cast<std::streamsize>(meshHeader.indexBytes));
+            }
+            offset += static_cast<size_t>(meshHeader.indexBytes);
+            writePadding(out, offset, STREAM_ALIGNMENT);
+        }
+
+        out.close();
+        if (!out) {
+            std::remove(tempFileName.c_str());
+            return false;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tempFileName, fileName, error);
+        if (error) {
+            std::remove(tempFileName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool MeshCache::load(const std::string& objFileName, const std::string& basePath, uint32_t contentFlags, const std::string& cacheFileName) {
+
+        meshes.clear();
+        file.close();
+
+        uint64_t sourceSize;
+        int64_t sourceMtime;
+        if (!readSourceStamp(objFileName, sourceSize, sourceMtime)) {
+            return false;
+        }
+
+        std::string fileName = cacheFileName.empty() ? cachePath(objFileName) : cacheFileName;
+        if (!file.open(fileName)) {
+            return false;
+        }
+
+        const unsigned char* data = file.data();
+        size_t size = file.size();
+
+        CacheHeader header;
+        if (size < sizeof(header)) {
+            file.close();
+            return false;
+        }
+        std::memcpy(&header, data, sizeof(header));
+
+        if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != VERSION || header.vertexSize != sizeof(Vertex) ||
+            header.contentFlags != contentFlags || header.sourceSize != sourceSize) {
+            file.close();
+            return false;
+        }
+
+        // a touched but unchanged source (e.g. after a checkout) still matches by content
+        if (header.sourceMtime != sourceMtime) {
+            uint64_t sourceHash;
+            if (!hashSourceFile(objFileName, sourceHash) || sourceHash != header.sourceHash) {
+                file.close();
+                return false;
+            }
+        }
+
+        // materials and texture names come from the libraries, an edited .mtl makes the cache stale too
+        size_t offset = sizeof(header);
+        bool intact = true;
+        for (uint32_t l = 0; l < header.libraryCount && intact; l++) {
+
+            LibraryStamp stamp;
+            intact = offset + sizeof(stamp) <= size;
+            if (intact) {
+                std::memcpy(&stamp, data + offset, sizeof(stamp));
+                offset += sizeof(stamp);
+                intact = offset + stamp.nameLength <= size;
+            }
+            if (!intact) {
+                break;
+            }
+            std::string library(reinterpret_cast<const char*>(data + offset), stamp.nameLength);
+            offset += stamp.nameLength;
+            if (!libraryMatches(basePath + library, stamp)) {
+                file.close();
+                return false;
+            }
+        }
+        // checked before anything is sized by the file's counts, a corrupt count must not allocate gigabytes
+        intact = intact && header.meshCount <= (size - offset) / sizeof(CacheMeshHeader);
+        if (!intact) {
+            std::cerr << "WARNING: discarding corrupt mesh cache " << fileName << std::endl;
+            file.close();
+            return false;
+        }
+
+        meshes.resize(header.meshCount);
+
+        for (uint32_t m = 0; m < header.meshCount; m++) {
+
+            CacheMeshHeader meshHeader;
+            if (offset + sizeof(meshHeader) > size) {
+                meshes.clear();
+                break;
+            }
+            std::memcpy(&meshHeader, data + offset, sizeof(meshHeader));
+            offset += sizeof(meshHeader);
+
+            CachedMesh& mesh = meshes[m];
+            mesh.info.hasMaterial = meshHeader.hasMaterial != 0;
+            mesh.info.material.ambient = toVec3(meshHeader.ambient);
+            mesh.info.material.diffuse = toVec3(meshHeader.diffuse);
+            mesh.info.material.specular = toVec3(meshHeader.specular);
+            mesh.info.boundsMin = toVec3(meshHeader.boundsMin);
+            mesh.info.boundsMax = toVec3(meshHeader.boundsMax);
+
+            std::string* textureNames[3] = { &mesh.info.ambientTexture, &mesh.info.diffuseTexture, &mesh.info.specularTexture };
+            bool valid = true;
+            for (int t = 0; t < 3 && valid; t++) {
+                size_t length = meshHeader.textureNameLengths[t];
+                valid = offset + length <= size;
+                if (valid) {
+                    textureNames[t]->assign(reinterpret_cast<const char*>(data + offset), length);
+                    offset += length;
+                }
+            }
+
+            size_t lodBytes = meshHeader.lodCount * sizeof(MeshLod);
+            valid = valid && offset + lodBytes <= size;
+            if (valid) {
+                mesh.info.lods.resize(meshHeader.lodCount);
+                std::memcpy(mesh.info.lods.data(), data + offset, lodBytes);
+                offset += lodBytes;
+                for (const MeshLod& lod : mesh.info.lods) {
+                    valid = valid && static_cast<uint64_t>(lod.indexOffset) + lod.indexCount <= meshHeader.indexCount;
+                }
+            }
+
+            valid = valid && meshHeader.vertexBytes <= size && meshHeader.indexBytes <= size;
+            size_t vertexOffset = alignUp(offset, STREAM_ALIGNMENT);
+            size_t indexOffset = alignUp(vertexOffset + static_cast<size_t>(meshHeader.vertexBytes), STREAM_ALIGNMENT);
+            offset = alignUp(indexOffset + static_cast<size_t>(meshHeader.indexBytes), STREAM_ALIGNMENT);
+            if (!valid || indexOffset + meshHeader.indexBytes > size) {
+                meshes.clear();
+                break;
+            }
+
+            mesh.vertexCount = meshHeader.vertexCount;
+            mesh.indexCount = meshHeader.indexCount;
+
+            if (meshHeader.vertexCodec == CODEC_RAW && meshHeader.vertexBytes == meshHeader.vertexCount * sizeof(Vertex)) {
+                mesh.vertices = reinterpret_cast<const Vertex*>(data + vertexOffset);
+            } else if (meshHeader.vertexCodec == CODEC_DELTA_VARINT && mesh.vertexCount * (sizeof(Vertex) / 4) <= meshHeader.vertexBytes) {
+                // every word takes at least one byte, so the counts are bounded by the stream before sizing by them
+                mesh.decodedVertices.resize(mesh.vertexCount);
+                valid = decodeWords(data + vertexOffset, static_cast<size_t>(meshHeader.vertexBytes),
+                    reinterpret_cast<uint32_t*>(mesh.decodedVertices.data()), mesh.vertexCount * sizeof(Vertex) / 4, sizeof(Vertex) / 4);
+                mesh.vertices = mesh.decodedVertices.data();
+            } else {
+                valid = false;
+            }
+
+            if (meshHeader.indexCodec == CODEC_RAW && meshHeader.indexBytes == meshHeader.indexCount * sizeof(GLuint)) {
+                mesh.indices = reinterpret_cast<const GLuint*>(data + indexOffset);
+            } else if (meshHeader.indexCodec == CODEC_DELTA_VARINT && mesh.indexCount <= meshHeader.indexBytes) {
+                mesh.decodedIndices.resize(mesh.indexCount);
+                valid = valid && decodeWords(data + indexOffset, static_cast<size_t>(meshHeader.indexBytes), mesh.decodedIndices.data(), mesh.indexCount, 1);
+                mesh.indices = mesh.decodedIndices.data();
+            } else {
+                valid = false;
+            }
+
+            // the indices go to the optimizer, the meshlet builder and the GPU as they are
+            for (size_t i = 0; valid && i < mesh.indexCount; i++) {
+                valid = mesh.indices[i] < mesh.vertexCount;
+            }
+
+            if (!valid) {
+                meshes.clear();
+                break;
+            }
+        }
+
+        if (meshes.size() != header.meshCount) {
+            std::cerr << "WARNING: discarding corrupt mesh cache " << fileName << std::endl;
+            meshes.clear();
+            file.close();
+            return false;
+        }
+
+        return true;
+    }
+
+    void MeshCache::close() {
+
+        meshes.clear();
+        file.close();
+    }
+
+    const std::vector<CachedMesh>& MeshCache::getMeshes() const {
+
+        return meshes;
+    }
+
+    size_t MeshCache::getFileSize() const {
+
+        return file.size();
+    }
+}
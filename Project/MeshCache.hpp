@@ -0,0 +1,92 @@
+#ifndef MeshCache_hpp
+#define MeshCache_hpp
+
+#include "Mesh.hpp"
+#include "MappedFile.hpp"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Material, texture names and bounds of one mesh - texture names are relative to the model's base path
+    struct MeshInfo {
+
+        bool hasMaterial;
+        Material material;
+        std::string ambientTexture;
+        std::string diffuseTexture;
+        std::string specularTexture;
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        // Index ranges of the detail levels, empty when the mesh has no LOD chain
+        std::vector<MeshLod> lods;
+    };
+
+    // CPU-side mesh as produced by the .obj parser
+    struct MeshData {
+
+        MeshInfo info;
+        std::vector<Vertex> vertices;
+        std::vector<GLuint> indices;
+    };
+
+    // Mesh read back from a cache file - the streams point into the mapping, or into the decoded copies for compressed caches
+    struct CachedMesh {
+
+        MeshInfo info;
+        const Vertex* vertices;
+        size_t vertexCount;
+        const GLuint* indices;
+        size_t indexCount;
+        std::vector<Vertex> decodedVertices;
+        std::vector<GLuint> decodedIndices;
+    };
+
+    // Versioned binary cache of parsed .obj models, stored next to the source file
+    class MeshCache {
+
+    public:
+        static const uint32_t VERSION = 4;
+
+        // Processing applied to the meshes before they were cached, a cache only matches the same flags
+        enum ContentFlags : uint32_t {
+            CONTENT_OPTIMIZED = 1,
+            CONTENT_LODS = 2,
+            CONTENT_MERGED = 4
+        };
+
+        // Cache file name for an .obj file
+        static std::string cachePath(const std::string& objFileName);
+
+        // Caches written from now on use the delta/varint codec instead of raw streams
+        static void setCompression(bool enabled);
+
+        // Writes the cache for an .obj file, stamped with the size, mtime and hash of the source and of every material
+        // library it names (resolved against basePath); cacheFileName replaces cachePath(objFileName) if not empty
+        static bool write(const std::string& objFileName, const std::string& basePath, const std::vector<MeshData>& meshes,
+                          uint32_t contentFlags = 0, const std::string& cacheFileName = "");
+
+        // Maps the cache of an .obj file, fails if it is missing, corrupt, older than the source or its material
+        // libraries, or built with other flags
+        bool load(const std::string& objFileName, const std::string& basePath, uint32_t contentFlags = 0,
+                  const std::string& cacheFileName = "");
+
+        // Unmaps the cache, invalidating the streams of its meshes
+        void close();
+
+        const std::vector<CachedMesh>& getMeshes() const;
+
+        // Size of the mapped cache file
+        size_t getFileSize() const;
+
+    private:
+        MappedFile file;
+        std::vector<CachedMesh> meshes;
+
+        static bool compressionEnabled;
+    };
+}
+
+#endif /* MeshCache_hpp */
@@ -0,0 +1,459 @@
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace gps {
+
+    namespace {
+
+        // Forsyth's scoring model works best with a slightly larger cache than the one it is measured against
+        const int SCORING_CACHE_SIZE = 32;
+        const float CACHE_DECAY_POWER = 1.5f;
+        const float LAST_TRIANGLE_SCORE = 0.75f;
+        const float VALENCE_BOOST_SCALE = 2.0f;
+        const float VALENCE_BOOST_POWER = 0.5f;
+
+        // Resolution of the software rasterizer used for the overdraw statistic
+        const int OVERDRAW_GRID = 256;
+
+        float vertexScore(int cachePosition, unsigned remainingTriangles) {
+
+            if (remainingTriangles == 0) {
+                return -1.0f;
+            }
+
+            float score = 0.0f;
+            if (cachePosition >= 0) {
+                if (cachePosition < 3) {
+                    // the three vertices of the last triangle get a fixed score so it is not reused right away
+                    score = LAST_TRIANGLE_SCORE;
+                } else {
+                    float scaler = 1.0f / (SCORING_CACHE_SIZE - 3);
+                    score = std::pow(1.0f - (cachePosition - 3) * scaler, CACHE_DECAY_POWER);
+                }
+            }
+
+            // vertices with few triangles left are worth finishing off
+            score += VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remainingTriangles), -VALENCE_BOOST_POWER);
+            return score;
+        }
+
+        // FIFO cache simulation shared by the statistics and the overdraw clustering
+        class FifoCache {
+
+        public:
+            explicit FifoCache(size_t vertexCount) : timestamps(vertexCount, 0), time(CACHE_SIZE_FIFO + 1) {
+            }
+
+            void flush() {
+
+                time += CACHE_SIZE_FIFO + 1;
+            }
+
+            // Returns the number of misses caused by the triangle
+            unsigned add(const GLuint* triangle) {
+
+                unsigned misses = 0;
+                for (int k = 0; k < 3; k++) {
+                    GLuint index = triangle[k];
+                    if (time - timestamps[index] > CACHE_SIZE_FIFO) {
+                        timestamps[index] = time++;
+                        misses++;
+                    }
+                }
+                return misses;
+            }
+
+        private:
+            static const size_t CACHE_SIZE_FIFO = MeshOptimizer::CACHE_SIZE;
+            std::vector<size_t> timestamps;
+            size_t time;
+        };
+
+        // Rasterizes the triangles in order with a less-than depth test and counts covered and shaded pixels
+        void rasterizeOverdraw(const std::vector<glm::vec3>& positions, const std::vector<GLuint>& indices,
+                               std::vector<float>& depthBuffer, size_t& covered, size_t& shaded, bool frontFacing) {
+
+            std::fill(depthBuffer.begin(), depthBuffer.end(), FLT_MAX);
+
+            for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+
+                const glm::vec3& a = positions[indices[t + 0]];
+                const glm::vec3& b = positions[indices[t + 1]];
+                const glm::vec3& c = positions[indices[t + 2]];
+
+                float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+                if (area == 0.0f || (area > 0.0f) != frontFacing) {
+                    continue;
+                }
+
+                int minX = std::max(0, static_cast<int>(std::floor(std::min(a.x, std::min(b.x, c.x)))));
+                int maxX = std::min(OVERDRAW_GRID - 1, static_cast<int>(std::ceil(std::max(a.x, std::max(b.x, c.x)))));
+                int minY = std::max(0, static_cast<int>(std::floor(std::min(a.y, std::min(b.y, c.y)))));
+                int maxY = std::min(OVERDRAW_GRID - 1, static_cast<int>(std::ceil(std::max(a.y, std::max(b.y, c.y)))));
+                float inverseArea = 1.0f / area;
+
+                for (int y = minY; y <= maxY; y++) {
+                    for (int x = minX; x <= maxX; x++) {
+
+                        // edge functions at the pixel center, normalized to barycentrics
+                        float px = x + 0.5f;
+                        float py = y + 0.5f;
+                        float w0 = ((c.x - b.x) * (py - b.y) - (c.y - b.y) * (px - b.x)) * inverseArea;
+                        float w1 = ((a.x - c.x) * (py - c.y) - (a.y - c.y) * (px - c.x)) * inverseArea;
+                        float w2 = 1.0f - w0 - w1;
+                        if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) {
+                            continue;
+                        }
+
+                        float z = w0 * a.z + w1 * b.z + w2 * c.z;
+                        float& depth = depthBuffer[y * OVERDRAW_GRID + x];
+                        if (z < depth) {
+                            depth = z;
+                            shaded++;
+                        }
+                    }
+                }
+            }
+
+            for (float depth : depthBuffer) {
+                covered += depth != FLT_MAX ? 1 : 0;
+            }
+        }
+    }
+
+    size_t MeshOptimizer::RemoveDegenerateTriangles(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices) {
+
+        size_t kept = 0;
+        for (size_t t = 0; t + 2 < indices.size(); t += 3) {
+
+            GLuint a = indices[t + 0];
+            GLuint b = indices[t + 1];
+            GLuint c = indices[t + 2];
+            if (a == b || b == c || a == c) {
+                continue;
+            }
+
+            glm::vec3 normal = glm::cross(vertices[b].Position - vertices[a].Position, vertices[c].Position - vertices[a].Position);
+            if (glm::dot(normal, normal) == 0.0f) {
+                continue;
+            }
+
+            indices[kept++] = a;
+            indices[kept++] = b;
+            indices[kept++] = c;
+        }
+
+        size_t removed = (indices.size() - kept) / 3;
+        indices.resize(kept);
+        return removed;
+    }
+
+    void MeshOptimizer::OptimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount) {
+
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0) {
+            return;
+        }
+
+        // vertex -> triangle adjacency, the per-vertex lists shrink as triangles are emitted
+        std::vector<unsigned> remaining(vertexCount, 0);
+        for (size_t i = 0; i < triangleCount * 3; i++) {
+            remaining[indices[i]]++;
+        }
+
+        std::vector<size_t> adjacencyOffsets(vertexCount + 1, 0);
+        for (size_t v = 0; v < vertexCount; v++) {
+            adjacencyOffsets[v + 1] = adjacencyOffsets[v] + remaining[v];
+        }
+
+        std::vector<unsigned> adjacency(triangleCount * 3);
+        std::vector<size_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+        for (size_t t = 0; t < triangleCount; t++) {
+            for (int k = 0; k < 3; k++) {
+                adjacency[fill[indices[t * 3 + k]]++] = static_cast<unsigned>(t);
+            }
+        }
+
+        std::vector<int> cachePositions(vertexCount, -1);
+        std::vector<float> vertexScores(vertexCount);
+        for (size_t v = 0; v < vertexCount; v++) {
+            vertexScores[v] = vertexScore(-1, remaining[v]);
+        }
+
+        std::vector<float> triangleScores(triangleCount);
+        std::vector<bool> emitted(triangleCount, false);
+        for (size_t t = 0; t < triangleCount; t++) {
+            triangleScores[t] = vertexScores[indices[t * 3]] + vertexScores[indices[t * 3 + 1]] + vertexScores[indices[t * 3 + 2]];
+        }
+
+        std::vector<GLuint> result;
+        result.reserve(triangleCount * 3);
+
+        // the cache holds three extra slots for the vertices pushed out by the triangle being added
+        std::vector<GLuint> cache;
+        std::vector<GLuint> newCache;
+        cache.reserve(SCORING_CACHE_SIZE + 3);
+        newCache.reserve(SCORING_CACHE_SIZE + 3);
+
+        size_t bestTriangle = 0;
+        float bestScore = triangleScores[0];
+        for (size_t t = 1; t < triangleCount; t++) {
+            if (triangleScores[t] > bestScore) {
+                bestScore = triangleScores[t];
+                bestTriangle = t;
+            }
+        }
+
+        size_t scanCursor = 0;
+        for (size_t emittedCount = 0; emittedCount < triangleCount; emittedCount++) {
+
+            if (bestScore < 0.0f) {
+                // nothing in the cache has triangles left, continue with the next triangle in input order
+                while (emitted[scanCursor]) {
+                    scanCursor++;
+                }
+                bestTriangle = scanCursor;
+            }
+
+            const GLuint* triangle = &indices[bestTriangle * 3];
+            emitted[bestTriangle] = true;
+            result.insert(result.end(), triangle, triangle + 3);
+
+            // remove the triangle from the adjacency of its vertices
+            for (int k = 0; k < 3; k++) {
+                GLuint v = triangle[k];
+                unsigned* begin = &adjacency[adjacencyOffsets[v]];
+                unsigned* end = begin + remaining[v];
+                unsigned* found = std::find(begin, end, static_cast<unsigned>(bestTriangle));
+                std::swap(*found, *(end - 1));
+                remaining[v]--;
+            }
+
+            // the triangle's vertices move to the front of the LRU cache
+            newCache.assign(triangle, triangle + 3);
+            for (GLuint v : cache) {
+                if (v != triangle[0] && v != triangle[1] && v != triangle[2]) {
+                    newCache.push_back(v);
+                }
+            }
+            cache.swap(newCache);
+
+            for (size_t i = 0; i < cache.size(); i++) {
+                cachePositions[cache[i]] = i < static_cast<size_t>(SCORING_CACHE_SIZE) ? static_cast<int>(i) : -1;
+            }
+
+            // rescore every triangle touching the cache and pick the best one among them
+            bestScore = -1.0f;
+            for (size_t i = 0; i < cache.size(); i++) {
+                GLuint v = cache[i];
+                float score = vertexScore(cachePositions[v], remaining[v]);
+                float delta = score - vertexScores[v];
+                vertexScores[v] = score;
+
+                for (size_t a = adjacencyOffsets[v]; a < adjacencyOffsets[v] + remaining[v]; a++) {
+                    unsigned t = adjacency[a];
+                    triangleScores[t] += delta;
+                    if (triangleScores[t] > bestScore) {
+                        bestScore = triangleScores[t];
+                        bestTriangle = t;
+                    }
+                }
+            }
+
+            if (cache.size() > static_cast<size_t>(SCORING_CACHE_SIZE)) {
+                cache.resize(SCORING_CACHE_SIZE);
+            }
+        }
+
+        indices.swap(result);
+    }
+
+    void MeshOptimizer::OptimizeOverdraw(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices, float threshold) {
+
+        size_t triangleCount = indices.size() / 3;
+        if (triangleCount == 0) {
+            return;
+        }
+
+        FifoCache cache(vertices.size());
+
+        // hard boundaries: triangles that miss on all three vertices start over anyway
+        std::vector<size_t> hardBoundaries;
+        for (size_t t = 0; t < triangleCount; t++) {
+            if (cache.add(&indices[t * 3]) == 3 || t == 0) {
+                hardBoundaries.push_back(t);
+            }
+        }
+        hardBoundaries.push_back(triangleCount);
+
+        // soft boundaries: split a hard cluster as soon as its running ACMR is within threshold of the cluster's
+        std::vector<size_t> clusters;
+        for (size_t h = 0; h + 1 < hardBoundaries.size(); h++) {
+
+            size_t start = hardBoundaries[h];
+            size_t end = hardBoundaries[h + 1];
+
+            cache.flush();
+            size_t clusterMisses = 0;
+            for (size_t t = start; t < end; t++) {
+                clusterMisses += cache.add(&indices[t * 3]);
+            }
+            float clusterThreshold = threshold * static_cast<float>(clusterMisses) / static_cast<float>(end - start);
+
+            clusters.push_back(start);
+            cache.flush();
+            size_t runningMisses = 0;
+            size_t runningTriangles = 0;
+            for (size_t t = start; t < end; t++) {
+                runningMisses += cache.add(&indices[t * 3]);
+                runningTriangles++;
+                if (t + 1 < end && static_cast<float>(runningMisses) / runningTriangles <= clusterThreshold) {
+                    clusters.push_back(t + 1);
+                    cache.flush();
+                    runningMisses = 0;
+                    runningTriangles = 0;
+                }
+            }
+        }
+        clusters.push_back(triangleCount);
+
+        glm::vec3 meshCentroid(0.0f);
+        for (GLuint index : indices) {
+            meshCentroid += vertices[index].Position;
+        }
+        meshCentroid /= static_cast<float>(indices.size());
+
+        // clusters facing away from the mesh center are drawn first, they are the most likely to occlude the rest
+        size_t clusterCount = clusters.size() - 1;
+        std::vector<float> sortKeys(clusterCount);
+        for (size_t c = 0; c < clusterCount; c++) {
+
+            glm::vec3 centroid(0.0f);
+            glm::vec3 normal(0.0f);
+            float totalArea = 0.0f;
+            for (size_t t = clusters[c]; t < clusters[c + 1]; t++) {
+                const glm::vec3& a = vertices[indices[t * 3 + 0]].Position;
+                const glm::vec3& b = vertices[indices[t * 3 + 1]].Position;
+                const glm::vec3& d = vertices[indices[t * 3 + 2]].Position;
+                glm::vec3 areaNormal = glm::cross(b - a, d - a);
+                float area = glm::length(areaNormal);
+                centroid += (a + b + d) * (area / 3.0f);
+                normal += areaNormal;
+                totalArea += area;
+            }
+
+            centroid = totalArea > 0.0f ? centroid / totalArea : meshCentroid;
+            float normalLength = glm::length(normal);
+            normal = normalLength > 0.0f ? normal / normalLength : glm::vec3(0.0f);
+            sortKeys[c] = glm::dot(centroid - meshCentroid, normal);
+        }
+
+        std::vector<size_t> order(clusterCount);
+        for (size_t c = 0; c < clusterCount; c++) {
+            order[c] = c;
+        }
+        std::stable_sort(order.begin(), order.end(), [&sortKeys](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+        std::vector<GLuint> result;
+        result.reserve(indices.size());
+        for (size_t c : order) {
+            result.insert(result.end(), indices.begin() + clusters[c] * 3, indices.begin() + clusters[c + 1] * 3);
+        }
+        indices.swap(result);
+    }
+
+    void MeshOptimizer::OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices) {
+
+        const GLuint UNUSED = 0xffffffffu;
+        std::vector<GLuint> remap(vertices.size(), UNUSED);
+        std::vector<Vertex> reordered;
+        reordered.reserve(vertices.size());
+
+        for (GLuint& index : indices) {
+            if (remap[index] == UNUSED) {
+                remap[index] = static_cast<GLuint>(reordered.size());
+                reordered.push_back(vertices[index]);
+            }
+            index = remap[index];
+        }
+
+        vertices.swap(reordered);
+    }
+
+    MeshStatistics MeshOptimizer::Analyze(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices) {
+
+        MeshStatistics statistics;
+        statistics.triangleCount = indices.size() / 3;
+        statistics.vertexCount = 0;
+        statistics.acmr = 0.0f;
+        statistics.atvr = 0.0f;
+        statistics.overdraw = 0.0f;
+        if (statistics.triangleCount == 0) {
+            return statistics;
+        }
+
+        FifoCache cache(vertices.size());
+        size_t misses = 0;
+        for (size_t t = 0; t < statistics.triangleCount; t++) {
+            misses += cache.add(&indices[t * 3]);
+        }
+
+        std::vector<bool> referenced(vertices.size(), false);
+        for (GLuint index : indices) {
+            if (!referenced[index]) {
+                referenced[index] = true;
+                statistics.vertexCount++;
+            }
+        }
+
+        statistics.acmr = static_cast<float>(misses) / statistics.triangleCount;
+        statistics.atvr = static_cast<float>(misses) / statistics.vertexCount;
+
+        glm::vec3 boundsMin(FLT_MAX);
+        glm::vec3 boundsMax(-FLT_MAX);
+        for (GLuint index : indices) {
+            boundsMin = glm::min(boundsMin, vertices[index].Position);
+            boundsMax = glm::max(boundsMax, vertices[index].Position);
+        }
+        glm::vec3 extent = boundsMax - boundsMin;
+        float scale = std::max(extent.x, std::max(extent.y, extent.z));
+        scale = scale > 0.0f ? (OVERDRAW_GRID - 1) / scale : 0.0f;
+
+        // look down each axis, front and back faces go to separate depth buffers like with culling off both ways
+        std::vector<glm::vec3> projected(vertices.size());
+        std::vector<float> depthBuffer(OVERDRAW_GRID * OVERDRAW_GRID);
+        size_t covered = 0;
+        size_t shaded = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            for (size_t v = 0; v < vertices.size(); v++) {
+                glm::vec3 p = (vertices[v].Position - boundsMin) * scale;
+                projected[v] = glm::vec3(p[(axis + 1) % 3], p[(axis + 2) % 3], p[axis]);
+            }
+            rasterizeOverdraw(projected, indices, depthBuffer, covered, shaded, true);
+            rasterizeOverdraw(projected, indices, depthBuffer, covered, shaded, false);
+        }
+
+        statistics.overdraw = covered > 0 ? static_cast<float>(shaded) / covered : 0.0f;
+        return statistics;
+    }
+
+    size_t MeshOptimizer::Optimize(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, MeshStatistics* before, MeshStatistics* after) {
+
+        if (before) {
+            *before = Analyze(vertices, indices);
+        }
+
+        size_t removed = RemoveDegenerateTriangles(vertices, indices);
+        OptimizeVertexCache(indices, vertices.size());
+        OptimizeOverdraw(vertices, indices);
+        OptimizeVertexFetch(vertices, indices);
+
+        if (after) {
+            *after = Analyze(vertices, indices);
+        }
+        return removed;
+    }
+}
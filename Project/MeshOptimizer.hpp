@@ -0,0 +1,49 @@
+#ifndef MeshOptimizer_hpp
+#define MeshOptimizer_hpp
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Vertex cache, vertex fetch and overdraw figures of an indexed triangle list
+    struct MeshStatistics {
+
+        size_t triangleCount;
+        size_t vertexCount;
+        // post-transform cache misses per triangle (0.5 is ideal for a regular grid, 3 is the worst case)
+        float acmr;
+        // post-transform cache misses per referenced vertex (1 is ideal)
+        float atvr;
+        // shaded pixels per covered pixel with early depth test, averaged over the three axis views (1 is ideal)
+        float overdraw;
+    };
+
+    // CPU passes run on the parsed mesh data before it is uploaded
+    class MeshOptimizer {
+
+    public:
+        // Size of the FIFO post-transform cache the statistics simulate
+        static const size_t CACHE_SIZE = 16;
+
+        // Drops triangles with repeated indices or zero area, returns how many were removed
+        static size_t RemoveDegenerateTriangles(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+
+        // Reorders triangles for the post-transform cache (Forsyth's linear-speed algorithm)
+        static void OptimizeVertexCache(std::vector<GLuint>& indices, size_t vertexCount);
+
+        // Splits the cache-ordered list into clusters and sorts them outside-in, keeping the ACMR within threshold
+        static void OptimizeOverdraw(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices, float threshold = 1.05f);
+
+        // Renumbers vertices in first-use order and drops the unreferenced ones
+        static void OptimizeVertexFetch(std::vector<Vertex>& vertices, std::vector<GLuint>& indices);
+
+        static MeshStatistics Analyze(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices);
+
+        // Runs every pass in order, returns the number of degenerate triangles removed
+        static size_t Optimize(std::vector<Vertex>& vertices, std::vector<GLuint>& indices, MeshStatistics* before = nullptr, MeshStatistics* after = nullptr);
+    };
+}
+
+#endif /* MeshOptimizer_hpp */
@@ -0,0 +1,317 @@
+#include "MeshSimplifier.hpp"
+#include "MeshOptimizer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+
+namespace gps {
+
+    namespace {
+
+        // Symmetric 4x4 plane quadric, upper triangle only
+        struct Quadric {
+
+            double a2, ab, ac, ad;
+            double b2, bc, bd;
+            double c2, cd;
+            double d2;
+        };
+
+        void addPlane(Quadric& q, double a, double b, double c, double d) {
+
+            q.a2 += a * a; q.ab += a * b; q.ac += a * c; q.ad += a * d;
+            q.b2 += b * b; q.bc += b * c; q.bd += b * d;
+            q.c2 += c * c; q.cd += c * d;
+            q.d2 += d * d;
+        }
+
+        void addQuadric(Quadric& q, const Quadric& other) {
+
+            q.a2 += other.a2; q.ab += other.ab; q.ac += other.ac; q.ad += other.ad;
+            q.b2 += other.b2; q.bc += other.bc; q.bd += other.bd;
+            q.c2 += other.c2; q.cd += other.cd;
+            q.d2 += other.d2;
+        }
+
+        // Sum of squared distances from p to the accumulated planes
+        double quadricError(const Quadric& q, const glm::vec3& p) {
+
+            double x = p.x, y = p.y, z = p.z;
+            double error = q.a2 * x * x + 2.0 * q.ab * x * y + 2.0 * q.ac * x * z + 2.0 * q.ad * x
+                         + q.b2 * y * y + 2.0 * q.bc * y * z + 2.0 * q.bd * y
+                         + q.c2 * z * z + 2.0 * q.cd * z
+                         + q.d2;
+            return std::max(error, 0.0);
+        }
+
+        struct PositionHash {
+
+            size_t operator()(const glm::vec3& p) const {
+
+                uint32_t bits[3];
+                std::memcpy(bits, &p, sizeof(bits));
+                return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+            }
+        };
+
+        struct PositionEqual {
+
+            bool operator()(const glm::vec3& a, const glm::vec3& b) const {
+
+                return a.x == b.x && a.y == b.y && a.z == b.z;
+            }
+        };
+
+        struct Collapse {
+
+            GLuint from;
+            GLuint to;
+            double cost;
+        };
+
+        glm::vec3 triangleNormal(const glm::vec3& a, const glm::vec3& b, const glm::vec3& c) {
+
+            return glm::cross(b - a, c - a);
+        }
+    }
+
+    std::vector<GLuint> MeshSimplifier::Simplify(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+                                                 size_t targetIndexCount, float& error) {
+
+        std::vector<GLuint> result = indices;
+        double maxCost = 0.0;
+        size_t vertexCount = vertices.size();
+
+        // split vertices (same position, different normal or UV) would tear the surface if moved apart
+        std::vector<bool> locked(vertexCount, false);
+        std::unordered_map<glm::vec3, GLuint, PositionHash, PositionEqual> positionUses;
+        for (size_t v = 0; v < vertexCount; v++) {
+            positionUses[vertices[v].Position]++;
+        }
+        for (size_t v = 0; v < vertexCount; v++) {
+            locked[v] = positionUses[vertices[v].Position] > 1;
+        }
+
+        // open borders and non-manifold edges keep their vertices as well
+        std::unordered_map<uint64_t, int> edgeUses;
+        for (size_t t = 0; t + 2 < result.size(); t += 3) {
+            for (int k = 0; k < 3; k++) {
+                GLuint a = result[t + k];
+                GLuint b = result[t + (k + 1) % 3];
+                uint64_t key = (static_cast<uint64_t>(std::min(a, b)) << 32) | std::max(a, b);
+                edgeUses[key]++;
+            }
+        }
+        for (const auto& edge : edgeUses) {
+            if (edge.second != 2) {
+                locked[static_cast<GLuint>(edge.first >> 32)] = true;
+                locked[static_cast<GLuint>(edge.first & 0xffffffffu)] = true;
+            }
+        }
+
+        std::vector<Quadric> quadrics(vertexCount);
+        std::memset(quadrics.data(), 0, quadrics.size() * sizeof(Quadric));
+        for (size_t t = 0; t + 2 < result.size(); t += 3) {
+            const glm::vec3& a = vertices[result[t + 0]].Position;
+            const glm::vec3& b = vertices[result[t + 1]].Position;
+            const glm::vec3& c = vertices[result[t + 2]].Position;
+            glm::vec3 normal = triangleNormal(a, b, c);
+            float length = glm::length(normal);
+            if (length == 0.0f) {
+                continue;
+            }
+            normal /= length;
+            double d = -glm::dot(normal, a);
+            for (int k = 0; k < 3; k++) {
+                addPlane(quadrics[result[t + k]], normal.x, normal.y, normal.z, d);
+            }
+        }
+
+        std::vector<GLuint> remap(vertexCount);
+        std::vector<bool> touched(vertexCount);
+        std::vector<size_t> adjacencyOffsets(vertexCount + 1);
+        std::vector<GLuint> adjacency;
+        std::vector<Collapse> collapses;
+        std::vector<GLuint> fromNeighbours;
+
+        // every pass collapses a batch of independent cheapest edges, then rewrites the index list
+        while (result.size() > targetIndexCount) {
+
+            size_t triangleCount = result.size() / 3;
+
+            std::fill(adjacencyOffsets.begin(), adjacencyOffsets.end(), 0);
+            for (GLuint index : result) {
+                adjacencyOffsets[index + 1]++;
+            }
+            for (size_t v = 0; v < vertexCount; v++) {
+                adjacencyOffsets[v + 1] += adjacencyOffsets[v];
+            }
+            adjacency.resize(result.size());
+            std::vector<size_t> fill(adjacencyOffsets.begin(), adjacencyOffsets.end() - 1);
+            for (size_t t = 0; t < triangleCount; t++) {
+                for (int k = 0; k < 3; k++) {
+                    adjacency[fill[result[t * 3 + k]]++] = static_cast<GLuint>(t);
+                }
+            }
+
+            collapses.clear();
+            for (size_t t = 0; t < triangleCount; t++) {
+                for (int k = 0; k < 3; k++) {
+                    GLuint a = result[t * 3 + k];
+                    GLuint b = result[t * 3 + (k + 1) % 3];
+                    Quadric merged = quadrics[a];
+                    addQuadric(merged, quadrics[b]);
+                    if (!locked[a]) {
+                        collapses.push_back({ a, b, quadricError(merged, vertices[b].Position) });
+                    }
+                    if (!locked[b]) {
+                        collapses.push_back({ b, a, quadricError(merged, vertices[a].Position) });
+                    }
+                }
+            }
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+            for (size_t v = 0; v < vertexCount; v++) {
+                remap[v] = static_cast<GLuint>(v);
+            }
+            std::fill(touched.begin(), touched.end(), false);
+
+            size_t trianglesToRemove = (result.size() - targetIndexCount + 2) / 3;
+            size_t removedTriangles = 0;
+            size_t collapseCount = 0;
+
+            for (const Collapse& collapse : collapses) {
+
+                if (removedTriangles >= trianglesToRemove) {
+                    break;
+                }
+                if (touched[collapse.from] || touched[collapse.to]) {
+                    continue;
+                }
+
+                // link condition: the edge may share at most the two opposite vertices, otherwise the surface folds
+                fromNeighbours.clear();
+                GLuint opposite[2] = { collapse.from, collapse.from };
+                size_t edgeTriangles = 0;
+                bool flips = false;
+                for (size_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1] && !flips; a++) {
+                    const GLuint* triangle = &result[adjacency[a] * 3];
+                    bool hasTo = triangle[0] == collapse.to || triangle[1] == collapse.to || triangle[2] == collapse.to;
+                    if (hasTo) {
+                        for (int k = 0; k < 3; k++) {
+                            if (triangle[k] != collapse.from && triangle[k] != collapse.to && edgeTriangles < 2) {
+                                opposite[edgeTriangles] = triangle[k];
+                            }
+                        }
+                        edgeTriangles++;
+                        continue;
+                    }
+                    fromNeighbours.insert(fromNeighbours.end(), triangle, triangle + 3);
+
+                    // moving the vertex must not turn any remaining triangle around
+                    glm::vec3 corners[3];
+                    glm::vec3 moved[3];
+                    for (int k = 0; k < 3; k++) {
+                        corners[k] = vertices[triangle[k]].Position;
+                        moved[k] = triangle[k] == collapse.from ? vertices[collapse.to].Position : corners[k];
+                    }
+                    glm::vec3 before = triangleNormal(corners[0], corners[1], corners[2]);
+                    glm::vec3 after = triangleNormal(moved[0], moved[1], moved[2]);
+                    flips = glm::dot(before, after) <= 0.0f;
+                }
+                if (flips || edgeTriangles == 0) {
+                    continue;
+                }
+
+                std::sort(fromNeighbours.begin(), fromNeighbours.end());
+                fromNeighbours.erase(std::unique(fromNeighbours.begin(), fromNeighbours.end()), fromNeighbours.end());
+                size_t sharedNeighbours = 0;
+                for (size_t a = adjacencyOffsets[collapse.to]; a < adjacencyOffsets[collapse.to + 1]; a++) {
+                    const GLuint* triangle = &result[adjacency[a] * 3];
+                    bool hasFrom = triangle[0] == collapse.from || triangle[1] == collapse.from || triangle[2] == collapse.from;
+                    if (hasFrom) {
+                        continue;
+                    }
+                    for (int k = 0; k < 3; k++) {
+                        if (triangle[k] != collapse.to && triangle[k] != opposite[0] && triangle[k] != opposite[1] &&
+                            std::binary_search(fromNeighbours.begin(), fromNeighbours.end(), triangle[k])) {
+                            sharedNeighbours++;
+                        }
+                    }
+                }
+                if (sharedNeighbours > 0) {
+                    continue;
+                }
+
+                remap[collapse.from] = collapse.to;
+                addQuadric(quadrics[collapse.to], quadrics[collapse.from]);
+                maxCost = std::max(maxCost, collapse.cost);
+                removedTriangles += edgeTriangles;
+                collapseCount++;
+
+                // keep the whole one-ring stable for the rest of this pass
+                for (size_t a = adjacencyOffsets[collapse.from]; a < adjacencyOffsets[collapse.from + 1]; a++) {
+                    const GLuint* triangle = &result[adjacency[a] * 3];
+                    for (int k = 0; k < 3; k++) {
+                        touched[triangle[k]] = true;
+                    }
+                }
+            }
+
+            if (collapseCount == 0) {
+                break;
+            }
+
+            size_t kept = 0;
+            for (size_t t = 0; t < triangleCount; t++) {
+                GLuint a = remap[result[t * 3 + 0]];
+                GLuint b = remap[result[t * 3 + 1]];
+                GLuint c = remap[result[t * 3 + 2]];
+                if (a != b && b != c && a != c) {
+                    result[kept++] = a;
+                    result[kept++] = b;
+                    result[kept++] = c;
+                }
+            }
+            result.resize(kept);
+        }
+
+        error = static_cast<float>(std::sqrt(maxCost));
+        return result;
+    }
+
+    void MeshSimplifier::BuildLodChain(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices, std::vector<MeshLod>& lods,
+                                       bool optimizeCache) {
+
+        lods.clear();
+        lods.push_back({ 0, static_cast<GLuint>(indices.size()), 0.0f });
+
+        std::vector<GLuint> current(indices.begin(), indices.end());
+        float error = 0.0f;
+
+        while (lods.size() < MAX_LODS && current.size() / 3 >= MIN_LOD_TRIANGLES) {
+
+            float levelError;
+            size_t target = current.size() / 6 * 3;
+            std::vector<GLuint> next = Simplify(vertices, current, target, levelError);
+
+            // mostly locked seams and borders, another level would look the same
+            if (next.size() * 5 > current.size() * 4) {
+                break;
+            }
+
+            if (optimizeCache) {
+                MeshOptimizer::OptimizeVertexCache(next, vertices.size());
+            }
+
+            // each level is measured against the previous one, so the distances add up
+            error += levelError;
+            lods.push_back({ static_cast<GLuint>(indices.size()), static_cast<GLuint>(next.size()), error });
+            indices.insert(indices.end(), next.begin(), next.end());
+            current.swap(next);
+        }
+    }
+}
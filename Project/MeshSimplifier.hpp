@@ -0,0 +1,32 @@
+#ifndef MeshSimplifier_hpp
+#define MeshSimplifier_hpp
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Quadric-error edge collapse over a fixed vertex buffer - simplified levels only index existing vertices,
+    // so every LOD of a mesh shares one VBO
+    class MeshSimplifier {
+
+    public:
+        // Each level aims for half the triangles of the previous one
+        static const size_t MAX_LODS = 5;
+        // Meshes this small are not worth another level
+        static const size_t MIN_LOD_TRIANGLES = 64;
+
+        // Collapses edges until at most targetIndexCount indices are left or nothing can collapse any more.
+        // error receives the largest collapse error in model units. Vertices on borders and attribute seams stay put.
+        static std::vector<GLuint> Simplify(const std::vector<Vertex>& vertices, const std::vector<GLuint>& indices,
+                                            size_t targetIndexCount, float& error);
+
+        // Appends the simplified levels to indices and describes every level, the full mesh included, in lods.
+        // optimizeCache reorders each new level for the post-transform cache as well.
+        static void BuildLodChain(const std::vector<Vertex>& vertices, std::vector<GLuint>& indices, std::vector<MeshLod>& lods,
+                                  bool optimizeCache);
+    };
+}
+
+#endif /* MeshSimplifier_hpp */
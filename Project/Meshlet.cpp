@@ -0,0 +1,150 @@
+#include "Meshlet.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace gps {
+
+    namespace {
+
+        void finishMeshlet(const Vertex* vertices, const GLuint* indices, Meshlet& meshlet) {
+
+            const GLuint* first = indices + meshlet.indexOffset;
+            size_t indexCount = meshlet.triangleCount * 3;
+
+            glm::vec3 boundsMin(FLT_MAX);
+            glm::vec3 boundsMax(-FLT_MAX);
+            for (size_t i = 0; i < indexCount; i++) {
+                boundsMin = glm::min(boundsMin, vertices[first[i]].Position);
+                boundsMax = glm::max(boundsMax, vertices[first[i]].Position);
+            }
+            meshlet.center = (boundsMin + boundsMax) * 0.5f;
+            meshlet.radius = 0.0f;
+            for (size_t i = 0; i < indexCount; i++) {
+                meshlet.radius = std::max(meshlet.radius, glm::length(vertices[first[i]].Position - meshlet.center));
+            }
+
+            std::vector<glm::vec3> normals;
+            normals.reserve(meshlet.triangleCount);
+            glm::vec3 axis(0.0f);
+            for (size_t i = 0; i < indexCount; i += 3) {
+                const glm::vec3& a = vertices[first[i + 0]].Position;
+                const glm::vec3& b = vertices[first[i + 1]].Position;
+                const glm::vec3& c = vertices[first[i + 2]].Position;
+                glm::vec3 normal = glm::cross(b - a, c - a);
+                float length = glm::length(normal);
+                if (length > 0.0f) {
+                    normals.push_back(normal / length);
+                    axis += normal / length;
+                }
+            }
+
+            // the cone only culls when every normal lies within 90 degrees of the axis
+            float axisLength = glm::length(axis);
+            meshlet.coneAxis = axisLength > 0.0f ? axis / axisLength : glm::vec3(0.0f, 0.0f, 1.0f);
+            float minDot = axisLength > 0.0f ? 1.0f : -1.0f;
+            for (const glm::vec3& normal : normals) {
+                minDot = std::min(minDot, glm::dot(normal, meshlet.coneAxis));
+            }
+            meshlet.coneCutoff = minDot > 0.0f ? std::sqrt(1.0f - minDot * minDot) : 1.0f;
+        }
+    }
+
+    void MeshletBuilder::Build(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount, std::vector<Meshlet>& meshlets) {
+
+        meshlets.clear();
+        if (indexCount < 3) {
+            return;
+        }
+
+        // stamps each vertex with the last meshlet that used it
+        std::vector<GLuint> usedBy(vertexCount, 0xffffffffu);
+        GLuint meshletId = 0;
+
+        Meshlet current = Meshlet();
+        for (size_t t = 0; t + 2 < indexCount; t += 3) {
+
+            const GLuint* triangle = indices + t;
+            size_t newVertices = 0;
+            for (int k = 0; k < 3; k++) {
+                bool repeated = (k > 0 && triangle[k] == triangle[0]) || (k > 1 && triangle[k] == triangle[1]);
+                if (usedBy[triangle[k]] != meshletId && !repeated) {
+                    newVertices++;
+                }
+            }
+
+            if (current.triangleCount > 0 && (current.vertexCount + newVertices > MAX_VERTICES || current.triangleCount + 1 > MAX_TRIANGLES)) {
+                finishMeshlet(vertices, indices, current);
+                meshlets.push_back(current);
+
+                meshletId++;
+                current = Meshlet();
+                current.indexOffset = static_cast<GLuint>(t);
+                newVertices = 3 - ((triangle[1] == triangle[0]) + (triangle[2] == triangle[0] || triangle[2] == triangle[1]));
+            }
+
+            for (int k = 0; k < 3; k++) {
+                usedBy[triangle[k]] = meshletId;
+            }
+            current.vertexCount += static_cast<GLuint>(newVertices);
+            current.triangleCount++;
+        }
+
+        finishMeshlet(vertices, indices, current);
+        meshlets.push_back(current);
+    }
+
+    ClusterCuller::ClusterCuller(const glm::mat4& viewProjection, const glm::mat4& modelMatrix, const glm::vec3& cameraPosition, bool coneCulling)
+        : coneCulling(coneCulling) {
+
+        // Gribb-Hartmann: rows of the combined matrix give the clip planes in model space
+        glm::mat4 matrix = viewProjection * modelMatrix;
+        glm::vec4 rows[4];
+        for (int r = 0; r < 4; r++) {
+            rows[r] = glm::vec4(matrix[0][r], matrix[1][r], matrix[2][r], matrix[3][r]);
+        }
+        planes[0] = rows[3] + rows[0];
+        planes[1] = rows[3] - rows[0];
+        planes[2] = rows[3] + rows[1];
+        planes[3] = rows[3] - rows[1];
+        planes[4] = rows[3] + rows[2];
+        planes[5] = rows[3] - rows[2];
+        for (glm::vec4& plane : planes) {
+            float length = glm::length(glm::vec3(plane));
+            plane = length > 0.0f ? plane / length : plane;
+        }
+
+        eye = glm::vec3(glm::inverse(modelMatrix) * glm::vec4(cameraPosition, 1.0f));
+    }
+
+    void ClusterCuller::Cull(const std::vector<Meshlet>& meshlets, std::vector<GLuint>& visible, ClusterCullStats& stats) const {
+
+        for (size_t m = 0; m < meshlets.size(); m++) {
+
+            const Meshlet& meshlet = meshlets[m];
+            stats.tested++;
+
+            bool outside = false;
+            for (int p = 0; p < 6 && !outside; p++) {
+                outside = glm::dot(glm::vec3(planes[p]), meshlet.center) + planes[p].w < -meshlet.radius;
+            }
+            if (outside) {
+                stats.frustumCulled++;
+                continue;
+            }
+
+            // every triangle faces away when the view direction lies inside the cone's back-facing region
+            if (coneCulling) {
+                glm::vec3 toCenter = meshlet.center - eye;
+                if (glm::dot(toCenter, meshlet.coneAxis) >= meshlet.coneCutoff * glm::length(toCenter) + meshlet.radius) {
+                    stats.backfaceCulled++;
+                    continue;
+                }
+            }
+
+            stats.drawn++;
+            visible.push_back(static_cast<GLuint>(m));
+        }
+    }
+}
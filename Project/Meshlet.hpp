@@ -0,0 +1,47 @@
+#ifndef Meshlet_hpp
+#define Meshlet_hpp
+
+#include "Mesh.hpp"
+
+#include <vector>
+
+namespace gps {
+
+    // Clusters culled by each test since the last reset
+    struct ClusterCullStats {
+
+        size_t tested;
+        size_t frustumCulled;
+        size_t backfaceCulled;
+        size_t drawn;
+    };
+
+    // Splits index ranges into meshlets
+    class MeshletBuilder {
+
+    public:
+        static const size_t MAX_VERTICES = 64;
+        static const size_t MAX_TRIANGLES = 124;
+
+        // Scans the triangles in order, so every meshlet stays a contiguous range of the index buffer
+        static void Build(const Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount, std::vector<Meshlet>& meshlets);
+    };
+
+    // Frustum and normal cone tests for the meshlets of one model placement, done in model space
+    class ClusterCuller {
+
+    public:
+        // viewProjection * modelMatrix gives the model-space frustum planes, coneCulling needs the camera position
+        ClusterCuller(const glm::mat4& viewProjection, const glm::mat4& modelMatrix, const glm::vec3& cameraPosition, bool coneCulling);
+
+        // Appends the indices of the meshlets that may be visible and counts the rejects in stats
+        void Cull(const std::vector<Meshlet>& meshlets, std::vector<GLuint>& visible, ClusterCullStats& stats) const;
+
+    private:
+        glm::vec4 planes[6];
+        glm::vec3 eye;
+        bool coneCulling;
+    };
+}
+
+#endif /* Meshlet_hpp */
@@ -1,27 +1,1197 @@
 #include "Model3D.hpp"
+#include "AsyncLoader.hpp"
+#include "MeshSimplifier.hpp"
+#include "LoadProfiler.hpp"
+#include "Meshlet.hpp"
+#include "ObjStreamer.hpp"
+#include "ObjectBuffer.hpp"
+#include "TextureAllocator.hpp"
+#include "TextureCache.hpp"
+#include "TextureStreamer.hpp"
+#include "TextureUploader.hpp"
+#include "VertexQuantizer.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdio>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <thread>
+#include <unordered_map>
 
 namespace gps {
 
+	// Registry key of a mesh's streams and LOD table
+	static uint64_t hashMeshContent(const gps::Vertex* vertices, size_t vertexCount, const GLuint* indices, size_t indexCount,
+		const std::vector<gps::MeshLod>& lods) {
+
+		uint64_t hash = gps::ResourceRegistry::hashBytes(vertices, vertexCount * sizeof(gps::Vertex));
+		hash = gps::ResourceRegistry::hashBytes(indices, indexCount * sizeof(GLuint), hash);
+		return gps::ResourceRegistry::hashBytes(lods.data(), lods.size() * sizeof(gps::MeshLod), hash);
+	}
+
+	// Whether an image is already on the GPU, as a texture of its own or as a material table layer
+	static bool isTextureResident(uint64_t contentHash) {
+
+		return gps::ResourceRegistry::instance().hasTexture(contentHash) ||
+			(gps::MaterialTable::isEnabled() && gps::MaterialTable::instance().hasLayer(contentHash));
+	}
+
+	// Hashes a (position, normal, texcoord) index triple so identical face corners can be welded
+	struct IndexTripleHash {
+
+		size_t operator()(const tinyobj::index_t& idx) const {
+
+			size_t h = std::hash<int>()(idx.vertex_index);
+			h ^= std::hash<int>()(idx.normal_index) + 0x9e3779b9 + (h << 6) + (h >> 2);
+			h ^= std::hash<int>()(idx.texcoord_index) + 0x9e3779b9 + (h << 6) + (h >> 2);
+			return h;
+		}
+	};
+
+	struct IndexTripleEqual {
+
+		bool operator()(const tinyobj::index_t& a, const tinyobj::index_t& b) const {
+
+			return a.vertex_index == b.vertex_index && a.normal_index == b.normal_index && a.texcoord_index == b.texcoord_index;
+		}
+	};
+
+	gps::LockFreeQueue<Model3D*> Model3D::parsedModels(256);
+	std::deque<Model3D*> Model3D::uploadQueue;
+	std::atomic<int> Model3D::asyncLoadsInFlight(0);
+	bool Model3D::meshOptimization = false;
+	bool Model3D::lodGeneration = true;
+	bool Model3D::materialMerging = false;
+	size_t Model3D::streamingBudget = 0;
+	bool Model3D::asyncTextureUploads = true;
+	std::atomic<bool> Model3D::streamingCancelled(false);
+	const double Model3D::LOD_FADE_SECONDS = 0.3;
+
+	ModelLoadHandle::ModelLoadHandle() : state(std::make_shared<std::atomic<int> >(MODEL_EMPTY)) {
+	}
+
+	ModelLoadState ModelLoadHandle::getState() const {
+
+		return (ModelLoadState)state->load(std::memory_order_acquire);
+	}
+
+	bool ModelLoadHandle::isResident() const {
+
+		return getState() == MODEL_RESIDENT;
+	}
+
+	bool ModelLoadHandle::hasFailed() const {
+
+		return getState() == MODEL_FAILED;
+	}
+
+	Model3D::Model3D() : textureBytes(0), cpuDataPolicy(gps::RELEASE_CPU_DATA), uploadedMeshes(0), boundsMin(0.0f), boundsMax(0.0f),
+		loadState(std::make_shared<std::atomic<int> >(MODEL_EMPTY)), asyncLoad(false), streamedImport(false) {
+	}
+
+	void Model3D::SetCpuDataPolicy(gps::CpuDataPolicy policy) {
+
+		cpuDataPolicy = policy;
+	}
+
+	ModelMemoryUsage Model3D::GetMemoryUsage() const {
+
+		ModelMemoryUsage usage = { 0, 0, textureBytes, 0 };
+		for (const gps::MeshRef& mesh : meshes) {
+
+			usage.vertexBytes += mesh->getVertexBufferSize();
+			usage.indexBytes += mesh->getIndexBufferSize();
+			usage.cpuBytes += mesh->getCpuSize();
+		}
+		for (const gps::MeshData& mesh : pendingMeshData) {
+
+			usage.cpuBytes += mesh.vertices.capacity() * sizeof(gps::Vertex) + mesh.indices.capacity() * sizeof(GLuint);
+		}
+		for (const gps::DecodedTexture& texture : pendingTextures) {
+
+			usage.cpuBytes += texture.pixels ? gps::BlockCompressor::ChainSize(texture.format, texture.width, texture.height, texture.levels) : 0;
+		}
+		return usage;
+	}
+
+	void Model3D::PrintMemoryReport(const std::string& name) const {
+
+		ModelMemoryUsage usage = GetMemoryUsage();
+		size_t gpuBytes = usage.vertexBytes + usage.indexBytes + usage.textureBytes;
+		printf("%-16s GPU %8.1f KB (vertices %.1f, indices %.1f, textures %.1f)  CPU %8.1f KB\n", name.c_str(),
+			gpuBytes / 1024.0, usage.vertexBytes / 1024.0, usage.indexBytes / 1024.0, usage.textureBytes / 1024.0, usage.cpuBytes / 1024.0);
+	}
+
 	void Model3D::LoadModel(std::string fileName) {
 
-        std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
-		ReadOBJ(fileName, basePath);
+        std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+		LoadModel(fileName, basePath);
+	}
+
+    void Model3D::LoadModel(std::string fileName, std::string basePath)	{
+
+		asyncLoad = false;
+		if (!ParseModel(fileName, basePath)) {
+
+			exit(1);
+		}
+		UploadModel();
+	}
+
+	bool Model3D::ParseModel(std::string fileName) {
+
+        std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+		return ParseModel(fileName, basePath);
+	}
+
+	bool Model3D::ParseModel(std::string fileName, std::string basePath) {
+
+		pendingBasePath = basePath;
+		pendingFileName = fileName;
+		streamedImport = false;
+
+		uint32_t contentFlags = (meshOptimization ? static_cast<uint32_t>(gps::MeshCache::CONTENT_OPTIMIZED) : 0u) |
+			(lodGeneration ? static_cast<uint32_t>(gps::MeshCache::CONTENT_LODS) : 0u) |
+			(materialMerging ? static_cast<uint32_t>(gps::MeshCache::CONTENT_MERGED) : 0u);
+
+		// the binary cache skips the text parse entirely when it is still up to date
+		bool cached;
+		{
+			gps::LoadScope scope(fileName, gps::STAGE_FILE_IO);
+			cached = pendingCache.load(fileName, basePath, contentFlags);
+		}
+
+		if (cached) {
+
+			gps::LoadProfiler::instance().addBytesRead(fileName, pendingCache.getFileSize());
+			std::cout << "Loading : " << fileName << " (cached)" << std::endl;
+		}
+		else if (streamingBudget > 0) {
+
+			return StreamOBJ(fileName, basePath);
+		}
+		else {
+
+			if (!ReadOBJ(fileName, basePath, pendingMeshData)) {
+
+				return false;
+			}
+
+			{
+				gps::LoadScope scope(fileName, gps::STAGE_MESH_PROCESSING);
+
+				if (meshOptimization) {
+
+					OptimizeMeshes(pendingMeshData);
+				}
+
+				if (lodGeneration) {
+
+					GenerateLods(pendingMeshData);
+				}
+
+				// after the per-shape passes, so each shape keeps its own cache order and simplification
+				if (materialMerging) {
+
+					MergeMeshesByMaterial(pendingMeshData);
+				}
+			}
+
+			gps::LoadScope scope(fileName, gps::STAGE_FILE_IO);
+			if (!gps::MeshCache::write(fileName, basePath, pendingMeshData, contentFlags)) {
+
+				std::cerr << "WARNING: could not cache " << fileName << std::endl;
+			}
+		}
+
+		// decode the textures here as well so the GL thread only has to upload them
+		std::vector<const gps::MeshInfo*> infos;
+		for (const gps::CachedMesh& mesh : pendingCache.getMeshes())
+			infos.push_back(&mesh.info);
+		for (const gps::MeshData& mesh : pendingMeshData)
+			infos.push_back(&mesh.info);
+
+		std::cout << fileName << " : " << infos.size() << " draw calls" << std::endl;
+
+		// meshlets cover the full-detail level only, they are cheap enough to rebuild on every load
+		std::unique_ptr<gps::LoadScope> processingScope(new gps::LoadScope(fileName, gps::STAGE_MESH_PROCESSING));
+		pendingMeshlets.clear();
+		for (const gps::CachedMesh& mesh : pendingCache.getMeshes()) {
+
+			size_t fullDetailCount = mesh.info.lods.empty() ? mesh.indexCount : mesh.info.lods[0].indexCount;
+			pendingMeshlets.push_back(std::vector<gps::Meshlet>());
+			gps::MeshletBuilder::Build(mesh.vertices, mesh.vertexCount, mesh.indices, fullDetailCount, pendingMeshlets.back());
+		}
+		for (const gps::MeshData& mesh : pendingMeshData) {
+
+			size_t fullDetailCount = mesh.info.lods.empty() ? mesh.indices.size() : mesh.info.lods[0].indexCount;
+			pendingMeshlets.push_back(std::vector<gps::Meshlet>());
+			gps::MeshletBuilder::Build(mesh.vertices.data(), mesh.vertices.size(), mesh.indices.data(), fullDetailCount, pendingMeshlets.back());
+		}
+
+		pendingMeshHashes.clear();
+		for (const gps::CachedMesh& mesh : pendingCache.getMeshes())
+			pendingMeshHashes.push_back(hashMeshContent(mesh.vertices, mesh.vertexCount, mesh.indices, mesh.indexCount, mesh.info.lods));
+		for (const gps::MeshData& mesh : pendingMeshData)
+			pendingMeshHashes.push_back(hashMeshContent(mesh.vertices.data(), mesh.vertices.size(), mesh.indices.data(), mesh.indices.size(), mesh.info.lods));
+		processingScope.reset();
+
+		boundsMin = glm::vec3(FLT_MAX);
+		boundsMax = glm::vec3(-FLT_MAX);
+		for (const gps::MeshInfo* info : infos) {
+
+			boundsMin = glm::min(boundsMin, info->boundsMin);
+			boundsMax = glm::max(boundsMax, info->boundsMax);
+		}
+		if (infos.empty()) {
+
+			boundsMin = boundsMax = glm::vec3(0.0f);
+		}
+
+		// a model level is as coarse as its coarsest mesh at that level, meshes with shorter chains repeat their last level
+		lodErrors.assign(1, 0.0f);
+		for (const gps::MeshInfo* info : infos) {
+
+			if (info->lods.size() > lodErrors.size())
+				lodErrors.resize(info->lods.size(), 0.0f);
+		}
+		for (const gps::MeshInfo* info : infos) {
+
+			for (size_t l = 0; l < lodErrors.size() && !info->lods.empty(); l++)
+				lodErrors[l] = std::max(lodErrors[l], info->lods[std::min(l, info->lods.size() - 1)].error);
+		}
+
+		for (const gps::MeshInfo* info : infos) {
+
+			const std::string* names[3] = { &info->ambientTexture, &info->diffuseTexture, &info->specularTexture };
+			for (const std::string* name : names) {
+
+				if (name->empty() || FindPendingTexture(basePath + *name) != nullptr)
+					continue;
+
+				// images another model already uploaded are only hashed
+				pendingTextures.push_back(DecodeTexture(basePath + *name, true));
+			}
+		}
+
+		return true;
+	}
+
+	void Model3D::UploadModel() {
+
+		while (!UploadNextMesh()) {
+		}
+		if (asyncTextureUploads) {
+
+			gps::TextureUploader::instance().finish();
+		}
+		DeleteProxy();
+		loadState->store(MODEL_RESIDENT, std::memory_order_release);
+	}
+
+	uint64_t Model3D::MeshKey(uint64_t contentHash, const std::vector<gps::Texture>& textures, int materialIndex) const {
+
+		// identical textures share one id or layer, so those tell the materials apart
+		uint64_t key = contentHash;
+		for (const gps::Texture& texture : textures) {
+
+			key = gps::ResourceRegistry::hashBytes(&texture.id, sizeof(texture.id), key);
+			key = gps::ResourceRegistry::hashBytes(&texture.array, sizeof(texture.array), key);
+			key = gps::ResourceRegistry::hashBytes(&texture.layer, sizeof(texture.layer), key);
+			key = gps::ResourceRegistry::hashBytes(texture.type.data(), texture.type.size(), key);
+		}
+		key = gps::ResourceRegistry::hashBytes(&materialIndex, sizeof(materialIndex), key);
+		return gps::ResourceRegistry::hashBytes(&cpuDataPolicy, sizeof(cpuDataPolicy), key);
+	}
+
+	int Model3D::MaterialIndex(const gps::MeshInfo& info, const std::vector<gps::Texture>& textures) {
+
+		if (!gps::MaterialTable::isEnabled()) {
+			return -1;
+		}
+
+		// the shader reads diffuse and specular from the table, the ambient term follows the diffuse texture
+		const gps::TextureLayer* layers[2] = { nullptr, nullptr };
+		gps::TextureLayer storage[2];
+		for (const gps::Texture& texture : textures) {
+
+			int slot = texture.type == "diffuseTexture" ? 0 : texture.type == "specularTexture" ? 1 : -1;
+			if (slot < 0) {
+				continue;
+			}
+			if (texture.array < 0) {
+				return -1;
+			}
+			storage[slot].array = texture.array;
+			storage[slot].layer = texture.layer;
+			layers[slot] = &storage[slot];
+		}
+
+		gps::Material material = info.hasMaterial ? info.material : gps::Material();
+		return gps::MaterialTable::instance().addMaterial(material, layers[0], layers[1]);
+	}
+
+	bool Model3D::UploadNextMesh() {
+
+		if (importStream) {
+
+			StreamedMesh mesh;
+			bool hasMesh = false;
+			bool done = false;
+			bool failed = false;
+			{
+				std::lock_guard<std::mutex> lock(importStream->mutex);
+				if (!importStream->meshes.empty()) {
+
+					mesh = std::move(importStream->meshes.front());
+					importStream->meshes.pop_front();
+					importStream->queuedBytes -= mesh.bytes;
+					hasMesh = true;
+				}
+				done = importStream->finished && importStream->meshes.empty();
+				failed = importStream->failed;
+			}
+			importStream->drained.notify_all();
+
+			if (hasMesh) {
+
+				UploadStreamedMesh(mesh);
+			}
+			if (!done) {
+
+				return false;
+			}
+
+			if (failed) {
+
+				loadState->store(MODEL_FAILED, std::memory_order_release);
+			}
+			importStream.reset();
+			return true;
+		}
+
+		const std::vector<gps::CachedMesh>& cachedMeshes = pendingCache.getMeshes();
+		size_t meshCount = cachedMeshes.size() + pendingMeshData.size();
+
+		if (uploadedMeshes < meshCount) {
+
+			bool cached = uploadedMeshes < cachedMeshes.size();
+			const gps::MeshInfo& info = cached ? cachedMeshes[uploadedMeshes].info : pendingMeshData[uploadedMeshes - cachedMeshes.size()].info;
+			std::vector<gps::Texture> textures = LoadMeshTextures(info, pendingBasePath);
+			int materialIndex = MaterialIndex(info, textures);
+			if (cached) {
+
+				const gps::CachedMesh& source = cachedMeshes[uploadedMeshes];
+				TrackTextureDensity(textures, source.vertices, source.indices, source.indexCount);
+			}
+			else {
+
+				const gps::MeshData& source = pendingMeshData[uploadedMeshes - cachedMeshes.size()];
+				TrackTextureDensity(textures, source.vertices.data(), source.indices.data(), source.indices.size());
+			}
+
+			uint64_t key = MeshKey(pendingMeshHashes[uploadedMeshes], textures, materialIndex);
+
+			gps::LoadScope scope(pendingFileName, gps::STAGE_GL_UPLOAD);
+			gps::ResourceRegistry& registry = gps::ResourceRegistry::instance();
+			gps::MeshRef mesh = registry.findMesh(key);
+			if (!mesh && cached) {
+
+				// the streams live in the mapping, the mesh copies them only if it has to keep them
+				const gps::CachedMesh& source = cachedMeshes[uploadedMeshes];
+				mesh = registry.addMesh(key, gps::Mesh(source.vertices, source.vertexCount, source.indices, source.indexCount, std::move(textures),
+					source.info.lods, std::move(pendingMeshlets[uploadedMeshes]), cpuDataPolicy));
+			}
+			else if (!mesh) {
+
+				// freshly parsed data is not needed after this, hand it over instead of copying
+				gps::MeshData& source = pendingMeshData[uploadedMeshes - cachedMeshes.size()];
+				mesh = registry.addMesh(key, gps::Mesh(std::move(source.vertices), std::move(source.indices), std::move(textures),
+					std::move(source.info.lods), std::move(pendingMeshlets[uploadedMeshes]), cpuDataPolicy));
+			}
+			mesh->setMaterial(materialIndex);
+			meshes.push_back(mesh);
+			uploadedMeshes++;
+		}
+
+		if (uploadedMeshes < meshCount) {
+
+			return false;
+		}
+
+		// everything lives in GL buffers now, drop the CPU copies
+		pendingCache.close();
+		pendingMeshData.clear();
+		pendingMeshData.shrink_to_fit();
+		pendingMeshlets.clear();
+		pendingMeshHashes.clear();
+		for (gps::DecodedTexture& texture : pendingTextures) {
+
+			gps::TextureProcessor::FreePixels(texture.pixels);
+		}
+		pendingTextures.clear();
+		uploadedMeshes = 0;
+		return true;
+	}
+
+	ModelLoadHandle Model3D::LoadModelAsync(std::string fileName) {
+
+		ModelLoadHandle handle;
+		handle.state = loadState;
+		loadState->store(MODEL_PARSING, std::memory_order_release);
+		asyncLoadsInFlight++;
+
+		asyncLoad = true;
+		Model3D* model = this;
+		gps::AsyncLoader::instance().enqueue([model, fileName]() {
+
+			bool parsed = model->ParseModel(fileName);
+
+			// a streamed model went to the GL thread when its import started, ProcessUploads finishes it either way
+			if (model->streamedImport) {
+
+				return;
+			}
+
+			if (!parsed) {
+
+				std::cerr << "ERROR: could not load " << fileName << std::endl;
+				model->loadState->store(MODEL_FAILED, std::memory_order_release);
+				asyncLoadsInFlight--;
+				return;
+			}
+
+			model->loadState->store(MODEL_PARSED, std::memory_order_release);
+			while (!parsedModels.push(model)) {
+
+				std::this_thread::yield();
+			}
+		});
+
+		return handle;
+	}
+
+	bool Model3D::ProcessUploads(double budgetMs) {
+
+		typedef std::chrono::steady_clock Clock;
+		Clock::time_point start = Clock::now();
+
+		gps::ResourceRegistry::instance().collectGarbage();
+
+		// every parsed model gets its proxy right away, the meshes follow as the budget allows
+		Model3D* parsed;
+		while (parsedModels.pop(parsed)) {
+
+			parsed->CreateProxy();
+			uploadQueue.push_back(parsed);
+		}
+
+		size_t idleModels = 0;
+		while (!uploadQueue.empty() && idleModels < uploadQueue.size()) {
+
+			Model3D* model = uploadQueue.front();
+			size_t meshCount = model->meshes.size();
+			if (model->UploadNextMesh()) {
+
+				model->DeleteProxy();
+				if (model->loadState->load(std::memory_order_acquire) != MODEL_FAILED) {
+
+					model->loadState->store(MODEL_RESIDENT, std::memory_order_release);
+				}
+				asyncLoadsInFlight--;
+				uploadQueue.pop_front();
+				idleModels = 0;
+			}
+			else if (model->meshes.size() == meshCount) {
+
+				// a streaming import waiting for its next segment, the other models upload meanwhile
+				uploadQueue.pop_front();
+				uploadQueue.push_back(model);
+				idleModels++;
+			}
+			else {
+
+				idleModels = 0;
+			}
+
+			if (std::chrono::duration<double, std::milli>(Clock::now() - start).count() >= budgetMs) {
+
+				break;
+			}
+		}
+
+		// textures the meshes above queued start copying right away
+		gps::TextureUploader& textureUploader = gps::TextureUploader::instance();
+		textureUploader.process(budgetMs - std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+
+		return asyncLoadsInFlight.load() == 0 && textureUploader.isIdle();
+	}
+
+	// Line box around the model bounds, drawn until the real meshes are resident
+	void Model3D::CreateProxy() {
+
+		// a streamed model has no bounds until its first segment arrives
+		if (proxyVAO || boundsMin.x > boundsMax.x) {
+
+			return;
+		}
+
+		glm::vec3 corners[8];
+		for (int i = 0; i < 8; i++) {
+
+			corners[i] = glm::vec3((i & 1) ? boundsMax.x : boundsMin.x, (i & 2) ? boundsMax.y : boundsMin.y, (i & 4) ? boundsMax.z : boundsMin.z);
+		}
+
+		// the 12 edges connect corners that differ in exactly one axis bit
+		std::vector<gps::Vertex> lines;
+		for (int i = 0; i < 8; i++) {
+
+			for (int axis = 1; axis < 8; axis <<= 1) {
+
+				if (i & axis)
+					continue;
+
+				for (int end : { i, i | axis }) {
+
+					gps::Vertex vertex;
+					vertex.Position = corners[end];
+					vertex.Normal = glm::vec3(0.0f, 1.0f, 0.0f);
+					vertex.TexCoords = glm::vec2(0.0f);
+					lines.push_back(vertex);
+				}
+			}
+		}
+
+		proxyVAO = gps::GLVertexArray::create();
+		proxyVBO = gps::GLBuffer::create();
+		glBindVertexArray(proxyVAO.get());
+		glBindBuffer(GL_ARRAY_BUFFER, proxyVBO.get());
+		glBufferData(GL_ARRAY_BUFFER, lines.size() * sizeof(gps::Vertex), lines.data(), GL_STATIC_DRAW);
+		glEnableVertexAttribArray(0);
+		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(gps::Vertex), (GLvoid*)0);
+		glEnableVertexAttribArray(1);
+		glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(gps::Vertex), (GLvoid*)offsetof(gps::Vertex, Normal));
+		glEnableVertexAttribArray(2);
+		glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(gps::Vertex), (GLvoid*)offsetof(gps::Vertex, TexCoords));
+		glBindVertexArray(0);
+	}
+
+	void Model3D::DeleteProxy() {
+
+		proxyVBO.reset();
+		proxyVAO.reset();
+	}
+
+	// Draw each mesh from the model
+	void Model3D::Draw(gps::Shader shaderProgram) {
+
+		if (loadState->load(std::memory_order_acquire) != MODEL_RESIDENT) {
+
+			if (proxyVAO) {
+
+				shaderProgram.useShaderProgram();
+				glBindVertexArray(proxyVAO.get());
+				glDrawArrays(GL_LINES, 0, 24);
+				glBindVertexArray(0);
+			}
+			return;
+		}
+
+		// no view to size the model by, so every level of its streamed textures
+		for (const TextureDensity& density : textureDensities)
+			gps::TextureStreamer::instance().request(density.texture, 0.0f);
+
+		for (int i = 0; i < meshes.size(); i++)
+			meshes[i]->Draw(shaderProgram);
+	}
+
+	// Draws the level of detail that keeps the projected error under view.pixelError, cross-fading between levels
+	void Model3D::Draw(gps::Shader shaderProgram, const glm::mat4& modelMatrix, const LodView& view, LodInstance& instance) {
+
+		if (loadState->load(std::memory_order_acquire) != MODEL_RESIDENT) {
+
+			Draw(shaderProgram);
+			return;
+		}
+
+		// shadows can take coarser geometry, and switch without a fade since the popping is hard to spot there
+		if (view.shadowPass) {
+
+			instance.shadowLod = SelectLod(modelMatrix, view, view.pixelError * view.shadowBias);
+			DrawLevel(shaderProgram, modelMatrix, view, instance.shadowLod, 0.0f);
+			return;
+		}
+
+		RequestTextureDetail(modelMatrix, view);
+
+		int target = SelectLod(modelMatrix, view, view.pixelError);
+		if (instance.lod < 0) {
+
+			instance.lod = target;
+		}
+		else if (target != instance.lod && instance.fadingFrom < 0) {
+
+			instance.fadingFrom = instance.lod;
+			instance.lod = target;
+			instance.fadeStart = view.time;
+		}
+
+		if (instance.fadingFrom >= 0) {
+
+			float fade = (float)((view.time - instance.fadeStart) / LOD_FADE_SECONDS);
+			if (fade >= 1.0f) {
+
+				instance.fadingFrom = -1;
+			}
+			else {
+
+				// complementary dither patterns, so every pixel is covered by exactly one of the two levels
+				fade = std::max(fade, 1.0f / 16.0f);
+				DrawLevel(shaderProgram, modelMatrix, view, instance.fadingFrom, -fade);
+				DrawLevel(shaderProgram, modelMatrix, view, instance.lod, fade);
+				return;
+			}
+		}
+
+		DrawLevel(shaderProgram, modelMatrix, view, instance.lod, 0.0f);
+	}
+
+	int Model3D::SelectLod(const glm::mat4& modelMatrix, const LodView& view, float pixelError) const {
+
+		glm::vec3 center = glm::vec3(modelMatrix * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+		float scale = std::max(glm::length(glm::vec3(modelMatrix[0])), std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+		float radius = glm::length(boundsMax - boundsMin) * 0.5f * scale;
+
+		// distance to the nearest point of the bounding sphere, inside it only the full mesh will do
+		float distance = glm::length(center - view.cameraPosition) - radius;
+		if (distance <= 0.0f) {
+
+			return 0;
+		}
+
+		int lod = 0;
+		for (size_t l = 1; l < lodErrors.size(); l++) {
+
+			if (lodErrors[l] * scale / distance * view.pixelScale > pixelError)
+				break;
+			lod = (int)l;
+		}
+		return lod;
+	}
+
+	void Model3D::TrackTextureDensity(const std::vector<gps::Texture>& textures, const gps::Vertex* vertices, const GLuint* indices, size_t indexCount) {
+
+		if (!gps::TextureStreamer::instance().isEnabled()) {
+			return;
+		}
+
+		// ratio of texture area to surface area over every triangle, a tiled or atlased mapping counts as it is drawn
+		double area = 0.0, uvArea = 0.0;
+		for (size_t i = 0; i + 2 < indexCount; i += 3) {
+
+			const gps::Vertex& a = vertices[indices[i]];
+			const gps::Vertex& b = vertices[indices[i + 1]];
+			const gps::Vertex& c = vertices[indices[i + 2]];
+			area += glm::length(glm::cross(b.Position - a.Position, c.Position - a.Position));
+			glm::vec2 u = b.TexCoords - a.TexCoords, v = c.TexCoords - a.TexCoords;
+			uvArea += std::abs(u.x * v.y - u.y * v.x);
+		}
+		float uvPerUnit = area > 0.0 ? (float)std::sqrt(uvArea / area) : 0.0f;
+
+		for (const gps::Texture& texture : textures) {
+
+			if (texture.id == 0)
+				continue;
+			auto found = std::find_if(textureDensities.begin(), textureDensities.end(),
+				[&](const TextureDensity& density) { return density.texture == texture.id; });
+			if (found == textureDensities.end())
+				textureDensities.push_back({ texture.id, uvPerUnit });
+			else
+				found->uvPerUnit = std::max(found->uvPerUnit, uvPerUnit);
+		}
+	}
+
+	void Model3D::RequestTextureDetail(const glm::mat4& modelMatrix, const LodView& view) const {
+
+		if (textureDensities.empty()) {
+			return;
+		}
+
+		// same nearest point of the bounding sphere as SelectLod, inside it every level is needed
+		glm::vec3 center = glm::vec3(modelMatrix * glm::vec4((boundsMin + boundsMax) * 0.5f, 1.0f));
+		float scale = std::max(glm::length(glm::vec3(modelMatrix[0])), std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+		float radius = glm::length(boundsMax - boundsMin) * 0.5f * scale;
+		float distance = glm::length(center - view.cameraPosition) - radius;
+
+		gps::TextureStreamer& streamer = gps::TextureStreamer::instance();
+		float pixelsPerUnit = distance > 0.0f ? scale / distance * view.pixelScale : 0.0f;
+		for (const TextureDensity& density : textureDensities) {
+
+			streamer.request(density.texture, pixelsPerUnit > 0.0f ? density.uvPerUnit / pixelsPerUnit : 0.0f);
+		}
+	}
+
+	void Model3D::DrawLevel(gps::Shader shaderProgram, const glm::mat4& modelMatrix, const LodView& view, int lod, float fade) {
+
+		shaderProgram.useShaderProgram();
+		gps::Shader::Uniform fadeLoc = shaderProgram.getUniform("lodFade");
+		shaderProgram.setUniform(fadeLoc, fade);
+
+		// full detail goes through meshlet culling, the coarser levels are small enough to draw whole;
+		// back faces of the light's view still cast shadows, so the shadow pass only uses the frustum test
+		bool culling = view.clusterCulling && lod == 0;
+		gps::ClusterCuller culler(view.viewProjection, modelMatrix, view.cameraPosition, !view.shadowPass);
+		gps::ClusterCullStats unusedStats = gps::ClusterCullStats();
+		gps::ClusterCullStats& stats = view.cullStats ? *view.cullStats : unusedStats;
+
+		bool quantized = false;
+		for (size_t i = 0; i < meshes.size(); i++) {
+
+			if (culling && !meshes[i]->getMeshlets().empty()) {
+
+				visibleMeshlets.clear();
+				culler.Cull(meshes[i]->getMeshlets(), visibleMeshlets, stats);
+				meshes[i]->DrawMeshlets(shaderProgram, modelMatrix, visibleMeshlets);
+			}
+			else {
+
+				meshes[i]->Draw(shaderProgram, lod, modelMatrix);
+			}
+			quantized = quantized || meshes[i]->isQuantized();
+		}
+
+		// quantized meshes draw a record with their dequantization folded into the model, later draws expect the object's
+		if (quantized)
+			gps::ObjectBuffer::instance().restoreObject(shaderProgram);
+
+		if (fade != 0.0f)
+			shaderProgram.setUniform(fadeLoc, 0.0f);
 	}
 
-    void Model3D::LoadModel(std::string fileName, std::string basePath)	{
+	void Model3D::BenchmarkLoad(std::string fileName, int iterations) {
+
+		typedef std::chrono::high_resolution_clock Clock;
+		std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+
+		std::vector<gps::MeshData> meshData;
+		Clock::time_point start = Clock::now();
+		for (int i = 0; i < iterations; i++) {
+
+			meshData.clear();
+			if (!ReadOBJ(fileName, basePath, meshData)) {
+
+				return;
+			}
+		}
+		double objMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / iterations;
+
+		// unprocessed meshes, kept apart from the model's real cache so the next start does not have to rebuild it
+		std::string benchmarkCache = gps::MeshCache::cachePath(fileName) + ".benchmark";
+		if (!gps::MeshCache::write(fileName, basePath, meshData, 0, benchmarkCache)) {
+
+			std::cerr << "ERROR: could not write the benchmark cache of " << fileName << std::endl;
+			return;
+		}
+
+		size_t cacheBytes = 0;
+		uint64_t checksum = 0;
+		start = Clock::now();
+		for (int i = 0; i < iterations; i++) {
+
+			gps::MeshCache cache;
+			if (!cache.load(fileName, basePath, 0, benchmarkCache)) {
+
+				std::cerr << "ERROR: could not load the cache of " << fileName << std::endl;
+				std::remove(benchmarkCache.c_str());
+				return;
+			}
+			cacheBytes = cache.getFileSize();
 
-		ReadOBJ(fileName, basePath);
+			// touch every page so the comparison includes the actual read, not just the mapping
+			for (const gps::CachedMesh& mesh : cache.getMeshes()) {
+
+				const unsigned char* bytes = reinterpret_cast<const unsigned char*>(mesh.vertices);
+				for (size_t b = 0; b < mesh.vertexCount * sizeof(gps::Vertex); b += 4096)
+					checksum += bytes[b];
+				checksum += mesh.indexCount ? mesh.indices[mesh.indexCount - 1] : 0;
+			}
+		}
+		double cacheMs = std::chrono::duration<double, std::milli>(Clock::now() - start).count() / iterations;
+		std::remove(benchmarkCache.c_str());
+
+		std::cout << "Benchmark : " << fileName << std::endl;
+		std::cout << "  obj parse  : " << objMs << " ms" << std::endl;
+		std::cout << "  cache load : " << cacheMs << " ms (" << cacheBytes << " bytes, checksum " << checksum << ")" << std::endl;
+		std::cout << "  speedup    : " << (cacheMs > 0.0 ? objMs / cacheMs : 0.0) << "x" << std::endl;
 	}
 
-	// Draw each mesh from the model
-	void Model3D::Draw(gps::Shader shaderProgram) {
+	void Model3D::SetMeshOptimization(bool enabled) {
 
-		for (int i = 0; i < meshes.size(); i++)
-			meshes[i].Draw(shaderProgram);
+		meshOptimization = enabled;
+	}
+
+	void Model3D::AnalyzeOptimization(std::string fileName) {
+
+		std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+
+		std::vector<gps::MeshData> meshData;
+		if (ReadOBJ(fileName, basePath, meshData)) {
+
+			OptimizeMeshes(meshData);
+		}
+	}
+
+	bool Model3D::VerifyQuantization(std::string fileName) {
+
+		// half a 16-bit step along the diagonal, under 0.2 degree for 10-bit normals with either snorm rule, half-float precision on [0, 1] UVs
+		const float MAX_RELATIVE_POSITION_ERROR = 1.5e-5f;
+		const float MAX_NORMAL_DEGREES = 0.25f;
+		const float MAX_TEXCOORD_ERROR = 5e-4f;
+
+		std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+
+		std::vector<gps::MeshData> meshData;
+		if (!ReadOBJ(fileName, basePath, meshData)) {
+
+			return false;
+		}
+
+		bool passed = true;
+		size_t floatBytes = 0;
+		size_t packedBytes = 0;
+		for (size_t s = 0; s < meshData.size(); s++) {
+
+			const gps::MeshData& mesh = meshData[s];
+			gps::QuantizationError error = gps::VertexQuantizer::Measure(mesh.vertices.data(), mesh.vertices.size());
+
+			// UVs past [0, 1] lose precision with their magnitude, scale the tolerance the same way
+			float largestTexCoord = 1.0f;
+			for (const gps::Vertex& vertex : mesh.vertices)
+				largestTexCoord = std::max(largestTexCoord, std::max(std::fabs(vertex.TexCoords.x), std::fabs(vertex.TexCoords.y)));
+
+			bool meshPassed = error.relativePosition <= MAX_RELATIVE_POSITION_ERROR && error.normalDegrees <= MAX_NORMAL_DEGREES &&
+				error.texCoord <= MAX_TEXCOORD_ERROR * largestTexCoord;
+			passed = passed && meshPassed;
+
+			size_t indexSize = mesh.vertices.size() <= 65536 ? sizeof(GLushort) : sizeof(GLuint);
+			floatBytes += mesh.vertices.size() * sizeof(gps::Vertex) + mesh.indices.size() * sizeof(GLuint);
+			packedBytes += mesh.vertices.size() * sizeof(gps::PackedVertex) + mesh.indices.size() * indexSize;
+
+			std::cout << "Mesh " << s << " quantization " << (meshPassed ? "ok" : "FAILED") << " : position " << error.position
+				<< " (" << error.relativePosition << " of the extent), normal " << error.normalDegrees << " deg, uv " << error.texCoord << std::endl;
+		}
+
+		std::cout << fileName << " : " << floatBytes << " -> " << packedBytes << " bytes ("
+			<< (floatBytes > 0 ? 100.0 * (1.0 - (double)packedBytes / floatBytes) : 0.0) << "% saved)" << std::endl;
+		return passed;
+	}
+
+	void Model3D::SetMaterialMerging(bool enabled) {
+
+		materialMerging = enabled;
+	}
+
+	void Model3D::MergeMeshesByMaterial(std::vector<gps::MeshData>& meshData) {
+
+		auto sameMaterial = [](const gps::MeshInfo& a, const gps::MeshInfo& b) {
+
+			return a.hasMaterial == b.hasMaterial && a.material.ambient == b.material.ambient && a.material.diffuse == b.material.diffuse &&
+				a.material.specular == b.material.specular && a.ambientTexture == b.ambientTexture &&
+				a.diffuseTexture == b.diffuseTexture && a.specularTexture == b.specularTexture;
+		};
+
+		// groups in order of first appearance
+		std::vector<std::vector<size_t> > groups;
+		for (size_t s = 0; s < meshData.size(); s++) {
+
+			size_t g = 0;
+			while (g < groups.size() && !sameMaterial(meshData[groups[g][0]].info, meshData[s].info))
+				g++;
+			if (g == groups.size())
+				groups.push_back(std::vector<size_t>());
+			groups[g].push_back(s);
+		}
+
+		std::vector<gps::MeshData> merged(groups.size());
+		for (size_t g = 0; g < groups.size(); g++) {
+
+			gps::MeshData& target = merged[g];
+			target.info = meshData[groups[g][0]].info;
+			target.info.lods.clear();
+
+			size_t levelCount = 0;
+			bool anyLods = false;
+			for (size_t s : groups[g]) {
+
+				const gps::MeshData& shape = meshData[s];
+				levelCount = std::max(levelCount, std::max(shape.info.lods.size(), (size_t)1));
+				anyLods = anyLods || !shape.info.lods.empty();
+				target.info.boundsMin = glm::min(target.info.boundsMin, shape.info.boundsMin);
+				target.info.boundsMax = glm::max(target.info.boundsMax, shape.info.boundsMax);
+			}
+
+			std::vector<GLuint> baseVertex;
+			for (size_t s : groups[g]) {
+
+				baseVertex.push_back((GLuint)target.vertices.size());
+				target.vertices.insert(target.vertices.end(), meshData[s].vertices.begin(), meshData[s].vertices.end());
+			}
+
+			// level l of the merged mesh is level l of every shape back to back, short chains repeat their last level
+			for (size_t l = 0; l < levelCount; l++) {
+
+				gps::MeshLod level = { (GLuint)target.indices.size(), 0, 0.0f };
+				for (size_t i = 0; i < groups[g].size(); i++) {
+
+					const gps::MeshData& shape = meshData[groups[g][i]];
+					gps::MeshLod range = { 0, (GLuint)shape.indices.size(), 0.0f };
+					if (!shape.info.lods.empty())
+						range = shape.info.lods[std::min(l, shape.info.lods.size() - 1)];
+
+					for (GLuint k = 0; k < range.indexCount; k++)
+						target.indices.push_back(shape.indices[range.indexOffset + k] + baseVertex[i]);
+					level.indexCount += range.indexCount;
+					level.error = std::max(level.error, range.error);
+				}
+				target.info.lods.push_back(level);
+			}
+
+			if (!anyLods)
+				target.info.lods.clear();
+		}
+
+		std::cout << "Merged " << meshData.size() << " shapes by material : draw calls " << meshData.size() << " -> " << merged.size() << std::endl;
+		meshData.swap(merged);
+	}
+
+	void Model3D::SetLodGeneration(bool enabled) {
+
+		lodGeneration = enabled;
+	}
+
+	void Model3D::SetStreamingImport(size_t budgetBytes) {
+
+		streamingBudget = budgetBytes;
+	}
+
+	void Model3D::SetAsyncTextureUploads(bool enabled) {
+
+		asyncTextureUploads = enabled;
+	}
+
+	void Model3D::SetTextureStreaming(size_t budgetBytes) {
+
+		gps::TextureStreamer& streamer = gps::TextureStreamer::instance();
+		streamer.setBudget(budgetBytes);
+		streamer.setLoader([](const std::string& path, int width, int height, int levels, gps::TextureFormat format) {
+
+			// the cooked copy in the common case; a changed file or format no longer matches the streamed texture
+			gps::DecodedTexture texture = DecodeTexture(path);
+			if (texture.width != width || texture.height != height || texture.levels != levels || texture.format != format) {
+
+				gps::TextureProcessor::FreePixels(texture.pixels);
+				return (unsigned char*)NULL;
+			}
+			return texture.pixels;
+		});
+	}
+
+	void Model3D::CancelStreamingImports() {
+
+		streamingCancelled = true;
+	}
+
+	bool Model3D::StreamOBJ(const std::string& fileName, const std::string& basePath) {
+
+		std::cout << "Loading : " << fileName << " (streaming, " << streamingBudget / (1024 * 1024) << " MB budget)" << std::endl;
+
+		// the GL thread grows these as the segments arrive
+		boundsMin = glm::vec3(FLT_MAX);
+		boundsMax = glm::vec3(-FLT_MAX);
+		lodErrors.assign(1, 0.0f);
+
+		std::shared_ptr<ImportStream> stream;
+		if (asyncLoad) {
+
+			// hand the model to the GL thread now, it uploads segments while the rest of the file is read
+			stream = std::make_shared<ImportStream>();
+			importStream = stream;
+			streamedImport = true;
+			while (!parsedModels.push(this)) {
+
+				std::this_thread::yield();
+			}
+		}
+
+		gps::ObjStreamer::SegmentSink sink = [this, &stream, &fileName](gps::MeshData& segment) {
+
+			std::unique_ptr<gps::LoadScope> processingScope(new gps::LoadScope(fileName, gps::STAGE_MESH_PROCESSING));
+			std::vector<gps::MeshData> segments(1);
+			segments[0] = std::move(segment);
+			if (meshOptimization) {
+
+				OptimizeMeshes(segments);
+			}
+			if (lodGeneration) {
+
+				GenerateLods(segments);
+			}
+
+			StreamedMesh mesh;
+			mesh.data = std::move(segments[0]);
+			const gps::MeshData& data = mesh.data;
+			size_t fullDetailCount = data.info.lods.empty() ? data.indices.size() : data.info.lods[0].indexCount;
+			gps::MeshletBuilder::Build(data.vertices.data(), data.vertices.size(), data.indices.data(), fullDetailCount, mesh.meshlets);
+			mesh.contentHash = hashMeshContent(data.vertices.data(), data.vertices.size(), data.indices.data(), data.indices.size(), data.info.lods);
+			mesh.bytes = data.vertices.size() * sizeof(gps::Vertex) + data.indices.size() * sizeof(GLuint);
+			processingScope.reset();
+
+			if (!stream) {
+
+				UploadStreamedMesh(mesh);
+				return true;
+			}
+
+			// an empty queue always takes the segment, so one larger than the budget still gets through
+			std::unique_lock<std::mutex> lock(stream->mutex);
+			while (stream->queuedBytes > 0 && stream->queuedBytes + mesh.bytes > streamingBudget) {
+
+				if (streamingCancelled) {
+
+					return false;
+				}
+				stream->drained.wait_for(lock, std::chrono::milliseconds(50));
+			}
+			stream->queuedBytes += mesh.bytes;
+			stream->meshes.push_back(std::move(mesh));
+			return true;
+		};
+
+		// a quarter of the budget per segment keeps a few of them in flight
+		gps::ObjStreamStats stats = {};
+		bool imported = gps::ObjStreamer::Import(fileName, basePath, std::max(streamingBudget / 4, (size_t)1), sink, &stats);
+		std::cout << fileName << " : " << stats.segments << " segments, " << stats.triangles << " triangles, "
+			<< stats.poolBytes / (1024 * 1024) << " MB attribute pools" << std::endl;
+		if (!imported) {
+
+			std::cerr << "ERROR: could not load " << fileName << std::endl;
+		}
+
+		if (stream) {
+
+			std::lock_guard<std::mutex> lock(stream->mutex);
+			stream->finished = true;
+			stream->failed = !imported;
+		}
+		return imported;
+	}
+
+	void Model3D::UploadStreamedMesh(StreamedMesh& mesh) {
+
+		gps::MeshInfo& info = mesh.data.info;
+		boundsMin = glm::min(boundsMin, info.boundsMin);
+		boundsMax = glm::max(boundsMax, info.boundsMax);
+
+		// earlier meshes repeat their last level, so a longer chain extends the table with its last value
+		if (info.lods.size() > lodErrors.size())
+			lodErrors.resize(info.lods.size(), lodErrors.back());
+		for (size_t l = 0; l < lodErrors.size() && !info.lods.empty(); l++)
+			lodErrors[l] = std::max(lodErrors[l], info.lods[std::min(l, info.lods.size() - 1)].error);
+
+		std::vector<gps::Texture> textures = LoadMeshTextures(info, pendingBasePath);
+		int materialIndex = MaterialIndex(info, textures);
+		TrackTextureDensity(textures, mesh.data.vertices.data(), mesh.data.indices.data(), mesh.data.indices.size());
+		uint64_t key = MeshKey(mesh.contentHash, textures, materialIndex);
+
+		gps::LoadScope scope(pendingFileName, gps::STAGE_GL_UPLOAD);
+		gps::ResourceRegistry& registry = gps::ResourceRegistry::instance();
+		gps::MeshRef created = registry.findMesh(key);
+		if (!created) {
+
+			created = registry.addMesh(key, gps::Mesh(std::move(mesh.data.vertices), std::move(mesh.data.indices), std::move(textures),
+				std::move(info.lods), std::move(mesh.meshlets), cpuDataPolicy));
+		}
+		created->setMaterial(materialIndex);
+		meshes.push_back(created);
+	}
+
+	void Model3D::ReportLods(std::string fileName) {
+
+		std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+
+		std::vector<gps::MeshData> meshData;
+		if (ReadOBJ(fileName, basePath, meshData)) {
+
+			if (meshOptimization)
+				OptimizeMeshes(meshData);
+			GenerateLods(meshData);
+		}
+	}
+
+	void Model3D::GenerateLods(std::vector<gps::MeshData>& meshData) {
+
+		typedef std::chrono::high_resolution_clock Clock;
+		Clock::time_point start = Clock::now();
+
+		std::vector<size_t> levelTriangles;
+		std::vector<float> levelErrors;
+		float diagonal = 0.0f;
+
+		for (gps::MeshData& mesh : meshData) {
+
+			gps::MeshSimplifier::BuildLodChain(mesh.vertices, mesh.indices, mesh.info.lods, meshOptimization);
+			diagonal = std::max(diagonal, glm::length(mesh.info.boundsMax - mesh.info.boundsMin));
+
+			if (mesh.info.lods.size() > levelTriangles.size()) {
+
+				levelTriangles.resize(mesh.info.lods.size(), 0);
+				levelErrors.resize(mesh.info.lods.size(), 0.0f);
+			}
+		}
+
+		// same aggregation as the model's draw levels: short chains repeat their last level
+		for (const gps::MeshData& mesh : meshData) {
+
+			for (size_t l = 0; l < levelTriangles.size() && !mesh.info.lods.empty(); l++) {
+
+				const gps::MeshLod& lod = mesh.info.lods[std::min(l, mesh.info.lods.size() - 1)];
+				levelTriangles[l] += lod.indexCount / 3;
+				levelErrors[l] = std::max(levelErrors[l], lod.error);
+			}
+		}
+
+		std::cout << "LOD chain built in " << std::chrono::duration<double, std::milli>(Clock::now() - start).count() << " ms" << std::endl;
+		for (size_t l = 0; l < levelTriangles.size(); l++) {
+
+			std::cout << "  LOD " << l << " : " << levelTriangles[l] << " triangles, error " << levelErrors[l]
+				<< " (" << (diagonal > 0.0f ? 100.0f * levelErrors[l] / diagonal : 0.0f) << "% of the bounds diagonal)" << std::endl;
+		}
+	}
+
+	void Model3D::OptimizeMeshes(std::vector<gps::MeshData>& meshData) {
+
+		for (size_t s = 0; s < meshData.size(); s++) {
+
+			gps::MeshStatistics before;
+			gps::MeshStatistics after;
+			size_t removed = gps::MeshOptimizer::Optimize(meshData[s].vertices, meshData[s].indices, &before, &after);
+
+			std::cout << "Mesh " << s << " optimized : " << removed << " degenerate triangles removed, "
+				<< before.vertexCount << " -> " << after.vertexCount << " vertices" << std::endl;
+			std::cout << "  ACMR     : " << before.acmr << " -> " << after.acmr << std::endl;
+			std::cout << "  ATVR     : " << before.atvr << " -> " << after.atvr << std::endl;
+			std::cout << "  overdraw : " << before.overdraw << " -> " << after.overdraw << std::endl;
+		}
 	}
 
-	// Does the parsing of the .obj file and fills in the data structure
-	void Model3D::ReadOBJ(std::string fileName, std::string basePath) {
+	// Does the parsing of the .obj file and fills in the CPU mesh data
+	bool Model3D::ReadOBJ(std::string fileName, std::string basePath, std::vector<gps::MeshData>& meshData) {
 
         std::cout << "Loading : " << fileName << std::endl;
 		tinyobj::attrib_t attrib;
@@ -30,7 +1200,7 @@ namespace gps {
 		int materialId;
 
 		std::string err;
-		bool ret = tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), GL_TRUE);
+		bool ret = gps::ObjParser::Load(&attrib, &shapes, &materials, &err, fileName, basePath);
 
 		if (!err.empty()) {
 
@@ -40,18 +1210,31 @@ namespace gps {
 
 		if (!ret) {
 
-			exit(1);
+			return false;
 		}
 
 		std::cout << "# of shapes    : " << shapes.size() << std::endl;
 		std::cout << "# of materials : " << materials.size() << std::endl;
 
+		// turning the index triples into deduplicated vertices takes up the rest of the call
+		gps::LoadScope expansionScope(fileName, gps::STAGE_VERTEX_EXPANSION);
+
 		// Loop over shapes
 		for (size_t s = 0; s < shapes.size(); s++) {
 
-			std::vector<gps::Vertex> vertices;
-			std::vector<GLuint> indices;
-			std::vector<gps::Texture> textures;
+			gps::MeshData currentMesh;
+			currentMesh.info.hasMaterial = false;
+			currentMesh.info.material = gps::Material();
+			std::vector<gps::Vertex>& vertices = currentMesh.vertices;
+			std::vector<GLuint>& indices = currentMesh.indices;
+
+			// Maps each unique index triple to the vertex emitted for it
+			std::unordered_map<tinyobj::index_t, GLuint, IndexTripleHash, IndexTripleEqual> uniqueVertices;
+			uniqueVertices.reserve(shapes[s].mesh.indices.size());
+			indices.reserve(shapes[s].mesh.indices.size());
+
+			glm::vec3 boundsMin(FLT_MAX);
+			glm::vec3 boundsMax(-FLT_MAX);
 
 			// Loop over faces(polygon)
 			size_t index_offset = 0;
@@ -59,15 +1242,20 @@ namespace gps {
 
 				int fv = shapes[s].mesh.num_face_vertices[f];
 
-				//gps::Texture currentTexture = LoadTexture("index1.png", "ambientTexture");
-				//textures.push_back(currentTexture);
-
 				// Loop over vertices in the face.
 				for (size_t v = 0; v < fv; v++) {
 
 					// access to vertex
 					tinyobj::index_t idx = shapes[s].mesh.indices[index_offset + v];
 
+					// reuse the vertex if this corner was already emitted
+					auto found = uniqueVertices.find(idx);
+					if (found != uniqueVertices.end()) {
+
+						indices.push_back(found->second);
+						continue;
+					}
+
 					float vx = attrib.vertices[3 * idx.vertex_index + 0];
 					float vy = attrib.vertices[3 * idx.vertex_index + 1];
 					float vz = attrib.vertices[3 * idx.vertex_index + 2];
@@ -92,14 +1280,24 @@ namespace gps {
 					currentVertex.Normal = vertexNormal;
 					currentVertex.TexCoords = vertexTexCoords;
 
+					boundsMin = glm::min(boundsMin, vertexPosition);
+					boundsMax = glm::max(boundsMax, vertexPosition);
+
+					GLuint vertexIndex = (GLuint)vertices.size();
+					uniqueVertices.emplace(idx, vertexIndex);
 					vertices.push_back(currentVertex);
 
-					indices.push_back((GLuint)(index_offset + v));
+					indices.push_back(vertexIndex);
 				}
 
 				index_offset += fv;
 			}
 
+			std::cout << "Mesh " << s << " vertices : " << index_offset << " -> " << vertices.size() << std::endl;
+
+			currentMesh.info.boundsMin = vertices.empty() ? glm::vec3(0.0f) : boundsMin;
+			currentMesh.info.boundsMax = vertices.empty() ? glm::vec3(0.0f) : boundsMax;
+
 			// get material id
 			// Only try to read materials if the .mtl file is present
 			size_t a = shapes[s].mesh.material_ids.size();
@@ -109,79 +1307,272 @@ namespace gps {
 				materialId = shapes[s].mesh.material_ids[0];
 				if (materialId != -1) {
 
-					gps::Material currentMaterial;
+					gps::Material& currentMaterial = currentMesh.info.material;
 					currentMaterial.ambient = glm::vec3(materials[materialId].ambient[0], materials[materialId].ambient[1], materials[materialId].ambient[2]);
 					currentMaterial.diffuse = glm::vec3(materials[materialId].diffuse[0], materials[materialId].diffuse[1], materials[materialId].diffuse[2]);
 					currentMaterial.specular = glm::vec3(materials[materialId].specular[0], materials[materialId].specular[1], materials[materialId].specular[2]);
+					currentMesh.info.hasMaterial = true;
 
-					//ambient texture
-					std::string ambientTexturePath = materials[materialId].ambient_texname;
+					currentMesh.info.ambientTexture = materials[materialId].ambient_texname;
+					currentMesh.info.diffuseTexture = materials[materialId].diffuse_texname;
+					currentMesh.info.specularTexture = materials[materialId].specular_texname;
+				}
+			}
 
-					if (!ambientTexturePath.empty()) {
+			meshData.push_back(std::move(currentMesh));
+		}
 
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + ambientTexturePath, "ambientTexture");
-						textures.push_back(currentTexture);
-					}
+		return true;
+	}
 
-					//diffuse texture
-					std::string diffuseTexturePath = materials[materialId].diffuse_texname;
+	// Loads the textures named by a mesh material
+	std::vector<gps::Texture> Model3D::LoadMeshTextures(const gps::MeshInfo& info, const std::string& basePath) {
 
-					if (!diffuseTexturePath.empty()) {
+		std::vector<gps::Texture> textures;
 
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + diffuseTexturePath, "diffuseTexture");
-						textures.push_back(currentTexture);
-					}
+		// texture memory is booked under the model, a texture shared with another one stays with whoever loaded it first
+		gps::TextureOwnerScope owner(pendingFileName.substr(pendingFileName.find_last_of('/') + 1));
 
-					//specular texture
-					std::string specularTexturePath = materials[materialId].specular_texname;
+		//ambient texture
+		if (!info.ambientTexture.empty()) {
 
-					if (!specularTexturePath.empty()) {
+			textures.push_back(LoadTexture(basePath + info.ambientTexture, "ambientTexture"));
+		}
 
-						gps::Texture currentTexture;
-						currentTexture = LoadTexture(basePath + specularTexturePath, "specularTexture");
-						textures.push_back(currentTexture);
-					}
-				}
-			}
+		//diffuse texture
+		if (!info.diffuseTexture.empty()) {
+
+			textures.push_back(LoadTexture(basePath + info.diffuseTexture, "diffuseTexture"));
+		}
 
-			meshes.push_back(gps::Mesh(vertices, indices, textures));
+		//specular texture
+		if (!info.specularTexture.empty()) {
+
+			textures.push_back(LoadTexture(basePath + info.specularTexture, "specularTexture"));
 		}
+
+		return textures;
 	}
 
 	// Retrieves a texture associated with the object - by its name and type
 	gps::Texture Model3D::LoadTexture(std::string path, std::string type) {
 
-			for (int i = 0; i < loadedTextures.size(); i++) {
+			std::unordered_map<std::string, gps::Texture>::const_iterator loaded = loadedTextures.find(path);
+			if (loaded != loadedTextures.end()) {
 
-				if (loadedTextures[i].path == path)	{
-
-					//already loaded texture
-					return loadedTextures[i];
-				}
+				//already loaded texture
+				return loaded->second;
 			}
 
 			gps::Texture currentTexture;
-			currentTexture.id = ReadTextureFromFile(path.c_str());
+			currentTexture.id = 0;
 			currentTexture.type = std::string(type);
 			currentTexture.path = path;
+			currentTexture.array = -1;
+			currentTexture.layer = -1;
+
+			gps::DecodedTexture fallback = {};
+			gps::DecodedTexture* decoded = FindPendingTexture(path);
+			if (decoded == nullptr) {
+
+				fallback = DecodeTexture(path, true);
+				decoded = &fallback;
+			}
+
+			// an array shares one level range between its layers, so streamed textures stay textures of their own
+			if (gps::MaterialTable::isEnabled() && !gps::TextureStreamer::instance().isEnabled()) {
+
+				gps::LayerRef layer = LoadTextureLayer(path, decoded, fallback);
+				if (layer) {
+
+					gps::TextureProcessor::FreePixels(fallback.pixels);
+					currentTexture.array = layer->array;
+					currentTexture.layer = layer->layer;
+					layerHandles.push_back(layer);
+					loadedTextures[path] = currentTexture;
+					return currentTexture;
+				}
+			}
 
-			loadedTextures.push_back(currentTexture);
+			// another model may have uploaded the same image under a different path
+			gps::ResourceRegistry& registry = gps::ResourceRegistry::instance();
+			size_t bytes = 0;
+			gps::TextureRef texture = registry.findTexture(decoded->contentHash, &bytes);
+			if (!texture) {
+
+				// skipped at parse time, but the shared copy has been released since
+				if (!decoded->pixels && decoded->contentHash != 0) {
+
+					fallback = DecodeTexture(path);
+					decoded = &fallback;
+				}
+
+				gps::TextureStreamer& streamer = gps::TextureStreamer::instance();
+				if (decoded->pixels && streamer.isEnabled()) {
+
+					// only the coarse levels now, the streamer reads the finer ones once a draw needs them
+					gps::LoadScope scope(path, gps::STAGE_GL_UPLOAD);
+					GLuint id = gps::TextureStreamer::createTexture(path, decoded->pixels, decoded->width, decoded->height, decoded->levels, decoded->format);
+					if (id) {
+
+						bytes = gps::TextureStreamer::residentSize(decoded->format, decoded->width, decoded->height, decoded->levels,
+							gps::TextureStreamer::startLevel(decoded->width, decoded->height, decoded->levels));
+						texture = registry.addTexture(decoded->contentHash, gps::GLTexture(id), bytes);
+						streamer.add(texture, path, decoded->width, decoded->height, decoded->levels, decoded->format);
+					}
+				}
+				else if (decoded->pixels) {
+
+					bytes = gps::BlockCompressor::ChainSize(decoded->format, decoded->width, decoded->height, decoded->levels);
+					GLuint id;
+					if (asyncTextureUploads) {
+
+						// the uploader frees the pixels once they are in a pixel buffer
+						id = gps::TextureUploader::instance().upload(path, decoded->pixels, decoded->width, decoded->height, decoded->levels, decoded->format);
+						decoded->pixels = NULL;
+						if (id) {
+							texture = registry.addTexture(decoded->contentHash, gps::GLTexture(id), bytes);
+							gps::TextureUploader::instance().setOwner(id, texture);
+						}
+					}
+					else {
+
+						id = UploadTexture(*decoded);
+						if (id) {
+							texture = registry.addTexture(decoded->contentHash, gps::GLTexture(id), bytes);
+						}
+					}
+				}
+			}
+			gps::TextureProcessor::FreePixels(fallback.pixels);
+
+			if (texture) {
+
+				currentTexture.id = texture->get();
+				textureBytes += bytes;
+				textureHandles.push_back(texture);
+			}
+
+			loadedTextures[path] = currentTexture;
 
 			return currentTexture;
 		}
 
-	// Reads the pixel data from an image file and loads it into the video memory
-	GLuint Model3D::ReadTextureFromFile(const char* file_name) {
+	gps::LayerRef Model3D::LoadTextureLayer(const std::string& path, gps::DecodedTexture*& decoded, gps::DecodedTexture& fallback) {
+
+		gps::MaterialTable& table = gps::MaterialTable::instance();
+		gps::LayerRef layer = table.findLayer(decoded->contentHash);
+		if (layer) {
+
+			textureBytes += table.getLayerSize(layer->array);
+			return layer;
+		}
+
+		// skipped at parse time, but the shared layer has been released since
+		if (!decoded->pixels && decoded->contentHash != 0) {
+
+			gps::TextureProcessor::FreePixels(fallback.pixels);
+			fallback = DecodeTexture(path);
+			decoded = &fallback;
+		}
+		if (!decoded->pixels) {
+
+			return gps::LayerRef();
+		}
+
+		layer = table.addLayer(decoded->contentHash, decoded->width, decoded->height, decoded->levels, decoded->format);
+		if (!layer) {
+
+			return gps::LayerRef();
+		}
+
+		if (asyncTextureUploads) {
+
+			// the uploader frees the pixels once they are in a pixel buffer
+			gps::TextureUploader::instance().uploadLayer(path, decoded->pixels, decoded->width, decoded->height, decoded->levels, decoded->format,
+				layer->array, layer->layer);
+			decoded->pixels = NULL;
+		}
+		else {
+
+			gps::LoadScope scope(path, gps::STAGE_GL_UPLOAD);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, table.getArrayTexture(layer->array));
+			gps::TextureUploader::uploadLevels(decoded->pixels, decoded->width, decoded->height, decoded->levels, decoded->format, layer->layer);
+			glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+		}
+		textureBytes += table.getLayerSize(layer->array);
+		return layer;
+	}
+
+	gps::DecodedTexture* Model3D::FindPendingTexture(const std::string& path) {
+
+		for (gps::DecodedTexture& texture : pendingTextures) {
+
+			if (texture.path == path)
+				return &texture;
+		}
+		return nullptr;
+	}
+
+	// Reads the cooked mip chain of an image file, or decodes the image, flips it to the GL row order, filters its mips,
+	// block compresses them if a compressed format is selected and cooks the result
+	gps::DecodedTexture Model3D::DecodeTexture(const std::string& path, bool skipRegistered) {
+
+		const char* file_name = path.c_str();
+		gps::DecodedTexture texture;
+		texture.path = path;
+		texture.pixels = NULL;
+		texture.width = 0;
+		texture.height = 0;
+		texture.levels = 0;
+		texture.format = gps::BlockCompressor::GetFormat();
+		texture.contentHash = 0;
+
+		gps::MipFilter filter = gps::TextureProcessor::GetMipFilter();
+		std::unique_ptr<gps::LoadScope> stageScope(new gps::LoadScope(path, gps::STAGE_FILE_IO));
+
+		// the cooked copy also carries the content hash, so a registered image is not even read
+		gps::TextureCache cache;
+		if (cache.load(path, filter, texture.format)) {
+
+			texture.contentHash = cache.getContentHash();
+			if (skipRegistered && isTextureResident(texture.contentHash)) {
+				return texture;
+			}
+
+			size_t bytes = gps::BlockCompressor::ChainSize(texture.format, cache.getWidth(), cache.getHeight(), cache.getLevels());
+			texture.pixels = gps::TextureProcessor::AllocatePixels(bytes);
+			if (texture.pixels) {
+				std::memcpy(texture.pixels, cache.getPixels(), bytes);
+				texture.width = cache.getWidth();
+				texture.height = cache.getHeight();
+				texture.levels = cache.getLevels();
+			}
+			gps::LoadProfiler::instance().addBytesRead(path, cache.getFileSize());
+			return texture;
+		}
+
+		std::ifstream file(path, std::ios::binary);
+		std::vector<unsigned char> fileData((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		if (!fileData.empty()) {
+			texture.contentHash = gps::ResourceRegistry::hashBytes(fileData.data(), fileData.size());
+		}
+		gps::LoadProfiler::instance().addBytesRead(path, fileData.size());
+		stageScope.reset();
+		if (skipRegistered && texture.contentHash != 0 && isTextureResident(texture.contentHash)) {
+			return texture;
+		}
 
 		int x, y, n;
 		int force_channels = 4;
-		unsigned char* image_data = stbi_load(file_name, &x, &y, &n, force_channels);
+		stageScope.reset(new gps::LoadScope(path, gps::STAGE_IMAGE_DECODE));
+		unsigned char* image_data = fileData.empty() ? NULL :
+			stbi_load_from_memory(fileData.data(), (int)fileData.size(), &x, &y, &n, force_channels);
+		stageScope.reset();
 
 		if (!image_data) {
 			fprintf(stderr, "ERROR: could not load %s\n", file_name);
-			return false;
+			return texture;
 		}
 		// NPOT check
 		if ((x & (x - 1)) != 0 || (y & (y - 1)) != 0) {
@@ -190,42 +1581,73 @@ namespace gps {
 			);
 		}
 
-		int width_in_bytes = x * 4;
-		unsigned char *top = NULL;
-		unsigned char *bottom = NULL;
-		unsigned char temp = 0;
-		int half_height = y / 2;
+		stageScope.reset(new gps::LoadScope(path, gps::STAGE_ROW_FLIP));
+		gps::TextureProcessor::FlipRows(image_data, x, y, force_channels);
 
-		for (int row = 0; row < half_height; row++) {
+		stageScope.reset(new gps::LoadScope(path, gps::STAGE_MIP_GENERATION));
+		texture.pixels = gps::TextureProcessor::BuildMipChain(image_data, x, y, filter);
+		stbi_image_free(image_data);
+		stageScope.reset();
 
-			top = image_data + row * width_in_bytes;
-			bottom = image_data + (y - row - 1) * width_in_bytes;
+		if (!texture.pixels) {
+			fprintf(stderr, "ERROR: out of memory for the mips of %s\n", file_name);
+			return texture;
+		}
+		texture.width = x;
+		texture.height = y;
+		texture.levels = gps::TextureProcessor::MipLevelCount(x, y);
+
+		if (texture.format != gps::FORMAT_RGBA8) {
+
+			// a one-off cost, later runs read the blocks from the cooked file
+			gps::LoadScope scope(path, gps::STAGE_BLOCK_COMPRESSION);
+			unsigned char* blocks = gps::BlockCompressor::CompressChain(texture.pixels, x, y, texture.levels, texture.format);
+			if (!blocks) {
+				// the RGBA8 chain draws as well, nothing is cooked so the next run compresses it again
+				fprintf(stderr, "WARNING: out of memory for the blocks of %s, kept uncompressed\n", file_name);
+				texture.format = gps::FORMAT_RGBA8;
+				return texture;
+			}
+			gps::TextureProcessor::FreePixels(texture.pixels);
+			texture.pixels = blocks;
+		}
+
+		gps::LoadScope cookScope(path, gps::STAGE_FILE_IO);
+		if (!gps::TextureCache::write(path, texture.contentHash, filter, texture.format, x, y, texture.levels, texture.pixels)) {
+			std::cerr << "WARNING: could not cook " << path << std::endl;
+		}
+		return texture;
+	}
 
-			for (int col = 0; col < width_in_bytes; col++) {
+	// Loads decoded pixel data into the video memory
+	GLuint Model3D::UploadTexture(const gps::DecodedTexture& texture) {
 
-				temp = *top;
-				*top = *bottom;
-				*bottom = temp;
-				top++;
-				bottom++;
-			}
+		if (!texture.pixels) {
+			return 0;
 		}
 
 		GLuint textureID;
 		glGenTextures(1, &textureID);
 		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(
-			GL_TEXTURE_2D,
-			0,
-			GL_SRGB, //GL_SRGB,//GL_RGBA,
-			x,
-			y,
-			0,
-			GL_RGBA,
-			GL_UNSIGNED_BYTE,
-			image_data
-		);
-		glGenerateMipmap(GL_TEXTURE_2D);
+		{
+			// the whole chain in one go, the mips were filtered on the CPU
+			gps::LoadScope scope(texture.path, gps::STAGE_GL_UPLOAD);
+			gps::TextureAllocator::beginAllocation();
+			gps::TextureUploader::allocateStorage(texture.width, texture.height, texture.levels, texture.format);
+			if (!gps::TextureAllocator::instance().track(textureID, GL_TEXTURE_2D, gps::BlockCompressor::GLInternalFormat(texture.format, true),
+				texture.width, texture.height, texture.levels, 1, texture.path, true)) {
+
+				// drawn without the texture, like one that failed to decode
+				glBindTexture(GL_TEXTURE_2D, 0);
+				glDeleteTextures(1, &textureID);
+				return 0;
+			}
+			gps::TextureUploader::uploadLevels(texture.pixels, texture.width, texture.height, texture.levels, texture.format);
+		}
+		if (texture.levels == 1 && texture.format == gps::FORMAT_RGBA8) {
+			gps::LoadScope scope(texture.path, gps::STAGE_MIP_GENERATION);
+			glGenerateMipmap(GL_TEXTURE_2D);
+		}
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -235,22 +1657,4 @@ namespace gps {
 
 		return textureID;
 	}
-
-	Model3D::~Model3D() {
-
-        for (size_t i = 0; i < loadedTextures.size(); i++) {
-
-            glDeleteTextures(1, &loadedTextures.at(i).id);
-        }
-
-        for (size_t i = 0; i < meshes.size(); i++) {
-
-            GLuint VBO = meshes.at(i).getBuffers().VBO;
-            GLuint EBO = meshes.at(i).getBuffers().EBO;
-            GLuint VAO = meshes.at(i).getBuffers().VAO;
-            glDeleteBuffers(1, &VBO);
-            glDeleteBuffers(1, &EBO);
-            glDeleteVertexArrays(1, &VAO);
-        }
-	}
 }
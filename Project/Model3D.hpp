@@ -2,41 +2,334 @@
 #define Model3D_hpp
 
 #include "Mesh.hpp"
+#include "BlockCompressor.hpp"
+#include "GLHandle.hpp"
+#include "MeshCache.hpp"
+#include "MaterialTable.hpp"
+#include "ObjParser.hpp"
+#include "LockFreeQueue.hpp"
+#include "MeshOptimizer.hpp"
+#include "Meshlet.hpp"
+#include "ResourceRegistry.hpp"
 
 #include "tiny_obj_loader.h"
 #include "stb_image.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
 #include <iostream>
+#include <memory>
+#include <mutex>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 namespace gps {
 
+    // Mip chain of an image file, already flipped to the GL row order, RGBA8 or block compressed
+    struct DecodedTexture {
+
+        std::string path;
+        int width;
+        int height;
+        int levels;
+        TextureFormat format;
+        // every level back to back, owned by the TextureProcessor allocator
+        unsigned char* pixels;
+        // hash of the image file, the registry key of the uploaded texture
+        uint64_t contentHash;
+    };
+
+    enum ModelLoadState { MODEL_EMPTY, MODEL_PARSING, MODEL_PARSED, MODEL_RESIDENT, MODEL_FAILED };
+
+    // Progress of a LoadModelAsync request, safe to query from any thread
+    class ModelLoadHandle {
+
+    public:
+        ModelLoadHandle();
+
+        ModelLoadState getState() const;
+        bool isResident() const;
+        bool hasFailed() const;
+
+    private:
+        friend class Model3D;
+        std::shared_ptr<std::atomic<int> > state;
+    };
+
+    // Camera parameters for picking a level of detail and culling meshlets, set once per pass
+    struct LodView {
+
+        glm::vec3 cameraPosition;
+        // projection * view of the pass, the frustum the meshlets are culled against
+        glm::mat4 viewProjection;
+        bool clusterCulling;
+        // where the culling counts go, may be null
+        gps::ClusterCullStats* cullStats;
+        // viewport height / (2 tan(fovY / 2)), turns an error at distance 1 into pixels
+        float pixelScale;
+        // largest projected error in pixels a level may have
+        float pixelError;
+        // the shadow pass scales pixelError by shadowBias and switches levels without fading
+        bool shadowPass;
+        float shadowBias;
+        double time;
+    };
+
+    // LOD state of one placement of a model
+    struct LodInstance {
+
+        int lod;
+        int fadingFrom;
+        double fadeStart;
+        int shadowLod;
+
+        LodInstance() : lod(-1), fadingFrom(-1), fadeStart(0.0), shadowLod(-1) {
+        }
+    };
+
+    // Bytes a model keeps resident, GPU sizes are what was handed to GL
+    struct ModelMemoryUsage {
+
+        size_t vertexBytes;
+        size_t indexBytes;
+        // full mip chains, 4 bytes per texel
+        size_t textureBytes;
+        // kept mesh arrays and LOD/meshlet tables, plus parsed data still waiting for upload
+        size_t cpuBytes;
+    };
+
+    // Owns its meshes and textures: movable, but not while a LoadModelAsync is in flight (the loader holds its address)
     class Model3D {
 
     public:
-        ~Model3D();
+        Model3D();
+
+        Model3D(Model3D&& other) = default;
+        Model3D& operator=(Model3D&& other) = default;
+        Model3D(const Model3D&) = delete;
+        Model3D& operator=(const Model3D&) = delete;
+
+		// Meshes uploaded from now on keep or drop their CPU vertices/indices, RELEASE_CPU_DATA by default
+		void SetCpuDataPolicy(gps::CpuDataPolicy policy);
+
+		ModelMemoryUsage GetMemoryUsage() const;
+
+		// Prints the GPU and CPU bytes of the model under the given name
+		void PrintMemoryReport(const std::string& name) const;
 
 		void LoadModel(std::string fileName);
 
 		void LoadModel(std::string fileName, std::string basePath);
 
+		// CPU half of LoadModel - parses the model and decodes its textures, safe to run on a worker thread
+		bool ParseModel(std::string fileName);
+
+		bool ParseModel(std::string fileName, std::string basePath);
+
+		// GL half of LoadModel - creates the buffers and textures from the parsed data, needs the GL context
+		void UploadModel();
+
+		// Parses on the background loader, ProcessUploads later moves the result into GL buffers
+		ModelLoadHandle LoadModelAsync(std::string fileName);
+
+		// Uploads parsed async models and queued texture pixels on the GL thread for at most budgetMs (at least one mesh
+		// per call), returns true once no async load or texture upload is left in flight
+		static bool ProcessUploads(double budgetMs);
+
+		// Draws the model, or a bounding-box proxy while it is still loading asynchronously
 		void Draw(gps::Shader shaderProgram);
 
+		// Draws the level of detail that fits the projected size of the model under modelMatrix
+		void Draw(gps::Shader shaderProgram, const glm::mat4& modelMatrix, const LodView& view, LodInstance& instance);
+
+		// Coarsest level whose projected error stays under pixelError
+		int SelectLod(const glm::mat4& modelMatrix, const LodView& view, float pixelError) const;
+
+		// Times the .obj parse against loading the binary cache of the same file
+		static void BenchmarkLoad(std::string fileName, int iterations);
+
+		// Runs the MeshOptimizer passes on freshly parsed meshes before they are cached and uploaded
+		static void SetMeshOptimization(bool enabled);
+
+		// Parses the .obj and prints the optimizer statistics of every mesh, without touching GL or the cache
+		static void AnalyzeOptimization(std::string fileName);
+
+		// Packs every mesh of the .obj into the quantized layout and checks the decoded attributes against the floats
+		static bool VerifyQuantization(std::string fileName);
+
+		// Combines the shapes that share a material into one mesh, off by default
+		static void SetMaterialMerging(bool enabled);
+
+		// Builds a quadric-simplified LOD chain for freshly parsed meshes, on by default
+		static void SetLodGeneration(bool enabled);
+
+		// Parses the .obj and prints triangles against error for every level, without touching GL or the cache
+		static void ReportLods(std::string fileName);
+
+		// On a cache miss, streams the .obj in segments of at most budgetBytes that go to the GPU while the rest of the file
+		// is still being read, instead of parsing it whole first. 0 (the default) turns it off.
+		// Streamed models are neither merged by material nor written to the cache.
+		static void SetStreamingImport(size_t budgetBytes);
+
+		// Wakes loader threads waiting for the GL thread to take streamed segments and makes them give up, before shutdown
+		static void CancelStreamingImports();
+
+		// Fills new textures through TextureUploader, off the render thread's critical path, instead of glTexImage2D
+		// from client memory. On by default; LoadModel waits for its textures either way.
+		static void SetAsyncTextureUploads(bool enabled);
+
+		// Creates textures with only their coarse levels and streams the finer ones in as the projected texel density of
+		// the models asks for them, keeping at most budgetBytes of streamed levels resident. 0 (the default) loads every
+		// level up front. Streamed textures stay out of the MaterialTable.
+		static void SetTextureStreaming(size_t budgetBytes);
+
     private:
-		// Component meshes - group of objects
-        std::vector<gps::Mesh> meshes;
-		// Associated textures
-        std::vector<gps::Texture> loadedTextures;
+		// Component meshes - group of objects, shared with every model that has the same mesh content
+        std::vector<gps::MeshRef> meshes;
+		// Associated textures by path, kept alive through textureHandles or, in the material table, layerHandles
+        std::unordered_map<std::string, gps::Texture> loadedTextures;
+        std::vector<gps::TextureRef> textureHandles;
+        std::vector<gps::LayerRef> layerHandles;
+        size_t textureBytes;
+
+		gps::CpuDataPolicy cpuDataPolicy;
+
+		// Results of ParseModel waiting for UploadModel
+		std::string pendingFileName;
+		std::string pendingBasePath;
+		gps::MeshCache pendingCache;
+		std::vector<gps::MeshData> pendingMeshData;
+		std::vector<gps::DecodedTexture> pendingTextures;
+		// one list per pending mesh, in upload order
+		std::vector<std::vector<gps::Meshlet> > pendingMeshlets;
+		// geometry part of each pending mesh's registry key, in upload order
+		std::vector<uint64_t> pendingMeshHashes;
+		size_t uploadedMeshes;
+
+		// Model-space bounds of all meshes, known once parsing finished
+		glm::vec3 boundsMin;
+		glm::vec3 boundsMax;
+		gps::GLVertexArray proxyVAO;
+		gps::GLBuffer proxyVBO;
+
+		// Largest mesh error of each model level of detail, in model units
+		std::vector<float> lodErrors;
+
+		// scratch list for the meshlets that survive culling
+		std::vector<GLuint> visibleMeshlets;
+
+		// Streamed textures of the meshes and the texture coordinates per model unit they are mapped at
+		struct TextureDensity {
+
+			GLuint texture;
+			float uvPerUnit;
+		};
+		std::vector<TextureDensity> textureDensities;
+
+		std::shared_ptr<std::atomic<int> > loadState;
+
+		// Segment of a streaming import, prepared on the loader thread
+		struct StreamedMesh {
+
+			gps::MeshData data;
+			std::vector<gps::Meshlet> meshlets;
+			uint64_t contentHash;
+			size_t bytes;
+		};
+
+		// Segments on their way from the loader thread to the GL thread, at most streamingBudget bytes queued at a time
+		struct ImportStream {
+
+			std::mutex mutex;
+			std::condition_variable drained;
+			std::deque<StreamedMesh> meshes;
+			size_t queuedBytes;
+			bool finished;
+			bool failed;
+
+			ImportStream() : queuedBytes(0), finished(false), failed(false) {
+			}
+		};
+
+		// set while an async streaming import feeds this model
+		std::shared_ptr<ImportStream> importStream;
+		// ParseModel runs on the loader job of LoadModelAsync
+		bool asyncLoad;
+		// the last ParseModel streamed and already handed the model to the GL thread, loader thread only
+		bool streamedImport;
 
-		// Does the parsing of the .obj file and fills in the data structure
-		void ReadOBJ(std::string fileName, std::string basePath);
+		// Models parsed by the loader threads, handed to the GL thread without locking
+		static gps::LockFreeQueue<Model3D*> parsedModels;
+		// GL-thread side: models with a proxy waiting for their meshes to be uploaded
+		static std::deque<Model3D*> uploadQueue;
+		static std::atomic<int> asyncLoadsInFlight;
+
+		static bool meshOptimization;
+		static bool lodGeneration;
+		static bool materialMerging;
+		static size_t streamingBudget;
+		static std::atomic<bool> streamingCancelled;
+		static bool asyncTextureUploads;
+
+		// Concatenates the meshes with identical materials, every LOD level of the result covers all of its shapes
+		static void MergeMeshesByMaterial(std::vector<gps::MeshData>& meshData);
+		static const double LOD_FADE_SECONDS;
+
+		// Appends the LOD chain to every mesh and prints the triangle count and error of each level
+		static void GenerateLods(std::vector<gps::MeshData>& meshData);
+
+		// fade > 0 fades the level in, fade < 0 fades it out, 0 draws it opaque
+		void DrawLevel(gps::Shader shaderProgram, const glm::mat4& modelMatrix, const LodView& view, int lod, float fade);
+
+		// Records how densely a mesh maps its textures, for the texture streamer
+		void TrackTextureDensity(const std::vector<gps::Texture>& textures, const gps::Vertex* vertices, const GLuint* indices, size_t indexCount);
+
+		// Asks the texture streamer for the levels the model needs at its projected size
+		void RequestTextureDetail(const glm::mat4& modelMatrix, const LodView& view) const;
+
+		// Optimizes every mesh in place and prints ACMR/ATVR/overdraw before and after
+		static void OptimizeMeshes(std::vector<gps::MeshData>& meshData);
+
+		// Uploads one more pending mesh, returns true when every mesh is resident
+		bool UploadNextMesh();
+
+		void CreateProxy();
+		void DeleteProxy();
+
+		// Streaming ParseModel: optimizes each segment as it is read and uploads it, directly or through importStream
+		bool StreamOBJ(const std::string& fileName, const std::string& basePath);
+
+		// Creates the mesh of a streamed segment and grows the bounds and LOD errors by it, GL thread only
+		void UploadStreamedMesh(StreamedMesh& mesh);
+
+		// Registry key of a mesh once its textures are loaded
+		uint64_t MeshKey(uint64_t contentHash, const std::vector<gps::Texture>& textures, int materialIndex) const;
+
+		// Material table entry of a mesh, -1 if the table is off or one of its textures did not get a layer
+		static int MaterialIndex(const gps::MeshInfo& info, const std::vector<gps::Texture>& textures);
+
+		// Does the parsing of the .obj file and fills in the CPU mesh data
+		static bool ReadOBJ(std::string fileName, std::string basePath, std::vector<gps::MeshData>& meshData);
+
+		// Loads the textures named by a mesh material
+		std::vector<gps::Texture> LoadMeshTextures(const gps::MeshInfo& info, const std::string& basePath);
 
 		// Retrieves a texture associated with the object - by its name and type
 		gps::Texture LoadTexture(std::string path, std::string type);
 
-		// Reads the pixel data from an image file and loads it into the video memory
-		GLuint ReadTextureFromFile(const char* file_name);
+		// Finds or fills the material table layer of an image, null if its shape does not fit the table
+		gps::LayerRef LoadTextureLayer(const std::string& path, gps::DecodedTexture*& decoded, gps::DecodedTexture& fallback);
+
+		gps::DecodedTexture* FindPendingTexture(const std::string& path);
+
+		// Reads the cooked mip chain of an image file, or decodes, flips, filters, compresses and cooks the image.
+		// skipRegistered only hashes the file when the registry already holds its content.
+		static gps::DecodedTexture DecodeTexture(const std::string& path, bool skipRegistered = false);
+
+		// Loads decoded pixel data into the video memory
+		static GLuint UploadTexture(const gps::DecodedTexture& texture);
     };
 }
 
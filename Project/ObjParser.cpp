@@ -0,0 +1,653 @@
+#include "ObjParser.hpp"
+#include "MappedFile.hpp"
+#include "LoadProfiler.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <thread>
+
+namespace gps {
+
+    namespace {
+
+        // chunks smaller than this are not worth a thread
+        const size_t MIN_CHUNK_BYTES = 256 * 1024;
+
+        enum ObjEventType { EVENT_USEMTL, EVENT_MTLLIB, EVENT_GROUP, EVENT_OBJECT };
+
+        // Statement that changes the shape/material state, replayed in file order after the parallel pass
+        struct ObjEvent {
+
+            ObjEventType type;
+            std::string name;
+            size_t faceCount;
+            size_t triangleCount;
+        };
+
+        struct ChunkResult {
+
+            std::vector<float> v;
+            std::vector<float> vn;
+            std::vector<float> vt;
+            // three corners per triangle, in face order
+            std::vector<tinyobj::index_t> corners;
+            // negative (relative) indices resolved against the chunk start, as corner * 4 + component
+            std::vector<size_t> relativeIndices;
+            std::vector<ObjEvent> events;
+            size_t faceCount;
+            size_t triangleCount;
+        };
+
+        inline bool isSpace(char c) {
+
+            return c == ' ' || c == '\t';
+        }
+
+        inline char charAt(const char* p, const char* end, size_t offset) {
+
+            return (p + offset < end) ? p[offset] : '\0';
+        }
+
+        inline const char* skipSpaces(const char* p, const char* end) {
+
+            while (p < end && isSpace(*p))
+                p++;
+            return p;
+        }
+
+        // first of " \t\r" - lines never contain '\r' here, so just blanks
+        inline const char* findTokenEnd(const char* p, const char* end) {
+
+            while (p < end && !isSpace(*p) && *p != '\r')
+                p++;
+            return p;
+        }
+
+        inline const char* findTripleEnd(const char* p, const char* end) {
+
+            while (p < end && *p != '/' && !isSpace(*p) && *p != '\r')
+                p++;
+            return p;
+        }
+
+        inline bool isDigit(char c) {
+
+            return static_cast<unsigned int>(c - '0') < 10u;
+        }
+
+        // atoi bounded by the line end
+        inline int parseIntRange(const char* p, const char* end) {
+
+            while (p < end && (isSpace(*p) || *p == '\v' || *p == '\f' || *p == '\r' || *p == '\n'))
+                p++;
+            bool negative = false;
+            if (p < end && (*p == '+' || *p == '-')) {
+                negative = (*p == '-');
+                p++;
+            }
+            int value = 0;
+            while (p < end && isDigit(*p)) {
+                value = value * 10 + (*p - '0');
+                p++;
+            }
+            return negative ? -value : value;
+        }
+
+        // from_chars-style parser over [first, last) using the same arithmetic as tinyobj's tryParseDouble,
+        // so every float comes out bit-identical to the reference loader
+        const char* parseDoubleRange(const char* first, const char* last, double& result) {
+
+            if (first >= last) {
+                return first;
+            }
+
+            double mantissa = 0.0;
+            int exponent = 0;
+            char sign = '+';
+            char exponentSign = '+';
+            const char* current = first;
+            int read = 0;
+
+            if (*current == '+' || *current == '-') {
+                sign = *current;
+                current++;
+            } else if (!isDigit(*current)) {
+                return first;
+            }
+
+            while (current != last && isDigit(*current)) {
+                mantissa *= 10;
+                mantissa += static_cast<int>(*current - 0x30);
+                current++;
+                read++;
+            }
+
+            if (read == 0) {
+                return first;
+            }
+
+            if (current != last) {
+
+                if (*current == '.') {
+                    current++;
+                    read = 1;
+                    while (current != last && isDigit(*current)) {
+                        static const double powLut[] = { 1.0, 0.1, 0.01, 0.001, 0.0001, 0.00001, 0.000001, 0.0000001 };
+                        const int lutEntries = sizeof powLut / sizeof powLut[0];
+                        mantissa += static_cast<int>(*current - 0x30) * (read < lutEntries ? powLut[read] : pow(10.0, -read));
+                        read++;
+                        current++;
+                    }
+                }
+
+                if (current != last && (*current == 'e' || *current == 'E')) {
+                    current++;
+                    if (current != last && (*current == '+' || *current == '-')) {
+                        exponentSign = *current;
+                        current++;
+                    } else if (current == last || !isDigit(*current)) {
+                        return first;
+                    }
+
+                    read = 0;
+                    while (current != last && isDigit(*current)) {
+                        exponent *= 10;
+                        exponent += static_cast<int>(*current - 0x30);
+                        current++;
+                        read++;
+                    }
+                    exponent *= (exponentSign == '+' ? 1 : -1);
+                    if (read == 0) {
+                        return first;
+                    }
+                }
+            }
+
+            result = (sign == '+' ? 1 : -1) * (exponent ? ldexp(mantissa * pow(5.0, exponent), exponent) : mantissa);
+            return current;
+        }
+
+        inline float parseFloat(const char*& p, const char* end) {
+
+            p = skipSpaces(p, end);
+            const char* tokenEnd = findTokenEnd(p, end);
+            double value = 0.0;
+            parseDoubleRange(p, tokenEnd, value);
+            p = tokenEnd;
+            return static_cast<float>(value);
+        }
+
+        // first blank-delimited word, like sscanf("%s")
+        inline std::string parseWord(const char* p, const char* end) {
+
+            while (p < end && (isSpace(*p) || *p == '\v' || *p == '\f'))
+                p++;
+            const char* wordEnd = p;
+            while (wordEnd < end && !isSpace(*wordEnd) && *wordEnd != '\v' && *wordEnd != '\f')
+                wordEnd++;
+            return std::string(p, wordEnd);
+        }
+
+        // fixIndex() against the counts seen so far in this chunk - negative results are fixed up after the merge
+        inline int chunkIndex(int idx, size_t localCount, ChunkResult& chunk, size_t corner, size_t component) {
+
+            if (idx > 0) return idx - 1;
+            if (idx == 0) return 0;
+            chunk.relativeIndices.push_back(corner * 4 + component);
+            return static_cast<int>(localCount) + idx;
+        }
+
+        void parseFace(const char* p, const char* end, ChunkResult& chunk, std::vector<tinyobj::index_t>& face) {
+
+            face.clear();
+            size_t vCount = chunk.v.size() / 3;
+            size_t vnCount = chunk.vn.size() / 3;
+            size_t vtCount = chunk.vt.size() / 2;
+
+            p = skipSpaces(p, end);
+            while (p < end) {
+
+                // corner indices are resolved once their final corner slot is known
+                tinyobj::index_t raw;
+                raw.vertex_index = parseIntRange(p, end);
+                raw.texcoord_index = 0;
+                raw.normal_index = 0;
+                int hasTexcoord = 0;
+                int hasNormal = 0;
+
+                p = findTripleEnd(p, end);
+                if (p < end && *p == '/') {
+                    p++;
+                    if (p < end && *p == '/') {
+                        p++;
+                        raw.normal_index = parseIntRange(p, end);
+                        hasNormal = 1;
+                        p = findTripleEnd(p, end);
+                    } else {
+                        raw.texcoord_index = parseIntRange(p, end);
+                        hasTexcoord = 1;
+                        p = findTripleEnd(p, end);
+                        if (p < end && *p == '/') {
+                            p++;
+                            raw.normal_index = parseIntRange(p, end);
+                            hasNormal = 1;
+                            p = findTripleEnd(p, end);
+                        }
+                    }
+                }
+
+                // -1 marks a missing component, like tinyobj's vertex_index(-1)
+                if (!hasTexcoord) raw.texcoord_index = INT_MIN;
+                if (!hasNormal) raw.normal_index = INT_MIN;
+                face.push_back(raw);
+
+                while (p < end && (isSpace(*p) || *p == '\r'))
+                    p++;
+            }
+
+            chunk.faceCount++;
+
+            // polygon -> triangle fan, as exportFaceGroupToShape does
+            for (size_t k = 2; k < face.size(); k++) {
+
+                const tinyobj::index_t* triangle[3] = { &face[0], &face[k - 1], &face[k] };
+                for (int c = 0; c < 3; c++) {
+
+                    size_t corner = chunk.corners.size();
+                    tinyobj::index_t idx;
+                    idx.vertex_index = chunkIndex(triangle[c]->vertex_index, vCount, chunk, corner, 0);
+                    idx.normal_index = (triangle[c]->normal_index == INT_MIN) ? -1 : chunkIndex(triangle[c]->normal_index, vnCount, chunk, corner, 1);
+                    idx.texcoord_index = (triangle[c]->texcoord_index == INT_MIN) ? -1 : chunkIndex(triangle[c]->texcoord_index, vtCount, chunk, corner, 2);
+                    chunk.corners.push_back(idx);
+                }
+            }
+        }
+
+        void addEvent(ChunkResult& chunk, ObjEventType type, const std::string& name) {
+
+            ObjEvent event;
+            event.type = type;
+            event.name = name;
+            event.faceCount = chunk.faceCount;
+            event.triangleCount = chunk.corners.size() / 3;
+            chunk.events.push_back(event);
+        }
+
+        void parseChunk(const char* begin, const char* end, ChunkResult& chunk) {
+
+            chunk.faceCount = 0;
+            std::vector<tinyobj::index_t> face;
+
+            const char* lineStart = begin;
+            while (lineStart < end) {
+
+                // lines end at '\n', '\r' or "\r\n" - empty lines are skipped anyway
+                const char* lineEnd = lineStart;
+                while (lineEnd < end && *lineEnd != '\n' && *lineEnd != '\r')
+                    lineEnd++;
+
+                const char* token = skipSpaces(lineStart, lineEnd);
+                const char* p = token;
+                const char* e = lineEnd;
+                lineStart = lineEnd + 1;
+
+                if (p == e || *p == '#') {
+                    continue;
+                }
+
+                char c0 = *p;
+                char c1 = charAt(p, e, 1);
+
+                if (c0 == 'v' && isSpace(c1)) {
+                    p += 2;
+                    float x = parseFloat(p, e);
+                    float y = parseFloat(p, e);
+                    float z = parseFloat(p, e);
+                    chunk.v.push_back(x);
+                    chunk.v.push_back(y);
+                    chunk.v.push_back(z);
+                    continue;
+                }
+
+                if (c0 == 'v' && c1 == 'n' && isSpace(charAt(p, e, 2))) {
+                    p += 3;
+                    float x = parseFloat(p, e);
+                    float y = parseFloat(p, e);
+                    float z = parseFloat(p, e);
+                    chunk.vn.push_back(x);
+                    chunk.vn.push_back(y);
+                    chunk.vn.push_back(z);
+                    continue;
+                }
+
+                if (c0 == 'v' && c1 == 't' && isSpace(charAt(p, e, 2))) {
+                    p += 3;
+                    float x = parseFloat(p, e);
+                    float y = parseFloat(p, e);
+                    chunk.vt.push_back(x);
+                    chunk.vt.push_back(y);
+                    continue;
+                }
+
+                if (c0 == 'f' && isSpace(c1)) {
+                    parseFace(p + 2, e, chunk, face);
+                    continue;
+                }
+
+                if (e - p >= 7 && std::strncmp(p, "usemtl", 6) == 0 && isSpace(p[6])) {
+                    addEvent(chunk, EVENT_USEMTL, parseWord(p + 7, e));
+                    continue;
+                }
+
+                if (e - p >= 7 && std::strncmp(p, "mtllib", 6) == 0 && isSpace(p[6])) {
+                    addEvent(chunk, EVENT_MTLLIB, parseWord(p + 7, e));
+                    continue;
+                }
+
+                if (c0 == 'g' && isSpace(c1)) {
+                    // names[0] is the 'g' itself, the group takes the first name after it
+                    const char* q = skipSpaces(p + 1, e);
+                    const char* nameEnd = findTokenEnd(q, e);
+                    addEvent(chunk, EVENT_GROUP, std::string(q, nameEnd));
+                    continue;
+                }
+
+                if (c0 == 'o' && isSpace(c1)) {
+                    addEvent(chunk, EVENT_OBJECT, parseWord(p + 2, e));
+                    continue;
+                }
+
+                // 't' tags and unknown statements are not used by Model3D
+            }
+        }
+
+        // Appends a run of faces to the current shape, like tinyobj's exportFaceGroupToShape
+        void exportFaceGroup(tinyobj::shape_t& shape, const std::vector<tinyobj::index_t>& corners,
+                             size_t firstTriangle, size_t lastTriangle, int materialId, const std::string& name) {
+
+            shape.mesh.indices.insert(shape.mesh.indices.end(), corners.begin() + firstTriangle * 3, corners.begin() + lastTriangle * 3);
+            shape.mesh.num_face_vertices.insert(shape.mesh.num_face_vertices.end(), lastTriangle - firstTriangle, 3);
+            shape.mesh.material_ids.insert(shape.mesh.material_ids.end(), lastTriangle - firstTriangle, materialId);
+            shape.name = name;
+        }
+    }
+
+    bool ObjParser::Load(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes, std::vector<tinyobj::material_t>* materials,
+                         std::string* err, const std::string& fileName, const std::string& basePath, unsigned threadCount) {
+
+        attrib->vertices.clear();
+        attrib->normals.clear();
+        attrib->texcoords.clear();
+        shapes->clear();
+
+        LoadProfiler& profiler = LoadProfiler::instance();
+        std::unique_ptr<LoadScope> stageScope(new LoadScope(fileName, STAGE_FILE_IO));
+
+        MappedFile file;
+        if (!file.open(fileName)) {
+            // an empty file is a valid, empty model
+            std::ifstream probe(fileName);
+            if (!probe) {
+                if (err) {
+                    (*err) = "Cannot open file [" + fileName + "]\n";
+                }
+                return false;
+            }
+            return true;
+        }
+
+        const char* data = reinterpret_cast<const char*>(file.data());
+        size_t size = file.size();
+
+        if (profiler.isEnabled()) {
+            // fault the mapping in up front, otherwise the disk reads would be counted as parsing
+            volatile unsigned char touched = 0;
+            for (size_t offset = 0; offset < size; offset += 4096) {
+                touched ^= static_cast<unsigned char>(data[offset]);
+            }
+            profiler.addBytesRead(fileName, size);
+        }
+        stageScope.reset(new LoadScope(fileName, STAGE_PARSE));
+
+        if (threadCount == 0) {
+            threadCount = std::max(1u, std::thread::hardware_concurrency());
+        }
+        size_t chunkCount = std::max<size_t>(1, std::min<size_t>(threadCount, size / MIN_CHUNK_BYTES));
+
+        // newline-aligned chunk boundaries
+        std::vector<const char*> boundaries;
+        boundaries.push_back(data);
+        for (size_t i = 1; i < chunkCount; i++) {
+            const char* split = std::max(boundaries.back(), data + size * i / chunkCount);
+            while (split < data + size && *split != '\n' && *split != '\r')
+                split++;
+            if (split < data + size)
+                split++;
+            boundaries.push_back(split);
+        }
+        boundaries.push_back(data + size);
+        chunkCount = boundaries.size() - 1;
+
+        std::vector<ChunkResult> chunks(chunkCount);
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < chunkCount; i++) {
+            workers.push_back(std::thread(parseChunk, boundaries[i], boundaries[i + 1], std::ref(chunks[i])));
+        }
+        parseChunk(boundaries[0], boundaries[1], chunks[0]);
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+
+        // the fans are split while parsing, this is gathering the triangles into the final attribute and shape arrays
+        stageScope.reset(new LoadScope(fileName, STAGE_TRIANGULATE));
+
+        // merge the attribute arrays and the triangle stream in file order
+        size_t totalV = 0, totalVn = 0, totalVt = 0, totalCorners = 0;
+        for (const ChunkResult& chunk : chunks) {
+            totalV += chunk.v.size();
+            totalVn += chunk.vn.size();
+            totalVt += chunk.vt.size();
+            totalCorners += chunk.corners.size();
+        }
+        attrib->vertices.reserve(totalV);
+        attrib->normals.reserve(totalVn);
+        attrib->texcoords.reserve(totalVt);
+
+        std::vector<tinyobj::index_t> corners;
+        corners.reserve(totalCorners);
+
+        for (ChunkResult& chunk : chunks) {
+
+            int baseV = static_cast<int>(attrib->vertices.size() / 3);
+            int baseVn = static_cast<int>(attrib->normals.size() / 3);
+            int baseVt = static_cast<int>(attrib->texcoords.size() / 2);
+            for (size_t fix : chunk.relativeIndices) {
+                tinyobj::index_t& idx = chunk.corners[fix / 4];
+                switch (fix % 4) {
+                    case 0: idx.vertex_index += baseV; break;
+                    case 1: idx.normal_index += baseVn; break;
+                    default: idx.texcoord_index += baseVt; break;
+                }
+            }
+
+            attrib->vertices.insert(attrib->vertices.end(), chunk.v.begin(), chunk.v.end());
+            attrib->normals.insert(attrib->normals.end(), chunk.vn.begin(), chunk.vn.end());
+            attrib->texcoords.insert(attrib->texcoords.end(), chunk.vt.begin(), chunk.vt.end());
+            corners.insert(corners.end(), chunk.corners.begin(), chunk.corners.end());
+            chunk.triangleCount = chunk.corners.size() / 3;
+
+            std::vector<float>().swap(chunk.v);
+            std::vector<float>().swap(chunk.vn);
+            std::vector<float>().swap(chunk.vt);
+            std::vector<tinyobj::index_t>().swap(chunk.corners);
+        }
+
+        // replay the shape/material statements in file order, exactly as tinyobj's line loop does
+        tinyobj::MaterialFileReader materialReader(basePath);
+        std::map<std::string, int> materialMap;
+        int material = -1;
+        std::string name;
+        tinyobj::shape_t shape;
+
+        size_t faceBase = 0;
+        size_t triangleBase = 0;
+        size_t groupFace = 0;
+        size_t groupTriangle = 0;
+
+        for (const ChunkResult& chunk : chunks) {
+
+            for (const ObjEvent& event : chunk.events) {
+
+                size_t faceAt = faceBase + event.faceCount;
+                size_t triangleAt = triangleBase + event.triangleCount;
+                bool hasFaces = faceAt > groupFace;
+
+                if (event.type == EVENT_USEMTL) {
+
+                    std::map<std::string, int>::const_iterator found = materialMap.find(event.name);
+                    int newMaterialId = (found != materialMap.end()) ? found->second : -1;
+                    if (newMaterialId != material) {
+                        if (hasFaces) {
+                            exportFaceGroup(shape, corners, groupTriangle, triangleAt, material, name);
+                        }
+                        groupFace = faceAt;
+                        groupTriangle = triangleAt;
+                        material = newMaterialId;
+                    }
+                }
+                else if (event.type == EVENT_MTLLIB) {
+
+                    std::string materialError;
+                    materialReader(event.name, materials, &materialMap, &materialError);
+                    if (err) {
+                        (*err) += materialError;
+                    }
+                }
+                else {
+
+                    if (hasFaces) {
+                        exportFaceGroup(shape, corners, groupTriangle, triangleAt, material, name);
+                        shapes->push_back(shape);
+                    }
+                    shape = tinyobj::shape_t();
+                    groupFace = faceAt;
+                    groupTriangle = triangleAt;
+                    name = event.name;
+                }
+            }
+
+            faceBase += chunk.faceCount;
+            triangleBase += chunk.triangleCount;
+        }
+
+        size_t triangleCount = corners.size() / 3;
+        if (faceBase > groupFace) {
+            exportFaceGroup(shape, corners, groupTriangle, triangleCount, material, name);
+            shapes->push_back(shape);
+        }
+        else if (!shape.mesh.indices.empty()) {
+            shapes->push_back(shape);
+        }
+
+        return true;
+    }
+
+    bool ObjParser::Verify(const std::string& fileName, const std::string& basePath, unsigned threadCount) {
+
+        tinyobj::attrib_t referenceAttrib, attrib;
+        std::vector<tinyobj::shape_t> referenceShapes, shapes;
+        std::vector<tinyobj::material_t> referenceMaterials, materials;
+        std::string referenceErr, err;
+
+        bool referenceOk = tinyobj::LoadObj(&referenceAttrib, &referenceShapes, &referenceMaterials, &referenceErr, fileName.c_str(), basePath.c_str(), true);
+        bool ok = Load(&attrib, &shapes, &materials, &err, fileName, basePath, threadCount);
+
+        bool same = referenceOk == ok
+            && referenceAttrib.vertices.size() == attrib.vertices.size()
+            && referenceAttrib.normals.size() == attrib.normals.size()
+            && referenceAttrib.texcoords.size() == attrib.texcoords.size()
+            && std::memcmp(referenceAttrib.vertices.data(), attrib.vertices.data(), attrib.vertices.size() * sizeof(float)) == 0
+            && std::memcmp(referenceAttrib.normals.data(), attrib.normals.data(), attrib.normals.size() * sizeof(float)) == 0
+            && std::memcmp(referenceAttrib.texcoords.data(), attrib.texcoords.data(), attrib.texcoords.size() * sizeof(float)) == 0
+            && referenceShapes.size() == shapes.size()
+            && referenceMaterials.size() == materials.size();
+
+        for (size_t s = 0; same && s < shapes.size(); s++) {
+
+            const tinyobj::mesh_t& a = referenceShapes[s].mesh;
+            const tinyobj::mesh_t& b = shapes[s].mesh;
+            same = referenceShapes[s].name == shapes[s].name
+                && a.num_face_vertices == b.num_face_vertices
+                && a.material_ids == b.material_ids
+                && a.indices.size() == b.indices.size();
+
+            for (size_t i = 0; same && i < a.indices.size(); i++) {
+                same = a.indices[i].vertex_index == b.indices[i].vertex_index
+                    && a.indices[i].normal_index == b.indices[i].normal_index
+                    && a.indices[i].texcoord_index == b.indices[i].texcoord_index;
+            }
+        }
+
+        std::cout << "Verify : " << fileName << (same ? " matches" : " DIFFERS FROM") << " tinyobj" << std::endl;
+        return same;
+    }
+
+    void ObjParser::Benchmark(const std::string& fileName, int iterations) {
+
+        typedef std::chrono::high_resolution_clock Clock;
+        std::string basePath = fileName.substr(0, fileName.find_last_of('/')) + "/";
+
+        MappedFile file;
+        if (!file.open(fileName)) {
+            std::cerr << "ERROR: could not open " << fileName << std::endl;
+            return;
+        }
+        double megabytes = file.size() / (1024.0 * 1024.0);
+        file.close();
+
+        std::cout << "OBJ parse benchmark : " << fileName << " (" << megabytes << " MB)" << std::endl;
+
+        tinyobj::attrib_t attrib;
+        std::vector<tinyobj::shape_t> shapes;
+        std::vector<tinyobj::material_t> materials;
+        std::string err;
+
+        Clock::time_point start = Clock::now();
+        for (int i = 0; i < iterations; i++) {
+            materials.clear();
+            tinyobj::LoadObj(&attrib, &shapes, &materials, &err, fileName.c_str(), basePath.c_str(), true);
+        }
+        double referenceSeconds = std::chrono::duration<double>(Clock::now() - start).count() / iterations;
+
+        size_t triangles = 0;
+        for (const tinyobj::shape_t& shape : shapes)
+            triangles += shape.mesh.num_face_vertices.size();
+
+        std::cout << std::fixed << std::setprecision(1);
+        std::cout << "  tinyobj     : " << std::setw(8) << megabytes / referenceSeconds << " MB/s  "
+                  << std::setw(12) << triangles / referenceSeconds << " tris/s" << std::endl;
+
+        unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned threads = 1; threads <= maxThreads; threads++) {
+
+            start = Clock::now();
+            for (int i = 0; i < iterations; i++) {
+                materials.clear();
+                Load(&attrib, &shapes, &materials, &err, fileName, basePath, threads);
+            }
+            double seconds = std::chrono::duration<double>(Clock::now() - start).count() / iterations;
+
+            std::cout << "  " << std::setw(2) << threads << " threads  : " << std::setw(8) << megabytes / seconds << " MB/s  "
+                      << std::setw(12) << triangles / seconds << " tris/s  (" << referenceSeconds / seconds << "x)" << std::endl;
+        }
+        std::cout << std::defaultfloat;
+    }
+}
@@ -0,0 +1,28 @@
+#ifndef ObjParser_hpp
+#define ObjParser_hpp
+
+#include "tiny_obj_loader.h"
+
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Memory-mapped .obj front end that parses newline-aligned chunks on several threads.
+    // Produces exactly what tinyobj::LoadObj(..., triangulate = true) produces, minus the 't' tags.
+    class ObjParser {
+
+    public:
+        // threadCount 0 uses every hardware thread
+        static bool Load(tinyobj::attrib_t* attrib, std::vector<tinyobj::shape_t>* shapes, std::vector<tinyobj::material_t>* materials,
+                         std::string* err, const std::string& fileName, const std::string& basePath, unsigned threadCount = 0);
+
+        // Compares the output with tinyobj::LoadObj for the same file
+        static bool Verify(const std::string& fileName, const std::string& basePath, unsigned threadCount = 0);
+
+        // Prints MB/s and triangles/s for every thread count up to the hardware concurrency
+        static void Benchmark(const std::string& fileName, int iterations);
+    };
+}
+
+#endif /* ObjParser_hpp */
@@ -0,0 +1,430 @@
+#include "ObjStreamer.hpp"
+#include "LoadProfiler.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    namespace {
+
+        // Grows in fixed blocks, so a large pool never needs a second copy of itself to grow
+        template <typename T>
+        class BlockPool {
+
+        public:
+            static const size_t BLOCK_SIZE = 1 << 16;
+
+            BlockPool() : count(0) {
+            }
+
+            void push(const T& value) {
+
+                if (count % BLOCK_SIZE == 0) {
+                    blocks.emplace_back(new T[BLOCK_SIZE]);
+                }
+                blocks.back()[count % BLOCK_SIZE] = value;
+                count++;
+            }
+
+            const T& operator[](size_t i) const {
+
+                return blocks[i / BLOCK_SIZE][i % BLOCK_SIZE];
+            }
+
+            size_t size() const {
+
+                return count;
+            }
+
+            size_t bytes() const {
+
+                return blocks.size() * BLOCK_SIZE * sizeof(T);
+            }
+
+        private:
+            std::vector<std::unique_ptr<T[]> > blocks;
+            size_t count;
+        };
+
+        // Face corner with its indices resolved to 0-based pool positions, -1 when missing
+        struct Corner {
+
+            long long position;
+            long long normal;
+            long long texCoord;
+        };
+
+        struct CornerHash {
+
+            size_t operator()(const Corner& corner) const {
+
+                size_t h = std::hash<long long>()(corner.position);
+                h ^= std::hash<long long>()(corner.normal) + 0x9e3779b9 + (h << 6) + (h >> 2);
+                h ^= std::hash<long long>()(corner.texCoord) + 0x9e3779b9 + (h << 6) + (h >> 2);
+                return h;
+            }
+        };
+
+        struct CornerEqual {
+
+            bool operator()(const Corner& a, const Corner& b) const {
+
+                return a.position == b.position && a.normal == b.normal && a.texCoord == b.texCoord;
+            }
+        };
+
+        // rough cost of one dedup map entry: key, value, node and bucket pointers
+        const size_t MAP_ENTRY_BYTES = sizeof(Corner) + sizeof(GLuint) + 4 * sizeof(void*);
+
+        struct StreamState {
+
+            BlockPool<glm::vec3> positions;
+            BlockPool<glm::vec3> normals;
+            BlockPool<glm::vec2> texCoords;
+            std::vector<tinyobj::material_t> materials;
+            int materialId;
+
+            MeshData segment;
+            glm::vec3 boundsMin;
+            glm::vec3 boundsMax;
+            std::unordered_map<Corner, GLuint, CornerHash, CornerEqual> uniqueVertices;
+
+            size_t segmentBytes;
+            const ObjStreamer::SegmentSink* sink;
+            bool stopped;
+            size_t triangles;
+            size_t segments;
+            // time spent in the sink, which profiles its own work
+            double sinkMs;
+        };
+
+        // OBJ indices are 1-based, negative ones count back from the end of the pool, 0 means missing
+        long long resolveIndex(int index, size_t poolSize) {
+
+            if (index > 0)
+                return index - 1 <= (long long)poolSize - 1 ? index - 1 : -1;
+            if (index < 0)
+                return (long long)poolSize + index >= 0 ? (long long)poolSize + index : -1;
+            return -1;
+        }
+
+        size_t segmentSize(const StreamState& state) {
+
+            return state.segment.vertices.capacity() * sizeof(Vertex) + state.segment.indices.capacity() * sizeof(GLuint) +
+                state.uniqueVertices.size() * MAP_ENTRY_BYTES;
+        }
+
+        // Hands the current segment to the sink and starts an empty one with the same material
+        void flushSegment(StreamState& state) {
+
+            if (state.segment.indices.empty() || state.stopped) {
+                return;
+            }
+
+            MeshInfo& info = state.segment.info;
+            info.hasMaterial = false;
+            info.material = Material();
+            if (state.materialId >= 0 && state.materialId < (int)state.materials.size()) {
+
+                const tinyobj::material_t& material = state.materials[state.materialId];
+                info.material.ambient = glm::vec3(material.ambient[0], material.ambient[1], material.ambient[2]);
+                info.material.diffuse = glm::vec3(material.diffuse[0], material.diffuse[1], material.diffuse[2]);
+                info.material.specular = glm::vec3(material.specular[0], material.specular[1], material.specular[2]);
+                info.hasMaterial = true;
+                info.ambientTexture = material.ambient_texname;
+                info.diffuseTexture = material.diffuse_texname;
+                info.specularTexture = material.specular_texname;
+            }
+            info.boundsMin = state.boundsMin;
+            info.boundsMax = state.boundsMax;
+
+            state.segments++;
+            std::chrono::steady_clock::time_point sinkStart = std::chrono::steady_clock::now();
+            if (!(*state.sink)(state.segment)) {
+                state.stopped = true;
+            }
+            state.sinkMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sinkStart).count();
+
+            state.segment = MeshData();
+            state.uniqueVertices.clear();
+            state.boundsMin = glm::vec3(FLT_MAX);
+            state.boundsMax = glm::vec3(-FLT_MAX);
+        }
+
+        void onVertex(void* userData, float x, float y, float z, float /*w*/) {
+
+            static_cast<StreamState*>(userData)->positions.push(glm::vec3(x, y, z));
+        }
+
+        void onNormal(void* userData, float x, float y, float z) {
+
+            static_cast<StreamState*>(userData)->normals.push(glm::vec3(x, y, z));
+        }
+
+        void onTexCoord(void* userData, float x, float y, float /*z*/) {
+
+            static_cast<StreamState*>(userData)->texCoords.push(glm::vec2(x, y));
+        }
+
+        GLuint emitCorner(StreamState& state, const Corner& corner, const glm::vec3& faceNormal) {
+
+            auto found = state.uniqueVertices.find(corner);
+            if (found != state.uniqueVertices.end()) {
+                return found->second;
+            }
+
+            Vertex vertex;
+            vertex.Position = state.positions[(size_t)corner.position];
+            // corners without a normal take the flat normal of the face that first used them
+            vertex.Normal = corner.normal >= 0 ? state.normals[(size_t)corner.normal] : faceNormal;
+            vertex.TexCoords = corner.texCoord >= 0 ? state.texCoords[(size_t)corner.texCoord] : glm::vec2(0.0f);
+
+            state.boundsMin = glm::min(state.boundsMin, vertex.Position);
+            state.boundsMax = glm::max(state.boundsMax, vertex.Position);
+
+            GLuint index = (GLuint)state.segment.vertices.size();
+            state.uniqueVertices.emplace(corner, index);
+            state.segment.vertices.push_back(vertex);
+            return index;
+        }
+
+        void onFace(void* userData, tinyobj::index_t* indices, int indexCount) {
+
+            StreamState& state = *static_cast<StreamState*>(userData);
+            if (state.stopped || indexCount < 3) {
+                return;
+            }
+
+            std::vector<Corner> corners((size_t)indexCount);
+            for (int i = 0; i < indexCount; i++) {
+
+                corners[i].position = resolveIndex(indices[i].vertex_index, state.positions.size());
+                corners[i].normal = resolveIndex(indices[i].normal_index, state.normals.size());
+                corners[i].texCoord = resolveIndex(indices[i].texcoord_index, state.texCoords.size());
+                if (corners[i].position < 0) {
+                    return;
+                }
+            }
+
+            const glm::vec3& a = state.positions[(size_t)corners[0].position];
+            const glm::vec3& b = state.positions[(size_t)corners[1].position];
+            const glm::vec3& c = state.positions[(size_t)corners[2].position];
+            glm::vec3 faceNormal = glm::cross(b - a, c - a);
+            float length = glm::length(faceNormal);
+            faceNormal = length > 0.0f ? faceNormal / length : glm::vec3(0.0f, 1.0f, 0.0f);
+
+            // triangle fan, like tinyobj's triangulation
+            for (int k = 1; k + 1 < indexCount; k++) {
+
+                state.segment.indices.push_back(emitCorner(state, corners[0], faceNormal));
+                state.segment.indices.push_back(emitCorner(state, corners[k], faceNormal));
+                state.segment.indices.push_back(emitCorner(state, corners[k + 1], faceNormal));
+                state.triangles++;
+            }
+
+            if (segmentSize(state) >= state.segmentBytes) {
+                flushSegment(state);
+            }
+        }
+
+        void onUseMaterial(void* userData, const char* /*name*/, int materialId) {
+
+            StreamState& state = *static_cast<StreamState*>(userData);
+            if (materialId != state.materialId) {
+
+                flushSegment(state);
+                state.materialId = materialId;
+            }
+        }
+
+        void onMaterialLibrary(void* userData, const tinyobj::material_t* materials, int materialCount) {
+
+            StreamState& state = *static_cast<StreamState*>(userData);
+            state.materials.assign(materials, materials + materialCount);
+        }
+
+        // groups and objects start new shapes in a full parse as well
+        void onGroup(void* userData, const char** /*names*/, int /*nameCount*/) {
+
+            flushSegment(*static_cast<StreamState*>(userData));
+        }
+
+        void onObject(void* userData, const char* /*name*/) {
+
+            flushSegment(*static_cast<StreamState*>(userData));
+        }
+
+        // Tiles of gridSize x gridSize quads, each tile with its own v/vt/vn block like an exporter writes objects
+        bool writeSyntheticObj(const std::string& fileName, size_t targetBytes) {
+
+            FILE* file = fopen(fileName.c_str(), "wb");
+            if (!file) {
+                return false;
+            }
+
+            const int gridSize = 128;
+            const int rowVertices = gridSize + 1;
+            std::vector<char> buffer(1 << 20);
+            size_t written = 0;
+            size_t used = 0;
+            long long firstVertex = 1;
+
+            auto append = [&](int length) {
+
+                used += (size_t)length;
+                if (used + 256 > buffer.size()) {
+                    fwrite(buffer.data(), 1, used, file);
+                    written += used;
+                    used = 0;
+                }
+            };
+
+            for (int tile = 0; written + used < targetBytes; tile++) {
+
+                float originX = (float)(tile % 64) * gridSize;
+                float originZ = (float)(tile / 64) * gridSize;
+                for (int z = 0; z < rowVertices; z++) {
+                    for (int x = 0; x < rowVertices; x++) {
+                        float height = std::sin((originX + x) * 0.05f) * std::cos((originZ + z) * 0.05f);
+                        append(snprintf(&buffer[used], 256, "v %.4f %.4f %.4f\n", originX + x, height, originZ + z));
+                        append(snprintf(&buffer[used], 256, "vt %.4f %.4f\n", (float)x / gridSize, (float)z / gridSize));
+                        append(snprintf(&buffer[used], 256, "vn 0.0 1.0 0.0\n"));
+                    }
+                }
+                for (int z = 0; z < gridSize; z++) {
+                    for (int x = 0; x < gridSize; x++) {
+                        long long i0 = firstVertex + z * rowVertices + x;
+                        long long i1 = i0 + rowVertices;
+                        append(snprintf(&buffer[used], 256, "f %lld/%lld/%lld %lld/%lld/%lld %lld/%lld/%lld %lld/%lld/%lld\n",
+                            i0, i0, i0, i1, i1, i1, i1 + 1, i1 + 1, i1 + 1, i0 + 1, i0 + 1, i0 + 1));
+                    }
+                }
+                firstVertex += (long long)rowVertices * rowVertices;
+            }
+
+            fwrite(buffer.data(), 1, used, file);
+            written += used;
+            fclose(file);
+            return true;
+        }
+    }
+
+    bool ObjStreamer::Import(const std::string& fileName, const std::string& basePath, size_t segmentBytes, const SegmentSink& sink,
+                             ObjStreamStats* stats) {
+
+        std::ifstream file;
+        // a larger stream buffer than the default, set before open
+        std::vector<char> readBuffer(1 << 20);
+        file.rdbuf()->pubsetbuf(readBuffer.data(), (std::streamsize)readBuffer.size());
+        file.open(fileName, std::ios::binary);
+        if (!file) {
+            std::cerr << "ERROR: could not open " << fileName << std::endl;
+            return false;
+        }
+
+        std::unique_ptr<StreamState> state(new StreamState());
+        state->materialId = -1;
+        state->boundsMin = glm::vec3(FLT_MAX);
+        state->boundsMax = glm::vec3(-FLT_MAX);
+        state->segmentBytes = segmentBytes;
+        state->sink = &sink;
+        state->stopped = false;
+        state->triangles = 0;
+        state->segments = 0;
+        state->sinkMs = 0.0;
+
+        tinyobj::callback_t callbacks;
+        callbacks.vertex_cb = onVertex;
+        callbacks.normal_cb = onNormal;
+        callbacks.texcoord_cb = onTexCoord;
+        callbacks.index_cb = onFace;
+        callbacks.usemtl_cb = onUseMaterial;
+        callbacks.mtllib_cb = onMaterialLibrary;
+        callbacks.group_cb = onGroup;
+        callbacks.object_cb = onObject;
+
+        tinyobj::MaterialFileReader materialReader(basePath);
+        std::string err;
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        bool ok = tinyobj::LoadObjWithCallback(file, callbacks, state.get(), &materialReader, &err);
+        if (!err.empty()) {
+            std::cerr << err << std::endl;
+        }
+        flushSegment(*state);
+
+        // reading, parsing, triangulation and vertex expansion interleave line by line, so they count as one parse stage
+        LoadProfiler& profiler = LoadProfiler::instance();
+        if (profiler.isEnabled()) {
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            profiler.addTime(fileName, STAGE_PARSE, ms - state->sinkMs);
+            file.clear();
+            file.seekg(0, std::ios::end);
+            std::streamoff bytes = file.tellg();
+            profiler.addBytesRead(fileName, bytes > 0 ? (size_t)bytes : 0);
+        }
+
+        if (stats) {
+            stats->positions = state->positions.size();
+            stats->normals = state->normals.size();
+            stats->texCoords = state->texCoords.size();
+            stats->triangles = state->triangles;
+            stats->segments = state->segments;
+            stats->poolBytes = state->positions.bytes() + state->normals.bytes() + state->texCoords.bytes();
+        }
+
+        return ok && !state->stopped;
+    }
+
+    bool ObjStreamer::VerifyPeakMemory(const std::string& fileName, size_t targetBytes, size_t segmentBytes) {
+
+        typedef std::chrono::steady_clock Clock;
+        const double MB = 1024.0 * 1024.0;
+
+        std::cout << "Writing " << targetBytes / MB << " MB synthetic .obj to " << fileName << std::endl;
+        if (!writeSyntheticObj(fileName, targetBytes)) {
+            std::cerr << "ERROR: could not write " << fileName << std::endl;
+            return false;
+        }
+
+        size_t peakBefore = LoadProfiler::PeakResidentBytes();
+        size_t largestSegment = 0;
+        size_t outputBytes = 0;
+        SegmentSink sink = [&](MeshData& segment) {
+
+            size_t bytes = segment.vertices.size() * sizeof(Vertex) + segment.indices.size() * sizeof(GLuint);
+            largestSegment = std::max(largestSegment, bytes);
+            outputBytes += bytes;
+            return true;
+        };
+
+        ObjStreamStats stats = {};
+        Clock::time_point start = Clock::now();
+        bool imported = Import(fileName, "", segmentBytes, sink, &stats);
+        double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+        size_t peakAfter = LoadProfiler::PeakResidentBytes();
+        std::remove(fileName.c_str());
+
+        // the pools, the segment being built (vectors may double past the budget) and the read buffers
+        size_t growth = peakAfter > peakBefore ? peakAfter - peakBefore : 0;
+        size_t ceiling = stats.poolBytes + 2 * segmentBytes + 32 * 1024 * 1024;
+        // what a full parse would hold at once: the tinyobj attributes and corners plus the expanded meshes
+        size_t fullParse = stats.poolBytes + stats.triangles * 3 * sizeof(tinyobj::index_t) + outputBytes;
+
+        printf("Streamed %zu triangles in %zu segments (largest %.1f MB) in %.2f s\n", stats.triangles, stats.segments, largestSegment / MB, seconds);
+        printf("Peak RSS grew by %.1f MB, ceiling %.1f MB (pools %.1f MB + budget), a full parse would hold about %.1f MB\n",
+            growth / MB, ceiling / MB, stats.poolBytes / MB, fullParse / MB);
+
+        bool passed = imported && peakAfter != 0 && growth <= ceiling;
+        std::cout << "Streaming import peak memory " << (passed ? "within" : "OVER") << " the ceiling" << std::endl;
+        return passed;
+    }
+}
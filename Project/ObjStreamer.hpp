@@ -0,0 +1,42 @@
+#ifndef ObjStreamer_hpp
+#define ObjStreamer_hpp
+
+#include "MeshCache.hpp"
+#include "tiny_obj_loader.h"
+
+#include <functional>
+#include <string>
+
+namespace gps {
+
+    // What a streaming import read and how much memory its attribute pools took
+    struct ObjStreamStats {
+
+        size_t positions;
+        size_t normals;
+        size_t texCoords;
+        size_t triangles;
+        size_t segments;
+        // v/vn/vt pools, the only part of the import that grows with the file
+        size_t poolBytes;
+    };
+
+    // Single-pass .obj import on tinyobj::LoadObjWithCallback. Faces become final vertices and indices as they are read,
+    // without the attrib_t and shape_t copies of a full parse, and the output is cut into segments of at most
+    // segmentBytes that are handed to the sink as soon as they are complete.
+    class ObjStreamer {
+
+    public:
+        // Receives each finished segment, may take its data; returning false stops the import
+        typedef std::function<bool(MeshData& segment)> SegmentSink;
+
+        static bool Import(const std::string& fileName, const std::string& basePath, size_t segmentBytes, const SegmentSink& sink,
+                           ObjStreamStats* stats = nullptr);
+
+        // Writes a synthetic tiled-grid .obj of about targetBytes, streams it with segmentBytes and checks that the peak
+        // resident size grew by no more than the attribute pools plus the segment budget. The file is removed afterwards.
+        static bool VerifyPeakMemory(const std::string& fileName, size_t targetBytes, size_t segmentBytes);
+    };
+}
+
+#endif /* ObjStreamer_hpp */
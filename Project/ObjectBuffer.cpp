@@ -0,0 +1,208 @@
+#include "ObjectBuffer.hpp"
+#include "GLCaps.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+namespace gps {
+
+    namespace {
+
+        typedef std::chrono::steady_clock Clock;
+
+        // objects per region before the first frame asks for more
+        const int INITIAL_CAPACITY = 1024;
+
+        static_assert(sizeof(ObjectData) == ObjectBuffer::TEXELS_PER_OBJECT * 4 * sizeof(GLfloat),
+                      "ObjectData must match the texels the vertex shaders fetch");
+
+        glm::mat3 normalMatrixOf(const ObjectData& object) {
+
+            return glm::mat3(glm::vec3(object.normalMatrix[0]), glm::vec3(object.normalMatrix[1]), glm::vec3(object.normalMatrix[2]));
+        }
+    }
+
+    ObjectBuffer& ObjectBuffer::instance() {
+
+        // never destroyed, like the material table
+        static ObjectBuffer* objects = new ObjectBuffer();
+        return *objects;
+    }
+
+    ObjectBuffer::ObjectBuffer() : mapped(nullptr), capacity(0), maxCapacity(0), region(0), count(0), requested(0), current(-1),
+                                   currentObject(), stats() {
+
+        for (int i = 0; i < FRAMES; i++) {
+            fences[i] = 0;
+        }
+        currentObject.model = glm::mat4(1.0f);
+        for (int i = 0; i < 3; i++) {
+            currentObject.normalMatrix[i] = glm::vec4(0.0f);
+            currentObject.normalMatrix[i][i] = 1.0f;
+        }
+    }
+
+    void ObjectBuffer::attach(Shader shader) {
+
+        // a samplerBuffer left on unit 0 would clash with the mesh textures there
+        shader.setUniform("objectTransforms", (GLint)TEXTURE_UNIT);
+        shader.setUniform("objectIndex", (GLint)-1);
+    }
+
+    void ObjectBuffer::beginFrame() {
+
+        if (!texture) {
+            GLint maxTexels = 0;
+            glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+            maxCapacity = maxTexels / (TEXELS_PER_OBJECT * FRAMES);
+            allocate(std::min(INITIAL_CAPACITY, maxCapacity));
+        }
+        else if (requested > capacity && capacity < maxCapacity) {
+            int grown = capacity;
+            while (grown < requested && grown < maxCapacity) {
+                grown = std::min(grown * 2, maxCapacity);
+            }
+            allocate(grown);
+        }
+
+        region = (region + 1) % FRAMES;
+        retire(region);
+        count = 0;
+        requested = 0;
+        current = -1;
+    }
+
+    void ObjectBuffer::endFrame() {
+
+        if (texture) {
+            fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+    }
+
+    void ObjectBuffer::allocate(int objects) {
+
+        // the GPU may still read every region of the old buffer
+        for (int i = 0; i < FRAMES; i++) {
+            retire(i);
+        }
+
+        // deleting the old buffer also ends a persistent mapping
+        capacity = objects;
+        mapped = nullptr;
+        GLsizeiptr bytes = (GLsizeiptr)FRAMES * capacity * sizeof(ObjectData);
+        buffer = GLBuffer::create();
+        glBindBuffer(GL_TEXTURE_BUFFER, buffer.get());
+#if !defined (__APPLE__)
+        if (GLCaps::get().bufferStorage) {
+            // dynamic storage keeps glBufferSubData open should the mapping fail
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_TEXTURE_BUFFER, bytes, NULL, flags | GL_DYNAMIC_STORAGE_BIT);
+            mapped = static_cast<ObjectData*>(glMapBufferRange(GL_TEXTURE_BUFFER, 0, bytes, flags));
+        }
+        else
+#endif
+        {
+            glBufferData(GL_TEXTURE_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+        // nothing else uses the unit, the texture stays bound there
+        if (!texture) {
+            texture = GLTexture::create();
+        }
+        glActiveTexture(GL_TEXTURE0 + TEXTURE_UNIT);
+        glBindTexture(GL_TEXTURE_BUFFER, texture.get());
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, buffer.get());
+        glActiveTexture(GL_TEXTURE0);
+    }
+
+    void ObjectBuffer::retire(int region) {
+
+        if (!fences[region]) {
+            return;
+        }
+
+        GLenum status = glClientWaitSync(fences[region], 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED) {
+
+            Clock::time_point start = Clock::now();
+            do {
+                status = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+            } while (status == GL_TIMEOUT_EXPIRED);
+            stats.fenceWaits++;
+            stats.waitMs += std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+        }
+        glDeleteSync(fences[region]);
+        fences[region] = 0;
+    }
+
+    int ObjectBuffer::write(const ObjectData& object) {
+
+        requested++;
+        if (count >= capacity) {
+            stats.overflowed++;
+            return -1;
+        }
+
+        int index = region * capacity + count++;
+        if (mapped) {
+            mapped[index] = object;
+        }
+        else {
+            glBindBuffer(GL_TEXTURE_BUFFER, buffer.get());
+            glBufferSubData(GL_TEXTURE_BUFFER, (GLintptr)index * sizeof(ObjectData), sizeof(ObjectData), &object);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+        stats.objects++;
+        return index;
+    }
+
+    void ObjectBuffer::apply(Shader shader, int index, const ObjectData& object) {
+
+        shader.setUniform("objectIndex", (GLint)index);
+        if (index < 0) {
+            shader.setUniform("model", object.model);
+            shader.setUniform("normalMatrix", normalMatrixOf(object));
+        }
+    }
+
+    void ObjectBuffer::setObject(Shader shader, const glm::mat4& model, const glm::mat3& normalMatrix) {
+
+        currentObject.model = model;
+        for (int i = 0; i < 3; i++) {
+            currentObject.normalMatrix[i] = glm::vec4(normalMatrix[i], 0.0f);
+        }
+        current = write(currentObject);
+        apply(shader, current, currentObject);
+    }
+
+    void ObjectBuffer::setObjectModel(Shader shader, const glm::mat4& model) {
+
+        ObjectData object = currentObject;
+        object.model = model;
+        apply(shader, write(object), object);
+    }
+
+    void ObjectBuffer::restoreObject(Shader shader) {
+
+        apply(shader, current, currentObject);
+    }
+
+    const glm::mat4& ObjectBuffer::getModel() const {
+
+        return currentObject.model;
+    }
+
+    ObjectBufferStats ObjectBuffer::takeStats() {
+
+        ObjectBufferStats taken = stats;
+        stats = ObjectBufferStats();
+        return taken;
+    }
+
+    void ObjectBuffer::printStats(std::ostream& out) const {
+
+        out << FRAMES << " regions of " << capacity << " objects (" << FRAMES * capacity * sizeof(ObjectData) / 1024 << " KB, "
+            << (mapped ? "persistently mapped" : "glBufferSubData") << ")";
+    }
+}
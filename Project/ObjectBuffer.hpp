@@ -0,0 +1,99 @@
+#ifndef ObjectBuffer_hpp
+#define ObjectBuffer_hpp
+
+#include "GLHandle.hpp"
+#include "Shader.hpp"
+
+#include <glm/glm.hpp>
+
+#include <ostream>
+
+namespace gps {
+
+    // One object's record as the vertex shaders fetch it, seven RGBA32F texels: the model matrix, then the
+    // normal matrix with each column padded to a texel
+    struct ObjectData {
+
+        glm::mat4 model;
+        glm::vec4 normalMatrix[3];
+    };
+
+    // Totals since the last takeStats
+    struct ObjectBufferStats {
+
+        size_t objects;
+        // objects that found their frame's region full and went out as uniforms instead
+        size_t overflowed;
+        // frames whose region the GPU was still reading, and the time spent waiting for it
+        size_t fenceWaits;
+        double waitMs;
+    };
+
+    // The model and normal matrices of every object drawn in a frame, written into a ring of FRAMES regions of one
+    // texture buffer so a draw only sets objectIndex. The buffer stays mapped where glBufferStorage exists, elsewhere
+    // each record goes in with glBufferSubData. A fence per region keeps the CPU from overwriting records the GPU has
+    // not read yet. A region grows to last frame's object count on the next frame, until then the objects that do
+    // not fit fall back to the model and normalMatrix uniforms. GL thread only.
+    class ObjectBuffer {
+
+    public:
+        // Frames the CPU may run ahead of the GPU
+        static const int FRAMES = 3;
+        static const int TEXELS_PER_OBJECT = 7;
+        // objectTransforms samples this unit, after the material table's arrays
+        static const GLuint TEXTURE_UNIT = 12;
+
+        static ObjectBuffer& instance();
+
+        // Points the program's objectTransforms sampler at TEXTURE_UNIT and objectIndex at the uniforms
+        void attach(Shader shader);
+
+        // Takes the next region once the GPU is done with it; endFrame fences it after the frame's draws
+        void beginFrame();
+        void endFrame();
+
+        // Writes the object's record and points the shader at it, it stays the current object until the next call
+        void setObject(Shader shader, const glm::mat4& model, const glm::mat3& normalMatrix);
+
+        // Another record of the current object with a different model matrix, for meshes that fold their
+        // dequantization into it
+        void setObjectModel(Shader shader, const glm::mat4& model);
+
+        // Points the shader back at the current object
+        void restoreObject(Shader shader);
+
+        const glm::mat4& getModel() const;
+
+        ObjectBufferStats takeStats();
+
+        // Capacity and mapping in one line
+        void printStats(std::ostream& out) const;
+
+    private:
+        GLBuffer buffer;
+        GLTexture texture;
+        GLsync fences[FRAMES];
+        // the whole ring, null without glBufferStorage
+        ObjectData* mapped;
+        // objects per region, and the most GL_MAX_TEXTURE_BUFFER_SIZE allows
+        int capacity;
+        int maxCapacity;
+        int region;
+        int count;
+        // objects of the frame including the ones that did not fit
+        int requested;
+        int current;
+        ObjectData currentObject;
+        ObjectBufferStats stats;
+
+        ObjectBuffer();
+
+        void allocate(int objects);
+        void retire(int region);
+        // Index of the record, -1 if the region is full
+        int write(const ObjectData& object);
+        void apply(Shader shader, int index, const ObjectData& object);
+    };
+}
+
+#endif /* ObjectBuffer_hpp */
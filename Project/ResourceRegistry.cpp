@@ -0,0 +1,157 @@
+#include "ResourceRegistry.hpp"
+
+#include <utility>
+
+namespace gps {
+
+    // Deleter of the registry handles, hands the resource back instead of destroying it
+    template <typename T>
+    struct ResourceRegistry::Release {
+
+        ResourceRegistry* registry;
+        uint64_t contentHash;
+
+        void operator()(T* resource) const {
+
+            registry->release(contentHash, resource);
+        }
+    };
+
+    ResourceRegistry& ResourceRegistry::instance() {
+
+        // never destroyed, models released during static destruction still hand their resources back
+        static ResourceRegistry* registry = new ResourceRegistry();
+        return *registry;
+    }
+
+    ResourceRegistry::ResourceRegistry() : textureStats(), meshStats() {
+    }
+
+    uint64_t ResourceRegistry::hashBytes(const void* data, size_t size, uint64_t seed) {
+
+        const unsigned char* bytes = static_cast<const unsigned char*>(data);
+        uint64_t hash = seed;
+        for (size_t i = 0; i < size; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    bool ResourceRegistry::hasTexture(uint64_t contentHash) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = textures.find(contentHash);
+        return found != textures.end() && !found->second.resource.expired();
+    }
+
+    TextureRef ResourceRegistry::findTexture(uint64_t contentHash, size_t* bytes) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = textures.find(contentHash);
+        if (found == textures.end()) {
+            return TextureRef();
+        }
+
+        TextureRef texture = found->second.resource.lock();
+        if (texture) {
+            textureStats.requests++;
+            textureStats.hits++;
+            textureStats.savedBytes += found->second.bytes;
+            if (bytes) {
+                *bytes = found->second.bytes;
+            }
+        }
+        return texture;
+    }
+
+    TextureRef ResourceRegistry::addTexture(uint64_t contentHash, GLTexture texture, size_t bytes) {
+
+        TextureRef registered(new GLTexture(std::move(texture)), Release<GLTexture>{ this, contentHash });
+
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry<GLTexture>& entry = textures[contentHash];
+        entry.resource = registered;
+        entry.bytes = bytes;
+        textureStats.requests++;
+        textureStats.uploadedBytes += bytes;
+        return registered;
+    }
+
+    MeshRef ResourceRegistry::findMesh(uint64_t contentHash) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = meshes.find(contentHash);
+        if (found == meshes.end()) {
+            return MeshRef();
+        }
+
+        MeshRef mesh = found->second.resource.lock();
+        if (mesh) {
+            meshStats.requests++;
+            meshStats.hits++;
+            meshStats.savedBytes += found->second.bytes;
+        }
+        return mesh;
+    }
+
+    MeshRef ResourceRegistry::addMesh(uint64_t contentHash, Mesh mesh) {
+
+        size_t bytes = mesh.getVertexBufferSize() + mesh.getIndexBufferSize();
+        MeshRef registered(new Mesh(std::move(mesh)), Release<Mesh>{ this, contentHash });
+
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry<Mesh>& entry = meshes[contentHash];
+        entry.resource = registered;
+        entry.bytes = bytes;
+        meshStats.requests++;
+        meshStats.uploadedBytes += bytes;
+        return registered;
+    }
+
+    void ResourceRegistry::release(uint64_t contentHash, GLTexture* texture) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        // the hash may already name a newer upload of the same content, which is still alive
+        auto found = textures.find(contentHash);
+        if (found != textures.end() && found->second.resource.expired()) {
+            textures.erase(found);
+        }
+        releasedTextures.push_back(std::move(*texture));
+        delete texture;
+    }
+
+    void ResourceRegistry::release(uint64_t contentHash, Mesh* mesh) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = meshes.find(contentHash);
+        if (found != meshes.end() && found->second.resource.expired()) {
+            meshes.erase(found);
+        }
+        releasedMeshes.push_back(std::move(*mesh));
+        delete mesh;
+    }
+
+    void ResourceRegistry::collectGarbage() {
+
+        std::vector<GLTexture> deadTextures;
+        std::vector<Mesh> deadMeshes;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            deadTextures.swap(releasedTextures);
+            deadMeshes.swap(releasedMeshes);
+        }
+        // the handles delete their GL objects as the vectors go out of scope
+    }
+
+    void ResourceRegistry::printStats(std::ostream& out) {
+
+        std::lock_guard<std::mutex> lock(mutex);
+        const char* names[2] = { "Textures", "Meshes" };
+        const Stats* stats[2] = { &textureStats, &meshStats };
+        for (int i = 0; i < 2; i++) {
+            out << names[i] << ": " << stats[i]->requests << " requests, " << stats[i]->hits << " shared, "
+                << stats[i]->uploadedBytes / 1024 << " KB uploaded, " << stats[i]->savedBytes / 1024 << " KB saved by deduplication" << std::endl;
+        }
+    }
+}
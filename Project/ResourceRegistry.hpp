@@ -0,0 +1,84 @@
+#ifndef ResourceRegistry_hpp
+#define ResourceRegistry_hpp
+
+#include "GLHandle.hpp"
+#include "Mesh.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // Reference-counted handles to registered GPU resources
+    typedef std::shared_ptr<GLTexture> TextureRef;
+    typedef std::shared_ptr<Mesh> MeshRef;
+
+    // Process-wide textures and meshes keyed by a hash of their content, so every model that uses the same
+    // data shares one GPU copy. When the last handle of a resource goes away it is parked until collectGarbage
+    // deletes it on the GL thread.
+    class ResourceRegistry {
+
+    public:
+        static ResourceRegistry& instance();
+
+        // 64-bit FNV-1a, pass a previous result as seed to chain several ranges into one key
+        static uint64_t hashBytes(const void* data, size_t size, uint64_t seed = 14695981039346656037ULL);
+
+        // Whether a live texture with this content exists, without counting a lookup - safe from any thread
+        bool hasTexture(uint64_t contentHash);
+
+        // Live texture with this content or null, bytes receives its size on a hit
+        TextureRef findTexture(uint64_t contentHash, size_t* bytes = nullptr);
+
+        // Registers a freshly uploaded texture, bytes is its GPU size
+        TextureRef addTexture(uint64_t contentHash, GLTexture texture, size_t bytes);
+
+        MeshRef findMesh(uint64_t contentHash);
+
+        MeshRef addMesh(uint64_t contentHash, Mesh mesh);
+
+        // Deletes the resources whose last handle is gone, GL thread only
+        void collectGarbage();
+
+        // Requests, hits and the bytes deduplication kept off the GPU
+        void printStats(std::ostream& out);
+
+    private:
+        template <typename T>
+        struct Entry {
+
+            std::weak_ptr<T> resource;
+            size_t bytes;
+        };
+
+        struct Stats {
+
+            size_t requests;
+            size_t hits;
+            size_t uploadedBytes;
+            size_t savedBytes;
+        };
+
+        template <typename T>
+        struct Release;
+
+        std::mutex mutex;
+        std::unordered_map<uint64_t, Entry<GLTexture> > textures;
+        std::unordered_map<uint64_t, Entry<Mesh> > meshes;
+        std::vector<GLTexture> releasedTextures;
+        std::vector<Mesh> releasedMeshes;
+        Stats textureStats;
+        Stats meshStats;
+
+        ResourceRegistry();
+
+        void release(uint64_t contentHash, GLTexture* texture);
+        void release(uint64_t contentHash, Mesh* mesh);
+    };
+}
+
+#endif /* ResourceRegistry_hpp */
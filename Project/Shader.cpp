@@ -7,8 +7,17 @@
 //
 
 #include "Shader.hpp"
+#include "LoadProfiler.hpp"
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstring>
 
 namespace gps {
+
+    UniformStats Shader::stats = { 0, 0, 0 };
+
     std::string Shader::readShaderFile(std::string fileName) {
 
         std::ifstream shaderFile;
@@ -60,27 +69,46 @@ namespace gps {
     
     void Shader::loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName) {
 
+        gps::LoadProfiler& profiler = gps::LoadProfiler::instance();
+
         //read, parse and compile the vertex shader
-        std::string v = readShaderFile(vertexShaderFileName);
+        std::string v;
+        {
+            gps::LoadScope scope(vertexShaderFileName, gps::STAGE_FILE_IO);
+            v = readShaderFile(vertexShaderFileName);
+            profiler.addBytesRead(vertexShaderFileName, v.size());
+        }
         const GLchar* vertexShaderString = v.c_str();
         GLuint vertexShader;
-        vertexShader = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertexShader, 1, &vertexShaderString, NULL);
-        glCompileShader(vertexShader);
-        //check compilation status
-        shaderCompileLog(vertexShader);
+        {
+            gps::LoadScope scope(vertexShaderFileName, gps::STAGE_SHADER_COMPILE);
+            vertexShader = glCreateShader(GL_VERTEX_SHADER);
+            glShaderSource(vertexShader, 1, &vertexShaderString, NULL);
+            glCompileShader(vertexShader);
+            //check compilation status
+            shaderCompileLog(vertexShader);
+        }
         
         //read, parse and compile the vertex shader
-        std::string f = readShaderFile(fragmentShaderFileName);
+        std::string f;
+        {
+            gps::LoadScope scope(fragmentShaderFileName, gps::STAGE_FILE_IO);
+            f = readShaderFile(fragmentShaderFileName);
+            profiler.addBytesRead(fragmentShaderFileName, f.size());
+        }
         const GLchar* fragmentShaderString = f.c_str();
         GLuint fragmentShader;
-        fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragmentShader, 1, &fragmentShaderString, NULL);
-        glCompileShader(fragmentShader);
-        //check compilation status
-        shaderCompileLog(fragmentShader);
+        {
+            gps::LoadScope scope(fragmentShaderFileName, gps::STAGE_SHADER_COMPILE);
+            fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+            glShaderSource(fragmentShader, 1, &fragmentShaderString, NULL);
+            glCompileShader(fragmentShader);
+            //check compilation status
+            shaderCompileLog(fragmentShader);
+        }
         
-        //attach and link the shader programs
+        //attach and link the shader programs, the link counts towards the vertex shader
+        gps::LoadScope linkScope(vertexShaderFileName, gps::STAGE_SHADER_COMPILE);
         this->shaderProgram = glCreateProgram();
         glAttachShader(this->shaderProgram, vertexShader);
         glAttachShader(this->shaderProgram, fragmentShader);
@@ -89,6 +117,7 @@ namespace gps {
         glDeleteShader(fragmentShader);
         //check linking info
         shaderLinkLog(this->shaderProgram);
+        reflectUniforms();
     }
     
     void Shader::useShaderProgram() {
@@ -96,4 +125,116 @@ namespace gps {
         glUseProgram(this->shaderProgram);
     }
 
+    void Shader::reflectUniforms() {
+
+        uniforms = std::make_shared<UniformTable>();
+
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> buffer(std::max(maxLength, 1));
+        for (GLint i = 0; i < count; i++) {
+
+            GLint size;
+            GLenum type;
+            glGetActiveUniform(shaderProgram, (GLuint)i, (GLsizei)buffer.size(), NULL, &size, &type, buffer.data());
+            std::string name(buffer.data());
+
+            //arrays are reported as "name[0]", every element gets an entry; block members have no location
+            std::string base = name.size() > 3 && name.compare(name.size() - 3, 3, "[0]") == 0 ? name.substr(0, name.size() - 3) : name;
+            for (GLint element = 0; element < size; element++) {
+
+                std::string elementName = size > 1 ? base + "[" + std::to_string(element) + "]" : name;
+                GLint location = glGetUniformLocation(shaderProgram, elementName.c_str());
+                if (location < 0) {
+                    continue;
+                }
+                UniformSlot slot;
+                slot.location = location;
+                slot.valid = false;
+                uniforms->indices[elementName] = (Uniform)uniforms->slots.size();
+                if (size > 1 && element == 0) {
+                    uniforms->indices[base] = (Uniform)uniforms->slots.size();
+                }
+                uniforms->slots.push_back(slot);
+            }
+        }
+    }
+
+    Shader::Uniform Shader::getUniform(const std::string& name) const {
+
+        if (!uniforms) {
+            return -1;
+        }
+        stats.lookups++;
+        auto found = uniforms->indices.find(name);
+        return found == uniforms->indices.end() ? -1 : found->second;
+    }
+
+    const GLfloat* Shader::getUniformValue(Uniform uniform) const {
+
+        if (uniform < 0 || !uniforms || uniform >= (Uniform)uniforms->slots.size() || !uniforms->slots[uniform].valid) {
+            return NULL;
+        }
+        return uniforms->slots[uniform].value;
+    }
+
+    bool Shader::changed(Uniform uniform, const void* value, size_t bytes) {
+
+        if (uniform < 0 || !uniforms || uniform >= (Uniform)uniforms->slots.size()) {
+            return false;
+        }
+        UniformSlot& slot = uniforms->slots[uniform];
+        if (slot.valid && std::memcmp(slot.value, value, bytes) == 0) {
+            stats.redundant++;
+            return false;
+        }
+        std::memcpy(slot.value, value, bytes);
+        slot.valid = true;
+        stats.uploads++;
+        return true;
+    }
+
+    void Shader::setUniform(Uniform uniform, GLint value) {
+
+        if (changed(uniform, &value, sizeof(value))) {
+            glProgramUniform1i(shaderProgram, uniforms->slots[uniform].location, value);
+        }
+    }
+
+    void Shader::setUniform(Uniform uniform, GLfloat value) {
+
+        if (changed(uniform, &value, sizeof(value))) {
+            glProgramUniform1f(shaderProgram, uniforms->slots[uniform].location, value);
+        }
+    }
+
+    void Shader::setUniform(Uniform uniform, const glm::vec3& value) {
+
+        if (changed(uniform, glm::value_ptr(value), 3 * sizeof(GLfloat))) {
+            glProgramUniform3fv(shaderProgram, uniforms->slots[uniform].location, 1, glm::value_ptr(value));
+        }
+    }
+
+    void Shader::setUniform(Uniform uniform, const glm::mat3& value) {
+
+        if (changed(uniform, glm::value_ptr(value), 9 * sizeof(GLfloat))) {
+            glProgramUniformMatrix3fv(shaderProgram, uniforms->slots[uniform].location, 1, GL_FALSE, glm::value_ptr(value));
+        }
+    }
+
+    void Shader::setUniform(Uniform uniform, const glm::mat4& value) {
+
+        if (changed(uniform, glm::value_ptr(value), 16 * sizeof(GLfloat))) {
+            glProgramUniformMatrix4fv(shaderProgram, uniforms->slots[uniform].location, 1, GL_FALSE, glm::value_ptr(value));
+        }
+    }
+
+    UniformStats Shader::takeUniformStats() {
+
+        UniformStats taken = stats;
+        stats = { 0, 0, 0 };
+        return taken;
+    }
+
 }
@@ -17,24 +17,77 @@
     #include <GL/glew.h>
 #endif
 
+#include <glm/glm.hpp>
+
 #include <fstream>
+#include <memory>
 #include <sstream>
 #include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 
 namespace gps {
     
+    //uniform traffic of all shaders since the last takeUniformStats
+    struct UniformStats {
+        //values that reached GL, and the ones skipped because GL already had them
+        size_t uploads;
+        size_t redundant;
+        //names resolved from the table instead of glGetUniformLocation
+        size_t lookups;
+    };
+    
     class Shader {
 
     public:
+        //index of an active uniform in the table built at link time, -1 for names the program does not use;
+        //resolve it once for the hot paths, the setters ignore -1 like glUniform does
+        typedef int Uniform;
+
         GLuint shaderProgram;
         void loadShader(std::string vertexShaderFileName, std::string fragmentShaderFileName);
         void useShaderProgram();
+
+        Uniform getUniform(const std::string& name) const;
+
+        //uploads with glProgramUniform only when the value differs from the last one set through the shader, so the
+        //program does not have to be current; copies of a Shader share the table and the last values
+        void setUniform(Uniform uniform, GLint value);
+        void setUniform(Uniform uniform, GLfloat value);
+        void setUniform(Uniform uniform, const glm::vec3& value);
+        void setUniform(Uniform uniform, const glm::mat3& value);
+        void setUniform(Uniform uniform, const glm::mat4& value);
+        template <typename T>
+        void setUniform(const std::string& name, const T& value) { setUniform(getUniform(name), value); }
+
+        //the last value set through the shader, null if there was none
+        const GLfloat* getUniformValue(Uniform uniform) const;
+
+        static UniformStats takeUniformStats();
     
     private:
+        struct UniformSlot {
+            GLint location;
+            //the last value, as bytes of up to a mat4
+            GLfloat value[16];
+            bool valid;
+        };
+        struct UniformTable {
+            std::unordered_map<std::string, Uniform> indices;
+            std::vector<UniformSlot> slots;
+        };
+        std::shared_ptr<UniformTable> uniforms;
+
+        static UniformStats stats;
+
         std::string readShaderFile(std::string fileName);
         void shaderCompileLog(GLuint shaderId);
         void shaderLinkLog(GLuint shaderProgramId);
+        void reflectUniforms();
+        //true if the value is new and has to be uploaded
+        bool changed(Uniform uniform, const void* value, size_t bytes);
     };
     
 }
@@ -7,34 +7,130 @@
 //
 
 #include "SkyBox.hpp"
+#include "GLCaps.hpp"
+#include "LoadProfiler.hpp"
+#include "ResourceRegistry.hpp"
+#include "TextureAllocator.hpp"
+#include "TextureProcessor.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <iterator>
 
 namespace gps {
     
-    SkyBox::SkyBox()
+    SkyBox::SkyBox() : skyboxVAO(0), skyboxVBO(0), cubemapTexture(0)
     {
-        
+        for (FaceImage& face : faceImages) {
+            face.fileName = nullptr;
+            face.width = 0;
+            face.height = 0;
+            face.levels = 0;
+            face.format = FORMAT_RGBA8;
+            face.contentHash = 0;
+            face.pixels = nullptr;
+        }
     }
     
     void SkyBox::Load(std::vector<const GLchar*> cubeMapFaces)
     {
-        cubemapTexture = LoadSkyBoxTextures(cubeMapFaces);
+        if (!Prepare(cubeMapFaces)) {
+            for (GLuint i = 0; i < cubeMapFaces.size() && i < 6; i++)
+            {
+                DecodeFace(i, cubeMapFaces[i]);
+            }
+        }
+        Upload();
+    }
+    
+    bool SkyBox::Prepare(std::vector<const GLchar*> cubeMapFaces)
+    {
+        loadStart = std::chrono::steady_clock::now();
+        faceFileNames.assign(cubeMapFaces.begin(), cubeMapFaces.end());
+        
+        gps::LoadScope scope(CubemapCache::cachePath(faceFileNames.empty() ? "" : faceFileNames[0]), gps::STAGE_FILE_IO);
+        if (!cooked.load(faceFileNames, BlockCompressor::GetFormat())) {
+            return false;
+        }
+        gps::LoadProfiler::instance().addBytesRead(CubemapCache::cachePath(faceFileNames[0]), cooked.getFileSize());
+        return true;
+    }
+    
+    bool SkyBox::DecodeFace(GLuint faceIndex, const GLchar* fileName)
+    {
+        FaceImage& face = faceImages[faceIndex];
+        face.fileName = fileName;
+        face.format = BlockCompressor::GetFormat();
+        if (cooked.isOpen()) {
+            return true;
+        }
+
+        std::vector<unsigned char> fileData;
+        {
+            gps::LoadScope scope(fileName, gps::STAGE_FILE_IO);
+            std::ifstream file(fileName, std::ios::binary);
+            fileData.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+            gps::LoadProfiler::instance().addBytesRead(fileName, fileData.size());
+        }
+        face.contentHash = fileData.empty() ? 0 : ResourceRegistry::hashBytes(fileData.data(), fileData.size());
+
+        //RGBA, so the rows stay 4-byte aligned for the upload
+        int n;
+        unsigned char* rgba;
+        {
+            gps::LoadScope scope(fileName, gps::STAGE_IMAGE_DECODE);
+            rgba = fileData.empty() ? nullptr :
+                stbi_load_from_memory(fileData.data(), (int)fileData.size(), &face.width, &face.height, &n, 4);
+        }
+        if (!rgba) {
+            fprintf(stderr, "ERROR: could not load %s\n", fileName);
+            return false;
+        }
+
+        //the box filter, the Kaiser one wraps around like GL_REPEAT and faces clamp; the faces keep the image row
+        //order cube maps expect
+        {
+            gps::LoadScope scope(fileName, gps::STAGE_MIP_GENERATION);
+            face.pixels = TextureProcessor::BuildMipChain(rgba, face.width, face.height, MIP_FILTER_BOX);
+            face.levels = TextureProcessor::MipLevelCount(face.width, face.height);
+        }
+        stbi_image_free(rgba);
+        if (!face.pixels) {
+            fprintf(stderr, "ERROR: out of memory for the mip chain of %s\n", fileName);
+            return false;
+        }
+
+        if (face.format != FORMAT_RGBA8) {
+            //one thread, the other faces are encoded next to this one
+            gps::LoadScope scope(fileName, gps::STAGE_BLOCK_COMPRESSION);
+            unsigned char* blocks = BlockCompressor::CompressChain(face.pixels, face.width, face.height, face.levels, face.format, 1);
+            TextureProcessor::FreePixels(face.pixels);
+            face.pixels = blocks;
+            if (!blocks) {
+                fprintf(stderr, "ERROR: out of memory for the blocks of %s\n", fileName);
+                return false;
+            }
+        }
+        return true;
+    }
+    
+    void SkyBox::Upload()
+    {
+        cubemapTexture = LoadSkyBoxTextures();
         InitSkyBox();
     }
     
-    void SkyBox::Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix)
+    void SkyBox::Draw(gps::Shader shader)
     {
+        //the view and projection come from the frame's uniform buffer
         shader.useShaderProgram();  
         
-        //set the view and projection matrices
-        glm::mat4 transformedView = glm::mat4(glm::mat3(viewMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(transformedView));
-        glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "projection"), 1, GL_FALSE, glm::value_ptr(projectionMatrix));
-        
         glDepthFunc(GL_LEQUAL);
         
         glBindVertexArray(skyboxVAO);
         glActiveTexture(GL_TEXTURE0);
-        glUniform1i(glGetUniformLocation(shader.shaderProgram, "skybox"), 0);
+        shader.setUniform("skybox", 0);
         glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
         glDrawArrays(GL_TRIANGLES, 0, 36);
         glBindVertexArray(0);
@@ -42,36 +138,113 @@ namespace gps {
         glDepthFunc(GL_LESS);
     }
     
-    GLuint SkyBox::LoadSkyBoxTextures(std::vector<const GLchar*> skyBoxFaces)
+    GLuint SkyBox::LoadSkyBoxTextures()
     {
+        //the faces come from the mapped cube map, or were decoded and get cooked into it
+        bool fromCache = cooked.isOpen();
+        const unsigned char* faces[6];
+        int size = fromCache ? cooked.getSize() : faceImages[0].width;
+        int levels = fromCache ? cooked.getLevels() : faceImages[0].levels;
+        TextureFormat format = fromCache ? cooked.getFormat() : faceImages[0].format;
+        uint64_t contentHashes[6];
+        bool complete = size > 0;
+        for (GLuint i = 0; i < 6; i++)
+        {
+            const FaceImage& face = faceImages[i];
+            faces[i] = fromCache ? cooked.getFace(i) : face.pixels;
+            contentHashes[i] = face.contentHash;
+            if (!fromCache && (!face.pixels || face.width != size || face.height != size || face.levels != levels || face.format != format)) {
+                complete = false;
+            }
+        }
+        if (!complete) {
+            fprintf(stderr, "ERROR: the sky box needs six square faces of the same size\n");
+        }
+        
         GLuint textureID;
         glGenTextures(1, &textureID);
         glActiveTexture(GL_TEXTURE0);
         
-        int width,height, n;
-        unsigned char* image;
-        int force_channels = 3;
-        
         glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
-        for(GLuint i = 0; i < skyBoxFaces.size(); i++)
-        {
-            image = stbi_load(skyBoxFaces[i], &width, &height, &n, force_channels);
-            if (!image) {
-                fprintf(stderr, "ERROR: could not load %s\n", skyBoxFaces[i]);
-                return false;
+        //linear like before, the sky is not gamma corrected
+        GLenum internalFormat = format == FORMAT_RGBA8 ? GL_RGBA8 : BlockCompressor::GLInternalFormat(format, false);
+        if (complete) {
+            gps::LoadScope scope(faceFileNames.empty() ? "skybox" : faceFileNames[0], gps::STAGE_GL_UPLOAD);
+            TextureAllocator::beginAllocation();
+            bool immutable = false;
+#if !defined (__APPLE__)
+            if (GLCaps::get().textureStorage) {
+                glTexStorage2D(GL_TEXTURE_CUBE_MAP, levels, internalFormat, size, size);
+                immutable = true;
+            }
+#endif
+            for (GLuint i = 0; i < 6; i++)
+            {
+                const unsigned char* pixels = faces[i];
+                for (int level = 0; level < levels; level++) {
+                    
+                    GLenum target = GL_TEXTURE_CUBE_MAP_POSITIVE_X + i;
+                    int levelSize = std::max(1, size >> level);
+                    GLsizei bytes = (GLsizei)BlockCompressor::LevelSize(format, levelSize, levelSize);
+                    if (format == FORMAT_RGBA8 && immutable) {
+                        glTexSubImage2D(target, level, 0, 0, levelSize, levelSize, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+                    }
+                    else if (format == FORMAT_RGBA8) {
+                        glTexImage2D(target, level, internalFormat, levelSize, levelSize, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+                    }
+                    else if (immutable) {
+                        glCompressedTexSubImage2D(target, level, 0, 0, levelSize, levelSize, internalFormat, bytes, pixels);
+                    }
+                    else {
+                        glCompressedTexImage2D(target, level, internalFormat, levelSize, levelSize, 0, bytes, pixels);
+                    }
+                    pixels += bytes;
+                }
             }
-            glTexImage2D(
-                         GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0,
-                         GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, image
-                         );
         }
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, std::max(levels - 1, 0));
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        bool resident = complete;
+        if (complete) {
+            TextureOwnerScope owner("skybox");
+            resident = TextureAllocator::instance().track(textureID, GL_TEXTURE_CUBE_MAP, internalFormat, size, size, levels, 6,
+                                                          faceFileNames.empty() ? "skybox" : faceFileNames[0], false);
+        }
         glBindTexture(GL_TEXTURE_CUBE_MAP, 0);
+        if (complete && !resident) {
+            // no sky rather than one with faces missing, the faces are still cooked below
+            glDeleteTextures(1, &textureID);
+            textureID = 0;
+        }
+        
+        if (complete && !fromCache) {
+            gps::LoadScope scope(CubemapCache::cachePath(faceFileNames[0]), gps::STAGE_FILE_IO);
+            if (!CubemapCache::write(faceFileNames, contentHashes, format, size, levels, faces)) {
+                fprintf(stderr, "WARNING: could not cook the sky box into %s\n", CubemapCache::cachePath(faceFileNames[0]).c_str());
+            }
+        }
+        
+        size_t fileBytes = cooked.getFileSize();
+        cooked.close();
+        for (FaceImage& face : faceImages) {
+            TextureProcessor::FreePixels(face.pixels);
+            face.pixels = nullptr;
+        }
         
+        if (resident) {
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loadStart).count();
+            std::cout << "Sky box: 6 faces of " << size << "x" << size << " " << BlockCompressor::FormatName(format) << ", " << levels << " levels, "
+                << (fromCache ? "mapped from the cooked cube map" : "decoded and cooked") << " in " << ms << " ms, "
+                << TextureAllocator::storageSize(internalFormat, size, size, levels, 0, 6) / 1024 << " KB resident";
+            if (fromCache) {
+                std::cout << ", " << fileBytes / 1024 << " KB file";
+            }
+            std::cout << std::endl;
+        }
         return textureID;
     }
     
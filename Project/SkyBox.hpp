@@ -11,11 +11,15 @@
 
 
 #include "Shader.hpp"
+#include "BlockCompressor.hpp"
+#include "CubemapCache.hpp"
 #include "stb_image.h"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include <chrono>
+#include <string>
 #include <vector>
 #include <stdio.h>
 
@@ -25,13 +29,35 @@ namespace gps {
     public:
         SkyBox();
         void Load(std::vector<const GLchar*> cubeMapFaces);
-        void Draw(gps::Shader shader, glm::mat4 viewMatrix, glm::mat4 projectionMatrix);
+        //maps the cooked cube map of the faces if it is current, DecodeFace has nothing left to do then; any thread
+        bool Prepare(std::vector<const GLchar*> cubeMapFaces);
+        //decodes one face of the cube map and builds its mip chain, in the selected format; faces can be decoded in
+        //parallel
+        bool DecodeFace(GLuint faceIndex, const GLchar* fileName);
+        //creates the cube map from the cooked or decoded faces and the cube geometry, cooks the decoded ones; needs the
+        //GL context
+        void Upload();
+        void Draw(gps::Shader shader);
         GLuint GetTextureId();
     private:
+        struct FaceImage {
+            const GLchar* fileName;
+            int width;
+            int height;
+            int levels;
+            //mip chain in RGBA8 or blocks, from the TextureProcessor allocator
+            TextureFormat format;
+            uint64_t contentHash;
+            unsigned char* pixels;
+        };
+        FaceImage faceImages[6];
+        std::vector<std::string> faceFileNames;
+        CubemapCache cooked;
+        std::chrono::steady_clock::time_point loadStart;
         GLuint skyboxVAO;
         GLuint skyboxVBO;
         GLuint cubemapTexture;
-        GLuint LoadSkyBoxTextures(std::vector<const GLchar*> cubeMapFaces);
+        GLuint LoadSkyBoxTextures();
         void InitSkyBox();
     };
 }
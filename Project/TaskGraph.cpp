@@ -0,0 +1,170 @@
+#include "TaskGraph.hpp"
+
+#include <algorithm>
+#include <iomanip>
+#include <thread>
+
+namespace gps {
+
+    TaskGraph::TaskId TaskGraph::addTask(std::string name, TaskThread thread, std::function<void()> work, std::vector<TaskId> dependencies) {
+
+        Task task;
+        task.name = name;
+        task.thread = thread;
+        task.work = work;
+        task.dependencies = dependencies;
+        task.pendingDependencies = 0;
+        task.startMs = 0.0;
+        task.endMs = 0.0;
+
+        TaskId id = tasks.size();
+        tasks.push_back(task);
+        for (TaskId dependency : dependencies) {
+            tasks[dependency].dependents.push_back(id);
+        }
+        return id;
+    }
+
+    void TaskGraph::run(unsigned workerCount) {
+
+        if (workerCount == 0) {
+            // like the AsyncLoader; hardware_concurrency may also be 0 when unknown
+            unsigned hardwareThreads = std::thread::hardware_concurrency();
+            workerCount = hardwareThreads > 2 ? hardwareThreads - 1 : 1;
+        }
+        usedWorkers = workerCount;
+        finishedTasks = 0;
+        workerQueue.clear();
+        contextQueue.clear();
+        runStart = Clock::now();
+
+        for (TaskId id = 0; id < tasks.size(); id++) {
+            tasks[id].pendingDependencies = tasks[id].dependencies.size();
+            if (tasks[id].pendingDependencies == 0) {
+                (tasks[id].thread == WORKER_THREAD ? workerQueue : contextQueue).push_back(id);
+            }
+        }
+
+        std::vector<std::thread> workers;
+        for (unsigned i = 0; i < workerCount; i++) {
+            workers.push_back(std::thread(&TaskGraph::workerLoop, this));
+        }
+
+        // the calling thread owns the GL context and only ever picks up context tasks
+        std::unique_lock<std::mutex> lock(queueMutex);
+        while (finishedTasks < tasks.size()) {
+
+            if (contextQueue.empty()) {
+                contextReady.wait(lock);
+                continue;
+            }
+
+            TaskId id = contextQueue.front();
+            contextQueue.erase(contextQueue.begin());
+            lock.unlock();
+            execute(id);
+            lock.lock();
+        }
+        lock.unlock();
+
+        workerReady.notify_all();
+        for (std::thread& worker : workers) {
+            worker.join();
+        }
+
+        wallMs = std::chrono::duration<double, std::milli>(Clock::now() - runStart).count();
+    }
+
+    void TaskGraph::workerLoop() {
+
+        std::unique_lock<std::mutex> lock(queueMutex);
+        while (finishedTasks < tasks.size()) {
+
+            if (workerQueue.empty()) {
+                workerReady.wait(lock);
+                continue;
+            }
+
+            TaskId id = workerQueue.front();
+            workerQueue.erase(workerQueue.begin());
+            lock.unlock();
+            execute(id);
+            lock.lock();
+        }
+    }
+
+    void TaskGraph::execute(TaskId id) {
+
+        Task& task = tasks[id];
+        task.startMs = std::chrono::duration<double, std::milli>(Clock::now() - runStart).count();
+        task.work();
+        task.endMs = std::chrono::duration<double, std::milli>(Clock::now() - runStart).count();
+
+        std::lock_guard<std::mutex> lock(queueMutex);
+        finishedTasks++;
+        for (TaskId dependent : task.dependents) {
+            if (--tasks[dependent].pendingDependencies == 0) {
+                (tasks[dependent].thread == WORKER_THREAD ? workerQueue : contextQueue).push_back(dependent);
+            }
+        }
+
+        // wake everyone on completion so idle threads can notice the graph is done
+        workerReady.notify_all();
+        contextReady.notify_all();
+    }
+
+    void TaskGraph::printReport(std::ostream& out) const {
+
+        if (tasks.empty()) {
+            return;
+        }
+
+        // longest chain of dependent task durations - tasks are added after their dependencies
+        std::vector<double> pathMs(tasks.size(), 0.0);
+        std::vector<TaskId> pathPrevious(tasks.size(), tasks.size());
+        double serialMs = 0.0;
+        TaskId pathEnd = 0;
+
+        for (TaskId id = 0; id < tasks.size(); id++) {
+
+            double duration = tasks[id].endMs - tasks[id].startMs;
+            serialMs += duration;
+
+            for (TaskId dependency : tasks[id].dependencies) {
+                if (pathMs[dependency] > pathMs[id]) {
+                    pathMs[id] = pathMs[dependency];
+                    pathPrevious[id] = dependency;
+                }
+            }
+            pathMs[id] += duration;
+
+            if (pathMs[id] > pathMs[pathEnd]) {
+                pathEnd = id;
+            }
+        }
+
+        std::vector<TaskId> criticalPath;
+        for (TaskId id = pathEnd; id < tasks.size(); id = pathPrevious[id]) {
+            criticalPath.push_back(id);
+        }
+        std::reverse(criticalPath.begin(), criticalPath.end());
+
+        out << "Startup tasks (" << usedWorkers << " workers):" << std::endl;
+        out << std::fixed << std::setprecision(2);
+        for (const Task& task : tasks) {
+            out << "  " << std::setw(9) << (task.endMs - task.startMs) << " ms  ["
+                << std::setw(8) << task.startMs << " - " << std::setw(8) << task.endMs << "]  "
+                << (task.thread == WORKER_THREAD ? "worker " : "context") << "  " << task.name << std::endl;
+        }
+
+        out << "Critical path (" << pathMs[pathEnd] << " ms):" << std::endl;
+        for (TaskId id : criticalPath) {
+            out << "  " << tasks[id].name << std::endl;
+        }
+
+        out << "Serial time   : " << serialMs << " ms" << std::endl;
+        out << "Wall time     : " << wallMs << " ms" << std::endl;
+        out << "Speedup       : " << (wallMs > 0.0 ? serialMs / wallMs : 0.0) << "x" << std::endl;
+        out << std::defaultfloat;
+    }
+}
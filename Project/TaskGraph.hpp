@@ -0,0 +1,63 @@
+#ifndef TaskGraph_hpp
+#define TaskGraph_hpp
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Dependency graph of startup work - CPU tasks run on a worker pool, GL tasks on the thread that owns the context
+    class TaskGraph {
+
+    public:
+        typedef size_t TaskId;
+
+        enum TaskThread { WORKER_THREAD, CONTEXT_THREAD };
+
+        // Dependencies must already be part of the graph
+        TaskId addTask(std::string name, TaskThread thread, std::function<void()> work, std::vector<TaskId> dependencies = std::vector<TaskId>());
+
+        // Executes every task and returns when all finished, the calling thread runs the CONTEXT_THREAD tasks
+        void run(unsigned workerCount = 0);
+
+        // Wall time of each task, the critical path and the speedup over running everything serially
+        void printReport(std::ostream& out) const;
+
+    private:
+        typedef std::chrono::steady_clock Clock;
+
+        struct Task {
+
+            std::string name;
+            TaskThread thread;
+            std::function<void()> work;
+            std::vector<TaskId> dependencies;
+            std::vector<TaskId> dependents;
+            size_t pendingDependencies;
+            double startMs;
+            double endMs;
+        };
+
+        std::vector<Task> tasks;
+        std::vector<TaskId> workerQueue;
+        std::vector<TaskId> contextQueue;
+        size_t finishedTasks;
+        unsigned usedWorkers;
+        double wallMs;
+        Clock::time_point runStart;
+
+        std::mutex queueMutex;
+        std::condition_variable workerReady;
+        std::condition_variable contextReady;
+
+        void execute(TaskId id);
+        void workerLoop();
+    };
+}
+
+#endif /* TaskGraph_hpp */
@@ -0,0 +1,369 @@
+#include "TextureAllocator.hpp"
+#include "BlockCompressor.hpp"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+namespace gps {
+
+    std::string TextureAllocator::currentOwner = "unowned";
+
+    namespace {
+
+        // Block compressed formats as the encoder knows them, FORMAT_RGBA8 for everything else
+        TextureFormat blockFormat(GLenum internalFormat) {
+
+            switch (internalFormat) {
+            case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+            case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+                return FORMAT_BC1;
+            case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+            case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+                return FORMAT_BC3;
+            case GL_COMPRESSED_RGBA_BPTC_UNORM:
+            case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+                return FORMAT_BC7;
+            default:
+                return FORMAT_RGBA8;
+            }
+        }
+
+        const char* errorName(GLenum error) {
+
+            switch (error) {
+            case GL_OUT_OF_MEMORY:
+                return "GL_OUT_OF_MEMORY";
+            case GL_INVALID_VALUE:
+                return "GL_INVALID_VALUE";
+            case GL_INVALID_ENUM:
+                return "GL_INVALID_ENUM";
+            case GL_INVALID_OPERATION:
+                return "GL_INVALID_OPERATION";
+            default:
+                return "GL error";
+            }
+        }
+    }
+
+    // Declared next to GLTextureTraits, so every GLTexture leaves the books when it is deleted
+    void untrackTextures(GLsizei count, const GLuint* names) {
+
+        for (GLsizei i = 0; i < count; i++) {
+            TextureAllocator::instance().untrack(names[i]);
+        }
+    }
+
+    TextureAllocator& TextureAllocator::instance() {
+
+        // never destroyed, textures released during static destruction still find their books
+        static TextureAllocator* allocator = new TextureAllocator();
+        return *allocator;
+    }
+
+    TextureAllocator::TextureAllocator() : budget(0), frame(0), totals() {
+    }
+
+    void TextureAllocator::setBudget(size_t bytes) {
+
+        budget = bytes;
+    }
+
+    bool TextureAllocator::hasBudget() const {
+
+        return budget > 0;
+    }
+
+    int TextureAllocator::fallbackLevel(int width, int height, int levels) {
+
+        int level = 0;
+        while (level < levels - 1 && std::max(std::max(1, width >> level), std::max(1, height >> level)) > FALLBACK_SIZE) {
+            level++;
+        }
+        return level;
+    }
+
+    size_t TextureAllocator::storageSize(GLenum internalFormat, int width, int height, int levels, int first, int layers) {
+
+        // drivers keep RGB8 and 24-bit depth in 4 bytes as well
+        TextureFormat format = blockFormat(internalFormat);
+        size_t bytes = 0;
+        for (int level = first; level < levels; level++) {
+            bytes += BlockCompressor::LevelSize(format, std::max(1, width >> level), std::max(1, height >> level));
+        }
+        return bytes * layers;
+    }
+
+    void TextureAllocator::beginAllocation() {
+
+        // each is an earlier call's error, not the allocation's
+        GLenum error;
+        while ((error = glGetError()) != GL_NO_ERROR) {
+            std::cerr << "WARNING: GL error " << errorName(error) << " pending before a texture allocation" << std::endl;
+        }
+    }
+
+    bool TextureAllocator::track(GLuint name, GLenum target, GLenum internalFormat, int width, int height, int levels, int layers,
+                                 const std::string& label, bool evictable, int baseLevel) {
+
+        Allocation allocation;
+        allocation.target = target;
+        allocation.internalFormat = internalFormat;
+        allocation.width = width;
+        allocation.height = height;
+        allocation.levels = levels;
+        allocation.layers = layers;
+        allocation.baseLevel = baseLevel;
+        allocation.bytes = 0;
+        allocation.owner = currentOwner;
+        allocation.label = label;
+        allocation.evictable = evictable && target == GL_TEXTURE_2D;
+        allocation.lastUsed = frame;
+
+        size_t bytes = storageSize(internalFormat, width, height, levels, baseLevel, layers);
+
+        GLenum error = glGetError();
+        if (error != GL_NO_ERROR) {
+
+            totals.failures++;
+            std::cerr << "ERROR: texture allocation failed with " << errorName(error) << ": " << label << " (" << currentOwner << "), "
+                      << width << "x" << height << "x" << layers << " " << formatName(internalFormat) << ", " << levels << " levels, "
+                      << bytes / 1024 << " KB; " << totals.totalBytes / (1024 * 1024) << " MB in " << allocations.size()
+                      << " textures already allocated";
+            if (budget > 0) {
+                std::cerr << ", budget " << budget / (1024 * 1024) << " MB";
+            }
+            std::cerr << std::endl;
+            // a failed allocation may raise more than one error, all of them are this one's
+            while (glGetError() != GL_NO_ERROR) {
+            }
+            return false;
+        }
+
+        untrack(name);
+        if (!reserve(bytes, name, true)) {
+
+            // the texture is needed to draw, so it stays; the first overrun is reported
+            if (totals.overBudget++ == 0) {
+                std::cerr << "WARNING: texture budget of " << budget / (1024 * 1024) << " MB exceeded by " << label << " (" << currentOwner
+                          << "), nothing left to evict" << std::endl;
+            }
+        }
+
+        Allocation& tracked = allocations[name];
+        tracked = allocation;
+        account(tracked, baseLevel);
+        return true;
+    }
+
+    void TextureAllocator::untrack(GLuint name) {
+
+        auto found = allocations.find(name);
+        if (found == allocations.end()) {
+            return;
+        }
+        totals.totalBytes -= found->second.bytes;
+        allocations.erase(found);
+    }
+
+    void TextureAllocator::touch(GLuint name) {
+
+        auto found = allocations.find(name);
+        if (found != allocations.end()) {
+            found->second.lastUsed = frame;
+        }
+    }
+
+    void TextureAllocator::setEvictable(GLuint name, bool evictable) {
+
+        auto found = allocations.find(name);
+        if (found != allocations.end()) {
+            found->second.evictable = evictable && found->second.target == GL_TEXTURE_2D;
+        }
+    }
+
+    void TextureAllocator::setBaseLevel(GLuint name, int baseLevel) {
+
+        auto found = allocations.find(name);
+        if (found != allocations.end()) {
+            account(found->second, baseLevel);
+        }
+    }
+
+    bool TextureAllocator::reserve(size_t bytes, GLuint exclude, bool anyFrame) {
+
+        if (budget == 0 || totals.totalBytes + bytes <= budget) {
+            return true;
+        }
+
+        std::vector<GLuint> victims;
+        for (auto& pair : allocations) {
+
+            const Allocation& allocation = pair.second;
+            if (pair.first != exclude && allocation.evictable && (anyFrame || allocation.lastUsed < frame) &&
+                allocation.baseLevel < fallbackLevel(allocation.width, allocation.height, allocation.levels)) {
+                victims.push_back(pair.first);
+            }
+        }
+        // least recently used first, the largest first among those used in the same frame
+        std::sort(victims.begin(), victims.end(), [this](GLuint a, GLuint b) {
+            const Allocation& ea = allocations[a];
+            const Allocation& eb = allocations[b];
+            return ea.lastUsed != eb.lastUsed ? ea.lastUsed < eb.lastUsed : ea.bytes > eb.bytes;
+        });
+
+        for (GLuint name : victims) {
+
+            const Allocation& victim = allocations[name];
+            dropLevels(name, fallbackLevel(victim.width, victim.height, victim.levels));
+            if (totals.totalBytes + bytes <= budget) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    size_t TextureAllocator::dropLevels(GLuint name, int baseLevel) {
+
+        auto found = allocations.find(name);
+        if (found == allocations.end() || found->second.target != GL_TEXTURE_2D || baseLevel <= found->second.baseLevel) {
+            return 0;
+        }
+        Allocation& allocation = found->second;
+
+        glBindTexture(GL_TEXTURE_2D, name);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, baseLevel);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, 0.0f);
+
+        // an empty image in place of each dropped level frees its storage, levels under the base level are never sampled
+        bool compressed = blockFormat(allocation.internalFormat) != FORMAT_RGBA8;
+        for (int level = allocation.baseLevel; level < baseLevel; level++) {
+            if (compressed) {
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, allocation.internalFormat, 0, 0, 0, 0, NULL);
+            }
+            else {
+                glTexImage2D(GL_TEXTURE_2D, level, allocation.internalFormat, 0, 0, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            }
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        size_t before = allocation.bytes;
+        account(allocation, baseLevel);
+        size_t freed = before - allocation.bytes;
+        totals.evictions++;
+        totals.evictedBytes += freed;
+
+        if (listener) {
+            listener(name, baseLevel);
+        }
+        return freed;
+    }
+
+    void TextureAllocator::setEvictionListener(EvictionListener listener) {
+
+        this->listener = listener;
+    }
+
+    void TextureAllocator::endFrame() {
+
+        frame++;
+    }
+
+    void TextureAllocator::account(Allocation& allocation, int baseLevel) {
+
+        totals.totalBytes -= allocation.bytes;
+        allocation.baseLevel = baseLevel;
+        allocation.bytes = storageSize(allocation.internalFormat, allocation.width, allocation.height, allocation.levels, baseLevel,
+                                       allocation.layers);
+        totals.totalBytes += allocation.bytes;
+        totals.peakBytes = std::max(totals.peakBytes, totals.totalBytes);
+    }
+
+    TextureMemoryStats TextureAllocator::getStats() const {
+
+        TextureMemoryStats stats = totals;
+        stats.textures = allocations.size();
+        stats.budgetBytes = budget;
+        return stats;
+    }
+
+    std::map<std::string, size_t> TextureAllocator::getBytesByOwner() const {
+
+        std::map<std::string, size_t> owners;
+        for (const auto& pair : allocations) {
+            owners[pair.second.owner] += pair.second.bytes;
+        }
+        return owners;
+    }
+
+    void TextureAllocator::printSummary(std::ostream& out) const {
+
+        TextureMemoryStats stats = getStats();
+        out << "Texture memory   : " << stats.totalBytes / 1024 << " KB in " << stats.textures << " textures";
+        if (stats.budgetBytes > 0) {
+            out << " of " << stats.budgetBytes / 1024 << " KB budget";
+        }
+        out << ", peak " << stats.peakBytes / 1024 << " KB, " << stats.evictions << " evictions (" << stats.evictedBytes / 1024 << " KB), "
+            << stats.failures << " failed allocations, " << stats.overBudget << " over budget" << std::endl;
+    }
+
+    void TextureAllocator::printStats(std::ostream& out) const {
+
+        printSummary(out);
+
+        for (const auto& owner : getBytesByOwner()) {
+            out << "  " << owner.first << " : " << owner.second / 1024 << " KB" << std::endl;
+        }
+
+        std::map<std::string, std::pair<size_t, size_t> > formats;
+        for (const auto& pair : allocations) {
+            std::pair<size_t, size_t>& format = formats[formatName(pair.second.internalFormat)];
+            format.first++;
+            format.second += pair.second.bytes;
+        }
+        for (const auto& format : formats) {
+            out << "  " << format.first << " : " << format.second.first << " textures, " << format.second.second / 1024 << " KB" << std::endl;
+        }
+    }
+
+    const char* TextureAllocator::formatName(GLenum internalFormat) {
+
+        switch (internalFormat) {
+        case GL_RGBA8:
+            return "RGBA8";
+        case GL_SRGB8_ALPHA8:
+            return "SRGB8_ALPHA8";
+        case GL_SRGB8:
+            return "SRGB8";
+        case GL_RGB:
+        case GL_RGB8:
+            return "RGB8";
+        case GL_DEPTH_COMPONENT:
+        case GL_DEPTH_COMPONENT24:
+            return "DEPTH24";
+        case GL_DEPTH_COMPONENT32F:
+            return "DEPTH32F";
+        case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+        case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+            return "BC1";
+        case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+        case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT:
+            return "BC3";
+        case GL_COMPRESSED_RGBA_BPTC_UNORM:
+        case GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM:
+            return "BC7";
+        default:
+            return "other";
+        }
+    }
+
+    TextureOwnerScope::TextureOwnerScope(const std::string& owner) : previous(TextureAllocator::currentOwner) {
+
+        TextureAllocator::currentOwner = owner;
+    }
+
+    TextureOwnerScope::~TextureOwnerScope() {
+
+        TextureAllocator::currentOwner = previous;
+    }
+}
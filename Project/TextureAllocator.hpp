@@ -0,0 +1,151 @@
+#ifndef TextureAllocator_hpp
+#define TextureAllocator_hpp
+
+#include "GLHandle.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+namespace gps {
+
+    // Live totals of the texture memory books
+    struct TextureMemoryStats {
+
+        size_t textures;
+        size_t totalBytes;
+        size_t peakBytes;
+        // 0 when there is no budget
+        size_t budgetBytes;
+        size_t evictions;
+        size_t evictedBytes;
+        // allocations GL refused, and ones that went over the budget with nothing left to evict
+        size_t failures;
+        size_t overBudget;
+    };
+
+    // Books of every texture allocation - target, internal format, size, mip count and owner - so GPU texture memory
+    // is known instead of guessed. With a budget, a new allocation that does not fit first evicts the least recently
+    // used textures down to a fallback of at most FALLBACK_SIZE texels: the levels above it are respecified empty,
+    // which frees them, and GL_TEXTURE_BASE_LEVEL skips them. Only textures with mutable storage can be evicted,
+    // so with a budget TextureUploader stops using glTexStorage2D. Render targets, cube maps and texture arrays
+    // are pinned. GL thread only.
+    class TextureAllocator {
+
+    public:
+        // Largest side of the level an evicted texture keeps
+        static const int FALLBACK_SIZE = 64;
+
+        static TextureAllocator& instance();
+
+        // Bytes all textures may take, 0 (the default) only keeps the books
+        void setBudget(size_t bytes);
+        bool hasBudget() const;
+
+        // Finest level an evicted texture keeps
+        static int fallbackLevel(int width, int height, int levels);
+
+        // Bytes of levels first..levels-1 of layers images in an internal format
+        static size_t storageSize(GLenum internalFormat, int width, int height, int levels, int first = 0, int layers = 1);
+
+        // Call right before the GL calls that allocate a texture's storage, so track sees only their errors. Errors
+        // still pending from earlier calls are reported here instead.
+        static void beginAllocation();
+
+        // Records the storage just allocated for the bound texture name; evicts others first if the budget needs room,
+        // prints a diagnostic with the totals if GL reported an error since beginAllocation. Levels from baseLevel up
+        // are resident. Returns false if the allocation failed, the caller deletes the name then.
+        bool track(GLuint name, GLenum target, GLenum internalFormat, int width, int height, int levels, int layers, const std::string& label,
+                   bool evictable, int baseLevel = 0);
+
+        // Forgets a deleted texture, unknown names are ignored
+        void untrack(GLuint name);
+
+        // The texture was sampled this frame, for the LRU order
+        void touch(GLuint name);
+
+        // Whether reserve may drop levels of a 2D texture, e.g. not before its pixels were uploaded
+        void setEvictable(GLuint name, bool evictable);
+
+        // Levels from baseLevel up are resident now, after its owner loaded or dropped some
+        void setBaseLevel(GLuint name, int baseLevel);
+
+        // Makes room for bytes more by evicting textures not used this frame (or, with anyFrame, any), other than
+        // exclude; false if the budget still cannot hold them
+        bool reserve(size_t bytes, GLuint exclude, bool anyFrame = false);
+
+        // Drops the levels of a mutable 2D texture above baseLevel, returns the bytes freed
+        size_t dropLevels(GLuint name, int baseLevel);
+
+        // Told about every texture dropLevels changed, to keep an owner's own residency in step
+        typedef std::function<void(GLuint name, int baseLevel)> EvictionListener;
+        void setEvictionListener(EvictionListener listener);
+
+        // Once per frame, after the draws
+        void endFrame();
+
+        TextureMemoryStats getStats() const;
+
+        // Resident bytes per owner, as named by the TextureOwnerScope of the allocation
+        std::map<std::string, size_t> getBytesByOwner() const;
+
+        // One line of totals
+        void printSummary(std::ostream& out) const;
+
+        // Totals, then bytes per owner and per format
+        void printStats(std::ostream& out) const;
+
+        static const char* formatName(GLenum internalFormat);
+
+    private:
+        struct Allocation {
+
+            GLenum target;
+            GLenum internalFormat;
+            int width;
+            int height;
+            int levels;
+            int layers;
+            int baseLevel;
+            size_t bytes;
+            std::string owner;
+            std::string label;
+            bool evictable;
+            uint64_t lastUsed;
+        };
+
+        std::unordered_map<GLuint, Allocation> allocations;
+        size_t budget;
+        uint64_t frame;
+        TextureMemoryStats totals;
+        EvictionListener listener;
+
+        static std::string currentOwner;
+
+        TextureAllocator();
+
+        void account(Allocation& allocation, int baseLevel);
+
+        friend class TextureOwnerScope;
+    };
+
+    // Names the owner of the textures allocated until the end of the scope, "unowned" outside of one
+    class TextureOwnerScope {
+
+    public:
+        explicit TextureOwnerScope(const std::string& owner);
+        ~TextureOwnerScope();
+
+        TextureOwnerScope(const TextureOwnerScope&) = delete;
+        TextureOwnerScope& operator=(const TextureOwnerScope&) = delete;
+
+    private:
+        std::string previous;
+    };
+}
+
+#endif /* TextureAllocator_hpp */
@@ -0,0 +1,191 @@
+#include "TextureCache.hpp"
+#include "ResourceRegistry.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace gps {
+
+    namespace {
+
+        const char CACHE_MAGIC[4] = { 'G', 'P', 'S', 'T' };
+
+        // 64 bytes, so the pixels start 16-byte aligned in the mapping
+        struct CacheHeader {
+
+            char magic[4];
+            uint32_t version;
+            uint32_t width;
+            uint32_t height;
+            uint32_t levels;
+            uint32_t filter;
+            uint32_t format;
+            uint32_t reserved[3];
+            uint64_t sourceSize;
+            int64_t sourceMtime;
+            uint64_t contentHash;
+        };
+    }
+
+    TextureCache::TextureCache() : width(0), height(0), levels(0), contentHash(0) {
+    }
+
+    std::string TextureCache::cachePath(const std::string& imageFileName) {
+
+        return imageFileName + ".gpstex";
+    }
+
+    bool TextureCache::readSourceStamp(const std::string& fileName, uint64_t& size, int64_t& mtime) {
+
+        std::error_code error;
+        uintmax_t fileSize = std::filesystem::file_size(fileName, error);
+        if (error) {
+            return false;
+        }
+        std::filesystem::file_time_type writeTime = std::filesystem::last_write_time(fileName, error);
+        if (error) {
+            return false;
+        }
+        size = static_cast<uint64_t>(fileSize);
+        mtime = static_cast<int64_t>(writeTime.time_since_epoch().count());
+        return true;
+    }
+
+    bool TextureCache::write(const std::string& imageFileName, uint64_t contentHash, MipFilter filter, TextureFormat format,
+                             int width, int height, int levels, const unsigned char* pixels) {
+
+        CacheHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+        header.version = VERSION;
+        header.width = static_cast<uint32_t>(width);
+        header.height = static_cast<uint32_t>(height);
+        header.levels = static_cast<uint32_t>(levels);
+        header.filter = static_cast<uint32_t>(filter);
+        header.format = static_cast<uint32_t>(format);
+        header.contentHash = contentHash;
+
+        if (!readSourceStamp(imageFileName, header.sourceSize, header.sourceMtime)) {
+            return false;
+        }
+
+        // write to a temporary file first so a crash never leaves a half-written cache behind
+        std::string fileName = cachePath(imageFileName);
+        std::string tempFileName = fileName + ".tmp";
+        std::ofstream out(tempFileName, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "WARNING: could not write texture cache " << fileName << std::endl;
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(pixels), static_cast<std::streamsize>(BlockCompressor::ChainSize(format, width, height, levels)));
+        out.close();
+        if (!out) {
+            std::remove(tempFileName.c_str());
+            return false;
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tempFileName, fileName, error);
+        if (error) {
+            std::remove(tempFileName.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool TextureCache::load(const std::string& imageFileName, MipFilter filter, TextureFormat format) {
+
+        close();
+
+        uint64_t sourceSize;
+        int64_t sourceMtime;
+        if (!readSourceStamp(imageFileName, sourceSize, sourceMtime)) {
+            return false;
+        }
+
+        if (!file.open(cachePath(imageFileName))) {
+            return false;
+        }
+
+        CacheHeader header;
+        if (file.size() < sizeof(header)) {
+            close();
+            return false;
+        }
+        std::memcpy(&header, file.data(), sizeof(header));
+
+        if (std::memcmp(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0 || header.version != VERSION ||
+            header.filter != static_cast<uint32_t>(filter) || header.format != static_cast<uint32_t>(format) || header.sourceSize != sourceSize) {
+            close();
+            return false;
+        }
+
+        int cachedWidth = static_cast<int>(header.width);
+        int cachedHeight = static_cast<int>(header.height);
+        int cachedLevels = static_cast<int>(header.levels);
+        if (cachedWidth <= 0 || cachedHeight <= 0 || cachedLevels <= 0 || cachedLevels > TextureProcessor::MipLevelCount(cachedWidth, cachedHeight) ||
+            file.size() - sizeof(header) < BlockCompressor::ChainSize(format, cachedWidth, cachedHeight, cachedLevels)) {
+            std::cerr << "WARNING: discarding corrupt texture cache " << cachePath(imageFileName) << std::endl;
+            close();
+            return false;
+        }
+
+        // a touched but unchanged source (e.g. after a checkout) still matches by content
+        if (header.sourceMtime != sourceMtime) {
+            MappedFile source;
+            if (!source.open(imageFileName) || ResourceRegistry::hashBytes(source.data(), source.size()) != header.contentHash) {
+                close();
+                return false;
+            }
+        }
+
+        width = cachedWidth;
+        height = cachedHeight;
+        levels = cachedLevels;
+        contentHash = header.contentHash;
+        return true;
+    }
+
+    void TextureCache::close() {
+
+        file.close();
+        width = 0;
+        height = 0;
+        levels = 0;
+        contentHash = 0;
+    }
+
+    int TextureCache::getWidth() const {
+
+        return width;
+    }
+
+    int TextureCache::getHeight() const {
+
+        return height;
+    }
+
+    int TextureCache::getLevels() const {
+
+        return levels;
+    }
+
+    uint64_t TextureCache::getContentHash() const {
+
+        return contentHash;
+    }
+
+    const unsigned char* TextureCache::getPixels() const {
+
+        return file.isOpen() ? file.data() + sizeof(CacheHeader) : nullptr;
+    }
+
+    size_t TextureCache::getFileSize() const {
+
+        return file.size();
+    }
+}
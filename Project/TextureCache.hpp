@@ -0,0 +1,58 @@
+#ifndef TextureCache_hpp
+#define TextureCache_hpp
+
+#include "BlockCompressor.hpp"
+#include "MappedFile.hpp"
+#include "TextureProcessor.hpp"
+
+#include <cstdint>
+#include <string>
+
+namespace gps {
+
+    // Versioned cooked copy of a decoded image, stored next to the source: the flipped mip chain in upload order, RGBA8
+    // or block compressed, so a load is one read and no decode or encode
+    class TextureCache {
+
+    public:
+        static const uint32_t VERSION = 2;
+
+        TextureCache();
+
+        // Cooked file name for an image file
+        static std::string cachePath(const std::string& imageFileName);
+
+        // Size and modification time a cooked file is stamped with
+        static bool readSourceStamp(const std::string& fileName, uint64_t& size, int64_t& mtime);
+
+        // Writes the cooked chain of an image, stamped with the source size, mtime and contentHash (the registry key)
+        static bool write(const std::string& imageFileName, uint64_t contentHash, MipFilter filter, TextureFormat format,
+                          int width, int height, int levels, const unsigned char* pixels);
+
+        // Maps the cooked file of an image, fails if it is missing, corrupt, older than the source or built with another
+        // filter or format
+        bool load(const std::string& imageFileName, MipFilter filter, TextureFormat format);
+
+        void close();
+
+        int getWidth() const;
+        int getHeight() const;
+        int getLevels() const;
+        uint64_t getContentHash() const;
+
+        // The mip chain in the requested format, points into the mapping
+        const unsigned char* getPixels() const;
+
+        // Size of the mapped cooked file
+        size_t getFileSize() const;
+
+    private:
+        MappedFile file;
+        int width;
+        int height;
+        int levels;
+        uint64_t contentHash;
+    };
+}
+
+#endif /* TextureCache_hpp */
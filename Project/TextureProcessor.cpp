@@ -0,0 +1,671 @@
+#include "TextureProcessor.hpp"
+#include "DecodePool.hpp"
+#include "GLCaps.hpp"
+#include "ResourceRegistry.hpp"
+#include "TaskGraph.hpp"
+#include "TextureCache.hpp"
+
+#include "stb_image.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+    #define GPS_SSE2 1
+    #include <emmintrin.h>
+#endif
+// AVX2 is picked at run time, the build targets CPUs without it
+#if defined (GPS_SSE2) && (defined (_MSC_VER) || defined (__GNUC__))
+    #define GPS_AVX2 1
+    #include <immintrin.h>
+    #if defined (_MSC_VER)
+        #include <intrin.h>
+        #define GPS_TARGET_AVX2
+    #else
+        #define GPS_TARGET_AVX2 __attribute__((target("avx2")))
+    #endif
+#endif
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+    #define GPS_NEON 1
+    #include <arm_neon.h>
+#endif
+
+namespace gps {
+
+    MipFilter TextureProcessor::mipFilter = MIP_FILTER_BOX;
+
+    namespace {
+
+        // One RGBA texel in linear space
+        struct Float4 {
+#if defined (GPS_SSE2)
+            __m128 v;
+#elif defined (GPS_NEON)
+            float32x4_t v;
+#else
+            float v[4];
+#endif
+        };
+
+        inline Float4 makeFloat4(float r, float g, float b, float a) {
+
+            Float4 result;
+#if defined (GPS_SSE2)
+            result.v = _mm_setr_ps(r, g, b, a);
+#elif defined (GPS_NEON)
+            float values[4] = { r, g, b, a };
+            result.v = vld1q_f32(values);
+#else
+            result.v[0] = r; result.v[1] = g; result.v[2] = b; result.v[3] = a;
+#endif
+            return result;
+        }
+
+        inline Float4 zeroFloat4() {
+
+            return makeFloat4(0.0f, 0.0f, 0.0f, 0.0f);
+        }
+
+        inline Float4 add(Float4 a, Float4 b) {
+
+#if defined (GPS_SSE2)
+            a.v = _mm_add_ps(a.v, b.v);
+#elif defined (GPS_NEON)
+            a.v = vaddq_f32(a.v, b.v);
+#else
+            for (int c = 0; c < 4; c++) a.v[c] += b.v[c];
+#endif
+            return a;
+        }
+
+        // a + b * weight
+        inline Float4 addScaled(Float4 a, Float4 b, float weight) {
+
+#if defined (GPS_SSE2)
+            a.v = _mm_add_ps(a.v, _mm_mul_ps(b.v, _mm_set1_ps(weight)));
+#elif defined (GPS_NEON)
+            a.v = vmlaq_n_f32(a.v, b.v, weight);
+#else
+            for (int c = 0; c < 4; c++) a.v[c] += b.v[c] * weight;
+#endif
+            return a;
+        }
+
+        inline Float4 scale(Float4 a, float factor) {
+
+            return addScaled(zeroFloat4(), a, factor);
+        }
+
+        inline void store(Float4 a, float* out) {
+
+#if defined (GPS_SSE2)
+            _mm_storeu_ps(out, a.v);
+#elif defined (GPS_NEON)
+            vst1q_f32(out, a.v);
+#else
+            for (int c = 0; c < 4; c++) out[c] = a.v[c];
+#endif
+        }
+
+        // sRGB <-> linear, the alpha channel stays linear
+        struct ColorTables {
+
+            static const int ENCODE_SIZE = 8192;
+
+            float toLinear[256];
+            float alpha[256];
+            unsigned char toSrgb[ENCODE_SIZE];
+
+            ColorTables() {
+
+                for (int i = 0; i < 256; i++) {
+                    float c = i / 255.0f;
+                    toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+                    alpha[i] = c;
+                }
+                for (int i = 0; i < ENCODE_SIZE; i++) {
+                    float l = i / float(ENCODE_SIZE - 1);
+                    float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.0f / 2.4f) - 0.055f;
+                    toSrgb[i] = static_cast<unsigned char>(std::min(255.0f, c * 255.0f + 0.5f));
+                }
+            }
+        };
+
+        const ColorTables& colorTables() {
+
+            static const ColorTables tables;
+            return tables;
+        }
+
+        inline Float4 decodeTexel(const ColorTables& tables, const unsigned char* texel) {
+
+            return makeFloat4(tables.toLinear[texel[0]], tables.toLinear[texel[1]], tables.toLinear[texel[2]], tables.alpha[texel[3]]);
+        }
+
+        inline unsigned char encodeChannel(const ColorTables& tables, float linear) {
+
+            float index = std::min(std::max(linear, 0.0f), 1.0f) * (ColorTables::ENCODE_SIZE - 1) + 0.5f;
+            return tables.toSrgb[static_cast<int>(index)];
+        }
+
+        inline void encodeTexel(const ColorTables& tables, Float4 value, unsigned char* texel) {
+
+            float channels[4];
+            store(value, channels);
+            texel[0] = encodeChannel(tables, channels[0]);
+            texel[1] = encodeChannel(tables, channels[1]);
+            texel[2] = encodeChannel(tables, channels[2]);
+            texel[3] = static_cast<unsigned char>(std::min(std::max(channels[3], 0.0f), 1.0f) * 255.0f + 0.5f);
+        }
+
+#if defined (GPS_AVX2)
+        bool cpuHasAvx2() {
+
+#if defined (_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7) {
+                return false;
+            }
+            // the OS has to save the YMM registers as well
+            __cpuid(info, 1);
+            const int osxsave = 1 << 27, avx = 1 << 28;
+            if ((info[2] & (osxsave | avx)) != (osxsave | avx) || (_xgetbv(0) & 6) != 6) {
+                return false;
+            }
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2") != 0;
+#endif
+        }
+
+        const bool HAS_AVX2 = cpuHasAvx2();
+
+        // Swaps whole 32-byte blocks, returns the bytes swapped
+        GPS_TARGET_AVX2 size_t swapRowsAvx2(unsigned char* a, unsigned char* b, size_t bytes) {
+
+            size_t i = 0;
+            for (; i + 32 <= bytes; i += 32) {
+                __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+                __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(a + i), y);
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(b + i), x);
+            }
+            return i;
+        }
+#endif
+
+        void swapRows(unsigned char* a, unsigned char* b, size_t bytes) {
+
+            size_t i = 0;
+#if defined (GPS_AVX2)
+            if (HAS_AVX2) {
+                i = swapRowsAvx2(a, b, bytes);
+            }
+#endif
+#if defined (GPS_SSE2)
+            for (; i + 16 <= bytes; i += 16) {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+                __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(a + i), y);
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(b + i), x);
+            }
+#elif defined (GPS_NEON)
+            for (; i + 16 <= bytes; i += 16) {
+                uint8x16_t x = vld1q_u8(a + i);
+                uint8x16_t y = vld1q_u8(b + i);
+                vst1q_u8(a + i, y);
+                vst1q_u8(b + i, x);
+            }
+#endif
+            for (; i < bytes; i++) {
+                std::swap(a[i], b[i]);
+            }
+        }
+
+        // Kaiser-windowed sinc for halving: taps at source offsets -2.5 .. 2.5 from the destination center
+        const int KAISER_TAPS = 6;
+
+        struct KaiserKernel {
+
+            float weights[KAISER_TAPS];
+
+            KaiserKernel() {
+
+                const double alpha = 4.0;
+                const double radius = 3.0;
+                double sum = 0.0;
+                for (int t = 0; t < KAISER_TAPS; t++) {
+                    double x = t - 2.5;
+                    // the cutoff is half the source rate
+                    double sinc = std::sin(3.14159265358979 * x / 2.0) / (3.14159265358979 * x / 2.0);
+                    double r = x / radius;
+                    double window = besselI0(alpha * std::sqrt(std::max(0.0, 1.0 - r * r))) / besselI0(alpha);
+                    weights[t] = static_cast<float>(sinc * window);
+                    sum += weights[t];
+                }
+                for (int t = 0; t < KAISER_TAPS; t++) {
+                    weights[t] = static_cast<float>(weights[t] / sum);
+                }
+            }
+
+            static double besselI0(double x) {
+
+                double sum = 1.0;
+                double term = 1.0;
+                for (int k = 1; k < 32; k++) {
+                    term *= (x / (2.0 * k)) * (x / (2.0 * k));
+                    sum += term;
+                }
+                return sum;
+            }
+        };
+
+        const KaiserKernel& kaiserKernel() {
+
+            static const KaiserKernel kernel;
+            return kernel;
+        }
+
+        inline int wrap(int i, int size) {
+
+            i %= size;
+            return i < 0 ? i + size : i;
+        }
+
+        void downsampleBox(const unsigned char* source, int sourceWidth, int sourceHeight, unsigned char* target, int targetWidth, int targetHeight) {
+
+            const ColorTables& tables = colorTables();
+            for (int y = 0; y < targetHeight; y++) {
+
+                const unsigned char* row0 = source + (size_t)std::min(2 * y, sourceHeight - 1) * sourceWidth * 4;
+                const unsigned char* row1 = source + (size_t)std::min(2 * y + 1, sourceHeight - 1) * sourceWidth * 4;
+                unsigned char* out = target + (size_t)y * targetWidth * 4;
+
+                for (int x = 0; x < targetWidth; x++) {
+
+                    int x0 = std::min(2 * x, sourceWidth - 1) * 4;
+                    int x1 = std::min(2 * x + 1, sourceWidth - 1) * 4;
+                    Float4 sum = add(add(decodeTexel(tables, row0 + x0), decodeTexel(tables, row0 + x1)),
+                                     add(decodeTexel(tables, row1 + x0), decodeTexel(tables, row1 + x1)));
+                    encodeTexel(tables, scale(sum, 0.25f), out + x * 4);
+                }
+            }
+        }
+
+        void downsampleKaiser(const unsigned char* source, int sourceWidth, int sourceHeight, unsigned char* target, int targetWidth, int targetHeight) {
+
+            const ColorTables& tables = colorTables();
+            const float* weights = kaiserKernel().weights;
+
+            // horizontal pass into linear floats, a dimension that stays the same is copied
+            std::vector<float> rows((size_t)targetWidth * sourceHeight * 4);
+            for (int y = 0; y < sourceHeight; y++) {
+
+                const unsigned char* in = source + (size_t)y * sourceWidth * 4;
+                float* out = &rows[(size_t)y * targetWidth * 4];
+                for (int x = 0; x < targetWidth; x++) {
+
+                    Float4 sum = zeroFloat4();
+                    if (sourceWidth == targetWidth) {
+                        sum = decodeTexel(tables, in + x * 4);
+                    }
+                    else {
+                        for (int t = 0; t < KAISER_TAPS; t++) {
+                            sum = addScaled(sum, decodeTexel(tables, in + wrap(2 * x - 2 + t, sourceWidth) * 4), weights[t]);
+                        }
+                    }
+                    store(sum, out + x * 4);
+                }
+            }
+
+            for (int y = 0; y < targetHeight; y++) {
+
+                unsigned char* out = target + (size_t)y * targetWidth * 4;
+                for (int x = 0; x < targetWidth; x++) {
+
+                    Float4 sum = zeroFloat4();
+                    if (sourceHeight == targetHeight) {
+                        const float* texel = &rows[((size_t)y * targetWidth + x) * 4];
+                        sum = makeFloat4(texel[0], texel[1], texel[2], texel[3]);
+                    }
+                    else {
+                        for (int t = 0; t < KAISER_TAPS; t++) {
+                            const float* texel = &rows[((size_t)wrap(2 * y - 2 + t, sourceHeight) * targetWidth + x) * 4];
+                            sum = addScaled(sum, makeFloat4(texel[0], texel[1], texel[2], texel[3]), weights[t]);
+                        }
+                    }
+                    encodeTexel(tables, sum, out + x * 4);
+                }
+            }
+        }
+
+        typedef std::chrono::steady_clock Clock;
+
+        double elapsedMs(Clock::time_point since) {
+
+            return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+        }
+
+        // Mean linear brightness of an RGBA8 sRGB image
+        double meanLinear(const unsigned char* pixels, size_t texels) {
+
+            const ColorTables& tables = colorTables();
+            double sum = 0.0;
+            for (size_t i = 0; i < texels * 4; i++) {
+                if (i % 4 != 3) {
+                    sum += tables.toLinear[pixels[i]];
+                }
+            }
+            return texels ? sum / (texels * 3) : 0.0;
+        }
+
+        // What a driver that filters the encoded bytes produces for level 1
+        void downsampleGamma(const unsigned char* source, int sourceWidth, int sourceHeight, unsigned char* target, int targetWidth, int targetHeight) {
+
+            for (int y = 0; y < targetHeight; y++) {
+                for (int x = 0; x < targetWidth; x++) {
+                    for (int c = 0; c < 4; c++) {
+                        int x0 = std::min(2 * x, sourceWidth - 1), x1 = std::min(2 * x + 1, sourceWidth - 1);
+                        int y0 = std::min(2 * y, sourceHeight - 1), y1 = std::min(2 * y + 1, sourceHeight - 1);
+                        int sum = source[((size_t)y0 * sourceWidth + x0) * 4 + c] + source[((size_t)y0 * sourceWidth + x1) * 4 + c] +
+                                  source[((size_t)y1 * sourceWidth + x0) * 4 + c] + source[((size_t)y1 * sourceWidth + x1) * 4 + c];
+                        target[((size_t)y * targetWidth + x) * 4 + c] = static_cast<unsigned char>((sum + 2) / 4);
+                    }
+                }
+            }
+        }
+    }
+
+    void TextureProcessor::FlipRows(unsigned char* pixels, int width, int height, int channels) {
+
+        size_t rowBytes = (size_t)width * channels;
+        for (int row = 0; row < height / 2; row++) {
+            swapRows(pixels + row * rowBytes, pixels + (height - row - 1) * rowBytes, rowBytes);
+        }
+    }
+
+    void TextureProcessor::FlipRowsScalar(unsigned char* pixels, int width, int height, int channels) {
+
+        int width_in_bytes = width * channels;
+        unsigned char *top = NULL;
+        unsigned char *bottom = NULL;
+        unsigned char temp = 0;
+        int half_height = height / 2;
+
+        for (int row = 0; row < half_height; row++) {
+
+            top = pixels + row * width_in_bytes;
+            bottom = pixels + (height - row - 1) * width_in_bytes;
+
+            for (int col = 0; col < width_in_bytes; col++) {
+
+                temp = *top;
+                *top = *bottom;
+                *bottom = temp;
+                top++;
+                bottom++;
+            }
+        }
+    }
+
+    int TextureProcessor::MipLevelCount(int width, int height) {
+
+        int levels = 1;
+        while (width > 1 || height > 1) {
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+            levels++;
+        }
+        return levels;
+    }
+
+    size_t TextureProcessor::MipChainSize(int width, int height, int levels) {
+
+        size_t bytes = 0;
+        for (int level = 0; level < levels; level++) {
+            bytes += (size_t)width * height * 4;
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        return bytes;
+    }
+
+    unsigned char* TextureProcessor::BuildMipChain(const unsigned char* pixels, int width, int height, MipFilter filter) {
+
+        int levels = MipLevelCount(width, height);
+        unsigned char* chain = AllocatePixels(MipChainSize(width, height, levels));
+        if (!chain) {
+            return nullptr;
+        }
+        std::memcpy(chain, pixels, (size_t)width * height * 4);
+
+        unsigned char* source = chain;
+        for (int level = 1; level < levels; level++) {
+
+            int targetWidth = std::max(1, width / 2);
+            int targetHeight = std::max(1, height / 2);
+            unsigned char* target = source + (size_t)width * height * 4;
+            if (filter == MIP_FILTER_KAISER) {
+                downsampleKaiser(source, width, height, target, targetWidth, targetHeight);
+            }
+            else {
+                downsampleBox(source, width, height, target, targetWidth, targetHeight);
+            }
+            source = target;
+            width = targetWidth;
+            height = targetHeight;
+        }
+        return chain;
+    }
+
+    unsigned char* TextureProcessor::AllocatePixels(size_t bytes) {
+
+        return static_cast<unsigned char*>(DecodePool::instance().allocate(bytes));
+    }
+
+    void TextureProcessor::FreePixels(unsigned char* pixels) {
+
+        DecodePool::instance().release(pixels);
+    }
+
+    void TextureProcessor::SetMipFilter(MipFilter filter) {
+
+        mipFilter = filter;
+    }
+
+    MipFilter TextureProcessor::GetMipFilter() {
+
+        return mipFilter;
+    }
+
+    void TextureProcessor::Benchmark(const std::vector<std::string>& fileNames, int iterations, bool withContext) {
+
+        struct Image {
+
+            std::string fileName;
+            int width;
+            int height;
+            unsigned char* pixels;
+            unsigned char* chain;
+        };
+        std::vector<Image> images;
+
+        for (const std::string& fileName : fileNames) {
+
+            std::ifstream file(fileName, std::ios::binary);
+            std::vector<unsigned char> fileData((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+            if (fileData.empty()) {
+                std::cerr << "ERROR: could not read " << fileName << std::endl;
+                continue;
+            }
+
+            Image image;
+            image.fileName = fileName;
+            int channels;
+            double decodeMs = 0.0, scalarFlipMs = 0.0, flipMs = 0.0, boxMs = 0.0, kaiserMs = 0.0, cookedMs = 0.0;
+            for (int i = 0; i < iterations; i++) {
+
+                Clock::time_point start = Clock::now();
+                unsigned char* decoded = stbi_load_from_memory(fileData.data(), (int)fileData.size(), &image.width, &image.height, &channels, 4);
+                decodeMs += elapsedMs(start);
+                if (!decoded) {
+                    break;
+                }
+
+                start = Clock::now();
+                FlipRowsScalar(decoded, image.width, image.height, 4);
+                scalarFlipMs += elapsedMs(start);
+
+                start = Clock::now();
+                FlipRows(decoded, image.width, image.height, 4);
+                flipMs += elapsedMs(start);
+
+                start = Clock::now();
+                FreePixels(BuildMipChain(decoded, image.width, image.height, MIP_FILTER_BOX));
+                boxMs += elapsedMs(start);
+
+                start = Clock::now();
+                FreePixels(BuildMipChain(decoded, image.width, image.height, MIP_FILTER_KAISER));
+                kaiserMs += elapsedMs(start);
+
+                stbi_image_free(decoded);
+            }
+
+            image.pixels = stbi_load_from_memory(fileData.data(), (int)fileData.size(), &image.width, &image.height, &channels, 4);
+            if (!image.pixels) {
+                std::cerr << "ERROR: could not decode " << fileName << std::endl;
+                continue;
+            }
+            FlipRows(image.pixels, image.width, image.height, 4);
+            image.chain = BuildMipChain(image.pixels, image.width, image.height, mipFilter);
+            if (!image.chain) {
+                std::cerr << "ERROR: out of memory for the mips of " << fileName << std::endl;
+                stbi_image_free(image.pixels);
+                continue;
+            }
+            int levels = MipLevelCount(image.width, image.height);
+            size_t chainBytes = MipChainSize(image.width, image.height, levels);
+
+            // the cooked file replaces decode, flip and filtering with one read
+            uint64_t contentHash = ResourceRegistry::hashBytes(fileData.data(), fileData.size());
+            TextureCache::write(fileName, contentHash, mipFilter, FORMAT_RGBA8, image.width, image.height, levels, image.chain);
+            uint64_t checksum = 0;
+            for (int i = 0; i < iterations; i++) {
+
+                Clock::time_point start = Clock::now();
+                TextureCache cache;
+                if (!cache.load(fileName, mipFilter, FORMAT_RGBA8)) {
+                    std::cerr << "ERROR: could not load the cooked copy of " << fileName << std::endl;
+                    break;
+                }
+                unsigned char* copy = AllocatePixels(chainBytes);
+                if (!copy) {
+                    std::cerr << "ERROR: out of memory for the cooked copy of " << fileName << std::endl;
+                    break;
+                }
+                std::memcpy(copy, cache.getPixels(), chainBytes);
+                checksum += copy[chainBytes - 1];
+                FreePixels(copy);
+                cookedMs += elapsedMs(start);
+            }
+
+            // level 1 should keep the brightness of level 0, averaging the encoded bytes darkens contrasty detail
+            int width1 = std::max(1, image.width / 2);
+            int height1 = std::max(1, image.height / 2);
+            std::vector<unsigned char> gammaLevel((size_t)width1 * height1 * 4);
+            downsampleGamma(image.pixels, image.width, image.height, gammaLevel.data(), width1, height1);
+            double level0 = meanLinear(image.pixels, (size_t)image.width * image.height);
+            double gammaError = level0 > 0.0 ? (meanLinear(gammaLevel.data(), gammaLevel.size() / 4) / level0 - 1.0) * 100.0 : 0.0;
+            double linearError = level0 > 0.0 ? (meanLinear(image.chain + (size_t)image.width * image.height * 4, (size_t)width1 * height1) / level0 - 1.0) * 100.0 : 0.0;
+
+            std::cout << "Benchmark : " << fileName << " (" << image.width << "x" << image.height << ", " << levels << " levels)" << std::endl;
+            std::cout << "  decode            : " << decodeMs / iterations << " ms" << std::endl;
+            std::cout << "  row flip          : " << scalarFlipMs / iterations << " ms scalar, " << flipMs / iterations << " ms SIMD" << std::endl;
+            std::cout << "  mip chain         : " << boxMs / iterations << " ms box, " << kaiserMs / iterations << " ms Kaiser" << std::endl;
+            std::cout << "  cooked load       : " << cookedMs / iterations << " ms (" << chainBytes << " bytes, checksum " << checksum << ")"
+                << " vs " << (decodeMs + scalarFlipMs) / iterations << " ms decode + scalar flip" << std::endl;
+            std::cout << "  level 1 brightness: " << gammaError << "% gamma-space average, " << linearError << "% linear" << std::endl;
+
+            images.push_back(image);
+        }
+
+        // the chains of different textures are independent, one worker task each
+        TaskGraph graph;
+        double serialMs = 0.0;
+        for (Image& image : images) {
+
+            Clock::time_point start = Clock::now();
+            FreePixels(BuildMipChain(image.pixels, image.width, image.height, mipFilter));
+            serialMs += elapsedMs(start);
+
+            const Image* source = &image;
+            graph.addTask("mips " + image.fileName, TaskGraph::WORKER_THREAD, [source]() {
+                FreePixels(BuildMipChain(source->pixels, source->width, source->height, mipFilter));
+            });
+        }
+        Clock::time_point start = Clock::now();
+        graph.run();
+        std::cout << "Mip chains of " << images.size() << " textures: " << serialMs << " ms serial, " << elapsedMs(start) << " ms in parallel" << std::endl;
+
+        if (withContext) {
+
+            // glFinish makes both sides include the GPU work, glGenerateMipmap included
+            for (const Image& image : images) {
+
+                int levels = MipLevelCount(image.width, image.height);
+                double currentMs = 0.0, chainMs = 0.0;
+                for (int i = 0; i < iterations; i++) {
+
+                    Clock::time_point begin = Clock::now();
+                    GLTexture current = GLTexture::create();
+                    glBindTexture(GL_TEXTURE_2D, current.get());
+                    glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8, image.width, image.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.pixels);
+                    glGenerateMipmap(GL_TEXTURE_2D);
+                    glFinish();
+                    currentMs += elapsedMs(begin);
+
+                    begin = Clock::now();
+                    GLTexture cooked = GLTexture::create();
+                    glBindTexture(GL_TEXTURE_2D, cooked.get());
+                    const unsigned char* level = image.chain;
+                    int width = image.width, height = image.height;
+#if !defined (__APPLE__)
+                    if (GLCaps::get().textureStorage) {
+                        glTexStorage2D(GL_TEXTURE_2D, levels, GL_SRGB8, width, height);
+                    }
+#endif
+                    for (int l = 0; l < levels; l++) {
+                        if (GLCaps::get().textureStorage) {
+                            glTexSubImage2D(GL_TEXTURE_2D, l, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, level);
+                        }
+                        else {
+                            glTexImage2D(GL_TEXTURE_2D, l, GL_SRGB8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, level);
+                        }
+                        level += (size_t)width * height * 4;
+                        width = std::max(1, width / 2);
+                        height = std::max(1, height / 2);
+                    }
+                    glFinish();
+                    chainMs += elapsedMs(begin);
+                    glBindTexture(GL_TEXTURE_2D, 0);
+                }
+                std::cout << "Upload : " << image.fileName << " : " << currentMs / iterations << " ms glTexImage2D + glGenerateMipmap, "
+                    << chainMs / iterations << " ms " << (GLCaps::get().textureStorage ? "glTexStorage2D" : "glTexImage2D") << " per level" << std::endl;
+            }
+        }
+
+        for (Image& image : images) {
+            stbi_image_free(image.pixels);
+            FreePixels(image.chain);
+        }
+    }
+}
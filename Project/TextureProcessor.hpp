@@ -0,0 +1,58 @@
+#ifndef TextureProcessor_hpp
+#define TextureProcessor_hpp
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // How each mip level is filtered from the one above it
+    enum MipFilter {
+        // 2x2 average
+        MIP_FILTER_BOX,
+        // separable 6-tap Kaiser-windowed sinc, sharper than the box, wraps around like GL_REPEAT
+        MIP_FILTER_KAISER
+    };
+
+    // CPU side of texture loading for RGBA8 sRGB images: the flip to GL row order and the mip chain, so the driver
+    // only copies. Filtering happens in linear space (the alpha channel as is), unlike many glGenerateMipmap
+    // implementations that average the gamma-encoded bytes. Thread safe.
+    class TextureProcessor {
+
+    public:
+        // Reverses the row order in place, 32 or 16 bytes at a time with AVX2, SSE2 or NEON
+        static void FlipRows(unsigned char* pixels, int width, int height, int channels);
+
+        // The byte-by-byte swap the loader used before, kept for the benchmark
+        static void FlipRowsScalar(unsigned char* pixels, int width, int height, int channels);
+
+        // Levels down to 1x1
+        static int MipLevelCount(int width, int height);
+
+        // Bytes of the first levels RGBA8 levels of a width x height image stored back to back, the top one first
+        static size_t MipChainSize(int width, int height, int levels);
+
+        // Full chain of an RGBA8 image, level 0 copied and every other level filtered from the previous one.
+        // Release the result with FreePixels.
+        static unsigned char* BuildMipChain(const unsigned char* pixels, int width, int height, MipFilter filter);
+
+        // Pixel memory handed between the loader, the caches and the uploader, from the DecodePool like stb_image's, so
+        // FreePixels and stbi_image_free take either
+        static unsigned char* AllocatePixels(size_t bytes);
+        static void FreePixels(unsigned char* pixels);
+
+        // Filter of the chains built from now on, MIP_FILTER_BOX by default
+        static void SetMipFilter(MipFilter filter);
+        static MipFilter GetMipFilter();
+
+        // Decodes every image and compares the old path (scalar flip, glGenerateMipmap) against SIMD flip,
+        // CPU mip chains, the cooked file and glTexStorage2D uploads. The GL half needs a current context.
+        static void Benchmark(const std::vector<std::string>& fileNames, int iterations, bool withContext);
+
+    private:
+        static MipFilter mipFilter;
+    };
+}
+
+#endif /* TextureProcessor_hpp */
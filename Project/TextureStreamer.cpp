@@ -0,0 +1,365 @@
+#include "TextureStreamer.hpp"
+#include "AsyncLoader.hpp"
+#include "LoadProfiler.hpp"
+#include "TextureAllocator.hpp"
+#include "TextureProcessor.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace gps {
+
+    namespace {
+
+        // MIN_LOD drops by this much per frame after a commit, a level fades in over 8 frames
+        const float FADE_STEP = 0.125f;
+
+        int levelSize(int size, int level) {
+
+            return std::max(1, size >> level);
+        }
+    }
+
+    TextureStreamer& TextureStreamer::instance() {
+
+        // never destroyed, loader threads may still hand in results during shutdown
+        static TextureStreamer* streamer = new TextureStreamer();
+        return *streamer;
+    }
+
+    TextureStreamer::TextureStreamer() : budget(0), residentBytes(0), pendingBytes(0), frame(0), totals() {
+
+        // levels the allocator drops for its own budget, and the ones dropped through it for this one, come back here
+        TextureAllocator::instance().setEvictionListener([this](GLuint name, int baseLevel) { evicted(name, baseLevel); });
+    }
+
+    void TextureStreamer::setBudget(size_t bytes) {
+
+        budget = bytes;
+    }
+
+    bool TextureStreamer::isEnabled() const {
+
+        return budget > 0;
+    }
+
+    void TextureStreamer::setLoader(Loader loader) {
+
+        this->loader = loader;
+    }
+
+    int TextureStreamer::startLevel(int width, int height, int levels) {
+
+        // the allocator's fallback, so an evicted streamed texture is back where it started
+        return TextureAllocator::fallbackLevel(width, height, levels);
+    }
+
+    size_t TextureStreamer::residentSize(TextureFormat format, int width, int height, int levels, int first) {
+
+        return BlockCompressor::ChainSize(format, width, height, levels) - BlockCompressor::ChainSize(format, width, height, first);
+    }
+
+    GLuint TextureStreamer::createTexture(const std::string& name, const unsigned char* pixels, int width, int height, int levels,
+                                          TextureFormat format) {
+
+        int first = startLevel(width, height, levels);
+
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        TextureAllocator::beginAllocation();
+        defineLevels(pixels, width, height, first, levels, format);
+        if (!TextureAllocator::instance().track(texture, GL_TEXTURE_2D, BlockCompressor::GLInternalFormat(format, true), width, height, levels, 1,
+                                                name, true, first)) {
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glDeleteTextures(1, &texture);
+            return 0;
+        }
+
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, first);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        return texture;
+    }
+
+    void TextureStreamer::add(const TextureRef& texture, const std::string& path, int width, int height, int levels, TextureFormat format) {
+
+        Entry entry;
+        entry.texture = texture;
+        entry.path = path;
+        entry.width = width;
+        entry.height = height;
+        entry.levels = levels;
+        entry.format = format;
+        entry.startLevel = startLevel(width, height, levels);
+        entry.residentLevel = entry.startLevel;
+        entry.desiredLevel = entry.startLevel;
+        entry.frameLevel = levels;
+        entry.lastUsed = 0;
+        entry.fade = 0.0f;
+        entry.loading = false;
+        entry.failed = false;
+
+        entries[texture->get()] = entry;
+        residentBytes += residentSize(format, width, height, levels, entry.startLevel);
+        totals.fullBytes += BlockCompressor::ChainSize(format, width, height, levels);
+    }
+
+    void TextureStreamer::request(GLuint texture, float uvPerPixel) {
+
+        auto found = entries.find(texture);
+        if (found == entries.end()) {
+            return;
+        }
+
+        // the level where one texel covers about one pixel, finer ones would only be minified away
+        Entry& entry = found->second;
+        int level = 0;
+        float texelsPerPixel = uvPerPixel * (float)std::max(entry.width, entry.height);
+        if (texelsPerPixel > 1.0f) {
+            level = (int)std::floor(std::log2(texelsPerPixel));
+        }
+        entry.frameLevel = std::min(entry.frameLevel, std::min(level, entry.levels - 1));
+        entry.lastUsed = frame;
+    }
+
+    void TextureStreamer::update() {
+
+        std::vector<Result> finished;
+        {
+            std::lock_guard<std::mutex> lock(resultsMutex);
+            finished.swap(results);
+        }
+        for (const Result& result : finished) {
+
+            commit(result);
+            TextureProcessor::FreePixels(result.pixels);
+        }
+
+        std::vector<GLuint> wanting;
+        int loading = 0;
+        for (auto it = entries.begin(); it != entries.end();) {
+
+            Entry& entry = it->second;
+            if (entry.texture.expired() && !entry.loading) {
+
+                // its levels went with the texture
+                residentBytes -= residentSize(entry.format, entry.width, entry.height, entry.levels, entry.residentLevel);
+                totals.fullBytes -= BlockCompressor::ChainSize(entry.format, entry.width, entry.height, entry.levels);
+                it = entries.erase(it);
+                continue;
+            }
+
+            if (entry.lastUsed == frame && entry.frameLevel < entry.levels) {
+                entry.desiredLevel = entry.frameLevel;
+            }
+            entry.frameLevel = entry.levels;
+
+            if (entry.lastUsed == frame) {
+                TextureAllocator::instance().touch(it->first);
+            }
+
+            if (entry.fade > 0.0f) {
+
+                entry.fade = std::max(0.0f, entry.fade - FADE_STEP);
+                glBindTexture(GL_TEXTURE_2D, it->first);
+                glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, entry.fade);
+            }
+
+            if (entry.loading) {
+                loading++;
+            }
+            else if (entry.desiredLevel < entry.residentLevel && !entry.failed && entry.lastUsed == frame) {
+                wanting.push_back(it->first);
+            }
+            ++it;
+        }
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        // the biggest jumps in sharpness first
+        std::sort(wanting.begin(), wanting.end(), [this](GLuint a, GLuint b) {
+            const Entry& ea = entries[a];
+            const Entry& eb = entries[b];
+            return ea.residentLevel - ea.desiredLevel > eb.residentLevel - eb.desiredLevel;
+        });
+        for (size_t i = 0; i < wanting.size() && loading < MAX_LOADS; i++) {
+
+            // as much of the wanted detail as the budget holds
+            Entry& entry = entries[wanting[i]];
+            for (int first = entry.desiredLevel; first < entry.residentLevel; first++) {
+
+                if (reserve(residentSize(entry.format, entry.width, entry.height, entry.residentLevel, first), wanting[i])) {
+
+                    startLoad(wanting[i], entry, first);
+                    loading++;
+                    break;
+                }
+            }
+        }
+
+        frame++;
+    }
+
+    bool TextureStreamer::reserve(size_t bytes, GLuint loading) {
+
+        // the streaming budget first, then the allocator's for all textures
+        bool fits = residentBytes + pendingBytes + bytes <= budget;
+        if (!fits) {
+
+            // least recently requested first; among equals, the textures holding the most detail
+            std::vector<GLuint> victims;
+            for (auto& pair : entries) {
+
+                if (pair.first != loading && !pair.second.loading && pair.second.residentLevel < pair.second.startLevel) {
+                    victims.push_back(pair.first);
+                }
+            }
+            std::sort(victims.begin(), victims.end(), [this](GLuint a, GLuint b) {
+                const Entry& ea = entries[a];
+                const Entry& eb = entries[b];
+                return ea.lastUsed != eb.lastUsed ? ea.lastUsed < eb.lastUsed : ea.residentLevel < eb.residentLevel;
+            });
+
+            // a texture as recent as the load only gives up levels it no longer needs
+            uint64_t lastUsed = entries[loading].lastUsed;
+            for (size_t i = 0; i < victims.size() && !fits; i++) {
+
+                Entry& entry = entries[victims[i]];
+                int target = entry.lastUsed < lastUsed ? entry.startLevel : std::min(entry.desiredLevel, entry.startLevel);
+                while (entry.residentLevel < target && residentBytes + pendingBytes + bytes > budget) {
+                    if (TextureAllocator::instance().dropLevels(victims[i], entry.residentLevel + 1) == 0) {
+                        break;
+                    }
+                }
+                fits = residentBytes + pendingBytes + bytes <= budget;
+            }
+        }
+        return fits && TextureAllocator::instance().reserve(pendingBytes + bytes, loading);
+    }
+
+    void TextureStreamer::evicted(GLuint name, int baseLevel) {
+
+        auto found = entries.find(name);
+        if (found == entries.end() || baseLevel <= found->second.residentLevel) {
+            return;
+        }
+
+        Entry& entry = found->second;
+        size_t bytes = residentSize(entry.format, entry.width, entry.height, baseLevel, entry.residentLevel);
+        entry.residentLevel = baseLevel;
+        entry.fade = 0.0f;
+        residentBytes -= bytes;
+        totals.evictions++;
+        totals.evictedBytes += bytes;
+    }
+
+    void TextureStreamer::startLoad(GLuint name, Entry& entry, int first) {
+
+        entry.loading = true;
+        pendingBytes += residentSize(entry.format, entry.width, entry.height, entry.residentLevel, first);
+
+        Result result;
+        result.texture = name;
+        result.pixels = NULL;
+        result.first = first;
+        result.last = entry.residentLevel;
+
+        Loader load = loader;
+        std::string path = entry.path;
+        int width = entry.width, height = entry.height, levels = entry.levels;
+        TextureFormat format = entry.format;
+        AsyncLoader::instance().enqueue([this, load, path, width, height, levels, format, result]() mutable {
+
+            if (load) {
+                LoadScope scope(path, STAGE_FILE_IO);
+                result.pixels = load(path, width, height, levels, format);
+            }
+            std::lock_guard<std::mutex> lock(resultsMutex);
+            results.push_back(result);
+        });
+    }
+
+    void TextureStreamer::commit(const Result& result) {
+
+        auto found = entries.find(result.texture);
+        if (found == entries.end()) {
+            return;
+        }
+
+        Entry& entry = found->second;
+        entry.loading = false;
+        pendingBytes -= residentSize(entry.format, entry.width, entry.height, result.last, result.first);
+        if (entry.texture.expired()) {
+            return;
+        }
+        if (!result.pixels) {
+
+            entry.failed = true;
+            return;
+        }
+
+        // the allocator may have dropped more levels during the load, the chain holds them all
+        int last = std::max(result.last, entry.residentLevel);
+
+        glBindTexture(GL_TEXTURE_2D, result.texture);
+        defineLevels(result.pixels, entry.width, entry.height, result.first, last, entry.format);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, result.first);
+        // sampling stays at the old sharpness and eases into the new levels
+        entry.fade += (float)(last - result.first);
+        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_LOD, entry.fade);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        TextureAllocator::instance().setBaseLevel(result.texture, result.first);
+
+        size_t bytes = residentSize(entry.format, entry.width, entry.height, last, result.first);
+        entry.residentLevel = result.first;
+        residentBytes += bytes;
+        totals.loads++;
+        totals.loadedBytes += bytes;
+    }
+
+    void TextureStreamer::defineLevels(const unsigned char* chain, int width, int height, int first, int last, TextureFormat format) {
+
+        GLenum internalFormat = BlockCompressor::GLInternalFormat(format, true);
+        const unsigned char* level = chain + BlockCompressor::ChainSize(format, width, height, first);
+        for (int l = first; l < last; l++) {
+
+            int w = levelSize(width, l), h = levelSize(height, l);
+            size_t bytes = BlockCompressor::LevelSize(format, w, h);
+            if (format == FORMAT_RGBA8) {
+                glTexImage2D(GL_TEXTURE_2D, l, internalFormat, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, level);
+            }
+            else {
+                glCompressedTexImage2D(GL_TEXTURE_2D, l, internalFormat, w, h, 0, (GLsizei)bytes, level);
+            }
+            level += bytes;
+        }
+    }
+
+    TextureStreamStats TextureStreamer::getStats() const {
+
+        TextureStreamStats stats = totals;
+        stats.textures = entries.size();
+        stats.residentBytes = residentBytes;
+        stats.budgetBytes = budget;
+        stats.pendingLoads = 0;
+        for (const auto& pair : entries) {
+            stats.pendingLoads += pair.second.loading ? 1 : 0;
+        }
+        return stats;
+    }
+
+    void TextureStreamer::printStats(std::ostream& out) const {
+
+        TextureStreamStats stats = getStats();
+        out << "Texture streaming: " << stats.textures << " textures, " << stats.residentBytes / 1024 << " of " << stats.budgetBytes / 1024
+            << " KB budget resident (full chains " << stats.fullBytes / 1024 << " KB), " << stats.pendingLoads << " loading, "
+            << stats.loads << " loads (" << stats.loadedBytes / 1024 << " KB), " << stats.evictions << " evictions ("
+            << stats.evictedBytes / 1024 << " KB)" << std::endl;
+    }
+}
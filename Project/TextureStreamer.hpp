@@ -0,0 +1,144 @@
+#ifndef TextureStreamer_hpp
+#define TextureStreamer_hpp
+
+#include "BlockCompressor.hpp"
+#include "ResourceRegistry.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace gps {
+
+    // Totals over every streamed texture
+    struct TextureStreamStats {
+
+        size_t textures;
+        // levels on the GPU, and what the full chains would take
+        size_t residentBytes;
+        size_t fullBytes;
+        size_t budgetBytes;
+        size_t pendingLoads;
+        size_t loads;
+        size_t evictions;
+        size_t loadedBytes;
+        size_t evictedBytes;
+    };
+
+    // Mip-level residency for 2D textures under a fixed memory budget. A streamed texture starts with only the levels
+    // of at most TextureAllocator::FALLBACK_SIZE texels; the draws report how many texels of it land on a pixel, the
+    // finer levels that asks for are read back on a loader thread and defined on the GL thread, lowering
+    // GL_TEXTURE_BASE_LEVEL.
+    // GL_TEXTURE_MIN_LOD then eases from the old base to the new one so the detail fades in. When a load does not
+    // fit the budget, the finest levels of the least recently requested textures are dropped first, through the
+    // TextureAllocator, which also evicts streamed textures for its own budget.
+    // Textures have mutable storage so a dropped level gives its memory back. GL thread only.
+    class TextureStreamer {
+
+    public:
+        // Rereads the full chain of a streamed image (TextureProcessor layout, or its blocks), null on failure.
+        // Runs on a loader thread.
+        typedef std::function<unsigned char*(const std::string& path, int width, int height, int levels, TextureFormat format)> Loader;
+
+        static TextureStreamer& instance();
+
+        // Bytes the levels of all streamed textures may take; textures created from now on are streamed if it is
+        // not 0 (the default)
+        void setBudget(size_t bytes);
+        bool isEnabled() const;
+
+        void setLoader(Loader loader);
+
+        // Finest level a texture starts with, the allocator's fallback
+        static int startLevel(int width, int height, int levels);
+
+        // Creates a texture and defines its levels from startLevel down, pixels stays with the caller. 0 if GL could not
+        // allocate them
+        static GLuint createTexture(const std::string& name, const unsigned char* pixels, int width, int height, int levels, TextureFormat format);
+
+        // Bytes of levels first..levels-1
+        static size_t residentSize(TextureFormat format, int width, int height, int levels, int first);
+
+        // Streams a texture made by createTexture for as long as it lives
+        void add(const TextureRef& texture, const std::string& path, int width, int height, int levels, TextureFormat format);
+
+        // Called by a draw: on screen, one pixel of the texture's mesh spans uvPerPixel texture coordinates, 0 asks
+        // for every level. The finest level any draw of the frame needs is the one that gets loaded.
+        void request(GLuint texture, float uvPerPixel);
+
+        // Once per frame: commits finished loads, eases MIN_LOD, drops released textures and starts new loads
+        void update();
+
+        TextureStreamStats getStats() const;
+
+        // One line of totals
+        void printStats(std::ostream& out) const;
+
+    private:
+        struct Entry {
+
+            std::weak_ptr<GLTexture> texture;
+            std::string path;
+            int width;
+            int height;
+            int levels;
+            TextureFormat format;
+            // finest level on the GPU, the one GL_TEXTURE_BASE_LEVEL points at
+            int residentLevel;
+            int startLevel;
+            // finest level asked for by the draws of the last frame that drew it
+            int desiredLevel;
+            // finest level asked for during the current frame, levels if none
+            int frameLevel;
+            uint64_t lastUsed;
+            // MIN_LOD above the base level, eased to 0 after a commit
+            float fade;
+            bool loading;
+            bool failed;
+        };
+
+        // Levels read by a loader thread, waiting for the GL thread
+        struct Result {
+
+            GLuint texture;
+            unsigned char* pixels;
+            int first;
+            int last;
+        };
+
+        // Loads in flight at once, each commits its levels in one frame
+        static const int MAX_LOADS = 2;
+
+        std::unordered_map<GLuint, Entry> entries;
+        size_t budget;
+        size_t residentBytes;
+        // bytes reserved by the loads in flight
+        size_t pendingBytes;
+        uint64_t frame;
+        Loader loader;
+        TextureStreamStats totals;
+
+        std::mutex resultsMutex;
+        std::vector<Result> results;
+
+        TextureStreamer();
+
+        // Makes room for bytes by dropping levels of other textures, false if the budget cannot hold them
+        bool reserve(size_t bytes, GLuint loading);
+        // Bookkeeping after the allocator dropped the levels above baseLevel
+        void evicted(GLuint name, int baseLevel);
+        // Reads levels first..residentLevel-1 on a loader thread
+        void startLoad(GLuint name, Entry& entry, int first);
+        void commit(const Result& result);
+
+        // Defines levels first..last-1 of the bound GL_TEXTURE_2D from a chain holding every level
+        static void defineLevels(const unsigned char* chain, int width, int height, int first, int last, TextureFormat format);
+    };
+}
+
+#endif /* TextureStreamer_hpp */
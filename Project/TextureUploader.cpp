@@ -0,0 +1,392 @@
+#include "TextureUploader.hpp"
+#include "AsyncLoader.hpp"
+#include "GLCaps.hpp"
+#include "LoadProfiler.hpp"
+#include "MaterialTable.hpp"
+#include "TextureAllocator.hpp"
+#include "TextureProcessor.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <thread>
+
+namespace gps {
+
+    namespace {
+
+        typedef std::chrono::steady_clock Clock;
+
+        double elapsedMs(Clock::time_point since) {
+
+            return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+        }
+
+        // PBOs grow in whole megabytes so textures of similar size reuse them
+        const size_t SLOT_GRANULARITY = 1024 * 1024;
+    }
+
+    TextureUploader& TextureUploader::instance() {
+
+        // never destroyed, like the registry the textures end up in
+        static TextureUploader* uploader = new TextureUploader();
+        return *uploader;
+    }
+
+    TextureUploader::TextureUploader() : stats() {
+
+        slots.resize(SLOT_COUNT);
+        for (Slot& slot : slots) {
+            slot.capacity = 0;
+            slot.mapped = nullptr;
+            slot.fence = 0;
+            slot.stallMs = 0.0;
+        }
+    }
+
+    GLuint TextureUploader::upload(const std::string& name, unsigned char* pixels, int width, int height, int levels, TextureFormat format) {
+
+        // every level exists from the start so the texture is complete meanwhile, a lone level 0 is sampled
+        // without mip filtering until glGenerateMipmap ran
+        GLuint texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        TextureAllocator::beginAllocation();
+        allocateStorage(width, height, levels, format);
+        // the levels are only written once the pixels arrived, nothing may drop them before that
+        if (!TextureAllocator::instance().track(texture, GL_TEXTURE_2D, BlockCompressor::GLInternalFormat(format, true), width, height, levels, 1,
+                                                name, false)) {
+            glBindTexture(GL_TEXTURE_2D, 0);
+            glDeleteTextures(1, &texture);
+            TextureProcessor::FreePixels(pixels);
+            return 0;
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+
+        queue(name, texture, -1, -1, pixels, width, height, levels, format);
+        return texture;
+    }
+
+    void TextureUploader::setOwner(GLuint texture, const std::shared_ptr<GLTexture>& owner) {
+
+        for (const std::shared_ptr<Job>& job : waiting) {
+            if (job->texture == texture && job->array < 0) {
+                job->owner = owner;
+            }
+        }
+        for (Slot& slot : slots) {
+            if (slot.job && slot.job->texture == texture && slot.job->array < 0) {
+                slot.job->owner = owner;
+            }
+        }
+    }
+
+    void TextureUploader::uploadLayer(const std::string& name, unsigned char* pixels, int width, int height, int levels, TextureFormat format,
+                                      int array, int layer) {
+
+        queue(name, 0, array, layer, pixels, width, height, levels, format);
+    }
+
+    void TextureUploader::queue(const std::string& name, GLuint texture, int array, int layer, unsigned char* pixels, int width, int height,
+                                int levels, TextureFormat format) {
+
+        std::shared_ptr<Job> job = std::make_shared<Job>();
+        job->name = name;
+        job->texture = texture;
+        job->array = array;
+        job->layer = layer;
+        job->pixels = pixels;
+        job->width = width;
+        job->height = height;
+        job->levels = levels;
+        job->format = format;
+        job->bytes = BlockCompressor::ChainSize(format, width, height, levels);
+        job->state.store(JOB_WAITING);
+        job->copyMs = 0.0;
+        job->queued = Clock::now();
+        waiting.push_back(job);
+    }
+
+    void TextureUploader::process(double budgetMs) {
+
+        Clock::time_point start = Clock::now();
+
+        for (Slot& slot : slots) {
+            retire(slot, false);
+        }
+
+        for (Slot& slot : slots) {
+            if (!slot.job && !waiting.empty()) {
+                startCopy(slot);
+            }
+        }
+
+        size_t submitted = 0;
+        for (Slot& slot : slots) {
+
+            if (!slot.job || slot.fence || slot.job->state.load(std::memory_order_acquire) != JOB_COPIED) {
+                continue;
+            }
+            if (submitted > 0 && elapsedMs(start) >= budgetMs) {
+                break;
+            }
+            submit(slot);
+            submitted++;
+        }
+
+        // the fences only signal once the driver has seen them
+        if (submitted > 0) {
+            glFlush();
+        }
+    }
+
+    void TextureUploader::finish() {
+
+        while (!isIdle()) {
+
+            process(1e9);
+            bool copying = false;
+            for (Slot& slot : slots) {
+                if (slot.fence) {
+                    retire(slot, true);
+                }
+                else if (slot.job) {
+                    copying = true;
+                }
+            }
+            if (copying) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    bool TextureUploader::isIdle() const {
+
+        if (!waiting.empty()) {
+            return false;
+        }
+        for (const Slot& slot : slots) {
+            if (slot.job) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void TextureUploader::printStats(std::ostream& out) const {
+
+        double seconds = (stats.stallMs + stats.gpuMs) / 1000.0;
+        out << "Texture uploads  : " << stats.textures << " textures, " << stats.bytes / (1024 * 1024) << " MB, render-thread stall "
+            << stats.stallMs << " ms";
+        if (seconds > 0.0) {
+            out << ", " << stats.bytes / (1024.0 * 1024.0) / seconds << " MB/s";
+        }
+        out << std::endl;
+    }
+
+    void TextureUploader::allocateStorage(int width, int height, int levels, TextureFormat format) {
+
+        GLenum internalFormat = BlockCompressor::GLInternalFormat(format, true);
+#if !defined (__APPLE__)
+        // immutable storage cannot give levels back, the allocator needs to when it has a budget
+        if (GLCaps::get().textureStorage && !TextureAllocator::instance().hasBudget()) {
+            glTexStorage2D(GL_TEXTURE_2D, levels, internalFormat, width, height);
+            return;
+        }
+#endif
+        for (int level = 0; level < levels; level++) {
+            if (format == FORMAT_RGBA8) {
+                glTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            }
+            else {
+                // compressed levels cannot be defined without data, zeroed blocks decode to black like the RGBA8 case
+                std::vector<unsigned char> blocks(BlockCompressor::LevelSize(format, width, height), 0);
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat, width, height, 0, (GLsizei)blocks.size(), blocks.data());
+            }
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    }
+
+    void TextureUploader::uploadLevels(const unsigned char* pixels, int width, int height, int levels, TextureFormat format, int layer) {
+
+        GLenum internalFormat = BlockCompressor::GLInternalFormat(format, true);
+        for (int level = 0; level < levels; level++) {
+            size_t bytes = BlockCompressor::LevelSize(format, width, height);
+            if (layer >= 0 && format == FORMAT_RGBA8) {
+                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+            }
+            else if (layer >= 0) {
+                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, width, height, 1, internalFormat, (GLsizei)bytes, pixels);
+            }
+            else if (format == FORMAT_RGBA8) {
+                glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+            }
+            else {
+                glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, width, height, internalFormat, (GLsizei)bytes, pixels);
+            }
+            pixels += bytes;
+            width = std::max(1, width / 2);
+            height = std::max(1, height / 2);
+        }
+    }
+
+    void TextureUploader::reserve(Slot& slot, size_t bytes) {
+
+        if (slot.buffer && slot.capacity >= bytes) {
+            return;
+        }
+
+        // deleting the old buffer also ends a persistent mapping
+        slot.capacity = (bytes + SLOT_GRANULARITY - 1) / SLOT_GRANULARITY * SLOT_GRANULARITY;
+        slot.mapped = nullptr;
+        slot.buffer = GLBuffer::create();
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer.get());
+#if !defined (__APPLE__)
+        if (GLCaps::get().bufferStorage) {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_PIXEL_UNPACK_BUFFER, slot.capacity, NULL, flags);
+            slot.mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slot.capacity, flags));
+        }
+        else
+#endif
+        {
+            glBufferData(GL_PIXEL_UNPACK_BUFFER, slot.capacity, NULL, GL_STREAM_DRAW);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    void TextureUploader::startCopy(Slot& slot) {
+
+        std::shared_ptr<Job> job = waiting.front();
+        waiting.pop_front();
+        reserve(slot, job->bytes);
+
+        // the slot's last fence has signaled, so nothing on the GPU reads the buffer any more
+        if (!GLCaps::get().bufferStorage) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer.get());
+            slot.mapped = static_cast<unsigned char*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, job->bytes,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT));
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+
+        slot.job = job;
+        if (!slot.mapped) {
+
+            // no staging memory, upload straight from the decoded pixels
+            std::cerr << "WARNING: could not map a pixel buffer for " << job->name << std::endl;
+            job->state.store(JOB_COPIED, std::memory_order_release);
+            return;
+        }
+
+        job->state.store(JOB_COPYING, std::memory_order_release);
+        unsigned char* target = slot.mapped;
+        AsyncLoader::instance().enqueue([job, target]() {
+
+            Clock::time_point start = Clock::now();
+            std::memcpy(target, job->pixels, job->bytes);
+            TextureProcessor::FreePixels(job->pixels);
+            job->pixels = nullptr;
+            job->copyMs = elapsedMs(start);
+            job->state.store(JOB_COPIED, std::memory_order_release);
+        });
+    }
+
+    void TextureUploader::submit(Slot& slot) {
+
+        Job& job = *slot.job;
+        Clock::time_point start = Clock::now();
+
+        const unsigned char* source = job.pixels;
+        if (slot.mapped) {
+
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer.get());
+            if (!GLCaps::get().bufferStorage) {
+                if (glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER) == GL_FALSE) {
+                    std::cerr << "WARNING: pixel buffer of " << job.name << " was lost while mapped" << std::endl;
+                }
+                slot.mapped = nullptr;
+            }
+            // offsets into the bound PBO
+            source = nullptr;
+        }
+
+        if (job.array >= 0) {
+
+            glBindTexture(GL_TEXTURE_2D_ARRAY, MaterialTable::instance().getArrayTexture(job.array));
+            {
+                LoadScope scope(job.name, STAGE_GL_UPLOAD);
+                uploadLevels(source, job.width, job.height, job.levels, job.format, job.layer);
+            }
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        }
+        // the registry may have deleted the texture while its pixels were on the way, and glGenTextures may have
+        // handed the name to another texture since
+        else if (!job.owner.expired()) {
+
+            glBindTexture(GL_TEXTURE_2D, job.texture);
+            {
+                LoadScope scope(job.name, STAGE_GL_UPLOAD);
+                uploadLevels(source, job.width, job.height, job.levels, job.format);
+            }
+            // compressed formats cannot be rendered to, their chains always come complete
+            if (job.levels == 1 && job.format == FORMAT_RGBA8) {
+                LoadScope scope(job.name, STAGE_MIP_GENERATION);
+                glGenerateMipmap(GL_TEXTURE_2D);
+                glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            }
+            glBindTexture(GL_TEXTURE_2D, 0);
+            TextureAllocator::instance().setEvictable(job.texture, true);
+        }
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+        if (job.pixels) {
+            TextureProcessor::FreePixels(job.pixels);
+            job.pixels = nullptr;
+        }
+
+        slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        slot.stallMs = elapsedMs(start);
+        slot.submitted = Clock::now();
+    }
+
+    bool TextureUploader::retire(Slot& slot, bool wait) {
+
+        if (!slot.fence) {
+            return !slot.job;
+        }
+
+        GLenum status;
+        do {
+            status = glClientWaitSync(slot.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000 : 0);
+        } while (wait && status == GL_TIMEOUT_EXPIRED);
+        if (status == GL_TIMEOUT_EXPIRED) {
+            return false;
+        }
+
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+
+        // the fence is polled once per frame, so this is an upper bound of the GPU time
+        const Job& job = *slot.job;
+        double gpuMs = elapsedMs(slot.submitted);
+        double seconds = (slot.stallMs + gpuMs) / 1000.0;
+        double megabytes = job.bytes / (1024.0 * 1024.0);
+        std::cout << "Texture " << job.name << " : " << job.width << "x" << job.height << " " << BlockCompressor::FormatName(job.format)
+            << ", " << megabytes << " MB, copy " << job.copyMs << " ms, stall " << slot.stallMs << " ms, GPU " << gpuMs << " ms, "
+            << (seconds > 0.0 ? megabytes / seconds : 0.0) << " MB/s, " << elapsedMs(job.queued) << " ms after the request" << std::endl;
+
+        stats.textures++;
+        stats.bytes += job.bytes;
+        stats.stallMs += slot.stallMs;
+        stats.gpuMs += gpuMs;
+
+        slot.job.reset();
+        return true;
+    }
+}
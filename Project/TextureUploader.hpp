@@ -0,0 +1,128 @@
+#ifndef TextureUploader_hpp
+#define TextureUploader_hpp
+
+#include "BlockCompressor.hpp"
+#include "GLHandle.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace gps {
+
+    // Fills 2D textures through a ring of pixel buffer objects so the GL thread never copies or waits for pixels.
+    // A loader thread copies the decoded image into a mapped PBO, the GL thread then issues glTexSubImage2D (or
+    // glCompressedTexSubImage2D) from it
+    // and recycles the PBO once its fence has signaled. PBOs stay mapped where glBufferStorage exists, otherwise
+    // they are mapped unsynchronized for every texture. GL thread only, except where noted.
+    class TextureUploader {
+
+    public:
+        static TextureUploader& instance();
+
+        // Creates a texture for a tightly packed mip chain in GL row order (TextureProcessor layout, or its blocks) and
+        // queues its upload. The uploader takes over pixels and frees them once copied. A single uncompressed level gets
+        // its mips from glGenerateMipmap. The texture samples black until process() filled it. The pixels only go in
+        // once the owner of the name was handed to setOwner. 0 if GL could not allocate the storage, pixels are freed then.
+        GLuint upload(const std::string& name, unsigned char* pixels, int width, int height, int levels, TextureFormat format = FORMAT_RGBA8);
+
+        // The registry handle of a texture from upload; once it expired the name may belong to another texture, so
+        // the upload is dropped instead of writing into it
+        void setOwner(GLuint texture, const std::shared_ptr<GLTexture>& owner);
+
+        // Same for a layer the MaterialTable reserved, the array is looked up when the upload is issued since it
+        // may have grown meanwhile
+        void uploadLayer(const std::string& name, unsigned char* pixels, int width, int height, int levels, TextureFormat format,
+                         int array, int layer);
+
+        // Starts copies into free PBOs, submits the finished ones for at most budgetMs (at least one) and retires
+        // PBOs whose upload completed, printing the stall time and bandwidth of each texture
+        void process(double budgetMs);
+
+        // Processes until every queued texture is on the GPU
+        void finish();
+
+        // No texture waiting, copying or in flight
+        bool isIdle() const;
+
+        // Totals over every texture uploaded so far
+        void printStats(std::ostream& out) const;
+
+        // sRGB storage for a mip chain in the bound GL_TEXTURE_2D, immutable where glTexStorage2D exists
+        static void allocateStorage(int width, int height, int levels, TextureFormat format = FORMAT_RGBA8);
+
+        // Fills the levels of the bound GL_TEXTURE_2D, or with layer >= 0 one layer of the bound GL_TEXTURE_2D_ARRAY,
+        // from a chain in TextureProcessor layout (or its blocks), pixels may be a PBO offset
+        static void uploadLevels(const unsigned char* pixels, int width, int height, int levels, TextureFormat format = FORMAT_RGBA8,
+                                 int layer = -1);
+
+    private:
+        enum JobState { JOB_WAITING, JOB_COPYING, JOB_COPIED };
+
+        struct Job {
+
+            std::string name;
+            GLuint texture;
+            std::weak_ptr<GLTexture> owner;
+            // MaterialTable array and layer instead of a texture, -1 if none
+            int array;
+            int layer;
+            unsigned char* pixels;
+            int width;
+            int height;
+            int levels;
+            TextureFormat format;
+            size_t bytes;
+            std::atomic<int> state;
+            // set by the loader thread
+            double copyMs;
+            std::chrono::steady_clock::time_point queued;
+        };
+
+        // Staging buffer, owns at most one texture from the copy until its fence signals
+        struct Slot {
+
+            GLBuffer buffer;
+            size_t capacity;
+            unsigned char* mapped;
+            std::shared_ptr<Job> job;
+            GLsync fence;
+            // render-thread time of the glTexSubImage2D calls
+            double stallMs;
+            std::chrono::steady_clock::time_point submitted;
+        };
+
+        struct Stats {
+
+            size_t textures;
+            size_t bytes;
+            double stallMs;
+            double gpuMs;
+        };
+
+        std::deque<std::shared_ptr<Job> > waiting;
+        std::vector<Slot> slots;
+        Stats stats;
+
+        // PBOs in the ring, each at least one texture large
+        static const size_t SLOT_COUNT = 4;
+
+        TextureUploader();
+
+        void queue(const std::string& name, GLuint texture, int array, int layer, unsigned char* pixels, int width, int height, int levels,
+                   TextureFormat format);
+
+        // Maps a slot for the next waiting texture and hands the copy to a loader thread
+        void startCopy(Slot& slot);
+        void submit(Slot& slot);
+        // Non-blocking unless wait is set, returns true once the slot is free again
+        bool retire(Slot& slot, bool wait);
+        void reserve(Slot& slot, size_t bytes);
+    };
+}
+
+#endif /* TextureUploader_hpp */
@@ -0,0 +1,218 @@
+#include "VertexQuantizer.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+namespace gps {
+
+    namespace {
+
+        const float POSITION_STEPS = 65535.0f;
+        const float NORMAL_STEPS = 511.0f;
+
+        // Signed 10 bit field of a GL_INT_2_10_10_10_REV word
+        uint32_t packSnorm10(float value) {
+
+            int quantized = static_cast<int>(std::lround(std::min(std::max(value, -1.0f), 1.0f) * NORMAL_STEPS));
+            return static_cast<uint32_t>(quantized) & 0x3ffu;
+        }
+
+        // GL 4.2+ conversion rule: c / 511, clamped to -1. The app asks for a 4.1 context, where a driver may still use
+        // the older (2c + 1) / 1023 instead, with legacy set; zero then decodes to 1/1023
+        float unpackSnorm10(uint32_t bits, bool legacy = false) {
+
+            int value = static_cast<int>(bits & 0x3ffu);
+            if (value & 0x200) {
+                value -= 0x400;
+            }
+            if (legacy) {
+                return (2.0f * value + 1.0f) / (2.0f * NORMAL_STEPS + 1.0f);
+            }
+            return std::max(value / NORMAL_STEPS, -1.0f);
+        }
+
+        // Angle between two directions, 0 if either has no length
+        float angleDegrees(const glm::vec3& a, const glm::vec3& b) {
+
+            float lengthA = glm::length(a);
+            float lengthB = glm::length(b);
+            if (lengthA == 0.0f || lengthB == 0.0f) {
+                return 0.0f;
+            }
+            float cosine = glm::dot(a / lengthA, b / lengthB);
+            return glm::degrees(std::acos(std::min(std::max(cosine, -1.0f), 1.0f)));
+        }
+
+        // Quantized position extent, degenerate axes get a unit extent so nothing divides by zero
+        glm::vec3 safeExtent(const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+
+            glm::vec3 extent = boundsMax - boundsMin;
+            for (int axis = 0; axis < 3; axis++) {
+                if (extent[axis] <= 0.0f) {
+                    extent[axis] = 1.0f;
+                }
+            }
+            return extent;
+        }
+    }
+
+    void VertexQuantizer::ComputeBounds(const Vertex* vertices, size_t count, glm::vec3& boundsMin, glm::vec3& boundsMax) {
+
+        boundsMin = glm::vec3(FLT_MAX);
+        boundsMax = glm::vec3(-FLT_MAX);
+        for (size_t i = 0; i < count; i++) {
+            boundsMin = glm::min(boundsMin, vertices[i].Position);
+            boundsMax = glm::max(boundsMax, vertices[i].Position);
+        }
+        if (count == 0) {
+            boundsMin = boundsMax = glm::vec3(0.0f);
+        }
+    }
+
+    PackedVertex VertexQuantizer::Pack(const Vertex& vertex, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+
+        PackedVertex packed;
+        glm::vec3 normalized = (vertex.Position - boundsMin) / safeExtent(boundsMin, boundsMax);
+        for (int axis = 0; axis < 3; axis++) {
+            float clamped = std::min(std::max(normalized[axis], 0.0f), 1.0f);
+            packed.position[axis] = static_cast<uint16_t>(std::lround(clamped * POSITION_STEPS));
+        }
+        packed.position[3] = 0;
+
+        glm::vec3 normal = vertex.Normal;
+        float length = glm::length(normal);
+        normal = length > 0.0f ? normal / length : glm::vec3(0.0f, 0.0f, 1.0f);
+        packed.normal = packSnorm10(normal.x) | (packSnorm10(normal.y) << 10) | (packSnorm10(normal.z) << 20);
+
+        packed.texCoords[0] = FloatToHalf(vertex.TexCoords.x);
+        packed.texCoords[1] = FloatToHalf(vertex.TexCoords.y);
+        return packed;
+    }
+
+    Vertex VertexQuantizer::Unpack(const PackedVertex& packed, const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+
+        Vertex vertex;
+        glm::vec3 normalized(packed.position[0] / POSITION_STEPS, packed.position[1] / POSITION_STEPS, packed.position[2] / POSITION_STEPS);
+        vertex.Position = glm::vec3(DequantizationMatrix(boundsMin, boundsMax) * glm::vec4(normalized, 1.0f));
+        vertex.Normal = glm::vec3(unpackSnorm10(packed.normal), unpackSnorm10(packed.normal >> 10), unpackSnorm10(packed.normal >> 20));
+        vertex.TexCoords = glm::vec2(HalfToFloat(packed.texCoords[0]), HalfToFloat(packed.texCoords[1]));
+        return vertex;
+    }
+
+    glm::mat4 VertexQuantizer::DequantizationMatrix(const glm::vec3& boundsMin, const glm::vec3& boundsMax) {
+
+        glm::vec3 extent = safeExtent(boundsMin, boundsMax);
+        glm::mat4 matrix(1.0f);
+        matrix[0][0] = extent.x;
+        matrix[1][1] = extent.y;
+        matrix[2][2] = extent.z;
+        matrix[3] = glm::vec4(boundsMin, 1.0f);
+        return matrix;
+    }
+
+    uint16_t VertexQuantizer::FloatToHalf(float value) {
+
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+
+        uint32_t sign = (bits >> 16) & 0x8000u;
+        int exponent = static_cast<int>((bits >> 23) & 0xffu) - 127 + 15;
+        uint32_t mantissa = bits & 0x7fffffu;
+
+        if (((bits >> 23) & 0xffu) == 0xffu) {
+            // infinity stays infinity, NaN stays a NaN
+            return static_cast<uint16_t>(sign | 0x7c00u | (mantissa ? 0x200u : 0u));
+        }
+        if (exponent >= 31) {
+            return static_cast<uint16_t>(sign | 0x7c00u);
+        }
+        if (exponent <= 0) {
+            if (exponent < -10) {
+                return static_cast<uint16_t>(sign);
+            }
+            // subnormal half, round to nearest
+            mantissa |= 0x800000u;
+            uint32_t shift = static_cast<uint32_t>(14 - exponent);
+            uint32_t half = mantissa >> shift;
+            uint32_t remainder = mantissa & ((1u << shift) - 1u);
+            uint32_t halfway = 1u << (shift - 1);
+            if (remainder > halfway || (remainder == halfway && (half & 1u))) {
+                half++;
+            }
+            return static_cast<uint16_t>(sign | half);
+        }
+
+        // round to nearest even, a carry out of the mantissa correctly bumps the exponent
+        uint32_t half = sign | (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+        uint32_t remainder = mantissa & 0x1fffu;
+        if (remainder > 0x1000u || (remainder == 0x1000u && (half & 1u))) {
+            half++;
+        }
+        return static_cast<uint16_t>(half);
+    }
+
+    float VertexQuantizer::HalfToFloat(uint16_t half) {
+
+        uint32_t sign = static_cast<uint32_t>(half & 0x8000u) << 16;
+        uint32_t exponent = (half >> 10) & 0x1fu;
+        uint32_t mantissa = half & 0x3ffu;
+
+        uint32_t bits;
+        if (exponent == 0) {
+            if (mantissa == 0) {
+                bits = sign;
+            } else {
+                // renormalize the subnormal
+                int shift = 0;
+                while (!(mantissa & 0x400u)) {
+                    mantissa <<= 1;
+                    shift++;
+                }
+                mantissa &= 0x3ffu;
+                bits = sign | (static_cast<uint32_t>(127 - 15 + 1 - shift) << 23) | (mantissa << 13);
+            }
+        } else if (exponent == 31) {
+            bits = sign | 0x7f800000u | (mantissa << 13);
+        } else {
+            bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+        }
+
+        float value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    QuantizationError VertexQuantizer::Measure(const Vertex* vertices, size_t count) {
+
+        QuantizationError error = { 0.0f, 0.0f, 0.0f, 0.0f };
+
+        glm::vec3 boundsMin;
+        glm::vec3 boundsMax;
+        ComputeBounds(vertices, count, boundsMin, boundsMax);
+        glm::vec3 extent = boundsMax - boundsMin;
+        float largestExtent = std::max(extent.x, std::max(extent.y, extent.z));
+
+        for (size_t i = 0; i < count; i++) {
+
+            const Vertex& original = vertices[i];
+            PackedVertex packed = Pack(original, boundsMin, boundsMax);
+            Vertex decoded = Unpack(packed, boundsMin, boundsMax);
+
+            error.position = std::max(error.position, glm::length(decoded.Position - original.Position));
+
+            // the shaders renormalize, so only the direction matters; either conversion rule has to stay in bounds
+            glm::vec3 legacyNormal(unpackSnorm10(packed.normal, true), unpackSnorm10(packed.normal >> 10, true),
+                                   unpackSnorm10(packed.normal >> 20, true));
+            error.normalDegrees = std::max(error.normalDegrees, std::max(angleDegrees(original.Normal, decoded.Normal),
+                                                                         angleDegrees(original.Normal, legacyNormal)));
+
+            glm::vec2 texCoordDelta = decoded.TexCoords - original.TexCoords;
+            error.texCoord = std::max(error.texCoord, std::max(std::fabs(texCoordDelta.x), std::fabs(texCoordDelta.y)));
+        }
+
+        error.relativePosition = largestExtent > 0.0f ? error.position / largestExtent : 0.0f;
+        return error;
+    }
+}
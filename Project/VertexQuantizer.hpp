@@ -0,0 +1,46 @@
+#ifndef VertexQuantizer_hpp
+#define VertexQuantizer_hpp
+
+#include "Mesh.hpp"
+
+#include <cstdint>
+#include <vector>
+
+namespace gps {
+
+    // Largest differences between decoded packed vertices and their float originals
+    struct QuantizationError {
+
+        // in model units, and relative to the largest extent of the mesh bounds
+        float position;
+        float relativePosition;
+        float normalDegrees;
+        float texCoord;
+    };
+
+    // Packs gps::Vertex into the 16 byte gps::PackedVertex layout and back
+    class VertexQuantizer {
+
+    public:
+        // Bounds the positions are normalized against
+        static void ComputeBounds(const Vertex* vertices, size_t count, glm::vec3& boundsMin, glm::vec3& boundsMax);
+
+        static PackedVertex Pack(const Vertex& vertex, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+        // Decodes like the GL 4.2+ vertex fetch does, with the dequantization applied. Under 4.1 the normals may come out
+        // up to 1/1023 per component apart, Measure accounts for both
+        static Vertex Unpack(const PackedVertex& packed, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+        // Maps the [0, 1] normalized positions back into model space, multiplied into the model matrix at draw time
+        static glm::mat4 DequantizationMatrix(const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+
+        static uint16_t FloatToHalf(float value);
+        static float HalfToFloat(uint16_t half);
+
+        // Packs and decodes every vertex, returning the worst error of each attribute; the normal error is the worse of the
+        // two snorm conversion rules
+        static QuantizationError Measure(const Vertex* vertices, size_t count);
+    };
+}
+
+#endif /* VertexQuantizer_hpp */
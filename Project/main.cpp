@@ -19,9 +19,28 @@
 #include "Camera.hpp"
 #include "Model3D.hpp"
 #include "SkyBox.hpp"
-
+#include "TaskGraph.hpp"
+#include "AsyncLoader.hpp"
+#include "BlockCompressor.hpp"
+#include "DecodePool.hpp"
+#include "FrameUniforms.hpp"
+#include "ResourceRegistry.hpp"
+#include "ObjStreamer.hpp"
+#include "LoadProfiler.hpp"
+#include "MaterialTable.hpp"
+#include "ObjectBuffer.hpp"
+#include "TextureAllocator.hpp"
+#include "TextureProcessor.hpp"
+#include "TextureStreamer.hpp"
+#include "TextureUploader.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <iterator>
 #include <random>
 #include <iostream>
+#include <string>
 
 // window
 gps::Window myWindow;
@@ -41,18 +60,9 @@ GLfloat lightAngle;
 GLint is_positional;
 
 // shader uniform locations
-GLint modelLoc;
-GLint viewLoc;
-GLint projectionLoc;
-GLint normalMatrixLoc;
-GLint lightDirLoc;
-GLint lightColorLoc;
-GLint lightPositionLoc;
-GLint CameraPositionLoc;
-GLint lightTypeLoc;
-GLint nearPlaneLoc;
-GLint fogDensityLoc;
-GLint farPlaneLoc;
+gps::Shader::Uniform CameraPositionLoc;
+gps::Shader::Uniform nearPlaneLoc;
+gps::Shader::Uniform farPlaneLoc;
 
 // Position:(0.618196,-0.123672,0.890926)
 gps::Camera myCamera(
@@ -77,6 +87,28 @@ gps::Model3D cottage;
 gps::Model3D stone;
 gps::Model3D skull;
 
+// every model of the scene with the .obj it is loaded from
+struct SceneModel {
+    gps::Model3D* model;
+    const char* fileName;
+};
+
+// the meshes drop their CPU copies once uploaded unless something (e.g. picking) needs them
+gps::CpuDataPolicy meshCpuData = gps::RELEASE_CPU_DATA;
+
+SceneModel sceneModels[] = {
+    { &ground, "models/ground/ground.obj" },
+    { &lightCube, "models/cube/cube.obj" },
+    { &cactus, "models/cactus/10436_Cactus_v1_max2010_it2.obj" },
+    { &tumbleweed, "models/tumbleweed/tumble.obj" },
+    { &windmill, "models/windmill/windmill.obj" },
+    { &windmillhead, "models/windmill/windmill_headobj.obj" },
+    { &cat, "models/cat/cat.obj" },
+    { &cottage, "models/cottage/cottage.obj" },
+    { &stone, "models/rock/rock.obj" },
+    { &skull, "models/bones/skull.obj" },
+};
+
 // shaders
 gps::Shader myBasicShader;
 gps::Shader depthMapShader;
@@ -86,6 +118,10 @@ gps::Shader skyBoxShader;
 // shadows parameters
 GLuint shadowMapFBO;
 GLuint depthMapTexture;
+// false if GL could not allocate the depth map, the scene is drawn without its depth pass then
+bool shadowMapAllocated = false;
+// false if a program's FrameData block does not match the CPU layout, it would read garbage matrices
+bool frameLayoutMatches = true;
 const unsigned int SHADOW_WIDTH = 2048;
 const unsigned int SHADOW_HEIGHT = 2048;
 
@@ -105,6 +141,45 @@ float lastFrame = 0.0f;
 //skybox
 gps::SkyBox mySkyBox;
 
+const GLchar* skyBoxFaces[] = {
+    "skybox/px.png",
+    "skybox/nx.png",
+    "skybox/py.png",
+    "skybox/ny.png",
+    "skybox/pz.png",
+    "skybox/nz.png",
+};
+
+// images of the models, for --bench-textures and --verify-compression
+const char* modelTextures[] = {
+    "models/cactus/10436_Cactus_v1_Diffuse.jpg",
+    "models/cat/chiyo_Material_BaseColor.png",
+    "models/tumbleweed/tumble.png",
+    "models/windmill/windmill.png",
+};
+
+// startup work, kept around for the report printed at exit
+gps::TaskGraph startupTasks;
+
+// level of detail selection, refreshed for every pass in renderScene
+const float LOD_PIXEL_ERROR = 1.0f;
+const float SHADOW_LOD_BIAS = 4.0f;
+gps::LodView lodView;
+
+// meshlet culling counts of the current frame, printed once per second
+bool clusterCulling = true;
+gps::ClusterCullStats colourCullStats;
+gps::ClusterCullStats shadowCullStats;
+double lastCullReport = 0.0;
+// frames since the last report, texture binds are averaged over them
+int framesSinceReport = 0;
+gps::LodInstance catLod, groundLod, tumbleweedLod, windmillLod, windmillheadLod, cottageLod, rockLod, skullLod;
+gps::LodInstance cactusLods[4];
+
+// models stream in after the first frame, each frame spends at most this long uploading them
+const double MODEL_UPLOAD_BUDGET_MS = 4.0;
+std::vector<gps::ModelLoadHandle> modelLoads;
+
 float getRandomFloat(float min, float max) {
     std::random_device rd;   
     std::mt19937 e2(rd());
@@ -235,27 +310,16 @@ void processMovement() {
         glPolygonMode(GL_FRONT_AND_BACK, GL_POINT);
     }
     if (pressedKeys[GLFW_KEY_O]) {
-        myBasicShader.useShaderProgram();
-        lightTypeLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightType");
-        glUniform1i(lightTypeLoc, 0);
         is_positional = 0;
     }
     if (pressedKeys[GLFW_KEY_P]) {
-        myBasicShader.useShaderProgram();
-        lightTypeLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightType");
-        glUniform1i(lightTypeLoc, 1);
         is_positional = 1;
     }
     if (pressedKeys[GLFW_KEY_M]) {
-        fogDensityLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogDensity");
         fogDensity = (fogDensity < 1.0f) ? fogDensity + 0.01f : 1.0f;
-        glUniform1f(fogDensityLoc, fogDensity);
     }
     if (pressedKeys[GLFW_KEY_N]) {
-        fogDensityLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogDensity");
-        
         fogDensity = (fogDensity > 0.0f)? fogDensity - 0.01f: 0.0f;
-        glUniform1f(fogDensityLoc, fogDensity);
     }
 }
 
@@ -303,17 +367,57 @@ void initOpenGLState() {
     glfwSwapInterval(1);
 }
 
-void initModels() {
-    ground.LoadModel("models/ground/ground.obj");
-    lightCube.LoadModel("models/cube/cube.obj");
-    cactus.LoadModel("models/cactus/10436_Cactus_v1_max2010_it2.obj");
-    tumbleweed.LoadModel("models/tumbleweed/tumble.obj");
-    windmill.LoadModel("models/windmill/windmill.obj");
-    windmillhead.LoadModel("models/windmill/windmill_headobj.obj");
-    cat.LoadModel("models/cat/cat.obj");
-    cottage.LoadModel("models/cottage/cottage.obj");
-    stone.LoadModel("models/rock/rock.obj");
-    skull.LoadModel("models/bones/skull.obj");
+// compares the .obj parse with the binary cache load for every model, no GL context needed
+void benchmarkModelLoading() {
+    for (SceneModel& sceneModel : sceneModels) {
+        gps::Model3D::BenchmarkLoad(sceneModel.fileName, 5);
+    }
+}
+
+// decode, flip and mip generation of the model textures, old path against the CPU chain and the cooked file
+void benchmarkTextures(bool withContext) {
+    std::vector<std::string> fileNames(std::begin(modelTextures), std::end(modelTextures));
+    gps::TextureProcessor::Benchmark(fileNames, 5, withContext);
+}
+
+// OBJ parser throughput for every model and thread count
+void benchmarkObjParsing() {
+    for (SceneModel& sceneModel : sceneModels) {
+        gps::ObjParser::Benchmark(sceneModel.fileName, 3);
+    }
+}
+
+// vertex cache, fetch and overdraw statistics before and after MeshOptimizer for every model
+void analyzeMeshOptimization() {
+    for (SceneModel& sceneModel : sceneModels) {
+        gps::Model3D::AnalyzeOptimization(sceneModel.fileName);
+    }
+}
+
+// decoded quantized attributes against the float originals for every model
+bool verifyQuantization() {
+    bool allPassed = true;
+    for (SceneModel& sceneModel : sceneModels) {
+        allPassed = gps::Model3D::VerifyQuantization(sceneModel.fileName) && allPassed;
+    }
+    return allPassed;
+}
+
+// triangle count against simplification error of every LOD of every model
+void reportLods() {
+    for (SceneModel& sceneModel : sceneModels) {
+        gps::Model3D::ReportLods(sceneModel.fileName);
+    }
+}
+
+// checks the parallel OBJ parser against tinyobj for every model
+bool verifyObjParsing() {
+    bool allMatch = true;
+    for (SceneModel& sceneModel : sceneModels) {
+        std::string fileName = sceneModel.fileName;
+        allMatch = gps::ObjParser::Verify(fileName, fileName.substr(0, fileName.find_last_of('/')) + "/") && allMatch;
+    }
+    return allMatch;
 }
 
 void initShaders() {
@@ -337,68 +441,38 @@ void initShaders() {
         "shaders/skyboxShader.frag");
     skyBoxShader.useShaderProgram();
 
-}
-
-void initSkyBox() {
-	std::vector<const GLchar*> faces;
-
-	faces.push_back("skybox/px.png");
-	faces.push_back("skybox/nx.png");
-	faces.push_back("skybox/py.png");
-	faces.push_back("skybox/ny.png");
-	faces.push_back("skybox/pz.png");
-	faces.push_back("skybox/nz.png");
-	mySkyBox.Load(faces);
+    //every program reads the camera and the light from the frame's uniform buffer
+    gps::FrameUniforms& frameUniforms = gps::FrameUniforms::instance();
+    frameLayoutMatches = frameUniforms.attach(myBasicShader, "basic");
+    frameLayoutMatches = frameUniforms.attach(lightShader, "lightCube") && frameLayoutMatches;
+    frameLayoutMatches = frameUniforms.attach(depthMapShader, "shadow") && frameLayoutMatches;
+    frameLayoutMatches = frameUniforms.attach(skyBoxShader, "skyboxShader") && frameLayoutMatches;
 
+    //and the object matrices from the object buffer
+    gps::ObjectBuffer::instance().attach(myBasicShader);
+    gps::ObjectBuffer::instance().attach(depthMapShader);
 }
 
 void initUniforms() {
 	myBasicShader.useShaderProgram();
 
-    // create model matrix
+    // model and normal matrices go to the object buffer draw by draw
 	model = glm::mat4(1.0f);
-	modelLoc = glGetUniformLocation(myBasicShader.shaderProgram, "model");
-	glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
 
-    // Create and send view matrix 
+    // view matrix, sent with the frame's uniforms
 	view = myCamera.getViewMatrix();
-	viewLoc = glGetUniformLocation(myBasicShader.shaderProgram, "view");
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
 
-    //Create and send normal matrix 
-    normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-    normalMatrixLoc = glGetUniformLocation(myBasicShader.shaderProgram, "normalMatrix");
-    glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-
-	// Create and send projection matrix
+	// projection matrix, sent with the frame's uniforms
 	projection = glm::perspective(glm::radians(45.0f),
                                (float)myWindow.getWindowDimensions().width / (float)myWindow.getWindowDimensions().height,
                                0.1f, 1000.0f);
-	projectionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "projection");
-	glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));	
 
-    // Create and send light direction  
+    // light direction, color and position, sent with the frame's uniforms
     lightDir = glm::vec3(0.0f, 1.5f, 1.5f);
     lightRotation = glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-    lightDirLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightDir");
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(glm::inverseTranspose(glm::mat3(view * lightRotation)) * lightDir));;
-        
-    // Create and send light color  
 	lightColor = glm::vec3(1.0f, 1.0f, 1.0f); //white light
-	lightColorLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightColor");
-	glUniform3fv(lightColorLoc, 1, glm::value_ptr(lightColor));
-
-    //Create and send light position Position:(-0.20185,-0.256673,-1.66408)
+    //Position:(-0.20185,-0.256673,-1.66408)
     lightPosition = glm::vec3(-0.2f, -0.25f, -1.3f);
-    lightPositionLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightPosition");
-    glUniform3fv(lightPositionLoc, 1, glm::value_ptr(lightPosition));
-    
-    fogDensityLoc = glGetUniformLocation(myBasicShader.shaderProgram, "fogDensity");
-    glUniform1f(fogDensityLoc, fogDensity);
-    
-    //Create and send light position 
-    lightTypeLoc = glGetUniformLocation(myBasicShader.shaderProgram, "lightType");
-    glUniform1i(lightTypeLoc, 0);
 }
 
 void initFBO() {
@@ -407,7 +481,16 @@ void initFBO() {
 
     glGenTextures(1, &depthMapTexture);
     glBindTexture(GL_TEXTURE_2D, depthMapTexture);
+    gps::TextureAllocator::beginAllocation();
     glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+    {
+        gps::TextureOwnerScope owner("shadowMap");
+        shadowMapAllocated = gps::TextureAllocator::instance().track(depthMapTexture, GL_TEXTURE_2D, GL_DEPTH_COMPONENT, SHADOW_WIDTH,
+            SHADOW_HEIGHT, 1, 1, "depth map", false);
+    }
+    if (!shadowMapAllocated) {
+        std::cerr << "ERROR: no shadow map, the scene is drawn without shadows" << std::endl;
+    }
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -426,6 +509,57 @@ void initFBO() {
 
 }
 
+// models are parsed on the background loader and drawn as boxes until ProcessUploads makes them resident
+void initModels() {
+    for (SceneModel& sceneModel : sceneModels) {
+        sceneModel.model->SetCpuDataPolicy(meshCpuData);
+        modelLoads.push_back(sceneModel.model->LoadModelAsync(sceneModel.fileName));
+    }
+}
+
+// resident GPU and CPU bytes of every model
+void printMemoryReport() {
+    gps::ModelMemoryUsage total = { 0, 0, 0, 0 };
+    for (SceneModel& sceneModel : sceneModels) {
+        std::string fileName = sceneModel.fileName;
+        sceneModel.model->PrintMemoryReport(fileName.substr(fileName.find_last_of('/') + 1));
+        gps::ModelMemoryUsage usage = sceneModel.model->GetMemoryUsage();
+        total.vertexBytes += usage.vertexBytes;
+        total.indexBytes += usage.indexBytes;
+        total.textureBytes += usage.textureBytes;
+        total.cpuBytes += usage.cpuBytes;
+    }
+    std::cout << "Total: GPU " << (total.vertexBytes + total.indexBytes + total.textureBytes) / 1024 << " KB, CPU "
+        << total.cpuBytes / 1024 << " KB" << std::endl;
+    gps::ResourceRegistry::instance().printStats(std::cout);
+    gps::TextureUploader::instance().printStats(std::cout);
+    gps::MaterialTable::instance().printStats(std::cout);
+    if (gps::TextureStreamer::instance().isEnabled()) {
+        gps::TextureStreamer::instance().printStats(std::cout);
+    }
+    gps::TextureAllocator::instance().printStats(std::cout);
+    gps::DecodePool::instance().printStats(std::cout);
+}
+
+// image decoding goes to the worker pool, everything touching GL stays on this thread
+void initStartupTasks() {
+    gps::TaskGraph::TaskId shaders = startupTasks.addTask("initShaders", gps::TaskGraph::CONTEXT_THREAD, initShaders);
+    startupTasks.addTask("initUniforms", gps::TaskGraph::CONTEXT_THREAD, initUniforms, { shaders });
+
+    // a current cooked cube map leaves the decodes nothing to do
+    gps::TaskGraph::TaskId skyBoxCache = startupTasks.addTask("map skybox cache", gps::TaskGraph::WORKER_THREAD,
+        []() { mySkyBox.Prepare(std::vector<const GLchar*>(std::begin(skyBoxFaces), std::end(skyBoxFaces))); });
+    std::vector<gps::TaskGraph::TaskId> faceDecodes;
+    for (GLuint i = 0; i < 6; i++) {
+        const GLchar* face = skyBoxFaces[i];
+        faceDecodes.push_back(startupTasks.addTask(std::string("decode ") + face, gps::TaskGraph::WORKER_THREAD,
+            [i, face]() { mySkyBox.DecodeFace(i, face); }, { skyBoxCache }));
+    }
+    startupTasks.addTask("upload skybox", gps::TaskGraph::CONTEXT_THREAD, []() { mySkyBox.Upload(); }, faceDecodes);
+
+    startupTasks.addTask("initFBO", gps::TaskGraph::CONTEXT_THREAD, initFBO);
+}
+
 glm::mat4 computeLightSpaceTrMatrixOrth() {
     
     glm::mat4 lightView = glm::lookAt(glm::vec3(lightRotation * glm::vec4(lightDir, 1.0f)), glm::vec3(0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
@@ -453,42 +587,35 @@ glm::mat4 computeLightSpaceTrMatrixPersp() {
     return lightSpaceMatrix;
 }
 
+// the object's matrices go into the frame's object buffer, its draws only pass the record's index;
+// the depth pass has no use for the normal matrix
+void setObject(gps::Shader shader, bool depthPass) {
+    normalMatrix = depthPass ? glm::mat3(1.0f) : glm::mat3(glm::inverseTranspose(view * model));
+    gps::ObjectBuffer::instance().setObject(shader, model, normalMatrix);
+}
+
 void drawCat(gps::Shader shader,bool depthPass) {
     model = glm::translate(glm::mat4(1.0f), glm::vec3(0.2488f, -0.47f, -1.72f));
     model = glm::scale(model, glm::vec3(0.004f));
     model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
     model = glm::rotate(model, glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    }
-    cat.Draw(shader);
+    setObject(shader, depthPass);
+    cat.Draw(shader, model, lodView, catLod);
 }
 
-void drawCactus(gps::Shader shader, bool depthPass, glm::vec3 position) {
+void drawCactus(gps::Shader shader, bool depthPass, glm::vec3 position, gps::LodInstance& lod) {
     model = glm::translate(glm::mat4(1.0f), position);
     model = glm::scale(model, glm::vec3(0.0009f));
     model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    }
-    cactus.Draw(shader);
+    setObject(shader, depthPass);
+    cactus.Draw(shader, model, lodView, lod);
 }
 
 void drawGround(gps::Shader shader, bool depthPass) {
     model = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.5f, -1.0f));
     model = glm::scale(model, glm::vec3(0.15f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    }
-    ground.Draw(shader);
+    setObject(shader, depthPass);
+    ground.Draw(shader, model, lodView, groundLod);
 }
 
 void drawTumbleweed(gps::Shader shader, bool depthPass,float startx, float endx) {
@@ -515,25 +642,16 @@ void drawTumbleweed(gps::Shader shader, bool depthPass,float startx, float endx)
     model = glm::translate(glm::mat4(1.0f), glm::vec3(currentTumblex, currentTumbley, zCoord));
     model = glm::scale(model, glm::vec3(0.0005f));
     model = glm::rotate(model, glm::radians(angle), glm::vec3(0.0f, 1.0f, 0.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    }
-    tumbleweed.Draw(shader);
+    setObject(shader, depthPass);
+    tumbleweed.Draw(shader, model, lodView, tumbleweedLod);
 }
 
 void drawWindmill(gps::Shader shader, bool depthPass) {
     model = glm::translate(glm::mat4(1.0f), glm::vec3(-0.767222f, -0.5f, -1.51006f));
     model = glm::scale(model, glm::vec3(0.1f));
     //model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    }
-    windmill.Draw(shader);
+    setObject(shader, depthPass);
+    windmill.Draw(shader, model, lodView, windmillLod);
 
     //animate windmill
     GLfloat animationSpeed = 20 * deltaTime;
@@ -542,31 +660,23 @@ void drawWindmill(gps::Shader shader, bool depthPass) {
     model = glm::translate(model, glm::vec3(0.0f, 6.93f, 1.0f));
     model=glm::rotate(model, glm::radians(rotation), glm::vec3(0.0f, 0.0f, 1.0f));
     
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    setObject(shader, depthPass);
 
-    windmillhead.Draw(shader);
+    windmillhead.Draw(shader, model, lodView, windmillheadLod);
 }
 
 void drawCottage(gps::Shader shader, bool depthPass) {
     model = glm::translate(glm::mat4(1.0f), glm::vec3(0.4f, -0.5f, -1.5f));
     model = glm::scale(model, glm::vec3(0.025f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    }
-    cottage.Draw(shader);
+    setObject(shader, depthPass);
+    cottage.Draw(shader, model, lodView, cottageLod);
 }
 
 void drawRock(gps::Shader shader, bool depthPass) {
     model = glm::translate(glm::mat4(1.0f), glm::vec3(-1.1f, -0.5f, 0.17f));
     model = glm::scale(model, glm::vec3(0.07f));
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    }
-    stone.Draw(shader);
+    setObject(shader, depthPass);
+    stone.Draw(shader, model, lodView, rockLod);
 }
 
 void drawSkull(gps::Shader shader, bool depthPass) {
@@ -575,12 +685,8 @@ void drawSkull(gps::Shader shader, bool depthPass) {
     model = glm::rotate(model, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
     model = glm::rotate(model, glm::radians(180.0f), glm::vec3(0.0f, 1.0f, 0.0f));
     
-    glUniformMatrix4fv(glGetUniformLocation(shader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
-    if (!depthPass) {
-        normalMatrix = glm::mat3(glm::inverseTranspose(view * model));
-        glUniformMatrix3fv(normalMatrixLoc, 1, GL_FALSE, glm::value_ptr(normalMatrix));
-    }
-    skull.Draw(shader);
+    setObject(shader, depthPass);
+    skull.Draw(shader, model, lodView, skullLod);
 }
 
 
@@ -589,10 +695,10 @@ void drawObjects(gps::Shader shader, bool depthPass) {
 
     shader.useShaderProgram();
 
-    drawCactus(shader,depthPass, glm::vec3(0.98f, -0.51f, -1.662f));
-    drawCactus(shader, depthPass, glm::vec3(-0.44f, -0.51f, -0.32f));
-    drawCactus(shader, depthPass, glm::vec3(-1.38f, -0.51f, -0.99f));
-    drawCactus(shader, depthPass, glm::vec3(1.23f, -0.51f, -0.36f));
+    drawCactus(shader,depthPass, glm::vec3(0.98f, -0.51f, -1.662f), cactusLods[0]);
+    drawCactus(shader, depthPass, glm::vec3(-0.44f, -0.51f, -0.32f), cactusLods[1]);
+    drawCactus(shader, depthPass, glm::vec3(-1.38f, -0.51f, -0.99f), cactusLods[2]);
+    drawCactus(shader, depthPass, glm::vec3(1.23f, -0.51f, -0.36f), cactusLods[3]);
     drawCat(shader, depthPass);
     drawGround(shader, depthPass);
     drawTumbleweed(shader, depthPass,-2.0f,2.0f);
@@ -603,22 +709,87 @@ void drawObjects(gps::Shader shader, bool depthPass) {
      
     skyBoxShader.useShaderProgram();
     if (!depthPass) {
-        mySkyBox.Draw(skyBoxShader, view, projection);
+        mySkyBox.Draw(skyBoxShader);
     }
 }
 
 
 
+void updateLodView(bool shadowPass, const glm::mat4& viewProjection) {
+    lodView.cameraPosition = myCamera.getCameraPosition();
+    lodView.viewProjection = viewProjection;
+    lodView.clusterCulling = clusterCulling;
+    lodView.cullStats = shadowPass ? &shadowCullStats : &colourCullStats;
+    lodView.pixelScale = myWindow.getWindowDimensions().height / (2.0f * tanf(glm::radians(45.0f) * 0.5f));
+    lodView.pixelError = LOD_PIXEL_ERROR;
+    lodView.shadowPass = shadowPass;
+    lodView.shadowBias = SHADOW_LOD_BIAS;
+    lodView.time = glfwGetTime();
+}
+
+void reportFrameStats() {
+    double now = glfwGetTime();
+    framesSinceReport++;
+    if (now - lastCullReport >= 1.0) {
+        lastCullReport = now;
+        std::cout << "Texture binds: " << gps::MaterialTable::takeTextureBinds() / framesSinceReport << " per frame ("
+            << (gps::MaterialTable::isEnabled() ? "material table" : "per mesh") << ")\n";
+        gps::UniformStats uniforms = gps::Shader::takeUniformStats();
+        std::cout << "Uniforms: " << uniforms.uploads / framesSinceReport << " uploads per frame, GL calls saved: "
+            << uniforms.redundant / framesSinceReport << " redundant uploads, " << uniforms.lookups / framesSinceReport << " location queries\n";
+        gps::ObjectBufferStats objects = gps::ObjectBuffer::instance().takeStats();
+        std::cout << "Objects: " << objects.objects / framesSinceReport << " per frame in ";
+        gps::ObjectBuffer::instance().printStats(std::cout);
+        std::cout << ", " << objects.overflowed << " drawn with uniforms, " << objects.fenceWaits << " fence waits ("
+            << objects.waitMs << " ms)\n";
+        framesSinceReport = 0;
+        if (gps::TextureStreamer::instance().isEnabled()) {
+            gps::TextureStreamer::instance().printStats(std::cout);
+        }
+        if (gps::TextureAllocator::instance().hasBudget()) {
+            gps::TextureAllocator::instance().printSummary(std::cout);
+        }
+        const gps::ClusterCullStats* passes[2] = { &colourCullStats, &shadowCullStats };
+        const char* names[2] = { "colour", "shadow" };
+        for (int p = 0; p < 2; p++) {
+            std::cout << "Clusters (" << names[p] << " pass): " << passes[p]->tested << " tested, "
+                << passes[p]->frustumCulled << " frustum culled, " << passes[p]->backfaceCulled << " backface culled, "
+                << passes[p]->drawn << " drawn\n";
+        }
+    }
+    colourCullStats = gps::ClusterCullStats();
+    shadowCullStats = gps::ClusterCullStats();
+}
+
 void renderScene() {
+    view = myCamera.getViewMatrix();
+    lightRotation = glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f));
     glm::mat4 lightSpaceTrMatrix = (is_positional) ? computeLightSpaceTrMatrixPersp() : computeLightSpaceTrMatrixOrth();
 
-    depthMapShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(depthMapShader.shaderProgram, "lightSpaceTrMatrix"), 1, GL_FALSE, glm::value_ptr(lightSpaceTrMatrix));
-    glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glClear(GL_DEPTH_BUFFER_BIT);
-    drawObjects(depthMapShader, 1);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    //one upload of the camera and the light for all passes and programs
+    gps::FrameData frame;
+    frame.view = view;
+    frame.projection = projection;
+    frame.viewProjection = projection * view;
+    frame.lightSpaceTrMatrix = lightSpaceTrMatrix;
+    frame.lightDir = glm::inverseTranspose(glm::mat3(view * lightRotation)) * lightDir;
+    frame.fogDensity = fogDensity;
+    frame.lightColor = lightColor;
+    frame.lightType = is_positional;
+    frame.lightPosition = lightPosition;
+    frame.padding = 0.0f;
+    gps::FrameUniforms::instance().update(frame);
+
+    // an incomplete framebuffer would fail every draw of the pass
+    if (shadowMapAllocated) {
+        depthMapShader.useShaderProgram();
+        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+        glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        updateLodView(true, lightSpaceTrMatrix);
+        drawObjects(depthMapShader, 1);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
 
     glViewport(0, 0, myWindow.getWindowDimensions().width, myWindow.getWindowDimensions().height);
 
@@ -626,77 +797,267 @@ void renderScene() {
 
     myBasicShader.useShaderProgram();
 
-    view = myCamera.getViewMatrix();
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-
-    lightRotation = glm::rotate(glm::mat4(1.0f), glm::radians(lightAngle), glm::vec3(0.0f, 1.0f, 0.0f));
-    glUniform3fv(lightDirLoc, 1, glm::value_ptr(glm::inverseTranspose(glm::mat3(view * lightRotation)) * lightDir));
-
     //bind the shadow map
     glActiveTexture(GL_TEXTURE3);
     glBindTexture(GL_TEXTURE_2D, depthMapTexture);
-    glUniform1i(glGetUniformLocation(myBasicShader.shaderProgram, "shadowMap"), 3);
+    myBasicShader.setUniform("shadowMap", 3);
 
-    glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "lightSpaceTrMatrix"),
-        1,
-       GL_FALSE,
-        glm::value_ptr(lightSpaceTrMatrix));
+    //every texture array and the material colors, for all colour pass draws
+    gps::MaterialTable::instance().bind(myBasicShader.shaderProgram);
 
+    updateLodView(false, frame.viewProjection);
     drawObjects(myBasicShader, false);
 
     myBasicShader.useShaderProgram();
-    glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "view"), 1, GL_FALSE, glm::value_ptr(view));
     model = lightRotation;
     model = glm::translate(model, 1.0f * lightDir);
     model = glm::scale(model, glm::vec3(0.05f, 0.05f, 0.05f));
-    glUniformMatrix4fv(glGetUniformLocation(myBasicShader.shaderProgram, "model"), 1, GL_FALSE, glm::value_ptr(model));
+    setObject(myBasicShader, false);
 
     lightCube.Draw(myBasicShader);
 
 }
 void cleanup() {
+    startupTasks.printReport(std::cout);
+    gps::Model3D::CancelStreamingImports();
+    gps::AsyncLoader::instance().shutdown();
+
     myWindow.Delete();
 
     glDeleteFramebuffers(1, &shadowMapFBO);
+    gps::TextureAllocator::instance().untrack(depthMapTexture);
     glDeleteTextures(1, &depthMapTexture);
     glfwTerminate();
 }
 
 int main(int argc, const char * argv[]) {
 
+    bool benchmarkLoading = false;
+    bool benchmarkParsing = false;
+    bool verifyParsing = false;
+    bool meshStatistics = false;
+    bool lodReport = false;
+    bool quantizationCheck = false;
+    bool textureBenchmark = false;
+    bool compressionCheck = false;
+    gps::TextureFormat textureFormat = gps::FORMAT_RGBA8;
+    size_t streamingBudgetMB = 64;
+    size_t streamingCheckMB = 0;
+    std::string loadReportFile;
+    std::string loadBudgetsFile;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--bench-load") {
+            benchmarkLoading = true;
+        } else if (arg == "--bench-obj") {
+            benchmarkParsing = true;
+        } else if (arg == "--verify-obj") {
+            verifyParsing = true;
+        } else if (arg == "--compress-cache") {
+            gps::MeshCache::setCompression(true);
+        } else if (arg == "--optimize-meshes") {
+            gps::Model3D::SetMeshOptimization(true);
+        } else if (arg == "--mesh-stats") {
+            meshStatistics = true;
+        } else if (arg == "--no-lods") {
+            gps::Model3D::SetLodGeneration(false);
+        } else if (arg == "--lod-report") {
+            lodReport = true;
+        } else if (arg == "--quantize-vertices") {
+            gps::Mesh::setQuantization(true);
+        } else if (arg == "--verify-quantization") {
+            quantizationCheck = true;
+        } else if (arg == "--no-cluster-culling") {
+            clusterCulling = false;
+        } else if (arg == "--merge-materials") {
+            gps::Model3D::SetMaterialMerging(true);
+        } else if (arg == "--keep-cpu-data") {
+            meshCpuData = gps::KEEP_CPU_DATA;
+        } else if (arg == "--stream-obj") {
+            if (i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0])) {
+                streamingBudgetMB = std::max<size_t>(std::stoull(argv[++i]), 1);
+            }
+            gps::Model3D::SetStreamingImport(streamingBudgetMB * 1024 * 1024);
+            gps::Mesh::setUploadChunkSize(streamingBudgetMB * 1024 * 1024 / 4);
+        } else if (arg == "--verify-streaming") {
+            streamingCheckMB = 2048;
+            if (i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0])) {
+                streamingCheckMB = std::stoull(argv[++i]);
+            }
+        } else if (arg == "--bench-textures") {
+            textureBenchmark = true;
+        } else if (arg == "--mip-filter" && i + 1 < argc) {
+            std::string filter = argv[++i];
+            gps::TextureProcessor::SetMipFilter(filter == "kaiser" ? gps::MIP_FILTER_KAISER : gps::MIP_FILTER_BOX);
+        } else if (arg == "--texture-compression" && i + 1 < argc) {
+            if (!gps::BlockCompressor::ParseFormat(argv[++i], textureFormat)) {
+                std::cerr << "WARNING: unknown texture format " << argv[i] << ", expected rgba8, bc1, bc3 or bc7" << std::endl;
+            }
+        } else if (arg == "--verify-compression") {
+            compressionCheck = true;
+        } else if (arg == "--stream-textures") {
+            size_t textureBudgetMB = 64;
+            if (i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0])) {
+                textureBudgetMB = std::max<size_t>(std::stoull(argv[++i]), 1);
+            }
+            gps::Model3D::SetTextureStreaming(textureBudgetMB * 1024 * 1024);
+        } else if (arg == "--decode-pool") {
+            if (i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0])) {
+                size_t decodeCacheMB = std::stoull(argv[++i]);
+                gps::DecodePool::instance().setCacheLimit(decodeCacheMB * 1024 * 1024);
+            } else {
+                std::cerr << "WARNING: --decode-pool expects a cache size in MB" << std::endl;
+            }
+        } else if (arg == "--texture-budget") {
+            if (i + 1 < argc && std::isdigit((unsigned char)argv[i + 1][0])) {
+                size_t textureBudgetMB = std::max<size_t>(std::stoull(argv[++i]), 1);
+                gps::TextureAllocator::instance().setBudget(textureBudgetMB * 1024 * 1024);
+            } else {
+                std::cerr << "WARNING: --texture-budget expects a size in MB" << std::endl;
+            }
+        } else if (arg == "--no-material-table") {
+            gps::MaterialTable::setEnabled(false);
+        } else if (arg == "--sync-textures") {
+            gps::Model3D::SetAsyncTextureUploads(false);
+        } else if (arg == "--load-report" && i + 1 < argc) {
+            loadReportFile = argv[++i];
+            gps::LoadProfiler::instance().setEnabled(true);
+        } else if (arg == "--load-budgets" && i + 1 < argc) {
+            loadBudgetsFile = argv[++i];
+            gps::LoadProfiler::instance().setEnabled(true);
+        }
+    }
+
+    if (!loadBudgetsFile.empty() && !gps::LoadProfiler::instance().loadBudgets(loadBudgetsFile)) {
+        std::cerr << "ERROR: could not read load budgets from " << loadBudgetsFile << std::endl;
+        return EXIT_FAILURE;
+    }
+
+    if (benchmarkLoading || benchmarkParsing || verifyParsing || meshStatistics || lodReport || quantizationCheck || streamingCheckMB > 0 ||
+        compressionCheck) {
+        bool success = true;
+        if (verifyParsing) {
+            success = verifyObjParsing();
+        }
+        if (benchmarkParsing) {
+            benchmarkObjParsing();
+        }
+        if (benchmarkLoading) {
+            benchmarkModelLoading();
+        }
+        if (meshStatistics) {
+            analyzeMeshOptimization();
+        }
+        if (lodReport) {
+            reportLods();
+        }
+        if (quantizationCheck) {
+            success = verifyQuantization() && success;
+        }
+        if (streamingCheckMB > 0) {
+            // the streamed segments stay at a quarter of the --stream-obj budget
+            success = gps::ObjStreamer::VerifyPeakMemory("models/streaming_check.obj", streamingCheckMB * 1024 * 1024,
+                streamingBudgetMB * 1024 * 1024 / 4) && success;
+        }
+        if (compressionCheck) {
+            std::vector<std::string> fileNames(std::begin(modelTextures), std::end(modelTextures));
+            success = gps::BlockCompressor::Verify(fileNames) && success;
+        }
+        return success ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
     try {
         initOpenGLWindow();
     } catch (const std::exception& e) {
         std::cerr << e.what() << std::endl;
+        if (textureBenchmark) {
+            // the CPU half still runs
+            benchmarkTextures(false);
+        }
         return EXIT_FAILURE;
     }
 
+    // the textures stay uncompressed on drivers without the format
+    if (textureFormat != gps::FORMAT_RGBA8 && !gps::BlockCompressor::IsSupported(textureFormat)) {
+        std::cerr << "WARNING: " << gps::BlockCompressor::FormatName(textureFormat) << " textures are not supported, using RGBA8" << std::endl;
+        textureFormat = gps::FORMAT_RGBA8;
+    }
+    gps::BlockCompressor::SetFormat(textureFormat);
+
+    if (textureBenchmark) {
+        benchmarkTextures(true);
+        glfwTerminate();
+        return EXIT_SUCCESS;
+    }
+
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point startupBegin = Clock::now();
+    bool firstFrameDone = false;
+    bool modelsLoaded = false;
+    int exitCode = EXIT_SUCCESS;
+
     initOpenGLState();
-	initModels();
-	initShaders();
-	initUniforms();
-    initSkyBox();
-    initFBO();
+    initModels();
+    initStartupTasks();
+    startupTasks.run();
+    if (!frameLayoutMatches) {
+        std::cerr << "ERROR: the shaders do not match FrameData, see above" << std::endl;
+        cleanup();
+        return EXIT_FAILURE;
+    }
     setWindowCallbacks();
 
 	glCheckError();
 	// application loop
 	while (!glfwWindowShouldClose(myWindow.getWindow())) {
+        if (gps::Model3D::ProcessUploads(MODEL_UPLOAD_BUDGET_MS) && !modelsLoaded) {
+            modelsLoaded = true;
+            size_t failed = 0;
+            for (const gps::ModelLoadHandle& handle : modelLoads) {
+                failed += handle.hasFailed() ? 1 : 0;
+            }
+            std::cout << "Time to fully loaded: "
+                << std::chrono::duration<double, std::milli>(Clock::now() - startupBegin).count() << " ms ("
+                << modelLoads.size() - failed << " models resident, " << failed << " failed)" << std::endl;
+            printMemoryReport();
+
+            gps::LoadProfiler& profiler = gps::LoadProfiler::instance();
+            if (!loadReportFile.empty() && !profiler.writeReport(loadReportFile)) {
+                std::cerr << "WARNING: could not write load report to " << loadReportFile << std::endl;
+            }
+            // a slow asset fails the startup check
+            if (!loadBudgetsFile.empty() && !profiler.checkBudgets(std::cerr)) {
+                exitCode = EXIT_FAILURE;
+                glfwSetWindowShouldClose(myWindow.getWindow(), GL_TRUE);
+            }
+        }
+
         float currentFrame = static_cast<float>(glfwGetTime());
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
         std::cout <<"Position:(" << myCamera.getCameraPosition().x<<","<< myCamera.getCameraPosition().y << "," << myCamera.getCameraPosition().z << ")\n";
 
         processMovement();
+        gps::ObjectBuffer::instance().beginFrame();
 	    renderScene();
+        gps::ObjectBuffer::instance().endFrame();
+        gps::TextureStreamer::instance().update();
+        gps::TextureAllocator::instance().endFrame();
+        reportFrameStats();
 
 		glfwPollEvents();
 		glfwSwapBuffers(myWindow.getWindow());
 
+        if (!firstFrameDone) {
+            firstFrameDone = true;
+            std::cout << "Time to first frame: "
+                << std::chrono::duration<double, std::milli>(Clock::now() - startupBegin).count() << " ms" << std::endl;
+        }
+
 		glCheckError();
 	}
 
 	cleanup();
 
-    return EXIT_SUCCESS;
+    return exitCode;
 }
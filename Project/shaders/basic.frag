@@ -7,11 +7,20 @@ in vec4 fragPosLightSpace;
 
 out vec4 fColor;
 
+//camera and light data of the frame, shared by every program (gps::FrameUniforms)
+layout(std140) uniform FrameData {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+	mat4 lightSpaceTrMatrix;
+	vec3 lightDir;
+	float fogDensity;
+	vec3 lightColor;
+	int lightType;
+	vec3 lightPosition;
+};
+
 //lighting
-uniform	vec3 lightDir;
-uniform	vec3 lightColor;
-uniform vec3 lightPosition;
-uniform int lightType;
 float attenuation = 1.0f;  //for positional light 
 
 //texture
@@ -19,6 +28,19 @@ uniform sampler2D diffuseTexture;
 uniform sampler2D specularTexture;
 uniform sampler2D shadowMap;
 
+//material table: texture arrays and per-material colors, used when materialIndex >= 0
+struct MaterialData {
+	vec4 ambient;
+	vec4 diffuse;
+	vec4 specular;
+	ivec4 textures; //diffuse array, diffuse layer, specular array, specular layer; -1 if none
+};
+layout(std140) uniform Materials {
+	MaterialData materials[256];
+};
+uniform sampler2DArray materialTextures[8];
+uniform int materialIndex;
+
 vec3 ambient;
 float ambientStrength = 0.2f;
 vec3 diffuse;
@@ -29,7 +51,30 @@ float shininess = 32.0f;
 //fog
 float fogEnd = 10.0f;
 vec3 fogColor = vec3(0.37,0.34,0.30);
-uniform float fogDensity;
+
+//lod cross-fade: > 0 keeps the dither cells below lodFade, < 0 keeps the cells from -lodFade up
+uniform float lodFade;
+
+float ditherThreshold(){
+	const float bayer[16] = float[16](0.0, 8.0, 2.0, 10.0, 12.0, 4.0, 14.0, 6.0, 3.0, 11.0, 1.0, 9.0, 15.0, 7.0, 13.0, 5.0);
+	ivec2 cell = ivec2(gl_FragCoord.xy) & 3;
+	return (bayer[cell.y * 4 + cell.x] + 0.5f) / 16.0f;
+}
+
+//sampler array indices must be dynamically uniform, the switch does not rely on the compiler proving that
+vec3 sampleMaterialTexture(int array, int layer){
+	vec3 coords = vec3(fTexCoords, float(layer));
+	switch (array) {
+		case 0: return texture(materialTextures[0], coords).rgb;
+		case 1: return texture(materialTextures[1], coords).rgb;
+		case 2: return texture(materialTextures[2], coords).rgb;
+		case 3: return texture(materialTextures[3], coords).rgb;
+		case 4: return texture(materialTextures[4], coords).rgb;
+		case 5: return texture(materialTextures[5], coords).rgb;
+		case 6: return texture(materialTextures[6], coords).rgb;
+		default: return texture(materialTextures[7], coords).rgb;
+	}
+}
 
 float getFogFactor(){
 	float fogCoordinate = abs(fPosEye.z/fPosEye.w);
@@ -108,13 +153,35 @@ float computeShadow(){
 
 void main() 
 {
+	if (lodFade != 0.0f) {
+		float threshold = ditherThreshold();
+		if ((lodFade > 0.0f && threshold >= lodFade) || (lodFade < 0.0f && threshold < -lodFade)) {
+			discard;
+		}
+	}
+
 	computeLightComponents();
 	
 	vec3 baseColor = vec3(0.9f, 0.35f, 0.0f);//orange
 	
-	ambient *= texture(diffuseTexture, fTexCoords).rgb * attenuation;
-	diffuse *= texture(diffuseTexture, fTexCoords).rgb * attenuation;
-	specular *= texture(specularTexture, fTexCoords).rgb * attenuation;
+	vec3 ambientColor;
+	vec3 diffuseColor;
+	vec3 specularColor;
+	if (materialIndex >= 0) {
+		MaterialData material = materials[materialIndex];
+		//untextured materials take their colors from the .mtl file
+		diffuseColor = material.textures.x >= 0 ? sampleMaterialTexture(material.textures.x, material.textures.y) : material.diffuse.rgb;
+		ambientColor = material.textures.x >= 0 ? diffuseColor : material.ambient.rgb;
+		specularColor = material.textures.z >= 0 ? sampleMaterialTexture(material.textures.z, material.textures.w) : material.specular.rgb;
+	} else {
+		diffuseColor = texture(diffuseTexture, fTexCoords).rgb;
+		ambientColor = diffuseColor;
+		specularColor = texture(specularTexture, fTexCoords).rgb;
+	}
+
+	ambient *= ambientColor * attenuation;
+	diffuse *= diffuseColor * attenuation;
+	specular *= specularColor * attenuation;
 
 	float shadow = computeShadow();
 	
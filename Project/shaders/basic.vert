@@ -10,19 +10,43 @@ out vec2 fTexCoords;
 out vec4 fragPosLightSpace;	
 
 
+//camera and light data of the frame, shared by every program (gps::FrameUniforms)
+layout(std140) uniform FrameData {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+	mat4 lightSpaceTrMatrix;
+	vec3 lightDir;
+	float fogDensity;
+	vec3 lightColor;
+	int lightType;
+	vec3 lightPosition;
+};
+
+//matrices of the objects drawn this frame (gps::ObjectBuffer), seven texels each: model, then normal matrix columns
+uniform samplerBuffer objectTransforms;
+//record of the drawn object, -1 when the model and normalMatrix uniforms hold its matrices
+uniform int objectIndex;
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 uniform	mat3 normalMatrix;
-uniform mat4 lightSpaceTrMatrix;
 
 
 void main() 
 {
-	fPosEye = view * model * vec4(vPosition, 1.0f);
-	fNormal = normalize(normalMatrix * vNormal);
+	mat4 objectModel = model;
+	mat3 objectNormalMatrix = normalMatrix;
+	if (objectIndex >= 0) {
+		int texel = objectIndex * 7;
+		objectModel = mat4(texelFetch(objectTransforms, texel), texelFetch(objectTransforms, texel + 1),
+			texelFetch(objectTransforms, texel + 2), texelFetch(objectTransforms, texel + 3));
+		objectNormalMatrix = mat3(texelFetch(objectTransforms, texel + 4).xyz, texelFetch(objectTransforms, texel + 5).xyz,
+			texelFetch(objectTransforms, texel + 6).xyz);
+	}
+
+	fPosEye = view * objectModel * vec4(vPosition, 1.0f);
+	fNormal = normalize(objectNormalMatrix * vNormal);
 	fTexCoords = vTexCoords;
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
-	fragPosLightSpace= lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+	gl_Position = viewProjection * objectModel * vec4(vPosition, 1.0f);
+	fragPosLightSpace= lightSpaceTrMatrix * objectModel * vec4(vPosition, 1.0f);
 	
 }
@@ -4,11 +4,22 @@ layout(location=0) in vec3 vPosition;
 layout(location=1) in vec3 vNormal;
 layout(location=2) in vec2 vTexCoords;
 
+//camera and light data of the frame, shared by every program (gps::FrameUniforms)
+layout(std140) uniform FrameData {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+	mat4 lightSpaceTrMatrix;
+	vec3 lightDir;
+	float fogDensity;
+	vec3 lightColor;
+	int lightType;
+	vec3 lightPosition;
+};
+
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
 
 void main() 
 {
-	gl_Position = projection * view * model * vec4(vPosition, 1.0f);
+	gl_Position = viewProjection * model * vec4(vPosition, 1.0f);
 }
@@ -1,9 +1,32 @@
 #version 410 core
 
 layout(location=0) in vec3 vPosition;
-uniform mat4 lightSpaceTrMatrix;
+
+//camera and light data of the frame, shared by every program (gps::FrameUniforms)
+layout(std140) uniform FrameData {
+	mat4 view;
+	mat4 projection;
+	mat4 viewProjection;
+	mat4 lightSpaceTrMatrix;
+	vec3 lightDir;
+	float fogDensity;
+	vec3 lightColor;
+	int lightType;
+	vec3 lightPosition;
+};
+
+//matrices of the objects drawn this frame (gps::ObjectBuffer), seven texels each: model, then normal matrix columns (unused here)
+uniform samplerBuffer objectTransforms;
+//record of the drawn object, -1 when the model uniform holds its matrix
+uniform int objectIndex;
 uniform mat4 model;
 
 void main(){
-	gl_Position = lightSpaceTrMatrix * model * vec4(vPosition, 1.0f);
+	mat4 objectModel = model;
+	if (objectIndex >= 0) {
+		int texel = objectIndex * 7;
+		objectModel = mat4(texelFetch(objectTransforms, texel), texelFetch(objectTransforms, texel + 1),
+			texelFetch(objectTransforms, texel + 2), texelFetch(objectTransforms, texel + 3));
+	}
+	gl_Position = lightSpaceTrMatrix * objectModel * vec4(vPosition, 1.0f);
 }
\ No newline at end of file
@@ -3,13 +3,23 @@
 layout (location = 0) in vec3 vertexPosition;
 out vec3 textureCoordinates;
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
+//camera and light data of the frame, shared by every program (gps::FrameUniforms)
+layout(std140) uniform FrameData {
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 lightSpaceTrMatrix;
+    vec3 lightDir;
+    float fogDensity;
+    vec3 lightColor;
+    int lightType;
+    vec3 lightPosition;
+};
 
 void main()
 {
-    vec4 tempPos = projection * view * vec4(vertexPosition, 1.0);
+    //only the rotation of the view, the sky box stays around the camera
+    vec4 tempPos = projection * mat4(mat3(view)) * vec4(vertexPosition, 1.0);
     gl_Position = tempPos.xyww;
     textureCoordinates = vertexPosition;
 }
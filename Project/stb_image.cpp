@@ -1,2 +1,9 @@
+#include "DecodePool.hpp"
+
+// decoded images and stb's working buffers come from the pool, stbi_image_free puts them back
+#define STBI_MALLOC(sz)           gps::DecodePool::instance().allocate(sz)
+#define STBI_REALLOC(p,newsz)     gps::DecodePool::instance().reallocate(p,newsz)
+#define STBI_FREE(p)              gps::DecodePool::instance().release(p)
+
 #define STB_IMAGE_IMPLEMENTATION
-#include "stb_image.h"
\ No newline at end of file
+#include "stb_image.h"